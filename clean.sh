@@ -6,6 +6,17 @@ rm -rf dependencies
 rm -rf share
 rm ./tem
 rm ./tas
+rm ./tld
+rm ./tdis
+rm ./twcet
+rm ./tsopt
+rm ./tcc
+rm ./tpack
+rm ./tdelta
+rm ./tgate
 rm ./bin2logisim
 rm *.bin
 rm *.ram
+rm *.tobj
+rm *.sym
+rm stress.tas
@@ -0,0 +1,31 @@
+// Same as factorial.tasm, compiled with tcc.
+#include <stdint.h>
+
+uint8_t result;
+
+uint8_t mult(uint8_t a, uint8_t b)
+{
+	uint8_t c = (a & 1) ? b : 0;
+	b <<= 1;
+	while (a >>= 1)
+	{
+		c += (a & 1) ? b : 0;
+		b <<= 1;
+	}
+	return c;
+}
+
+uint8_t fact(uint8_t a)
+{
+	if (a)
+	{
+		return mult(a, fact(a - 1));
+	}
+	return 1;
+}
+
+int main()
+{
+	result = fact(3);
+	return 0;
+}
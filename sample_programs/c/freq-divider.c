@@ -0,0 +1,23 @@
+// Same as freq-divider.tasm, compiled with tcc.
+#include <stdint.h>
+
+uint8_t f, b, t, c;
+
+int main()
+{
+	f = 10;		// desired frequency of an action
+	b = 20;		// base frequency of timer
+	t = 0;		// counter for frequency division
+	c = 7;		// how many times to perform the action
+
+	while (c != 0)
+	{
+		t += f;
+		if (t >= b)
+		{
+			--c;
+			t -= b;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,26 @@
+// if/else where neither arm returns, so the then-arm has to jump past the else-arm.
+#include <stdint.h>
+
+uint8_t above;
+uint8_t below;
+
+uint8_t step(uint8_t x, uint8_t y)
+{
+	uint8_t t = x;
+	if (x > 100)
+	{
+		t = t - y;
+	}
+	else
+	{
+		t = t + y;
+	}
+	return t;
+}
+
+int main()
+{
+	above = step(150, 20); // 130
+	below = step(50, 20); // 70
+	return 0;
+}
@@ -0,0 +1,46 @@
+// Repeated calls for tem --memoize: the final RAM has to be the same with & without it.
+#include <stdint.h>
+
+uint8_t squares[4];
+uint8_t scale;
+uint8_t scaled_fives[5];
+uint8_t calling;
+
+uint8_t mult(uint8_t a, uint8_t b)
+{
+	uint8_t result = 0;
+	while (a)
+	{
+		if (a & 1)
+			result += b;
+		b <<= 1;
+		a >>= 1;
+	}
+	return result;
+}
+
+// Same argument every time, but it reads scale: a call recorded with another scale mustn't be reused.
+uint8_t scaled(uint8_t x)
+{
+	return mult(x, scale);
+}
+
+int main()
+{
+	uint8_t i = 0;
+	while (i < 4)
+	{
+		squares[i] = mult(9, 9); // 81, from the cache once the registers repeat
+		i = i + 1;
+	}
+
+	i = 0;
+	while (i < 5)
+	{
+		scale = 3 + ((i >> 1) & 1); // 3, 3, 4, 4, 3
+		calling = 1; // Leaves the same registers behind every time, so only scale tells the calls apart.
+		scaled_fives[i] = scaled(5); // 15, 15, 20, 20, 15
+		i = i + 1;
+	}
+	return 0;
+}
@@ -0,0 +1,25 @@
+// Same as mult_stack.tas, compiled with tcc.
+#include <stdint.h>
+
+uint8_t result;
+
+uint8_t mult(uint8_t a, uint8_t b)
+{
+	uint8_t r = (a & 1) ? b : 0;
+	b <<= 1;
+	while ((a >>= 1) != 0) // add b up a times.
+	{
+		if (a & 1)
+		{
+			r += b;
+		}
+		b <<= 1;
+	}
+	return r;
+}
+
+int main()
+{
+	result = mult(255, 0);
+	return 0;
+}
@@ -0,0 +1,15 @@
+// Same as simple_parameters.tas, compiled with tcc.
+#include <stdint.h>
+
+uint8_t result;
+
+uint8_t sum(uint8_t a, uint8_t b)
+{
+	return a + b;
+}
+
+int main()
+{
+	result = sum(4, 5);
+	return 0;
+}
@@ -0,0 +1,15 @@
+// Same as simple_return.tas, compiled with tcc.
+#include <stdint.h>
+
+uint8_t result;
+
+uint8_t five()
+{
+	return 5;
+}
+
+int main()
+{
+	result = five() + five();
+	return 0;
+}
@@ -0,0 +1,22 @@
+// Same as strcmp.tas, compiled with tcc.
+#include <stdint.h>
+
+char p1[] = "Jeeb";
+char p2[] = "Jeec";
+uint8_t result;
+
+uint8_t strcmp(const char *a, const char *b)
+{
+	while (*a && *a == *b)
+	{
+		++a;
+		++b;
+	}
+	return *a - *b;
+}
+
+int main()
+{
+	result = strcmp(p1, p2);
+	return 0;
+}
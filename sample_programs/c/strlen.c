@@ -0,0 +1,22 @@
+// Same as strlen.tas, compiled with tcc.
+#include <stdint.h>
+
+char p1[] = "Potato";
+uint8_t result;
+
+uint8_t strlen(const char *p)
+{
+	uint8_t count = 0;
+	while (*p)
+	{
+		++p;
+		++count;
+	}
+	return count;
+}
+
+int main()
+{
+	result = strlen(p1);
+	return 0;
+}
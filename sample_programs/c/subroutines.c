@@ -0,0 +1,20 @@
+// Same as subroutines.tas, compiled with tcc.
+#include <stdint.h>
+
+uint8_t x;
+
+void func()
+{
+	if (x > 0)
+	{
+		--x;
+		func();
+	}
+}
+
+int main()
+{
+	x = 2;
+	func();
+	return 0;
+}
@@ -0,0 +1,22 @@
+// Same as swap.tas, compiled with tcc.
+#include <stdint.h>
+
+uint8_t x;
+uint8_t y;
+
+void swap(uint8_t *a, uint8_t *b)
+{
+	uint8_t t;
+	t = *a;
+	*a = *b;
+	*b = t;
+}
+
+int main()
+{
+	x = 42;
+	y = 77;
+	swap(&x, &y);
+	swap(&x, &y);
+	return 0;
+}
@@ -6,9 +6,22 @@
 #include <string>
 #include <cstring>
 #include <vector>
+#include <deque>
 #include <map>
 #include <iterator>
 #include <sstream>
+#include <string_view>
+#include <charconv>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "isa.hpp"
+#include "lexer.hpp"
+#include "symbols.hpp"
+#include "object.hpp"
+#include "symbolmap.hpp"
+#include "profile.hpp"
 
 /*
  * This is a *very* basic assembler for the toy processor 8-bit RISC CPU.
@@ -25,6 +38,8 @@
  *		ADD <X> <Y>		[X += Y]
  *		SUB <X> <Y>		[X -= Y]
  *		RSHIFT <X> <Y>	[X >>= Y]
+ *		LSHIFT <X> <Y>	[X <<= Y] C flag = last bit shifted out.
+ *		MUL <X> <Y>		[Y:X = X * Y] Low byte of the product goes in X, high byte in Y. C & O flags = high byte != 0.
  *		NOT <X>			[X = ~X]
  *		JMP	<X>			[PC = X] Sets program counter to address pointed to by register X (unconditional jump).
  *		PCC <X>			[PC = X iff C = 1] Sets program counter to address pointed to by register X iff C flag == 1.
@@ -33,11 +48,39 @@
  *		OR <X> <Y>		[X |= Y]
  *		CMP <X> <Y>		[X - Y] (no store -- only sets flags)
  *		ST <X> <Y>		[*X = Y] Sets RAM pointed to by register X to Y.
+ *		PUSH <X>		[*(--D) = X] Pushes register X onto the stack.
+ *		POP <X>			[X = *(D++)] Pops the top of the stack into register X.
+ *		CALL <X>		[*(--D) = PC + 1, PC = X] Pushes the return address onto the stack and jumps to the address in register X.
+ *		RET				[PC = *(D++)] Pops the return address off the stack and jumps to it.
+ *		ADDI <X> <VAL>	[X += VAL]
+ *		SUBI <X> <VAL>	[X -= VAL]
+ *		CMPI <X> <VAL>	[X - VAL] (no store -- only sets flags)
+ *		BRA <LABEL>		[PC = LABEL] Branch always.
+ *		BZ <LABEL>		[PC = LABEL iff Z == 1]
+ *		BNZ <LABEL>		[PC = LABEL iff Z == 0]
+ *		BC <LABEL>		[PC = LABEL iff C == 1]
+ *		BNC <LABEL>		[PC = LABEL iff C == 0]
+ *		BS <LABEL>		[PC = LABEL iff S == 1]
+ *		BO <LABEL>		[PC = LABEL iff O == 1]
+ *		BL <LABEL>		[PC = LABEL iff L == 1]
+ *		MCPY			[memmove(A, B, C)] A += C, B += C, C = 0.
+ *		MSET			[memset(A, B, C)] A += C, C = 0.
+ *		MSCAN			Scans up to C bytes from A for byte B. Stops with A pointing at it & Z = 1, or A += C, C = 0 & Z = 0 if not found.
+ *		MCMP			Compares up to C bytes at A and B. Stops with A & B pointing at the first difference & flags = CMP *A *B, or A += C, B += C, C = 0 & Z = 1 if equal.
+ *	Register D is the stack pointer. The stack grows down.
+ *	Branches are encoded as an 8-bit displacement from the next instruction, so they don't need a register.
+ *	Block memory instructions take their operands from registers A, B & C. Addresses wrap around at 256.
  *
  *	To allocate data:
  *		BYTE <x>
  *	Data section should probably be at the end of your source file.
  *
+ *	Sections & modules:
+ *		SECTION <name>	Code/data after this goes into section <name> (TEXT until the first SECTION).
+ *						Sections are laid out in the order they first appear, e.g. SECTION DATA at the end keeps data after the code.
+ *		GLOBAL <label>	Makes <label> visible to other modules.
+ *	tas -c assembles a module into an object file (see object.hpp), where labels it doesn't define are left for tld to resolve.
+ *
  *	Assembler does not support labels (yet).
  *
  *	Keep in mind that you only have 4 8-bit registers to play with, and 256 bytes of RAM.
@@ -68,1053 +111,1628 @@
 
 
 /*
- * Instructions will be implemented like so:
- * * Array of structs which has the name and the function pointer.
- * * Read in instruction from source file, lookup instruction in instruction array/table, call its function pointer.
- * * Function pointer reads in whatever optional parameters. Also validates instruction usage.
+ * Instructions are implemented like so:
+ * * The instruction set is described once, in INSTRUCTION_SET (isa.hpp). The emulator decodes from the same table.
+ * * Read in instruction from source file, lookup instruction in instruction table, call its parse function.
+ * * Parse function validates instruction usage and encodes the instruction & its parameters.
  * If at any time an illegal instruction is encountered or misformatted source code, error dump the user & abort.
  */
 
-static const uint16_t RAM_SIZE = 256; //How much program memory we have (8-bit CPU/RAM).
-static const uint16_t NUM_REGISTERS = 4;
-
 struct Instruction
 {
 	std::string name;
 	uint16_t instruction_size; //Size of instruction in this architecture in bytes.
 	uint8_t num_parameters;
 
-	Instruction()
-	{
-		name = "NULL";
-		instruction_size = 1;
-		num_parameters = 0;
-	}
-	virtual ~Instruction() = 0;
-
-	//Returns number of bytes written. 0 on error.
-	virtual int parse(uint8_t& address, uint8_t* memory, int = 0, int = 0) = 0;
-};
-
-inline Instruction::~Instruction() { } //magic.
-
-
-// ***** INSTRUCTION IMPLEMENTATIONS *****
-
-//0x00 0000_0000 -- nop
-struct irNOP : public Instruction
-{
-	irNOP()
-	{
-		name = "NOP";
-		instruction_size = 1;
-		num_parameters = 0;
-	}
-
-	virtual int parse(uint8_t& address, uint8_t* memory, int = 0, int = 0)
-	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
-		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
-		}
-
-		memory[address] = 0x00;
-
-		++address;
-
-		return instruction_size;
-	}
-};
-
-//0x01 0000_0001 -- halt
-struct irHalt : public Instruction
-{
-	irHalt()
-	{
-		name = "HALT";
-		instruction_size = 1;
-		num_parameters = 0;
-	}
-
-	virtual int parse(uint8_t& address, uint8_t* memory, int = 0, int = 0)
-	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
-		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
-		}
-
-		memory[address] = 0x01;
-
-		++address;
-
-		return instruction_size;
-	}
-};
+	const InstructionInfo &info;
 
-//0x5? 0101_xxyy -- x = y
-struct irSet : public Instruction
-{
-	irSet()
+	Instruction(const InstructionInfo &instruction_info) :
+		info(instruction_info)
 	{
-		name = "SET";
-		instruction_size = 1;
-		num_parameters = 2;
+		name = info.name;
+		instruction_size = info.size;
+		num_parameters = info.num_parameters;
 	}
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int reg2)
+	//Returns number of bytes written. 0 on error, explained on log.
+	int parse(std::ostream &log, uint16_t& address, uint8_t* memory, int x = 0, int y = 0) const
 	{
 		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
+		if (address + instruction_size > RAM_SIZE)
 		{
-			std::cout << "Error: Program exceeded max size.\n";
+			log << "Error: Program exceeded max size.\n";
 			return 0;
 		}
 
 		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
+		if (isRegisterOperand(info.layout, 0) && x >= NUM_REGISTERS)
 		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
+			log << "Error: Invalid register \"" << x << "\".\n";
 			return 0;
 		}
-		if (reg2 >= NUM_REGISTERS)
+		if (isRegisterOperand(info.layout, 1) && y >= NUM_REGISTERS)
 		{
-			std::cout << "Error: Invalid register \"" << reg2 << "\".\n";
+			log << "Error: Invalid register \"" << y << "\".\n";
 			return 0;
 		}
 
-		memory[address] = 0x50 + (reg1 << 2) + (reg2);
+		//First the actual instruction's code.
+		memory[address] = encodeInstruction(info, x, y);
 		++address;
 
-		return instruction_size;
-	}
-};
-
-//0x6? 0110_00xx -- PC = x iff L=1
-struct irPCL : public Instruction
-{
-	irPCL()
-	{
-		name = "PCL";
-		instruction_size = 1;
-		num_parameters = 1;
-	}
-
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int = 0)
-	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
+		//Then the parameters to the instruction.
+		if (info.layout == LAYOUT_X_LOW_IMMEDIATE)
 		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
+			memory[address] = y;
+			++address;
 		}
-
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
+		else if (info.layout == LAYOUT_RELATIVE)
 		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
+			//Displacement from the next instruction. Addresses wrap around, so every target is in range.
+			memory[address] = static_cast<uint8_t>(x - (address + 1));
+			++address;
 		}
 
-		memory[address] = 0x60 + (reg1);
-		++address;
-
 		return instruction_size;
 	}
 };
 
-//0x6? 0110_01xx -- PC = x iff O=1
-struct irPCO : public Instruction
+//Built on first use & only read after that, so every InstructionParser (and batch worker thread) shares it.
+static const std::vector<Instruction> &instructionTable()
 {
-	irPCO()
-	{
-		name = "PCO";
-		instruction_size = 1;
-		num_parameters = 1;
-	}
+	static const std::vector<Instruction> table(INSTRUCTION_SET, INSTRUCTION_SET + NUM_INSTRUCTIONS);
+	return table;
+}
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int = 0)
-	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
-		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
-		}
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
-		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
-		}
 
-		memory[address] = 0x64 + (reg1);
-		++address;
 
-		return instruction_size;
-	}
-};
 
-//0x6? 0110_10xx -- PC = x iff S=1
-struct irPCS : public Instruction
+class InstructionParser
 {
-	irPCS()
+public:
+	enum StatementKind
 	{
-		name = "PCS";
-		instruction_size = 1;
-		num_parameters = 1;
-	}
-
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int = 0)
+		STATEMENT_INSTRUCTION,
+		STATEMENT_BYTE,
+		STATEMENT_SECTION,
+		STATEMENT_LABEL,	//Label definition, takes no space.
+		STATEMENT_UNKNOWN	//Neither, the main assembling run complains about it.
+	};
+
+	struct Statement
 	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
-		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
-		}
+		uint32_t token; //Index of its first token.
+		StatementKind kind;
+		uint32_t symbol; //Instruction or label symbol id.
+		bool removed; //By the optimizer.
+		bool rewritten; //By the optimizer: assemble instruction symbol with registers x & y, instead of what the tokens say.
+		uint8_t x;
+		uint8_t y;
+		uint32_t target; //Label a branch goes to instead of its operand (set by layoutForProfile()), NO_SYMBOL if none.
+	};
+
+	//Everything in the source, in order.
+	std::vector<Statement> statements;
+
+	//Assembling a module (tas -c): labels that aren't defined are left for the linker to resolve.
+	bool object_mode;
+
+	//Log every token & optimization, not just errors (off in batch mode, where it would be megabytes per file).
+	bool verbose;
+
+	//Assembled code/data, one per SECTION. Each is assembled as if it starts at address 0, tld lays them out.
+	struct Section
+	{
+		std::string name;
+		uint8_t memory[RAM_SIZE];
+		uint16_t address; //Where the next byte goes. RAM_SIZE once a section is full, so it can't wrap to 0.
+		uint16_t layout_address; //Same, while laying out labels.
+	};
+	std::vector<Section> sections;
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
-		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
-		}
+private:
+	std::ostream &log; //Where diagnostics go.
 
-		memory[address] = 0x68 + (reg1);
-		++address;
+	SymbolTable symbols; //Instructions get the first ids, in INSTRUCTION_SET order, then the keywords, then labels.
+	const std::vector<Instruction> &instructions; //Indexed by symbol id.
+	uint32_t keyword_count; //Ids below this aren't labels.
+	uint32_t byte_symbol;
+	uint32_t section_symbol;
+	uint32_t global_symbol;
 
-		return instruction_size;
-	}
-};
+	//Memory address each label points to (into its section), indexed by symbol id. -1 until defined.
+	std::vector<int16_t> labels;
+	std::vector<uint16_t> label_sections;
+	std::vector<bool> label_globals;
 
-//0x6? 0110_11xx -- X = (*(PC++))
-struct irLDI : public Instruction
-{
-	irLDI()
-	{
-		name = "LDI";
-		instruction_size = 2; //instruction + 1 operands
-		num_parameters = 2;
-	}
+	//Symbol id of each token that names an instruction, keyword or label. NO_SYMBOL for everything else.
+	std::vector<uint32_t> token_symbols;
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int value)
+	//Bytes holding label addresses, patched by the linker.
+	struct LabelReference
 	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
-		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
-		}
+		uint16_t section;
+		uint8_t offset;
+		uint32_t symbol;
+		RelocationType type;
+	};
+	std::vector<LabelReference> references;
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
+	int32_t current_section;
+
+	//Names of the labels layoutForProfile() makes up. The symbol table points into them, so they can't move.
+	std::deque<std::string> generated_labels;
+
+public:
+	InstructionParser(std::ostream &log_stream = std::cout) :
+		log(log_stream),
+		instructions(instructionTable())
+	{
+		for (uint16_t i = 0; i < NUM_INSTRUCTIONS; ++i)
 		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
+			symbols.intern(INSTRUCTION_SET[i].name);
 		}
+		byte_symbol = symbols.intern("BYTE");
+		section_symbol = symbols.intern("SECTION");
+		global_symbol = symbols.intern("GLOBAL");
+		keyword_count = symbols.size();
 
-		//First the actual instruction's code.
-		memory[address] = 0x6C + reg1;
-		++address;
-		//Then the parameters to the instruction.
-		memory[address] = value;
-		++address;
+		object_mode = false;
+		verbose = true;
+		current_section = -1;
+	}
 
-		return instruction_size;
+	/*
+	 * Forgets everything about the last file assembled, keeping the instructions & keywords, so a parser can be reused.
+	 * Label names point into the last file's source, so this has to be called before that's closed.
+	 */
+	void reset()
+	{
+		symbols.truncate(keyword_count);
+		generated_labels.clear();
+		statements.clear();
+		sections.clear();
+		labels.clear();
+		label_sections.clear();
+		label_globals.clear();
+		token_symbols.clear();
+		references.clear();
+		current_section = -1;
 	}
-};
 
-//0x7? 0111_xxyy -- x = *y
-struct irLD : public Instruction
-{
-	irLD()
+	//Prefix for error messages about token.
+	static std::string location(const Token &token)
 	{
-		name = "LD";
-		instruction_size = 1;
-		num_parameters = 2;
+		return "line " + std::to_string(token.line) + ", column " + std::to_string(token.column) + ": ";
 	}
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int reg2)
+	static std::string upperCase(std::string_view name)
 	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
+		std::string result(name);
+		for (auto & i: result)
 		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
+			i = toupper(static_cast<unsigned char>(i));
 		}
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
-		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
-		}
-		if (reg2 >= NUM_REGISTERS)
+		return result;
+	}
+
+	bool isLabelDefinition(std::string_view symbol)
+	{
+		if (!symbol.empty() && symbol.back() == ':') //Is a label definition
 		{
-			std::cout << "Error: Invalid register \"" << reg2 << "\".\n";
-			return 0;
+			return true;
 		}
 
-		memory[address] = 0x70 + (reg1 << 2) + (reg2);
-		++address;
-
-		return instruction_size;
+		return false;
 	}
-};
 
-//0x8? 1000_xxyy -- x += y
-struct irAdd : public Instruction
-{
-	irAdd()
+	bool isInstruction(uint32_t symbol) const
 	{
-		name = "ADD";
-		instruction_size = 1;
-		num_parameters = 2;
+		return symbol < instructions.size();
 	}
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int reg2)
+	bool isKeyword(uint32_t symbol) const
 	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
-		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
-		}
+		return isInstruction(symbol) || symbol == byte_symbol || symbol == section_symbol || symbol == global_symbol;
+	}
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
-		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
-		}
-		if (reg2 >= NUM_REGISTERS)
+	//Interns a label name.
+	uint32_t labelSymbol(std::string_view name)
+	{
+		uint32_t symbol = symbols.intern(name);
+		if (symbol >= labels.size())
 		{
-			std::cout << "Error: Invalid register \"" << reg2 << "\".\n";
-			return 0;
+			labels.resize(symbol + 1, -1);
+			label_sections.resize(symbol + 1, 0);
+			label_globals.resize(symbol + 1, false);
 		}
 
-		memory[address] = 0x80 + (reg1 << 2) + (reg2);
-		++address;
-
-		return instruction_size;
+		return symbol;
 	}
-};
 
-//0x9? 1001_xxyy -- x -= y
-struct irSub : public Instruction
-{
-	irSub()
+	//The section code currently goes into. Code before the first SECTION goes into TEXT.
+	Section &currentSection()
 	{
-		name = "SUB";
-		instruction_size = 1;
-		num_parameters = 2;
+		if (current_section == -1)
+		{
+			switchSection("TEXT");
+		}
+
+		return sections[current_section];
 	}
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int reg2)
+	void switchSection(std::string_view name)
 	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
-		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
-		}
+		std::string section_name = upperCase(name);
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
-		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
-		}
-		if (reg2 >= NUM_REGISTERS)
+		for (current_section = 0; current_section < static_cast<int32_t>(sections.size()); ++current_section)
 		{
-			std::cout << "Error: Invalid register \"" << reg2 << "\".\n";
-			return 0;
+			if (sections[current_section].name == section_name)
+			{
+				return;
+			}
 		}
 
-		memory[address] = 0x90 + (reg1 << 2) + (reg2);
-		++address;
-
-		return instruction_size;
+		sections.emplace_back();
+		Section &section = sections.back();
+		section.name = section_name;
+		std::fill(section.memory, section.memory + RAM_SIZE, 0);
+		section.address = 0;
+		section.layout_address = 0;
 	}
-};
 
-//0xA? 1010_xxyy -- x >>= y
-struct irRShift : public Instruction
-{
-	irRShift()
+	//Returns the label's symbol id, its address is filled in by layout(). Throws on error.
+	uint32_t addLabel(const Token &token)
 	{
-		name = "RSHIFT";
-		instruction_size = 1;
-		num_parameters = 2;
-	}
+		std::string_view name = token.text;
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int reg2)
-	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
+		if (name.size() <= 2) //One character + the colon.
 		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
+			log << "Error: " << location(token) << "Label too short.\n";
+			throw 0;
 		}
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
+		name.remove_suffix(1); //Get rid of the trailing colon.
+
+		uint32_t symbol = labelSymbol(name);
+		if (isKeyword(symbol))
 		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
+			log << "Error: " << location(token) << "Reserved keyword \"" << name << "\".\n";
+			throw 0;
 		}
-		if (reg2 >= NUM_REGISTERS)
+
+		if (labels[symbol] != -1)
 		{
-			std::cout << "Error: Invalid register \"" << reg2 << "\".\n";
-			return 0;
+			log << "Error: " << location(token) << "Redefinition of label \"" << name << "\"\n";
+			throw 0;
 		}
 
-		memory[address] = 0xA0 + (reg1 << 2) + (reg2);
-		++address;
-
-		return instruction_size;
+		labels[symbol] = 0;
+		label_sections[symbol] = current_section;
+		return symbol;
 	}
-};
 
-//0xB? 1011_xx00 -- x = ~x
-struct irNot : public Instruction
-{
-	irNot()
+	bool isDefined(uint32_t symbol) const
 	{
-		name = "NOT";
-		instruction_size = 1;
-		num_parameters = 1;
+		return symbol < labels.size() && labels[symbol] != -1;
 	}
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int = 0)
+	//Throws if does not find.
+	uint8_t getLabel(const Token &token, uint32_t symbol)
 	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
-		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
-		}
-
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
+		if (!isDefined(symbol))
 		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
+			log << "Error: " << location(token) << "Undefined label \"" << token.text << "\"\n";
+			throw 0;
 		}
 
-		memory[address] = 0xB0 + (4 * reg1);
-		++address;
-
-		return instruction_size;
-	}
-};
-
-//0xB? 1011_xx01 -- PC = x
-struct irJMP : public Instruction
-{
-	irJMP()
-	{
-		name = "JMP";
-		instruction_size = 1;
-		num_parameters = 1;
+		return labels[symbol];
 	}
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int = 0)
+	uint8_t regNameToNum(std::string_view name)
 	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
+		if (name.size() == 0)
 		{
-			std::cout << "Error: Program exceeded max size.\n";
 			return 0;
 		}
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
+		return toupper(static_cast<unsigned char>(name[0])) - 'A'; //Only supports names A, B, C, D.
+	}
+
+	//Throws if token isn't a decimal number.
+	int parseNumber(const Token &token)
+	{
+		int value = 0;
+		const char *end = token.text.data() + token.text.size();
+		std::from_chars_result result = std::from_chars(token.text.data(), end, value);
+		if (result.ec != std::errc() || result.ptr != end)
 		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
+			log << "Error: " << location(token) << "Invalid number \"" << token.text << "\"\n";
+			throw 0;
 		}
 
-		memory[address] = 0xB1 + (4 * reg1);
-		++address;
-
-		return instruction_size;
+		return value;
 	}
-};
 
-//0xB? 1011_xx10 -- PC = x iff C=1
-struct irPCC : public Instruction
-{
-	irPCC()
+	bool isNumber(std::string_view text)
 	{
-		name = "PCC";
-		instruction_size = 1;
-		num_parameters = 1;
+		return text.find_first_not_of("0123456789") == std::string_view::npos;
 	}
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int = 0)
+	//Throws if the directive at source_counter is missing its name, or it's not a valid name.
+	std::string_view directiveName(const std::vector<Token>& source_code, uint32_t source_counter)
 	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
+		const Token &directive = source_code[source_counter];
+		if (source_code.size() - source_counter <= 1)
 		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
+			log << "Error: " << location(directive) << "Missing name for " << directive.text << ".\n";
+			throw 0;
 		}
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
+		const Token &name = source_code[source_counter + 1];
+		if (name.text.size() <= 1 || isNumber(name.text) || isLabelDefinition(name.text) || isKeyword(symbols.find(name.text)))
 		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
+			log << "Error: " << location(name) << "Invalid name \"" << name.text << "\" for " << directive.text << ".\n";
+			throw 0;
 		}
 
-		memory[address] = 0xB2 + (4 * reg1);
-		++address;
-
-		return instruction_size;
+		return name.text;
 	}
-};
 
-//0xB? 1011_xx11 -- PC = x iff Z=1
-struct irPCZ : public Instruction
-{
-	irPCZ()
+	/*
+	 * Parses for label definitions and inserts them into labels array.
+	 * Also does some preliminary validation of program, and interns every symbol so the main assembling run doesn't have to.
+	 * Records every statement in statements, the token stream itself is left alone. Label addresses are left to layout().
+	 */
+	void preprocess(const std::vector<Token>& source_code)
 	{
-		name = "PCZ";
-		instruction_size = 1;
-		num_parameters = 1;
-	}
+		statements.clear();
+		token_symbols.assign(source_code.size(), SymbolTable::NO_SYMBOL);
+		symbols.reserve(source_code.size() / 2);
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int = 0)
-	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
+		for (uint32_t source_counter = 0; source_counter < source_code.size(); ++source_counter)
 		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
-		}
+			const Token &source_symbol = source_code[source_counter];
+			if (verbose)
+			{
+				log << "Preprocessing: \"" << source_symbol.text << "\"\n";
+			}
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
-		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
-		}
+			if (isLabelDefinition(source_symbol.text))
+			{
+				currentSection();
+				statements.push_back(Statement { source_counter, STATEMENT_LABEL, addLabel(source_symbol), false, false, 0, 0, SymbolTable::NO_SYMBOL });
+				continue;
+			}
 
-		memory[address] = 0xB3 + (4 * reg1);
-		++address;
+			uint32_t symbol = symbols.find(source_symbol.text);
+			token_symbols[source_counter] = symbol;
 
-		return instruction_size;
-	}
-};
+			if (symbol == section_symbol)
+			{
+				switchSection(directiveName(source_code, source_counter));
+				statements.push_back(Statement { source_counter, STATEMENT_SECTION, symbol, false, false, 0, 0, SymbolTable::NO_SYMBOL });
+				++source_counter;
+				continue;
+			}
 
-//0xC? 1100_xxyy -- x &= y
-struct irAnd : public Instruction
-{
-	irAnd()
-	{
-		name = "AND";
-		instruction_size = 1;
-		num_parameters = 2;
+			if (symbol == global_symbol)
+			{
+				label_globals[labelSymbol(directiveName(source_code, source_counter))] = true;
+				++source_counter;
+				continue;
+			}
+
+			if (isInstruction(symbol))
+			{
+				const Instruction &instruction = instructions[symbol];
+				if (source_code.size() - source_counter <= instruction.num_parameters)
+				{
+					log << "Error: " << location(source_symbol) << "Missing parameter for " << source_symbol.text << ".\n";
+					throw 0;
+				}
+
+				//Parameters that are labels.
+				for (uint8_t i = 1; i <= instruction.num_parameters; ++i)
+				{
+					std::string_view parameter = source_code[source_counter + i].text;
+					if (parameter.size() > 1 && !isNumber(parameter))
+					{
+						token_symbols[source_counter + i] = labelSymbol(parameter);
+					}
+				}
+
+				statements.push_back(Statement { source_counter, STATEMENT_INSTRUCTION, symbol, false, false, 0, 0, SymbolTable::NO_SYMBOL });
+				source_counter += instruction.num_parameters;
+				continue; //Valid instruction. Move on.
+			}
+
+			if (symbol == byte_symbol)
+			{
+				if (source_code.size() - source_counter <= 1)
+				{
+					log << "Error: " << location(source_symbol) << "Missing value for BYTE.\n";
+					throw 0;
+				}
+				statements.push_back(Statement { source_counter, STATEMENT_BYTE, symbol, false, false, 0, 0, SymbolTable::NO_SYMBOL });
+				++source_counter; //Next symbol will be a byte to allocate.
+				continue;
+			}
+
+			/*
+			 * Final case: It's either a label or something invalid. Assume label, it takes up one byte.
+			 * (The main assembling run will complain about it.)
+			 */
+			statements.push_back(Statement { source_counter, STATEMENT_UNKNOWN, symbol, false, false, 0, 0, SymbolTable::NO_SYMBOL });
+		}
+
+		current_section = -1; //Start over for the layout.
 	}
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int reg2)
+	//Works out the address of every label from the size of the statements before it. Throws on error.
+	void layout(const std::vector<Token>& source_code)
 	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
+		for (const Statement &statement : statements)
 		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
+			if (statement.kind == STATEMENT_SECTION)
+			{
+				switchSection(source_code[statement.token + 1].text);
+				continue;
+			}
+
+			uint16_t &address = currentSection().layout_address;
+
+			if (statement.kind == STATEMENT_LABEL)
+			{
+				labels[statement.symbol] = static_cast<uint8_t>(address); //A label right after a full section wraps around to 0.
+				continue;
+			}
+
+			if (statement.removed)
+			{
+				continue;
+			}
+
+			uint16_t size = (statement.kind == STATEMENT_INSTRUCTION) ? instructions[statement.symbol].instruction_size : 1;
+			if (address + size > RAM_SIZE)
+			{
+				//Overflowed program memory, not enough space.
+				log << "Error: " << location(source_code[statement.token]) << "Program exceeds max size allowed on this architecture!\n";
+				throw 0;
+			}
+			address += size;
 		}
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
+		current_section = -1; //Start over for the main assembling run.
+	}
+
+	//What the optimizer knows a register holds: a number, or the address of a label.
+	struct KnownValue
+	{
+		bool known;
+		bool label;
+		uint32_t value; //The number, or the label's symbol id.
+
+		bool operator==(const KnownValue &other) const
 		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
+			return known && other.known && label == other.label && value == other.value;
 		}
-		if (reg2 >= NUM_REGISTERS)
+	};
+
+	//Register number of an instruction's register operand, NUM_REGISTERS if it isn't a valid one.
+	uint8_t operandRegister(const std::vector<Token>& source_code, uint32_t token)
+	{
+		const Token &parameter = source_code[token];
+		if (token_symbols[token] != SymbolTable::NO_SYMBOL)
 		{
-			std::cout << "Error: Invalid register \"" << reg2 << "\".\n";
-			return 0;
+			return NUM_REGISTERS;
 		}
 
-		memory[address] = 0xC0 + (reg1 << 2) + (reg2);
-		++address;
-
-		return instruction_size;
+		int reg = isNumber(parameter.text) ? parseNumber(parameter) : regNameToNum(parameter.text);
+		return (reg >= 0 && reg < NUM_REGISTERS) ? reg : NUM_REGISTERS;
 	}
-};
 
-//0xD? 1101_xxyy -- x |= y
-struct irOr : public Instruction
-{
-	irOr()
+	//Value of an instruction's immediate operand.
+	KnownValue operandValue(const std::vector<Token>& source_code, uint32_t token)
 	{
-		name = "OR";
-		instruction_size = 1;
-		num_parameters = 2;
+		if (token_symbols[token] != SymbolTable::NO_SYMBOL)
+		{
+			return KnownValue { true, true, token_symbols[token] };
+		}
+
+		return KnownValue { true, false, static_cast<uint8_t>(parseNumber(source_code[token])) };
 	}
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int reg2)
+	//Label or number a branch goes to.
+	KnownValue branchTarget(const std::vector<Token>& source_code, const Statement &statement)
 	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
+		if (statement.target != SymbolTable::NO_SYMBOL)
 		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
+			return KnownValue { true, true, statement.target };
 		}
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
+		return operandValue(source_code, statement.token + 1);
+	}
+
+	//True if execution falling through the statement at index lands on label (no code in between).
+	bool fallsThroughTo(uint32_t index, const KnownValue &label)
+	{
+		if (!label.known || !label.label)
 		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
+			return false;
 		}
-		if (reg2 >= NUM_REGISTERS)
+
+		for (++index; index < statements.size(); ++index)
 		{
-			std::cout << "Error: Invalid register \"" << reg2 << "\".\n";
-			return 0;
+			const Statement &statement = statements[index];
+			if (statement.kind == STATEMENT_LABEL)
+			{
+				if (statement.symbol == label.value)
+				{
+					return true;
+				}
+			}
+			else if (!statement.removed)
+			{
+				return false;
+			}
 		}
 
-		memory[address] = 0xD0 + (reg1 << 2) + (reg2);
-		++address;
-
-		return instruction_size;
-	}
-};
-
-//0xE? 1110_xxyy -- x - y (no store)
-struct irCMP : public Instruction
-{
-	irCMP()
-	{
-		name = "CMP";
-		instruction_size = 1;
-		num_parameters = 2;
+		return false;
 	}
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int reg2)
+	//Registers an instruction statement names, NUM_REGISTERS for operands that aren't registers.
+	void statementRegisters(const std::vector<Token>& source_code, const Statement &statement, uint8_t &x, uint8_t &y)
 	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
+		const Instruction &instruction = instructions[statement.symbol];
+		x = y = NUM_REGISTERS;
+		if (statement.rewritten)
 		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
+			x = statement.x;
+			y = statement.y;
+			return;
 		}
-
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
+		if (isRegisterOperand(instruction.info.layout, 0))
 		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
+			x = operandRegister(source_code, statement.token + 1);
 		}
-		if (reg2 >= NUM_REGISTERS)
+		if (isRegisterOperand(instruction.info.layout, 1))
 		{
-			std::cout << "Error: Invalid register \"" << reg2 << "\".\n";
-			return 0;
+			y = operandRegister(source_code, statement.token + 2);
 		}
-
-		memory[address] = 0xE0 + (reg1 << 2) + (reg2);
-		++address;
-
-		return instruction_size;
 	}
-};
 
-//0xF? 1111_xxyy -- *y = x
-struct irRAM : public Instruction
-{
-	irRAM()
+	/*
+	 * True if register reg is overwritten before anything reads it, carrying on in a straight line after the statement at index.
+	 * Labels on the way don't matter, whatever jumps to them doesn't come from here. Gives up at anything that may go elsewhere.
+	 */
+	bool overwrittenBeforeRead(const std::vector<Token>& source_code, uint32_t index, uint8_t reg)
 	{
-		name = "ST";
-		instruction_size = 1;
-		num_parameters = 2;
+		for (++index; index < statements.size(); ++index)
+		{
+			const Statement &statement = statements[index];
+			if (statement.kind == STATEMENT_LABEL || statement.removed)
+			{
+				continue;
+			}
+			if (statement.kind != STATEMENT_INSTRUCTION)
+			{
+				return false;
+			}
+
+			uint8_t x, y;
+			statementRegisters(source_code, statement, x, y);
+			switch (instructions[statement.symbol].info.operation)
+			{
+			case OP_LDI:
+			case OP_SET:
+			case OP_LD:
+				if (y == reg)
+				{
+					return false;
+				}
+				if (x == reg)
+				{
+					return true;
+				}
+				break;
+
+			case OP_POP:
+				if (reg == STACK_POINTER)
+				{
+					return false;
+				}
+				if (x == reg)
+				{
+					return true;
+				}
+				break;
+
+			case OP_PUSH:
+				if (x == reg || reg == STACK_POINTER)
+				{
+					return false;
+				}
+				break;
+
+			case OP_MCPY:
+			case OP_MSET:
+			case OP_MSCAN:
+			case OP_MCMP:
+				if (reg == BLOCK_POINTER || reg == BLOCK_VALUE || reg == BLOCK_COUNT)
+				{
+					return false;
+				}
+				break;
+
+			case OP_NOP:
+			case OP_ADD:
+			case OP_SUB:
+			case OP_RSHIFT:
+			case OP_LSHIFT:
+			case OP_MUL:
+			case OP_NOT:
+			case OP_AND:
+			case OP_OR:
+			case OP_CMP:
+			case OP_ST:
+			case OP_ADDI:
+			case OP_SUBI:
+			case OP_CMPI:
+				if (x == reg || y == reg)
+				{
+					return false;
+				}
+				break;
+
+			default:
+				//Jumps, branches, calls, returns & HALT.
+				return false;
+			}
+		}
+
+		return false;
 	}
 
-	virtual int parse(uint8_t& address, uint8_t* memory, int reg1, int reg2)
+	/*
+	 * The jump at index was removed. If the instruction right before it only loaded the jump's address into reg,
+	 * and reg is overwritten before it's read again, removes that too & adds its size to saved. Returns true if it did.
+	 */
+	bool removeAddressLoad(const std::vector<Token>& source_code, uint32_t index, uint8_t reg, uint32_t &saved)
 	{
-		//Validate instruction size.
-		if (address >= RAM_SIZE - 1 - instruction_size)
+		uint32_t load = index;
+		while (load > 0 && statements[load - 1].kind == STATEMENT_INSTRUCTION && statements[load - 1].removed)
 		{
-			std::cout << "Error: Program exceeded max size.\n";
-			return 0;
+			--load;
+		}
+		if (load == 0 || statements[load - 1].kind != STATEMENT_INSTRUCTION)
+		{
+			return false;
 		}
 
-		//Validate registers.
-		if (reg1 >= NUM_REGISTERS)
+		Statement &statement = statements[load - 1];
+		Operation operation = instructions[statement.symbol].info.operation;
+		uint8_t x, y;
+		statementRegisters(source_code, statement, x, y);
+		if ((operation != OP_LDI && operation != OP_SET) || x != reg || !overwrittenBeforeRead(source_code, index, reg))
 		{
-			std::cout << "Error: Invalid register \"" << reg1 << "\".\n";
-			return 0;
+			return false;
 		}
-		if (reg2 >= NUM_REGISTERS)
+
+		statement.removed = true;
+		saved += instructions[statement.symbol].instruction_size;
+		if (verbose)
 		{
-			std::cout << "Error: Invalid register \"" << reg2 << "\".\n";
-			return 0;
+			log << "Optimizing: " << location(source_code[statement.token]) << "Removed " << instructions[statement.symbol].name << " (only loaded the address of a removed jump).\n";
 		}
+		return true;
+	}
 
-		memory[address] = 0xF0 + (reg2 << 2) + (reg1);
-		++address;
+	/*
+	 * Peephole optimizer (tas -O). Tracks which registers hold known constants through straight line code, and:
+	 * * Removes LDIs of a value the register already holds, and SETs that don't change anything.
+	 * * Turns LDIs of a value another register already holds into a (shorter) SET.
+	 * * Turns ST X Y followed by LD Z X into SET Z Y, or removes the LD if Z is Y.
+	 * * Removes jumps & branches to the next instruction, and the LDI of a removed jump's address if nothing reads it.
+	 * Whatever it knows is forgotten at every label (code may jump there from anywhere) & after CALLs.
+	 * Only marks statements as removed or rewritten, layout() then works out where the labels end up.
+	 * Assumes code doesn't read or modify itself, and refers to code addresses by label only.
+	 * Returns the number of bytes saved. Throws on error.
+	 */
+	uint32_t optimize(const std::vector<Token>& source_code)
+	{
+		uint32_t set_symbol = symbols.find("SET");
+		uint32_t removed = 0, rewritten = 0, saved = 0;
 
-		return instruction_size;
-	}
-};
+		KnownValue registers[NUM_REGISTERS];
+		const KnownValue UNKNOWN = { false, false, 0 };
+		std::fill(registers, registers + NUM_REGISTERS, UNKNOWN);
+		const Statement *previous = nullptr; //Instruction right before this one, if nothing can jump in between.
 
-// ***** END INSTRUCTION IMPLEMENTATIONS *****
+		for (uint32_t index = 0; index < statements.size(); ++index)
+		{
+			Statement &statement = statements[index];
+			const Statement *store = previous;
+			previous = nullptr;
 
+			if (statement.kind != STATEMENT_INSTRUCTION)
+			{
+				//Labels can be jumped to, data & unknown statements might be executed as anything.
+				std::fill(registers, registers + NUM_REGISTERS, UNKNOWN);
+				continue;
+			}
 
+			const Instruction &instruction = instructions[statement.symbol];
+			uint8_t x = NUM_REGISTERS, y = NUM_REGISTERS;
+			if (isRegisterOperand(instruction.info.layout, 0))
+			{
+				x = operandRegister(source_code, statement.token + 1);
+			}
+			if (isRegisterOperand(instruction.info.layout, 1))
+			{
+				y = operandRegister(source_code, statement.token + 2);
+			}
+			if ((isRegisterOperand(instruction.info.layout, 0) && x == NUM_REGISTERS) || (isRegisterOperand(instruction.info.layout, 1) && y == NUM_REGISTERS))
+			{
+				//The main assembling run will complain about it.
+				std::fill(registers, registers + NUM_REGISTERS, UNKNOWN);
+				continue;
+			}
 
+			const Token &token = source_code[statement.token];
+			std::string change;
 
+			switch (instruction.info.operation)
+			{
+			case OP_LDI:
+			{
+				KnownValue value = operandValue(source_code, statement.token + 2);
+				if (registers[x] == value)
+				{
+					statement.removed = true;
+					change = "register already holds that value";
+					break;
+				}
 
-class InstructionParser
-{
-public:
-	static const uint16_t NUM_INSTRUCTIONS = 1;
+				for (uint8_t reg = 0; reg < NUM_REGISTERS; ++reg)
+				{
+					if (registers[reg] == value)
+					{
+						statement.rewritten = true;
+						statement.symbol = set_symbol;
+						statement.x = x;
+						statement.y = reg;
+						change = std::string("register ") + static_cast<char>('A' + reg) + " already holds that value";
+						break;
+					}
+				}
+				registers[x] = value;
+				break;
+			}
 
-private:
-	std::map<std::string, Instruction* > instructions;
-	std::map<std::string, Instruction* >::iterator instructions_iter;
+			case OP_SET:
+				if (x == y || registers[x] == registers[y])
+				{
+					statement.removed = true;
+					change = "register already holds that value";
+					break;
+				}
+				registers[x] = registers[y];
+				break;
 
-	//Array of labels keyed by their name, returns the memory address they point to.
-	std::map<std::string, uint8_t> labels;
-	std::map<std::string, uint8_t>::iterator labels_iter;
+			case OP_LD:
+				if (store != nullptr && store->x == y)
+				{
+					if (x == store->y)
+					{
+						statement.removed = true;
+						change = "loads the value just stored from that register";
+					}
+					else
+					{
+						statement.rewritten = true;
+						statement.symbol = set_symbol;
+						statement.y = store->y;
+						change = "loads the value just stored";
+					}
+					statement.x = x;
+					registers[x] = registers[store->y];
+					break;
+				}
+				registers[x] = UNKNOWN;
+				break;
+
+			case OP_ST:
+				//Remembered for a following LD.
+				statement.x = x;
+				statement.y = y;
+				previous = &statement;
+				break;
+
+			case OP_ADDI:
+			case OP_SUBI:
+			{
+				KnownValue value = operandValue(source_code, statement.token + 2);
+				if (registers[x].known && !registers[x].label && !value.label)
+				{
+					registers[x].value = static_cast<uint8_t>((instruction.info.operation == OP_ADDI) ? registers[x].value + value.value : registers[x].value - value.value);
+				}
+				else
+				{
+					registers[x] = UNKNOWN;
+				}
+				break;
+			}
 
-public:
-	InstructionParser()
+			case OP_JMP:
+			case OP_PCC:
+			case OP_PCZ:
+			case OP_PCL:
+			case OP_PCO:
+			case OP_PCS:
+				if (fallsThroughTo(index, registers[x]))
+				{
+					statement.removed = true;
+					change = "jumps to the next instruction";
+					if (removeAddressLoad(source_code, index, x, saved))
+					{
+						++removed;
+						registers[x] = UNKNOWN;
+					}
+				}
+				else if (instruction.info.operation == OP_JMP)
+				{
+					//Only reachable through a label from here on.
+					std::fill(registers, registers + NUM_REGISTERS, UNKNOWN);
+				}
+				break;
+
+			case OP_BRA:
+			case OP_BZ:
+			case OP_BNZ:
+			case OP_BC:
+			case OP_BNC:
+			case OP_BS:
+			case OP_BO:
+			case OP_BL:
+				if (fallsThroughTo(index, branchTarget(source_code, statement)))
+				{
+					statement.removed = true;
+					change = "branches to the next instruction";
+				}
+				else if (instruction.info.operation == OP_BRA)
+				{
+					std::fill(registers, registers + NUM_REGISTERS, UNKNOWN);
+				}
+				break;
+
+			case OP_PUSH:
+				registers[STACK_POINTER] = UNKNOWN;
+				break;
+
+			case OP_POP:
+				registers[x] = UNKNOWN;
+				registers[STACK_POINTER] = UNKNOWN;
+				break;
+
+			case OP_MUL:
+				registers[x] = UNKNOWN;
+				registers[y] = UNKNOWN;
+				break;
+
+			case OP_MCPY:
+			case OP_MSET:
+			case OP_MSCAN:
+			case OP_MCMP:
+				registers[BLOCK_POINTER] = UNKNOWN;
+				registers[BLOCK_VALUE] = UNKNOWN;
+				registers[BLOCK_COUNT] = UNKNOWN;
+				break;
+
+			case OP_CALL:
+			case OP_RET:
+			case OP_HALT:
+				std::fill(registers, registers + NUM_REGISTERS, UNKNOWN);
+				break;
+
+			case OP_NOP:
+			case OP_CMP:
+			case OP_CMPI:
+				break;
+
+			default:
+				//ADD, SUB, shifts, NOT, AND, OR.
+				registers[x] = UNKNOWN;
+				break;
+			}
+
+			if (statement.removed)
+			{
+				if (verbose)
+				{
+					log << "Optimizing: " << location(token) << "Removed " << instruction.name << " (" << change << ").\n";
+				}
+				++removed;
+				saved += instruction.instruction_size;
+			}
+			else if (statement.rewritten)
+			{
+				if (verbose)
+				{
+					log << "Optimizing: " << location(token) << "Replaced " << instruction.name << " with SET (" << change << ").\n";
+				}
+				++rewritten;
+				saved += instruction.instruction_size - instructions[set_symbol].instruction_size;
+			}
+		}
+
+		if (verbose)
+		{
+			log << "Optimizer removed " << removed << " and rewrote " << rewritten << " instructions, saving " << saved << " bytes.\n";
+		}
+		return saved;
+	}
+
+	//A run of statements layoutForProfile() keeps together: code up to the next label or jump, or data with its labels.
+	struct LayoutBlock
+	{
+		uint32_t begin; //First statement.
+		uint32_t end; //One past the last.
+		bool code; //Code, or data the profile says ran. Everything else is data, never executed.
+		bool empty; //Labels only (at the end of the program).
+		bool falls_through; //Execution may carry on into the next block of the source.
+		uint32_t taken; //Block its last instruction jumps to, if laying it out right after can save the jump. NO_BLOCK if none.
+		bool invertible; //That jump is a conditional branch that can be flipped, to fall through to taken instead.
+		uint64_t count; //Times it ran.
+		uint64_t fallthrough_count; //Times it fell through into the next block of the source.
+		uint64_t taken_count; //Times it jumped to taken.
+	};
+
+	static constexpr uint32_t NO_BLOCK = UINT32_MAX;
+
+	//The conditional branch taken exactly when operation's isn't. NUM_OPERATIONS if there isn't one.
+	static Operation invertedBranch(Operation operation)
 	{
-		Instruction *instruction = new irNOP();
-		instructions[instruction->name] = instruction;
+		switch (operation)
+		{
+		case OP_BZ:
+			return OP_BNZ;
+		case OP_BNZ:
+			return OP_BZ;
+		case OP_BC:
+			return OP_BNC;
+		case OP_BNC:
+			return OP_BC;
+		default:
+			return NUM_OPERATIONS;
+		}
+	}
 
-		instruction = new irHalt();
-		instructions[instruction->name] = instruction;
+	//Defines a new label, at an address layout() works out, with a name that isn't used yet.
+	uint32_t generateLabel()
+	{
+		std::string name;
+		for (uint32_t n = generated_labels.size(); ; ++n)
+		{
+			name = "pgo." + std::to_string(n);
+			if (symbols.find(name) == SymbolTable::NO_SYMBOL)
+			{
+				break;
+			}
+		}
 
-		instruction = new irSet();
-		instructions[instruction->name] = instruction;
+		generated_labels.push_back(name);
+		uint32_t symbol = labelSymbol(generated_labels.back());
+		labels[symbol] = 0;
+		label_sections[symbol] = 0;
+		return symbol;
+	}
 
-		instruction = new irPCL();
-		instructions[instruction->name] = instruction;
+	//Label at the start of block. If it has none, one is made up into generated (once), for the caller to put there.
+	uint32_t blockLabel(const LayoutBlock &block, uint32_t &generated)
+	{
+		if (statements[block.begin].kind == STATEMENT_LABEL)
+		{
+			return statements[block.begin].symbol;
+		}
+		if (generated == SymbolTable::NO_SYMBOL)
+		{
+			generated = generateLabel();
+		}
 
-		instruction = new irPCO();
-		instructions[instruction->name] = instruction;
+		return generated;
+	}
 
-		instruction = new irPCS();
-		instructions[instruction->name] = instruction;
+	/*
+	 * Profile guided layout (tas -P). Reorders the code so the paths the profile (from tem --profile-out) says are hot
+	 * run straight through, instead of jumping around:
+	 * * Splits the code into blocks at labels & after jumps, and chains blocks with the hottest edge between them first:
+	 *   falling through, an unconditional jump, or a BZ/BNZ/BC/BNC that can be flipped to fall through instead.
+	 * * Lays out the entry block's chain first, then the other chains that ran, hottest first, then code that never ran
+	 *   in its original order, then data that never ran (execution never falls into it, and no code moves).
+	 * * Flips branches whose target now comes right after them, and adds a BRA where a block no longer falls through to the
+	 *   block it used to. Jumps & branches that end up going to the next instruction are left for optimize() to remove.
+	 * Call right after preprocess() & optimize(), so statements are where they were in the profiled program.
+	 * Undoes what optimize() did, so run it again after. Only single section programs are reordered.
+	 * Returns false (with a note on the log) if the program is left as it is.
+	 */
+	bool layoutForProfile(const std::vector<Token>& source_code, const ExecutionProfile &profile)
+	{
+		for (const Statement &statement : statements)
+		{
+			if (statement.kind == STATEMENT_SECTION || statement.kind == STATEMENT_UNKNOWN)
+			{
+				log << "Note: Profile guided layout only reorders programs without sections, skipped.\n";
+				return false;
+			}
+		}
 
-		instruction = new irLDI();
-		instructions[instruction->name] = instruction;
+		//Where each statement was in the profiled program, which optimize() just reproduced.
+		std::vector<uint16_t> addresses(statements.size(), 0);
+		std::vector<bool> kept(statements.size(), false);
+		std::vector<bool> starts(RAM_SIZE, false);
+		uint16_t address = 0;
+		for (uint32_t i = 0; i < statements.size(); ++i)
+		{
+			const Statement &statement = statements[i];
+			addresses[i] = address;
+			if (statement.kind != STATEMENT_LABEL && !statement.removed)
+			{
+				kept[i] = true;
+				starts[address % RAM_SIZE] = true;
+				address += (statement.kind == STATEMENT_INSTRUCTION) ? instructions[statement.symbol].instruction_size : 1;
+			}
+		}
+		for (uint32_t i = 0; i < profile.counts.size(); ++i)
+		{
+			if (profile.counts[i] && (i >= RAM_SIZE || !starts[i]))
+			{
+				log << "Note: Profile doesn't match the program (it has to be profiled assembled with -O), skipped.\n";
+				return false;
+			}
+		}
 
-		instruction = new irLD();
-		instructions[instruction->name] = instruction;
+		//Code that runs off the end of the program can't be kept going where it did once it's moved.
+		uint32_t tail = statements.size();
+		while (tail > 0 && statements[tail - 1].kind == STATEMENT_LABEL)
+		{
+			--tail;
+		}
+		bool runs_off = false;
+		if (tail > 0 && statements[tail - 1].kind == STATEMENT_INSTRUCTION)
+		{
+			Operation operation = instructions[token_symbols[statements[tail - 1].token]].info.operation;
+			runs_off = operation != OP_JMP && operation != OP_BRA && operation != OP_RET && operation != OP_HALT;
+		}
+		else if (tail > 0)
+		{
+			runs_off = profile.count(addresses[tail - 1]) != 0;
+		}
+		if (runs_off)
+		{
+			log << "Note: Profile guided layout needs a program that doesn't run off its end, skipped.\n";
+			return false;
+		}
 
-		instruction = new irAdd();
-		instructions[instruction->name] = instruction;
+		//Operation as written in the source, optimize() may have rewritten it.
+		auto sourceOperation = [this](uint32_t index)
+		{
+			return instructions[token_symbols[statements[index].token]].info.operation;
+		};
+		auto endsBlock = [this, &sourceOperation](uint32_t index)
+		{
+			if (statements[index].kind != STATEMENT_INSTRUCTION)
+			{
+				return false;
+			}
 
-		instruction = new irSub();
-		instructions[instruction->name] = instruction;
+			Operation operation = sourceOperation(index);
+			return operation == OP_JMP || operation == OP_RET || operation == OP_HALT || operation == OP_PCC || operation == OP_PCZ ||
+					operation == OP_PCL || operation == OP_PCO || operation == OP_PCS || (operation >= OP_BRA && operation <= OP_BL);
+		};
+		auto isData = [this, &profile, &addresses](uint32_t index)
+		{
+			return statements[index].kind == STATEMENT_BYTE && profile.count(addresses[index]) == 0;
+		};
 
-		instruction = new irRShift();
-		instructions[instruction->name] = instruction;
+		//Split into blocks.
+		std::vector<LayoutBlock> blocks;
+		for (uint32_t i = 0; i < statements.size(); ++i)
+		{
+			bool label = statements[i].kind == STATEMENT_LABEL;
+			bool start = blocks.empty();
+			if (!start && !blocks.back().empty)
+			{
+				if (label)
+				{
+					//Data keeps the labels in between, e.g. an array's elements.
+					uint32_t next = i;
+					while (next < statements.size() && statements[next].kind == STATEMENT_LABEL)
+					{
+						++next;
+					}
+					start = blocks.back().code || next == statements.size() || !isData(next);
+				}
+				else
+				{
+					start = blocks.back().code == isData(i) || endsBlock(i - 1);
+				}
+			}
 
-		instruction = new irNot();
-		instructions[instruction->name] = instruction;
+			if (start)
+			{
+				blocks.push_back(LayoutBlock { i, i, true, true, true, NO_BLOCK, false, 0, 0, 0 });
+			}
 
-		instruction = new irJMP();
-		instructions[instruction->name] = instruction;
+			LayoutBlock &block = blocks.back();
+			block.end = i + 1;
+			if (!label && block.empty)
+			{
+				block.empty = false;
+				block.code = !isData(i);
+			}
+		}
 
-		instruction = new irPCC();
-		instructions[instruction->name] = instruction;
+		//Block each label starts.
+		std::map<uint32_t, uint32_t> label_blocks;
+		for (uint32_t b = 0; b < blocks.size(); ++b)
+		{
+			for (uint32_t i = blocks[b].begin; i < blocks[b].end && statements[i].kind == STATEMENT_LABEL; ++i)
+			{
+				label_blocks[statements[i].symbol] = b;
+			}
+		}
 
-		instruction = new irPCZ();
-		instructions[instruction->name] = instruction;
+		//Where each block goes, and how often.
+		for (uint32_t b = 0; b < blocks.size(); ++b)
+		{
+			LayoutBlock &block = blocks[b];
+			if (block.empty)
+			{
+				block.falls_through = false; //Always last.
+				continue;
+			}
 
-		instruction = new irAnd();
-		instructions[instruction->name] = instruction;
+			uint32_t last = block.end - 1;
+			uint32_t last_kept = NO_BLOCK;
+			for (uint32_t i = block.begin; i < block.end; ++i)
+			{
+				if (kept[i])
+				{
+					block.count = std::max(block.count, profile.count(addresses[i]));
+					last_kept = i;
+				}
+			}
 
-		instruction = new irOr();
-		instructions[instruction->name] = instruction;
+			if (!block.code)
+			{
+				block.falls_through = false;
+				continue;
+			}
 
-		instruction = new irCMP();
-		instructions[instruction->name] = instruction;
+			Operation operation = (statements[last].kind == STATEMENT_INSTRUCTION) ? sourceOperation(last) : OP_NOP;
+			uint64_t exits = (last_kept == NO_BLOCK) ? 0 : profile.count(addresses[last_kept]);
+			uint64_t taken = (last_kept == last && endsBlock(last)) ? profile.taken(addresses[last]) : 0;
+			block.falls_through = operation != OP_JMP && operation != OP_BRA && operation != OP_RET && operation != OP_HALT;
+			if (block.falls_through)
+			{
+				block.fallthrough_count = (exits > taken) ? exits - taken : 0;
+			}
 
-		instruction = new irRAM();
-		instructions[instruction->name] = instruction;
-	}
+			if (operation == OP_BRA || invertedBranch(operation) != NUM_OPERATIONS)
+			{
+				std::map<uint32_t, uint32_t>::const_iterator target = label_blocks.find(token_symbols[statements[last].token + 1]);
+				if (target != label_blocks.end())
+				{
+					block.taken = target->second;
+					block.invertible = operation != OP_BRA;
+					block.taken_count = (operation == OP_BRA) ? block.count : taken;
+				}
+			}
+			else if (operation == OP_JMP && last > block.begin && statements[last - 1].kind == STATEMENT_INSTRUCTION &&
+					sourceOperation(last - 1) == OP_LDI)
+			{
+				//LDI X <label> JMP X, which optimize() can remove if <label> comes next.
+				uint8_t x, y;
+				statementRegisters(source_code, statements[last], x, y);
+				std::map<uint32_t, uint32_t>::const_iterator target = label_blocks.find(token_symbols[statements[last - 1].token + 2]);
+				if (x == operandRegister(source_code, statements[last - 1].token + 1) && target != label_blocks.end())
+				{
+					block.taken = target->second;
+					block.taken_count = block.count;
+				}
+			}
+		}
 
-	~InstructionParser()
-	{
-		for (instructions_iter = instructions.begin(); instructions_iter != instructions.end(); ++instructions_iter)
+		//Chain blocks along the hottest edges first. Nothing can go before the entry block.
+		struct Edge
+		{
+			uint64_t weight;
+			uint32_t from;
+			uint32_t to;
+		};
+		std::vector<Edge> edges;
+		for (uint32_t b = 0; b < blocks.size(); ++b)
 		{
-			delete (*instructions_iter).second;
-			(*instructions_iter).second = nullptr;
+			const LayoutBlock &block = blocks[b];
+			if (block.falls_through && block.fallthrough_count && blocks[b + 1].code && !blocks[b + 1].empty)
+			{
+				edges.push_back(Edge { block.fallthrough_count, b, b + 1 });
+			}
+			if (block.taken != NO_BLOCK && block.taken_count && blocks[block.taken].code)
+			{
+				edges.push_back(Edge { block.taken_count, b, block.taken });
+			}
 		}
+		std::stable_sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) { return a.weight > b.weight; });
 
-		instructions.clear();
-	}
-
-	bool isLabelDefinition(std::string symbol)
-	{
-		std::string::iterator i = symbol.end();
+		std::vector<uint32_t> next(blocks.size(), NO_BLOCK), previous(blocks.size(), NO_BLOCK);
+		for (const Edge &edge : edges)
+		{
+			if (edge.to == 0 || edge.from == edge.to || next[edge.from] != NO_BLOCK || previous[edge.to] != NO_BLOCK)
+			{
+				continue;
+			}
+			uint32_t head = edge.from;
+			while (previous[head] != NO_BLOCK)
+			{
+				head = previous[head];
+			}
+			if (head == edge.to)
+			{
+				continue; //Would close a loop.
+			}
+			next[edge.from] = edge.to;
+			previous[edge.to] = edge.from;
+		}
 
-		if (i > symbol.begin() && *(i - 1) == ':') //Is a label definition
+		//Order the chains: entry first, then hot ones, hottest first, then cold code, then data & the labels at the end.
+		std::vector<uint32_t> heads;
+		std::vector<uint64_t> heat(blocks.size(), 0);
+		for (uint32_t b = 1; b < blocks.size(); ++b)
 		{
-			return true;
+			if (previous[b] == NO_BLOCK && blocks[b].code && !blocks[b].empty)
+			{
+				heads.push_back(b);
+				for (uint32_t i = b; i != NO_BLOCK; i = next[i])
+				{
+					heat[b] = std::max(heat[b], blocks[i].count);
+				}
+			}
 		}
+		std::stable_sort(heads.begin(), heads.end(), [&heat](uint32_t a, uint32_t b) { return heat[a] > heat[b]; });
+		heads.insert(heads.begin(), 0);
 
-		return false;
-	}
+		std::vector<uint32_t> order;
+		for (uint32_t head : heads)
+		{
+			for (uint32_t i = head; i != NO_BLOCK; i = next[i])
+			{
+				order.push_back(i);
+			}
+		}
+		for (uint32_t b = 1; b < blocks.size(); ++b)
+		{
+			if (!blocks[b].code || blocks[b].empty)
+			{
+				order.push_back(b);
+			}
+		}
 
-	//Throws on error.
-	void addLabel(std::string name, uint8_t memory_location)
-	{
-		if (name.size() <= 1)
+		//Instructions that saves running, by the profile: jumps that now go to the next block (& are removed), less BRAs added.
+		int64_t gain = 0;
+		for (uint32_t p = 0; p < order.size(); ++p)
 		{
-			std::cout << "Error: Label too short.\n";
-			throw 0;
+			const LayoutBlock &block = blocks[order[p]];
+			uint32_t following = (p + 1 < order.size()) ? order[p + 1] : NO_BLOCK;
+			if (block.falls_through && following != order[p] + 1 && !(block.invertible && block.taken == following))
+			{
+				gain -= static_cast<int64_t>(block.fallthrough_count);
+			}
+			else if (!block.falls_through && block.taken != NO_BLOCK)
+			{
+				int64_t count = static_cast<int64_t>(block.taken_count);
+				gain += ((block.taken == following) ? count : 0) - ((block.taken == order[p] + 1) ? count : 0);
+			}
+		}
+		if (gain <= 0)
+		{
+			log << "Note: Profile guided layout wouldn't save anything, skipped.\n";
+			return false;
 		}
 
-		if ((labels_iter = labels.find(name)) != labels.end())
+		//Lay the blocks out in that order, keeping every path going where it did.
+		uint32_t bra_symbol = symbols.find("BRA");
+		std::vector<uint32_t> generated(blocks.size(), SymbolTable::NO_SYMBOL);
+		std::vector<Statement> fixes(blocks.size(), Statement { 0, STATEMENT_INSTRUCTION, bra_symbol, false, false, 0, 0, SymbolTable::NO_SYMBOL });
+		uint32_t inverted = 0, added = 0, moved = 0;
+		for (uint32_t p = 0; p < order.size(); ++p)
 		{
-			std::cout << "Error: Redefinition of label \" " << name << "\"\n";
-			throw 0;
+			uint32_t b = order[p];
+			uint32_t following = (p + 1 < order.size()) ? order[p + 1] : NO_BLOCK;
+			moved += (b != p) ? 1 : 0;
+			if (!blocks[b].falls_through || following == b + 1)
+			{
+				continue;
+			}
+
+			Statement &fix = fixes[b];
+			fix.token = statements[blocks[b].end - 1].token;
+			fix.target = blockLabel(blocks[b + 1], generated[b + 1]);
+			if (blocks[b].invertible && blocks[b].taken == following)
+			{
+				fix.symbol = invertedBranch(sourceOperation(blocks[b].end - 1)); //Instructions' symbol ids are their Operation.
+				++inverted;
+			}
+			else
+			{
+				++added;
+			}
 		}
 
-		name.erase(name.end() - 1); //Get rid of the trailing colon.
+		//Back to the source as written.
+		for (Statement &statement : statements)
+		{
+			if (statement.kind == STATEMENT_INSTRUCTION)
+			{
+				statement.symbol = token_symbols[statement.token];
+			}
+			statement.removed = false;
+			statement.rewritten = false;
+		}
 
-		if ((instructions_iter = instructions.find(name)) != instructions.end() || name == "BYTE")
+		std::vector<Statement> reordered;
+		reordered.reserve(statements.size() + 2 * blocks.size());
+		for (uint32_t b : order)
 		{
-			std::cout << "Error: Reserved keyword \"" << name << "\".\n";
-			throw 0;
+			const LayoutBlock &block = blocks[b];
+			if (generated[b] != SymbolTable::NO_SYMBOL)
+			{
+				reordered.push_back(Statement { statements[block.begin].token, STATEMENT_LABEL, generated[b], false, false, 0, 0, SymbolTable::NO_SYMBOL });
+			}
+			reordered.insert(reordered.end(), statements.begin() + block.begin, statements.begin() + block.end);
+			if (fixes[b].target != SymbolTable::NO_SYMBOL)
+			{
+				if (fixes[b].symbol == bra_symbol)
+				{
+					reordered.push_back(fixes[b]);
+				}
+				else
+				{
+					reordered.back().symbol = fixes[b].symbol;
+					reordered.back().target = fixes[b].target;
+				}
+			}
 		}
+		statements.swap(reordered);
 
-		labels[name] = memory_location;
+		if (verbose)
+		{
+			log << "Profile guided layout moved " << moved << " of " << blocks.size() << " blocks, flipped " << inverted << " branches and added " << added << " jumps.\n";
+		}
+		return true;
 	}
 
-	//Throws if does not find.
-	uint8_t getLabel(std::string name)
+	/*
+	 * Assembles one statement into the current section.
+	 * Paramaters:
+	 * 		source_code		- input file split up into vector of individual words/symbols
+	 * 		statement		- the statement to assemble
+	 */
+	void parseInstruction(const std::vector<Token>& source_code, const Statement &statement)
 	{
-		if (labels.find(name) == labels.end())
+		if (statement.kind == STATEMENT_LABEL || statement.removed)
 		{
-			std::cout << "Error: Undefined label \"" << name << "\"\n";
-			throw 0;
+			return;
 		}
 
+		uint32_t source_counter = statement.token;
+		const Token &source_symbol = source_code[source_counter];
+		uint32_t symbol = token_symbols[source_counter];
+		++source_counter;
 
-		return labels[name];
-	}
-
-	uint8_t regNameToNum(std::string name)
-	{
-		if (name.size() == 0)
+		if (statement.target != SymbolTable::NO_SYMBOL)
 		{
-			return 0;
+			//Branch set up by layoutForProfile(), to a label in the same section.
+			Section &section = currentSection();
+			if (instructions[statement.symbol].parse(log, section.address, section.memory, getLabel(source_symbol, statement.target)) == 0)
+			{
+				log << "Error: " << location(source_symbol) << "Could not assemble " << instructions[statement.symbol].name << ".\n";
+				throw 0;
+			}
+			return;
 		}
 
-		return name[0] - 'A'; //Only supports names A, B, C, D.
-	}
+		if (symbol == section_symbol)
+		{
+			switchSection(source_code[source_counter].text);
+			return;
+		}
 
-	void stripComments(std::ifstream& source_code, std::vector<std::string> &symbols_list)
-	{
-		std::string line;
-		std::vector<std::string> lines;
+		Section &section = currentSection();
 
-		std::size_t comment_index;
-		while (std::getline(source_code, line))
+		//Handle byte allocation
+		if (symbol == byte_symbol)
 		{
-			comment_index = line.find(";");
-			if (comment_index != std::string::npos)
+			//Allocate a byte.
+			uint8_t byte = parseNumber(source_code[source_counter]);
+			if (section.address >= RAM_SIZE)
 			{
-				line.erase(comment_index, line.size());
+				log << "Error: " << location(source_symbol) << "Program exceeds max size allowed on this architecture!\n";
+				throw 0;
 			}
+			section.memory[section.address] = byte;
+			++section.address;
 
-			lines.push_back(line);
+			return;
 		}
 
-		std::string symbol = "";
-		for (std::vector<std::string>::iterator i = lines.begin(); i < lines.end(); ++i)
+		//Handle instruction
+		if (!isInstruction(symbol))
 		{
-			std::stringstream ss(*i);
+			log << "Error: " << location(source_symbol) << "Invalid instruction \"" << source_symbol.text << "\"\n";
+			throw 0;
+		}
 
-			while (ss >> symbol)
+		if (statement.rewritten)
+		{
+			//Registers only, nothing to resolve.
+			if (instructions[statement.symbol].parse(log, section.address, section.memory, statement.x, statement.y) == 0)
 			{
-				if (symbol[0] != '\0') //Ignore kludge left over after comment cutting.
-				{
-					for (auto & i: symbol)
-					{
-						i = toupper(i);
-					}
-
-					symbols_list.push_back(symbol);
-					//std::cout << "Read in: \"" << symbol << "\"\n";
-				}
-				symbol = "";
+				log << "Error: " << location(source_symbol) << "Could not assemble \"" << source_symbol.text << "\".\n";
+				throw 0;
 			}
+			return;
 		}
-	}
-
-	/*
-	 * Parses for label definitions and inserts them into labels array.
-	 * Also does some preliminary validation of program.
-	 */
-	void preprocess(std::vector<std::string>& source_code)
-	{
-		std::vector<std::string>::iterator source_counter;
-		std::string source_symbol;
 
-		uint8_t address = 0x00;
-
-		for (source_counter = source_code.begin(); source_counter != source_code.end(); ++source_counter)
+		const Instruction &instruction = instructions[symbol];
+		int parameters[2] = { 0, 0 }; //Parse function requires two parameters, unused ones stay 0.
+		for (uint8_t i = 0; i < instruction.num_parameters; ++i, ++source_counter)
 		{
-			source_symbol = *source_counter;
-			std::cout << "Preprocessing: \"" << source_symbol << "\"\n";
-
-			if ((instructions_iter = instructions.find(source_symbol)) != instructions.end())
+			const Token &parameter = source_code[source_counter];
+			uint32_t label = token_symbols[source_counter];
+			if (label != SymbolTable::NO_SYMBOL)
 			{
-				if (address + (*instructions_iter).second->instruction_size < address )
+				//It's a label. Its address is only known once the sections are laid out, so let the linker fill it in.
+				bool address_operand = (instruction.info.layout == LAYOUT_X_LOW_IMMEDIATE && i == 1) || instruction.info.layout == LAYOUT_RELATIVE;
+				if (!address_operand || (!object_mode && !isDefined(label)))
 				{
-					//Overflowed program memory, not enough space.
-					std::cout << "Error: Program exceeds max size allowed on this architecture!\n";
-					throw 0;
+					parameters[i] = getLabel(parameter, label); //Resolve label.
 				}
-				address += (*instructions_iter).second->instruction_size;
-				source_counter += (*instructions_iter).second->num_parameters;
-				continue; //Valid instruction. Move on.
-			}
-
-			if (source_symbol == "BYTE")
-			{
-				if (address + 1 < address)
+				else if (instruction.info.layout == LAYOUT_RELATIVE && isDefined(label) && label_sections[label] == current_section)
 				{
-					//Overflowed program memory, not enough space.
-					std::cout << "Error: Program exceeds max size allowed on this architecture!\n";
-					throw 0;
+					parameters[i] = labels[label]; //Branches within a section don't depend on where it ends up.
+				}
+				else
+				{
+					references.push_back(LabelReference { static_cast<uint16_t>(current_section), static_cast<uint8_t>(section.address + 1), label,
+							instruction.info.layout == LAYOUT_RELATIVE ? RELOC_REL8 : RELOC_ABS8 });
 				}
-				++address;
-				++source_counter; //Next symbol will be a byte to allocate.
-				continue;
 			}
-
-			if (isLabelDefinition(source_symbol))
+			else if (isNumber(parameter.text))
 			{
-				addLabel(source_symbol, address);
-				source_code.erase(source_counter--); //Don't process label definitions in the main assembling run.
-				//Might be more efficient to swap this index & last, then pop off end.
-				continue;
+				//It's a number.
+				parameters[i] = parseNumber(parameter);
 			}
-
-			/*
-			 * Final case: It's either a label or something invalid. Assume label and increment address by one byte.
-			 */
-			if (address + 1 < address)
+			else
 			{
-				//Overflowed program memory, not enough space.
-				std::cout << "Error: Program exceeds max size allowed on this architecture!\n";
-				throw 0;
+				//Is a register name. Convert register name to number.
+				parameters[i] = regNameToNum(parameter.text);
 			}
-			++address;
+		}
+
+		uint8_t bytes_written = instruction.parse(log, section.address, section.memory, parameters[0], parameters[1]);
+		if (bytes_written == 0)
+		{
+			//Error.
+			log << "Error: " << location(source_symbol) << "Could not assemble \"" << source_symbol.text << "\".\n";
+			throw 0;
 		}
 	}
 
 	/*
-	 * Paramaters:
-	 * 		source_code		- input file split up into vector of individual words/symbols
-	 * 		source_counter	- current location into source code
-	 * 		address			- current address writing to in program memory.
-	 * 		memory			- array that is the entire program memory.
+	 * Debug symbols for the program image, once the statements are assembled.
+	 * Addresses are where linkObjects() puts a single module: its sections one after the other, in order.
 	 */
-	int parseInstruction(std::vector<std::string>& source_code, std::vector<std::string>::iterator& source_counter, uint8_t& address, uint8_t* memory)
+	void buildSymbolMap(const std::vector<Token>& source_code, SymbolMap &map)
 	{
-		//Don't care about capitalization.
-		std::string source_symbol = *source_counter;
-		for (auto & i: source_symbol)
+		std::vector<uint16_t> bases(sections.size(), 0);
+		for (std::size_t i = 1; i < sections.size(); ++i)
 		{
-			i = toupper(i);
+			bases[i] = bases[i - 1] + sections[i - 1].address;
 		}
-		++source_counter;
 
-		//Handle byte allocation
-		if (source_symbol == "BYTE")
+		for (uint32_t symbol = 0; symbol < labels.size(); ++symbol)
 		{
-			//Allocate a byte.
-			uint8_t byte = std::stoi(*source_counter);
-			memory[address] = byte;
-			++source_counter;
+			if (isDefined(symbol))
+			{
+				map.addLabel(bases[label_sections[symbol]] + labels[symbol], std::string(symbols.name(symbol)));
+			}
+		}
 
-			return 1;
+		std::size_t section = 0;
+		std::vector<uint16_t> addresses(sections.size(), 0);
+		for (const Statement &statement : statements)
+		{
+			if (statement.kind == STATEMENT_SECTION)
+			{
+				std::string name = upperCase(source_code[statement.token + 1].text);
+				for (section = 0; sections[section].name != name; ++section);
+				continue;
+			}
+			if (statement.kind == STATEMENT_LABEL || statement.removed)
+			{
+				continue;
+			}
+
+			bool code = statement.kind == STATEMENT_INSTRUCTION;
+			uint16_t size = code ? instructions[statement.symbol].instruction_size : 1;
+			map.addStatement(bases[section] + addresses[section], code, size, source_code[statement.token].line);
+			addresses[section] += size;
 		}
+	}
 
-		//Handle instruction
-		if ((instructions_iter = instructions.find(source_symbol)) == instructions.end())
+	//Packs the assembled sections, labels & label references up into an object. Throws on error.
+	void buildObject(ObjectFile &object)
+	{
+		object.sections.clear();
+		object.symbols.clear();
+		object.relocations.clear();
+
+		for (const Section &section : sections)
 		{
-			std::cout << "Error: Invalid instruction \" " << source_symbol << "\"\n";
-			throw 0;
+			object.sections.push_back(ObjectSection { section.name, std::vector<uint8_t>(section.memory, section.memory + section.address) });
 		}
 
-		std::vector<uint8_t> parameters;
-		for (uint8_t i = 0; i < (*instructions_iter).second->num_parameters; ++i)
+		//Every defined label, and every label referenced but not defined.
+		std::vector<int32_t> object_symbols(labels.size(), -1);
+		for (uint32_t symbol = 0; symbol < labels.size(); ++symbol)
 		{
-			if ((*source_counter).find_first_not_of( "0123456789" ) == std::string::npos)
+			if (isDefined(symbol))
 			{
-				//It's a number.
-				parameters.push_back(std::stoi(*source_counter));
+				object_symbols[symbol] = object.symbols.size();
+				object.symbols.push_back(ObjectSymbol { upperCase(symbols.name(symbol)), static_cast<uint8_t>(SYMBOL_DEFINED | (label_globals[symbol] ? SYMBOL_GLOBAL : 0)),
+						label_sections[symbol], static_cast<uint8_t>(labels[symbol]) });
 			}
-			else
+			else if (label_globals[symbol])
 			{
-				if ((*source_counter).size() > 1)
-				{
-					//It's a label.
-					try
-					{
-						parameters.push_back(getLabel(*source_counter)); //Resolve label.
-					}
-					catch (...)
-					{
-						throw 0;
-					}
-				}
-				else
-				{
-					//Is a register name. Convert register name to number.
-					parameters.push_back(regNameToNum(*source_counter));
-				}
+				log << "Error: GLOBAL label \"" << symbols.name(symbol) << "\" is never defined.\n";
+				throw 0;
 			}
-			++source_counter;
 		}
 
-		//Parse function requires two parameters. Generate NULL parameters if needed.
-		for (uint8_t i = (*instructions_iter).second->num_parameters; i < 2; ++i)
+		for (const LabelReference &reference : references)
 		{
-			parameters.push_back(0);
-		}
+			if (object_symbols[reference.symbol] == -1)
+			{
+				object_symbols[reference.symbol] = object.symbols.size();
+				object.symbols.push_back(ObjectSymbol { upperCase(symbols.name(reference.symbol)), 0, 0, 0 });
+			}
 
-		uint8_t bytes_written = (*instructions_iter).second->parse(address, memory, parameters[0], parameters[1]);
-		if (bytes_written == 0)
-		{
-			//Error.
-			throw 0;
+			object.relocations.push_back(Relocation { reference.section, reference.offset, static_cast<uint16_t>(object_symbols[reference.symbol]), reference.type });
 		}
-		return 0; //The instruction's parse function automatically increments the address, don't do it here.
 	}
 };
 
 class Program
 {
+	std::ostream &log; //Where diagnostics go.
+
 public:
-	InstructionParser &parser;
+	InstructionParser parser;
 
 private:
 	uint8_t memory[RAM_SIZE];
 
-	std::vector<std::string> sourcecode;
-	std::vector<std::string>::iterator source_pointer; //Current location in processing source code.
+	SourceFile source_file; //Tokens point into it.
+	std::vector<Token> sourcecode;
 
 public:
-	Program() :
-		parser(*(new InstructionParser()))
+	Program(std::ostream &log_stream = std::cout) :
+		log(log_stream),
+		parser(log_stream)
 	{
 		uint16_t i = 0;
 		for (i = 0; i < RAM_SIZE; ++i)
@@ -1128,62 +1746,156 @@ public:
 		memory[byte] = value;
 	}
 
-	/*
-	 * Load in file and pass off each instruction one by one to the instruction parser.
-	 * Save output binary file that can be run in the emulator.
-	 */
-	bool assembleFile(std::string input, std::string output)
+	//FNV-1a of the source, to tell if an object file is out of date.
+	static uint64_t hashSource(std::string_view source)
+	{
+		uint64_t hash = 14695981039346656037ULL ^ OBJECT_VERSION;
+		for (char c : source)
+		{
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 1099511628211ULL;
+		}
+
+		return hash;
+	}
+
+	//Translates the source that's been opened into object_file, for assembleFile().
+	bool translate(ObjectFile &object_file, bool object, bool optimize, const ExecutionProfile *profile)
 	{
-		std::ifstream input_file(input);
+		//Break the file up into an array of words.
+		tokenize(source_file.contents(), sourcecode);
+
+
+		//Preprocessor.
+		try
+		{
+			if (parser.verbose)
+			{
+				log << " *** Preprocessing (labels) ***\n";
+			}
+			parser.object_mode = object;
+			parser.preprocess(sourcecode);
+			if (parser.verbose)
+			{
+				log << " *** ***\n\n\n";
+			}
+
+			if (optimize || profile)
+			{
+				if (parser.verbose)
+				{
+					log << " *** Optimizing ***\n";
+				}
+				parser.optimize(sourcecode);
+				if (profile && parser.layoutForProfile(sourcecode, *profile))
+				{
+					parser.optimize(sourcecode);
+				}
+				if (parser.verbose)
+				{
+					log << " *** ***\n\n\n";
+				}
+			}
 
-		if (!input_file)
+			parser.layout(sourcecode);
+		}
+		catch (...)
 		{
-			std::cout << "Error: Could not open input input_file \"" << input << "\"\n";
 			return false;
 		}
 
-		//Break the file up into an array of words:std::string file_contents;
-
 		try
 		{
-			std::cout << " *** Stripping comments ***\n";
-			parser.stripComments(input_file, sourcecode);
-			std::cout << " *** ***\n\n\n";
+			if (parser.verbose)
+			{
+				log << " *** Assembling File ***\n";
+			}
+			for (const InstructionParser::Statement &statement : parser.statements)
+			{
+				parser.parseInstruction(sourcecode, statement);
+			}
+			parser.buildObject(object_file);
+			if (parser.verbose)
+			{
+				log << " *** ***\n\n\n";
+			}
 		}
 		catch (...)
 		{
-			input_file.close();
 			return false;
 		}
 
-		input_file.close();
+		return true;
+	}
+
+	/*
+	 * Assembles input the way tas -O does, into memory only: the image a profile for tas -P has to be taken of.
+	 * Returns false (& complains to log) if it doesn't assemble.
+	 */
+	bool assembleImage(std::string input)
+	{
+		parser.reset();
+		sourcecode.clear();
+		std::fill(memory, memory + RAM_SIZE, 0);
 
+		ObjectFile object_file;
+		return source_file.open(input, log) && translate(object_file, false, true, nullptr) && linkObjects(std::vector<ObjectFile>(1, object_file), std::vector<std::string>(1, input), memory, true, log);
+	}
 
-		//Preprocessor.
-		try
+	const uint8_t *image() const
+	{
+		return memory;
+	}
+
+	/*
+	 * Load in file and pass off each instruction one by one to the instruction parser.
+	 * Save output binary file that can be run in the emulator, or with object set, a relocatable object file for tld.
+	 * Binaries get debug symbols (see symbolmap.hpp) alongside, in <output>.sym.
+	 * Object files are only rebuilt if the source changed since they were assembled.
+	 * With optimize set, runs the peephole optimizer before laying the code out.
+	 * With a profile (of the program assembled with optimize) it's also reordered along its hot paths first, see layoutForProfile().
+	 */
+	bool assembleFile(std::string input, std::string output, bool object = false, bool optimize = false, const ExecutionProfile *profile = nullptr)
+	{
+		//Same Program may assemble many files (batch mode). The parser's labels point into the old source, so reset it first.
+		parser.reset();
+		sourcecode.clear();
+		std::fill(memory, memory + RAM_SIZE, 0);
+
+		if (!source_file.open(input, log))
 		{
-			std::cout << " *** Preprocessing (labels) ***\n";
-			parser.preprocess(sourcecode);
-			std::cout << " *** ***\n\n\n";
+			return false;
 		}
-		catch (...)
+
+		ObjectFile object_file;
+		uint64_t source_hash = hashSource(source_file.contents()) ^ (optimize ? 1 : 0);
+		if (object && object_file.read(output, true) && object_file.source_hash == source_hash)
+		{
+			log << output << " is up to date.\n";
+			return true;
+		}
+
+		if (!translate(object_file, object, optimize, profile))
 		{
 			return false;
 		}
 
-		uint8_t address = 0x00;
+		if (object)
+		{
+			object_file.source_hash = source_hash;
+			return object_file.write(output, log);
+		}
 
-		try
+		//Lay the sections out, same as tld would for a single module.
+		if (!linkObjects(std::vector<ObjectFile>(1, object_file), std::vector<std::string>(1, input), memory, true, log))
 		{
-			std::cout << " *** Assembling File ***\n";
-			source_pointer = sourcecode.begin();
-			while (source_pointer < sourcecode.end()) //Must increment source_pointer in parser.
-			{
-				address += parser.parseInstruction(sourcecode, source_pointer, address, memory);
-			}
-			std::cout << " *** ***\n\n\n";
+			return false;
 		}
-		catch (...)
+
+		SymbolMap symbol_map;
+		symbol_map.source = input;
+		parser.buildSymbolMap(sourcecode, symbol_map);
+		if (!symbol_map.write(SymbolMap::filenameFor(output), log))
 		{
 			return false;
 		}
@@ -1192,7 +1904,7 @@ public:
 
 		if (!output_file)
 		{
-			std::cout << "Error: Could not open input input_file \"" << output << "\"\n";
+			log << "Error: Could not open input input_file \"" << output << "\"\n";
 			return false;
 		}
 
@@ -1204,10 +1916,123 @@ public:
 	}
 };
 
+//One file for batch mode to assemble.
+struct BatchJob
+{
+	std::string input;
+	std::string output;
+	bool succeeded;
+	std::string log; //Its diagnostics, printed once all jobs are done so they don't interleave.
+};
+
+/*
+ * Assembles every job on a pool of threads threads. Each thread has its own Program (and InstructionParser),
+ * they only share the instruction table. Jobs are handed out in order from a shared counter.
+ * Returns the number of jobs that failed.
+ */
+std::size_t assembleBatch(std::vector<BatchJob> &jobs, unsigned threads, bool object, bool optimize)
+{
+	std::atomic<std::size_t> next(0);
+	instructionTable(); //Build it before the threads start.
+
+	auto worker = [&jobs, &next, object, optimize]()
+	{
+		std::ostringstream log;
+		Program program(log);
+		program.parser.verbose = false;
+		for (std::size_t i = next++; i < jobs.size(); i = next++)
+		{
+			log.str("");
+			jobs[i].succeeded = program.assembleFile(jobs[i].input, jobs[i].output, object, optimize);
+			jobs[i].log = log.str();
+		}
+	};
+
+	threads = std::max(1u, std::min<unsigned>(threads, jobs.size()));
+	std::vector<std::thread> pool;
+	for (unsigned i = 1; i < threads; ++i)
+	{
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (std::thread &thread : pool)
+	{
+		thread.join();
+	}
+
+	std::size_t failed = 0;
+	for (const BatchJob &job : jobs)
+	{
+		if (!job.log.empty())
+		{
+			std::cout << job.input << ":\n" << job.log;
+		}
+		failed += job.succeeded ? 0 : 1;
+	}
+	std::cout << "Assembled " << (jobs.size() - failed) << " of " << jobs.size() << " files.\n";
+	return failed;
+}
+
+//input with its extension replaced by extension.
+std::string replaceExtension(const std::string &input, const std::string &extension)
+{
+	std::size_t dot = input.find_last_of('.');
+	std::size_t slash = input.find_last_of('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+	{
+		return input + extension;
+	}
+
+	return input.substr(0, dot) + extension;
+}
+
+//Reads "<input> [<output>]" lines. Returns false (and complains) if the manifest can't be read.
+bool readManifest(const std::string &filename, const std::string &extension, std::vector<BatchJob> &jobs)
+{
+	std::ifstream manifest(filename);
+	if (!manifest)
+	{
+		std::cout << "Error: Could not open manifest \"" << filename << "\"\n";
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(manifest, line))
+	{
+		std::istringstream fields(line.substr(0, line.find(';')));
+		BatchJob job = { "", "", false, "" };
+		if (!(fields >> job.input))
+		{
+			continue; //Blank line or comment.
+		}
+		if (!(fields >> job.output))
+		{
+			job.output = replaceExtension(job.input, extension);
+		}
+		jobs.push_back(job);
+	}
+
+	return true;
+}
+
 void displayUsageInstructions(std::string default_input, std::string default_output)
 {
 	std::cout << "Program usage: \n" \
-			<< "\n$> tas <input source file> <output binary file>\n\n" \
+			<< "\n$> tas <input source file> <output binary file>\n" \
+			<< "$> tas -c <input source file> <output object file>\n" \
+			<< "$> tas -O [-c] <input source file> <output file>\n" \
+			<< "$> tas -P <profile file> <input source file> <output binary file>\n" \
+			<< "$> tas [-O] [-c] [-j <threads>] --batch <input source file>...\n" \
+			<< "$> tas [-O] [-c] [-j <threads>] --manifest <manifest file>\n\n" \
+			<< "-c assembles a module into a relocatable object file for tld, if the object file isn't up to date already.\n" \
+			<< "-O runs a peephole optimizer: drops redundant loads & jumps to the next instruction.\n" \
+			<< "   Code has to refer to code addresses by label only, as instructions move.\n" \
+			<< "-P reorders the code along the hot paths in a profile from tem --profile-out, then runs -O on it.\n" \
+			<< "   Profile the program assembled with -O, e.g. tas -O p.tas p.bin; tem --profile-out p.prof p.bin; tas -P p.prof p.tas p.bin\n" \
+			<< "   Profiles of anything else (e.g. an older version of the source) are refused.\n" \
+			<< "--batch assembles every input file, each into the same name with a .bin (or with -c, .tobj) extension.\n" \
+			<< "--manifest does the same for the files listed in the manifest, one \"<input> [<output>]\" per line.\n" \
+			<< "   Files are assembled on -j threads (default: one per core), and only errors are printed, per file.\n\n" \
 			<< "Default input: " << default_input \
 			<< "\nDefault output: " << default_output << "\n";
 }
@@ -1220,21 +2045,93 @@ int main(int argc, char **argv)
 
 	std::string input_file = "program.tas";
 	std::string output_file = "program.bin";
+	bool object = false;
+	bool optimize = false;
+	std::string profile_file;
+	unsigned threads = std::thread::hardware_concurrency();
 
-	//I'm going to set a hard limit on the command line arguments to 3 (2 actual useable arguments) for now.
-	if (argc > 3)
+	if (argc >= 2 && !strcmp(argv[1], "-h"))
 	{
 		displayUsageInstructions(input_file, output_file);
-		return 1; //Blarg. They doin' it wrong.
+		return 0;
+	}
+
+	while (argc >= 2 && (!strcmp(argv[1], "-c") || !strcmp(argv[1], "-O") || !strcmp(argv[1], "-j") || !strcmp(argv[1], "-P")))
+	{
+		if (!strcmp(argv[1], "-c"))
+		{
+			object = true;
+			output_file = "program.tobj";
+		}
+		else if (!strcmp(argv[1], "-O"))
+		{
+			optimize = true;
+		}
+		else if (!strcmp(argv[1], "-P"))
+		{
+			if (argc < 3)
+			{
+				displayUsageInstructions(input_file, output_file);
+				return 1;
+			}
+			profile_file = argv[2];
+			--argc;
+			++argv;
+		}
+		else
+		{
+			//The whole argument has to be a positive number, like tem's counts.
+			if (argc < 3)
+			{
+				displayUsageInstructions(input_file, output_file);
+				return 1;
+			}
+			const char *end = argv[2] + strlen(argv[2]);
+			std::from_chars_result result = std::from_chars(argv[2], end, threads);
+			if (result.ec != std::errc() || result.ptr != end || threads == 0)
+			{
+				std::cout << "Error: -j takes a positive number of threads, not \"" << argv[2] << "\".\n";
+				displayUsageInstructions(input_file, output_file);
+				return 1;
+			}
+			--argc;
+			++argv;
+		}
+		--argc;
+		++argv;
 	}
 
-	if (argc >= 2)
+	//Batch mode.
+	if (argc >= 2 && (!strcmp(argv[1], "--batch") || !strcmp(argv[1], "--manifest")))
 	{
-		if (!strcmp(argv[1], "-h"))
+		if (!profile_file.empty())
+		{
+			std::cout << "Error: -P takes the profile of a single program, it can't be used with " << argv[1] << ".\n";
+			return 1;
+		}
+		std::string extension = object ? ".tobj" : ".bin";
+		std::vector<BatchJob> jobs;
+		if (!strcmp(argv[1], "--batch"))
+		{
+			for (int i = 2; i < argc; ++i)
+			{
+				jobs.push_back(BatchJob { argv[i], replaceExtension(argv[i], extension), false, "" });
+			}
+		}
+		else if (argc != 3 || !readManifest(argv[2], extension, jobs))
 		{
 			displayUsageInstructions(input_file, output_file);
-			return 0;
+			return 1;
 		}
+
+		return (assembleBatch(jobs, threads, object, optimize) == 0) ? 0 : 1;
+	}
+
+	//I'm going to set a hard limit on the command line arguments to 3 (2 actual useable arguments) for now.
+	if (argc > 3)
+	{
+		displayUsageInstructions(input_file, output_file);
+		return 1; //Blarg. They doin' it wrong.
 	}
 
 	//Parse command line parameters.
@@ -1250,10 +2147,42 @@ int main(int argc, char **argv)
 		}
 	}
 
+	//Profile guided layout, for whole programs only.
+	ExecutionProfile profile;
+	if (!profile_file.empty())
+	{
+		if (object)
+		{
+			std::cout << "Error: -P lays out whole programs, it can't be used with -c.\n";
+			return 1;
+		}
+		if (!profile.read(profile_file, RAM_SIZE))
+		{
+			return 1;
+		}
+
+		//A profile of another build of the program would lay this one out along paths it doesn't have.
+		Program profiled;
+		profiled.parser.verbose = false;
+		if (!profile.image_hash)
+		{
+			std::cout << "Warning: \"" << profile_file << "\" doesn't say which image it was taken of, so it can't be checked against " << input_file << ".\n";
+		}
+		else if (!profiled.assembleImage(input_file))
+		{
+			return 1;
+		}
+		else if (ExecutionProfile::hashImage(profiled.image(), RAM_SIZE) != profile.image_hash)
+		{
+			std::cout << "Error: \"" << profile_file << "\" was taken of a different image than " << input_file << " assembled with -O. Profile that again.\n";
+			return 1;
+		}
+	}
+
 	Program program;
 
 
-	if (!program.assembleFile(input_file, output_file))
+	if (!program.assembleFile(input_file, output_file, object, optimize, profile_file.empty() ? nullptr : &profile))
 	{
 		return 1; //Failed to assemble.
 	}
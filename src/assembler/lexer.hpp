@@ -0,0 +1,168 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_LEXER_HPP
+#define TRISK_LEXER_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cctype>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Splits assembly source into tokens in a single pass, without copying it.
+ * The source file is memory mapped and tokens are string_views into the mapping,
+ * so a SourceFile must outlive the tokens made from it.
+ */
+
+struct Token
+{
+	std::string_view text;
+	uint32_t line; //Both start at 1.
+	uint32_t column;
+};
+
+inline bool equalsIgnoreCase(std::string_view a, std::string_view b)
+{
+	if (a.size() != b.size())
+	{
+		return false;
+	}
+
+	for (std::size_t i = 0; i < a.size(); ++i)
+	{
+		if (toupper(static_cast<unsigned char>(a[i])) != toupper(static_cast<unsigned char>(b[i])))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//A read only memory mapping of a whole file.
+class SourceFile
+{
+	const char *data;
+	std::size_t size;
+
+public:
+	SourceFile()
+	{
+		data = nullptr;
+		size = 0;
+	}
+
+	~SourceFile()
+	{
+		close();
+	}
+
+	SourceFile(const SourceFile &) = delete;
+	SourceFile &operator=(const SourceFile &) = delete;
+
+	void close()
+	{
+		if (data != nullptr)
+		{
+			munmap(const_cast<char* >(data), size);
+		}
+		data = nullptr;
+		size = 0;
+	}
+
+	//Returns false (and complains to log) if the file can't be opened. Closes the file open before, if any.
+	bool open(const std::string &filename, std::ostream &log = std::cout)
+	{
+		close();
+
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			log << "Error: Could not open input file \"" << filename << "\"\n";
+			return false;
+		}
+
+		struct stat info;
+		if (fstat(fd, &info) < 0)
+		{
+			log << "Error: Could not read input file \"" << filename << "\"\n";
+			::close(fd);
+			return false;
+		}
+
+		size = info.st_size;
+		if (size > 0) //Can't map an empty file, but there's nothing to read anyway.
+		{
+			void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping == MAP_FAILED)
+			{
+				log << "Error: Could not map input file \"" << filename << "\"\n";
+				::close(fd);
+				size = 0;
+				return false;
+			}
+			data = static_cast<const char* >(mapping);
+			madvise(mapping, size, MADV_SEQUENTIAL);
+		}
+
+		::close(fd);
+		return true;
+	}
+
+	std::string_view contents() const
+	{
+		return std::string_view(data, size);
+	}
+};
+
+/*
+ * Appends the tokens of source to tokens.
+ * Tokens are separated by whitespace, and anything from a ';' to the end of the line is a comment.
+ */
+inline void tokenize(std::string_view source, std::vector<Token> &tokens)
+{
+	uint32_t line = 1;
+	std::size_t line_start = 0;
+	std::size_t i = 0;
+	std::size_t size = source.size();
+
+	while (i < size)
+	{
+		char c = source[i];
+
+		if (c == '\n')
+		{
+			++line;
+			line_start = ++i;
+		}
+		else if (c == ';')
+		{
+			while (i < size && source[i] != '\n')
+			{
+				++i;
+			}
+		}
+		else if (isspace(static_cast<unsigned char>(c)) || c == '\0')
+		{
+			++i;
+		}
+		else
+		{
+			std::size_t start = i;
+			while (i < size && source[i] != ';' && source[i] != '\0' && !isspace(static_cast<unsigned char>(source[i])))
+			{
+				++i;
+			}
+			tokens.push_back(Token { source.substr(start, i - start), line, static_cast<uint32_t>(start - line_start + 1) });
+		}
+	}
+}
+
+#endif //TRISK_LEXER_HPP
@@ -0,0 +1,99 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_SYMBOLS_HPP
+#define TRISK_SYMBOLS_HPP
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <cctype>
+
+#include "lexer.hpp"
+
+/*
+ * Interns names (instructions, keywords & labels) into small integer ids, case insensitively.
+ * Each name is hashed once, when it's first seen. After that the assembler only deals in ids,
+ * so per-symbol data can live in plain vectors indexed by id.
+ * Names are string_views, whatever they point into (the source mapping, INSTRUCTION_SET) must outlive the table.
+ */
+
+struct CaseInsensitiveHash
+{
+	std::size_t operator()(std::string_view name) const
+	{
+		//FNV-1a
+		uint64_t hash = 14695981039346656037ULL;
+		for (char c : name)
+		{
+			hash ^= static_cast<uint64_t>(toupper(static_cast<unsigned char>(c)));
+			hash *= 1099511628211ULL;
+		}
+
+		return static_cast<std::size_t>(hash);
+	}
+};
+
+struct CaseInsensitiveEqual
+{
+	bool operator()(std::string_view a, std::string_view b) const
+	{
+		return equalsIgnoreCase(a, b);
+	}
+};
+
+class SymbolTable
+{
+	std::unordered_map<std::string_view, uint32_t, CaseInsensitiveHash, CaseInsensitiveEqual> ids;
+	std::vector<std::string_view> names; //Indexed by id.
+
+public:
+	static constexpr uint32_t NO_SYMBOL = UINT32_MAX;
+
+	//Returns the id of name, giving it the next free one if it's new.
+	uint32_t intern(std::string_view name)
+	{
+		auto inserted = ids.emplace(name, static_cast<uint32_t>(names.size()));
+		if (inserted.second)
+		{
+			names.push_back(name);
+		}
+
+		return inserted.first->second;
+	}
+
+	//Returns the id of name, NO_SYMBOL if it hasn't been interned.
+	uint32_t find(std::string_view name) const
+	{
+		auto i = ids.find(name);
+		return (i == ids.end()) ? NO_SYMBOL : i->second;
+	}
+
+	std::string_view name(uint32_t id) const
+	{
+		return names[id];
+	}
+
+	uint32_t size() const
+	{
+		return static_cast<uint32_t>(names.size());
+	}
+
+	//Forgets every name from id count on. Must be called while their text is still valid.
+	void truncate(uint32_t count)
+	{
+		while (names.size() > count)
+		{
+			ids.erase(names.back());
+			names.pop_back();
+		}
+	}
+
+	void reserve(std::size_t count)
+	{
+		ids.reserve(count);
+		names.reserve(count);
+	}
+};
+
+#endif //TRISK_SYMBOLS_HPP
@@ -6,6 +6,8 @@
 #include <string>
 #include <cstring>
 
+#include "isa.hpp"
+
 void displayUsageInstructions(std::string default_input, std::string default_output)
 {
 	std::cout << "Program usage: \n" \
@@ -14,8 +16,6 @@ void displayUsageInstructions(std::string default_input, std::string default_out
 			<< "\nDefault output: " << default_output << "\n";
 }
 
-static const uint16_t RAM_SIZE = 256; //8-bit RAM.
-
 int main(int argc, char **argv)
 {
 	std::string input_filename = "program.bin";
@@ -0,0 +1,292 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_ARCHIVE_HPP
+#define TRISK_ARCHIVE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "isa.hpp"
+
+/*
+ * Image archives: any number of program images (or the RAMs they left behind) in one file, for batch runs.
+ * tpack packs image files into an archive & unpacks them again. tem --archive runs every image in an archive,
+ * and writes the final RAMs to an archive of the same shape, with each image's outcome in its index entry.
+ * Archives are mapped into memory and used where they are, so there's no per-image opening, seeking or parsing.
+ *
+ * File layout (little endian, the structs below are the format):
+ * 		ArchiveHeader
+ * 		ArchiveEntry, one per image
+ * 		Name table: the images' names, back to back (file names only, see validArchiveName())
+ * 		Images: image_size bytes each, back to back from images_offset, which is a multiple of ARCHIVE_ALIGNMENT
+ */
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Archives are used in place, so the host has to be little endian like the format.");
+
+static const uint16_t ARCHIVE_VERSION = 2;
+static const uint32_t ARCHIVE_ALIGNMENT = 4096; //Images start on a page.
+
+enum ArchiveStatus : uint8_t
+{
+	ARCHIVE_NOT_RUN,			//Input image.
+	ARCHIVE_HALTED,
+	ARCHIVE_INSTRUCTION_LIMIT,
+	ARCHIVE_TIMEOUT,
+	ARCHIVE_EMPTY				//Nothing but zeroes, not run (same as tem on its own).
+};
+
+inline const char *archiveStatusName(uint8_t status)
+{
+	static const char *NAMES[] = { "not run", "halted", "instruction limit", "timeout", "empty" };
+	return (status <= ARCHIVE_EMPTY) ? NAMES[status] : "invalid";
+}
+
+struct ArchiveHeader
+{
+	char magic[4]; //"TRKA"
+	uint16_t version;
+	uint16_t image_size;
+	uint32_t count;
+	uint32_t names_size;
+	uint64_t images_offset;
+	uint64_t reserved;
+};
+
+//What's known about an image. Everything but the name is filled in by tem, & is 0 in an input archive.
+struct ArchiveEntry
+{
+	uint32_t name_offset; //Into the name table.
+	uint32_t name_length;
+	uint64_t instructions; //Executed.
+	uint8_t status; //ArchiveStatus
+	uint8_t flags; //C Z S O L in bits 4 - 0.
+	uint8_t pc;
+	uint8_t registers[NUM_REGISTERS];
+	uint8_t reserved[32 - 19 - NUM_REGISTERS]; //Pads the entry out to 32 bytes.
+};
+
+//Names are plain file names, so unpacking can't write outside the directory it's given.
+inline bool validArchiveName(std::string_view name)
+{
+	return !name.empty() && name != "." && name.find('/') == std::string_view::npos && name.find("..") == std::string_view::npos;
+}
+
+static_assert(sizeof(ArchiveHeader) == 32 && sizeof(ArchiveEntry) == 32, "Archive structs must match the file format.");
+
+class ImageArchive
+{
+	uint8_t *data;
+	std::size_t size;
+
+	const ArchiveHeader &header() const
+	{
+		return *reinterpret_cast<const ArchiveHeader* >(data);
+	}
+
+public:
+	ImageArchive() :
+		data(nullptr),
+		size(0)
+	{
+	}
+
+	~ImageArchive()
+	{
+		close();
+	}
+
+	ImageArchive(const ImageArchive &) = delete;
+	ImageArchive &operator=(const ImageArchive &) = delete;
+
+	/*
+	 * Writes out an archive of images of image_size bytes, with the given names, and all images & entries zeroed.
+	 * Open it writable to fill the images in. Returns false (and complains to log) if a name isn't valid or the file can't be written.
+	 */
+	static bool create(const std::string &filename, const std::vector<std::string> &names, uint16_t image_size, std::ostream &log = std::cout)
+	{
+		ArchiveHeader new_header = {};
+		std::memcpy(new_header.magic, "TRKA", 4);
+		new_header.version = ARCHIVE_VERSION;
+		new_header.image_size = image_size;
+		new_header.count = names.size();
+
+		std::vector<ArchiveEntry> entries(names.size(), ArchiveEntry {});
+		for (std::size_t i = 0; i < names.size(); ++i)
+		{
+			if (!validArchiveName(names[i]))
+			{
+				log << "Error: \"" << names[i] << "\" can't be stored in an archive, names can't contain '/' or \"..\".\n";
+				return false;
+			}
+			entries[i].name_offset = new_header.names_size;
+			entries[i].name_length = names[i].size();
+			new_header.names_size += names[i].size();
+		}
+
+		uint64_t names_offset = sizeof(ArchiveHeader) + entries.size() * sizeof(ArchiveEntry);
+		new_header.images_offset = (names_offset + new_header.names_size + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT;
+
+		std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			log << "Error: Could not open output file \"" << filename << "\"\n";
+			return false;
+		}
+
+		file.write(reinterpret_cast<const char* >(&new_header), sizeof(new_header));
+		file.write(reinterpret_cast<const char* >(entries.data()), entries.size() * sizeof(ArchiveEntry));
+		for (const std::string &name : names)
+		{
+			file.write(name.data(), name.size());
+		}
+
+		//Images start out as a hole, the filesystem doesn't store zeroes until they're written.
+		uint64_t end = new_header.images_offset + static_cast<uint64_t>(new_header.count) * image_size;
+		file.seekp(end - 1);
+		file.put(0);
+
+		if (!file)
+		{
+			log << "Error: Could not write output file \"" << filename << "\"\n";
+			return false;
+		}
+		return true;
+	}
+
+	//Writes out a copy of archive, to be filled in with results. Returns false (and complains to log) if the file can't be written.
+	static bool createLike(const std::string &filename, const ImageArchive &archive, std::ostream &log = std::cout)
+	{
+		std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+		if (!file || !file.write(reinterpret_cast<const char* >(archive.data), archive.size))
+		{
+			log << "Error: Could not write output file \"" << filename << "\"\n";
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+		if (data != nullptr)
+		{
+			munmap(data, size);
+		}
+		data = nullptr;
+		size = 0;
+	}
+
+	//Returns false (and complains to log) if the file can't be mapped or isn't a valid archive. Closes the archive open before, if any.
+	bool open(const std::string &filename, bool writable = false, std::ostream &log = std::cout)
+	{
+		close();
+
+		int fd = ::open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+		if (fd < 0)
+		{
+			log << "Error: Could not open archive \"" << filename << "\"\n";
+			return false;
+		}
+
+		struct stat info;
+		if (fstat(fd, &info) < 0 || static_cast<std::size_t>(info.st_size) < sizeof(ArchiveHeader))
+		{
+			log << "Error: \"" << filename << "\" is not an image archive.\n";
+			::close(fd);
+			return false;
+		}
+
+		size = info.st_size;
+		void *mapping = mmap(nullptr, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mapping == MAP_FAILED)
+		{
+			log << "Error: Could not map archive \"" << filename << "\"\n";
+			size = 0;
+			return false;
+		}
+		data = static_cast<uint8_t* >(mapping);
+		madvise(mapping, size, MADV_SEQUENTIAL);
+
+		if (!valid())
+		{
+			log << "Error: \"" << filename << "\" is not a valid image archive.\n";
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	uint32_t count() const
+	{
+		return header().count;
+	}
+
+	uint16_t imageSize() const
+	{
+		return header().image_size;
+	}
+
+	ArchiveEntry &entry(uint32_t i)
+	{
+		return reinterpret_cast<ArchiveEntry* >(data + sizeof(ArchiveHeader))[i];
+	}
+
+	const ArchiveEntry &entry(uint32_t i) const
+	{
+		return reinterpret_cast<const ArchiveEntry* >(data + sizeof(ArchiveHeader))[i];
+	}
+
+	std::string_view name(uint32_t i) const
+	{
+		const char *names = reinterpret_cast<const char* >(data + sizeof(ArchiveHeader) + count() * sizeof(ArchiveEntry));
+		return std::string_view(names + entry(i).name_offset, entry(i).name_length);
+	}
+
+	uint8_t *image(uint32_t i)
+	{
+		return data + header().images_offset + static_cast<uint64_t>(i) * imageSize();
+	}
+
+	const uint8_t *image(uint32_t i) const
+	{
+		return data + header().images_offset + static_cast<uint64_t>(i) * imageSize();
+	}
+
+private:
+	//Everything the index points to is inside the file.
+	bool valid() const
+	{
+		const ArchiveHeader &h = header();
+		if (std::memcmp(h.magic, "TRKA", 4) || h.version != ARCHIVE_VERSION || !h.image_size)
+		{
+			return false;
+		}
+
+		uint64_t names_offset = sizeof(ArchiveHeader) + static_cast<uint64_t>(h.count) * sizeof(ArchiveEntry);
+		if (names_offset + h.names_size > h.images_offset || h.images_offset + static_cast<uint64_t>(h.count) * h.image_size > size)
+		{
+			return false;
+		}
+
+		for (uint32_t i = 0; i < h.count; ++i)
+		{
+			if (static_cast<uint64_t>(entry(i).name_offset) + entry(i).name_length > h.names_size || !validArchiveName(name(i)))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+#endif //TRISK_ARCHIVE_HPP
@@ -0,0 +1,220 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_BATCHCPU_HPP
+#define TRISK_BATCHCPU_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "isa.hpp"
+#include "cpu.hpp"
+
+/*
+ * Runs straight line code on many register states ("lanes") at once, for tools that have to try
+ * a lot of code on a lot of inputs (e.g. the superoptimizer).
+ * Only the instructions that just compute on registers & flags are supported (see supports()).
+ * Unlike CPU, nothing is printed and there's no RAM or program counter: instructions are given already decoded,
+ * and each one is applied to every lane in a tight loop. Flags come from the same ALU the CPU uses, so results match tem.
+ */
+
+//A decoded instruction with its immediate, if any, in y.
+struct MicroOp
+{
+	Operation operation;
+	uint8_t x;
+	uint8_t y;
+};
+
+class BatchCPU
+{
+public:
+	std::size_t lanes;
+	std::vector<uint8_t> registers[NUM_REGISTERS]; //registers[r][lane]
+	std::vector<ALU> alus; //Flags of each lane.
+
+	BatchCPU(std::size_t lane_count = 0)
+	{
+		resize(lane_count);
+	}
+
+	void resize(std::size_t lane_count)
+	{
+		lanes = lane_count;
+		for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+		{
+			registers[r].assign(lanes, 0);
+		}
+		alus.assign(lanes, ALU());
+	}
+
+	//True if operation only reads & writes registers and flags, and always falls through to the next instruction.
+	static bool supports(Operation operation)
+	{
+		switch (operation)
+		{
+		case OP_NOP:
+		case OP_SET:
+		case OP_LDI:
+		case OP_ADD:
+		case OP_SUB:
+		case OP_RSHIFT:
+		case OP_LSHIFT:
+		case OP_MUL:
+		case OP_NOT:
+		case OP_AND:
+		case OP_OR:
+		case OP_CMP:
+		case OP_ADDI:
+		case OP_SUBI:
+		case OP_CMPI:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	//Flags of a lane, as C Z S O L in bits 4 - 0.
+	uint8_t flags(std::size_t lane) const
+	{
+		const ALU &alu = alus[lane];
+		return (alu.getCFlag() << 4) | (alu.getZFlag() << 3) | (alu.getSFlag() << 2) | (alu.getOFlag() << 1) | alu.getLFlag();
+	}
+
+	void setFlags(std::size_t lane, uint8_t flags)
+	{
+		alus[lane].setFlags(checkBit(flags, 4), checkBit(flags, 3), checkBit(flags, 2), checkBit(flags, 1), checkBit(flags, 0));
+	}
+
+	//Runs op on lanes [begin, end). op has to be supported().
+	void execute(const MicroOp &op, std::size_t begin, std::size_t end)
+	{
+		uint8_t *x = registers[op.x % NUM_REGISTERS].data();
+		uint8_t *y = registers[op.y % NUM_REGISTERS].data();
+		ALU *alu = alus.data();
+
+		switch (op.operation)
+		{
+		case OP_SET:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				x[i] = y[i];
+			}
+			break;
+
+		case OP_LDI:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				x[i] = op.y;
+			}
+			break;
+
+		case OP_ADD:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				x[i] = alu[i].add(x[i], y[i], false);
+			}
+			break;
+
+		case OP_SUB:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				x[i] = alu[i].sub(x[i], y[i], false);
+			}
+			break;
+
+		case OP_RSHIFT:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				x[i] = alu[i].bitwiseRightShift(x[i], y[i], false);
+			}
+			break;
+
+		case OP_LSHIFT:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				x[i] = alu[i].bitwiseLeftShift(x[i], y[i], false);
+			}
+			break;
+
+		case OP_MUL:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				uint8_t high;
+				uint8_t low = alu[i].multiply(x[i], y[i], high, false);
+
+				//High byte first, so MUL X X leaves the low byte in X. Same as the CPU.
+				y[i] = high;
+				x[i] = low;
+			}
+			break;
+
+		case OP_NOT:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				x[i] = alu[i].bitwiseNot(x[i], false);
+			}
+			break;
+
+		case OP_AND:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				x[i] = alu[i].bitwiseAnd(x[i], y[i], false);
+			}
+			break;
+
+		case OP_OR:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				x[i] = alu[i].bitwiseOr(x[i], y[i], false);
+			}
+			break;
+
+		case OP_CMP:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				alu[i].sub(x[i], y[i], false);
+			}
+			break;
+
+		case OP_ADDI:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				x[i] = alu[i].add(x[i], op.y, false);
+			}
+			break;
+
+		case OP_SUBI:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				x[i] = alu[i].sub(x[i], op.y, false);
+			}
+			break;
+
+		case OP_CMPI:
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				alu[i].sub(x[i], op.y, false);
+			}
+			break;
+
+		default:
+			//NOP.
+			break;
+		}
+	}
+
+	void execute(const MicroOp &op)
+	{
+		execute(op, 0, lanes);
+	}
+
+	void execute(const std::vector<MicroOp> &ops, std::size_t begin, std::size_t end)
+	{
+		for (const MicroOp &op : ops)
+		{
+			execute(op, begin, end);
+		}
+	}
+};
+
+#endif //TRISK_BATCHCPU_HPP
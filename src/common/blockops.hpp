@@ -0,0 +1,178 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_BLOCKOPS_HPP
+#define TRISK_BLOCKOPS_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Host implementations of the block memory instructions (MCPY, MSET, MSCAN, MCMP).
+ * They work on the 256 byte window of RAM that 8-bit register pointers can reach, so addresses wrap around at 256.
+ * Contiguous runs are handed off to SIMD kernels: AVX2 if the compiler targets it (see TRISK_NATIVE in CMakeLists.txt),
+ * otherwise SSE2, otherwise plain loops.
+ */
+
+static const uint16_t BLOCK_WINDOW = 256; //Registers are 8 bits wide, so that's as far as a block can reach.
+
+//Returns the index of the first byte equal to value in p[0, n), or n if there is none.
+inline size_t findByte(const uint8_t *p, size_t n, uint8_t value)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256i needle = _mm256_set1_epi8(static_cast<char>(value));
+	for (; i + 32 <= n; i += 32)
+	{
+		__m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i* >(p + i));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+		if (mask)
+		{
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+
+#if defined(__SSE2__)
+	const __m128i needle16 = _mm_set1_epi8(static_cast<char>(value));
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i* >(p + i));
+		uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16));
+		if (mask)
+		{
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+
+	for (; i < n; ++i)
+	{
+		if (p[i] == value)
+		{
+			return i;
+		}
+	}
+
+	return n;
+}
+
+//Returns the index of the first byte where a[0, n) and b[0, n) differ, or n if they're equal.
+inline size_t findMismatch(const uint8_t *a, const uint8_t *b, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	for (; i + 32 <= n; i += 32)
+	{
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i* >(a + i));
+		__m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i* >(b + i));
+		uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+		if (mask)
+		{
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+
+#if defined(__SSE2__)
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i* >(a + i));
+		__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i* >(b + i));
+		uint32_t mask = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))) & 0xFFFF;
+		if (mask)
+		{
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+
+	for (; i < n; ++i)
+	{
+		if (a[i] != b[i])
+		{
+			return i;
+		}
+	}
+
+	return n;
+}
+
+//Length of the run starting at address that doesn't wrap around the end of the window.
+inline uint16_t contiguousRun(uint8_t address, uint16_t count)
+{
+	uint16_t to_end = BLOCK_WINDOW - address;
+	return (count < to_end) ? count : to_end;
+}
+
+//memory[dst, dst + count) = memory[src, src + count). Overlapping blocks behave like memmove().
+inline void blockCopy(uint8_t *memory, uint8_t dst, uint8_t src, uint8_t count)
+{
+	if (contiguousRun(dst, count) == count && contiguousRun(src, count) == count)
+	{
+		std::memmove(memory + dst, memory + src, count);
+		return;
+	}
+
+	//One of the blocks wraps around, go through a temporary.
+	uint8_t buffer[BLOCK_WINDOW];
+	for (uint16_t i = 0; i < count; ++i)
+	{
+		buffer[i] = memory[static_cast<uint8_t>(src + i)];
+	}
+	for (uint16_t i = 0; i < count; ++i)
+	{
+		memory[static_cast<uint8_t>(dst + i)] = buffer[i];
+	}
+}
+
+//memory[dst, dst + count) = value.
+inline void blockFill(uint8_t *memory, uint8_t dst, uint8_t value, uint8_t count)
+{
+	uint16_t first = contiguousRun(dst, count);
+	std::memset(memory + dst, value, first);
+	std::memset(memory, value, count - first);
+}
+
+//Returns the offset of the first byte equal to value in memory[start, start + count), or count if there is none.
+inline uint16_t blockScan(const uint8_t *memory, uint8_t start, uint8_t value, uint8_t count)
+{
+	uint16_t first = contiguousRun(start, count);
+	uint16_t found = findByte(memory + start, first, value);
+	if (found < first)
+	{
+		return found;
+	}
+
+	return first + findByte(memory, count - first, value);
+}
+
+//Returns the offset of the first byte where memory[p1, p1 + count) & memory[p2, p2 + count) differ, or count if they're equal.
+inline uint16_t blockCompare(const uint8_t *memory, uint8_t p1, uint8_t p2, uint8_t count)
+{
+	uint16_t offset = 0;
+	while (offset < count)
+	{
+		uint8_t a = p1 + offset;
+		uint8_t b = p2 + offset;
+		uint16_t run = contiguousRun(b, contiguousRun(a, count - offset));
+
+		uint16_t found = findMismatch(memory + a, memory + b, run);
+		if (found < run)
+		{
+			return offset + found;
+		}
+
+		offset += run;
+	}
+
+	return count;
+}
+
+#endif //TRISK_BLOCKOPS_HPP
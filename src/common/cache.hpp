@@ -0,0 +1,296 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_CACHE_HPP
+#define TRISK_CACHE_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+
+/*
+ * Guest memory hierarchy model, for sizing the caches of the hardware build.
+ * Only counts hits & misses, the data itself always comes out of RAM.
+ * Stores are write-allocate and otherwise treated like loads (no write-back traffic is modeled).
+ */
+
+enum ReplacementPolicy
+{
+	REPLACE_LRU,
+	REPLACE_FIFO,
+	REPLACE_RANDOM
+};
+
+struct CacheConfig
+{
+	uint32_t size = 64; //Total size in bytes.
+	uint32_t associativity = 2; //Ways per set.
+	uint32_t line_size = 4; //Bytes per line.
+	ReplacementPolicy policy = REPLACE_LRU;
+	uint32_t miss_penalty = 10; //Stall cycles added by each miss.
+
+	/*
+	 * Parses "<size>,<associativity>,<line size>[,<lru|fifo|random>[,<miss penalty>]]", e.g. "64,2,4,lru,10".
+	 * Returns false (and complains) if the spec or the geometry it describes is invalid.
+	 */
+	bool parse(const std::string &spec)
+	{
+		std::stringstream ss(spec);
+		std::string field;
+		std::vector<std::string> fields;
+		while (std::getline(ss, field, ','))
+		{
+			fields.push_back(field);
+		}
+
+		if (fields.size() < 3 || fields.size() > 5)
+		{
+			std::cout << "Error: Invalid cache spec \"" << spec << "\". Expected <size>,<associativity>,<line size>[,<policy>[,<miss penalty>]].\n";
+			return false;
+		}
+
+		try
+		{
+			size = std::stoul(fields[0]);
+			associativity = std::stoul(fields[1]);
+			line_size = std::stoul(fields[2]);
+			if (fields.size() >= 5)
+			{
+				miss_penalty = std::stoul(fields[4]);
+			}
+		}
+		catch (...)
+		{
+			std::cout << "Error: Invalid number in cache spec \"" << spec << "\".\n";
+			return false;
+		}
+
+		if (fields.size() >= 4)
+		{
+			if (fields[3] == "lru")
+			{
+				policy = REPLACE_LRU;
+			}
+			else if (fields[3] == "fifo")
+			{
+				policy = REPLACE_FIFO;
+			}
+			else if (fields[3] == "random")
+			{
+				policy = REPLACE_RANDOM;
+			}
+			else
+			{
+				std::cout << "Error: Unknown replacement policy \"" << fields[3] << "\". Use lru, fifo or random.\n";
+				return false;
+			}
+		}
+
+		return validate();
+	}
+
+	bool validate() const
+	{
+		bool power_of_two = line_size && !(line_size & (line_size - 1));
+		if (!power_of_two || !associativity || size % (associativity * line_size) != 0 || size < associativity * line_size)
+		{
+			std::cout << "Error: Invalid cache geometry (size " << size << ", associativity " << associativity << ", line size " << line_size << "). Line size must be a power of two, and size a multiple of associativity * line size.\n";
+			return false;
+		}
+
+		return true;
+	}
+};
+
+class CacheModel
+{
+	struct Line
+	{
+		bool valid;
+		uint32_t tag;
+		uint64_t stamp; //Last use (LRU) or fill (FIFO) time.
+	};
+
+	CacheConfig config;
+	uint32_t num_sets;
+	std::vector<Line> lines; //num_sets * associativity, set by set.
+
+	uint64_t time;
+	uint32_t random_state;
+
+public:
+	uint64_t hits;
+	uint64_t misses;
+
+	CacheModel(const CacheConfig &cache_config) :
+		config(cache_config)
+	{
+		num_sets = config.size / (config.associativity * config.line_size);
+		lines.assign(num_sets * config.associativity, Line { false, 0, 0 });
+
+		time = 0;
+		random_state = 0x2016; //Fixed seed, so runs are reproducible.
+		hits = 0;
+		misses = 0;
+	}
+
+	//Returns true on a hit. Misses fill the line.
+	bool access(uint32_t address)
+	{
+		++time;
+
+		uint32_t line_address = address / config.line_size;
+		uint32_t set = line_address % num_sets;
+		uint32_t tag = line_address / num_sets;
+		Line *ways = &lines[set * config.associativity];
+
+		for (uint32_t i = 0; i < config.associativity; ++i)
+		{
+			if (ways[i].valid && ways[i].tag == tag)
+			{
+				if (config.policy == REPLACE_LRU)
+				{
+					ways[i].stamp = time;
+				}
+				++hits;
+				return true;
+			}
+		}
+
+		++misses;
+		ways[pickVictim(ways)] = Line { true, tag, time };
+		return false;
+	}
+
+	//Accesses every line touched by count bytes starting at address. Addresses wrap around at 256, like registers.
+	void accessBlock(uint8_t address, uint16_t count)
+	{
+		uint32_t last_line = ~0u;
+		for (uint16_t i = 0; i < count; ++i)
+		{
+			uint32_t line = static_cast<uint8_t>(address + i) / config.line_size;
+			if (line != last_line)
+			{
+				access(static_cast<uint8_t>(address + i));
+				last_line = line;
+			}
+		}
+	}
+
+	uint64_t getStallCycles() const
+	{
+		return misses * config.miss_penalty;
+	}
+
+	void report(const std::string &name) const
+	{
+		uint64_t accesses = hits + misses;
+		double hit_rate = accesses ? 100.0 * hits / accesses : 0.0;
+
+		std::cout << name << ": " << config.size << " bytes, " << config.associativity << "-way, " << config.line_size << " byte lines, " \
+				<< ((config.policy == REPLACE_LRU) ? "LRU" : (config.policy == REPLACE_FIFO) ? "FIFO" : "random") << "\n" \
+				<< "\tAccesses: " << accesses << "\n" \
+				<< "\tHits: " << hits << " (" << hit_rate << "%)\n" \
+				<< "\tMisses: " << misses << " (" << (accesses ? 100.0 - hit_rate : 0.0) << "%)\n" \
+				<< "\tStall cycles: " << getStallCycles() << "\n";
+	}
+
+private:
+	uint32_t pickVictim(const Line *ways)
+	{
+		for (uint32_t i = 0; i < config.associativity; ++i)
+		{
+			if (!ways[i].valid)
+			{
+				return i;
+			}
+		}
+
+		if (config.policy == REPLACE_RANDOM)
+		{
+			//xorshift32
+			random_state ^= random_state << 13;
+			random_state ^= random_state >> 17;
+			random_state ^= random_state << 5;
+			return random_state % config.associativity;
+		}
+
+		//LRU & FIFO both evict the oldest stamp, they just update it at different times.
+		uint32_t victim = 0;
+		for (uint32_t i = 1; i < config.associativity; ++i)
+		{
+			if (ways[i].stamp < ways[victim].stamp)
+			{
+				victim = i;
+			}
+		}
+
+		return victim;
+	}
+};
+
+/*
+ * Memory model for CPU that feeds instruction fetches through an instruction cache and loads & stores through a data cache.
+ * Either cache may be left out.
+ */
+struct CachedMemory
+{
+	CacheModel *icache = nullptr;
+	CacheModel *dcache = nullptr;
+
+	void onFetch(uint32_t address)
+	{
+		if (icache)
+		{
+			icache->access(address);
+		}
+	}
+
+	void onLoad(uint32_t address)
+	{
+		if (dcache)
+		{
+			dcache->access(address);
+		}
+	}
+
+	void onStore(uint32_t address)
+	{
+		onLoad(address);
+	}
+
+	void onLoadBlock(uint8_t address, uint16_t count)
+	{
+		if (dcache)
+		{
+			dcache->accessBlock(address, count);
+		}
+	}
+
+	void onStoreBlock(uint8_t address, uint16_t count)
+	{
+		onLoadBlock(address, count);
+	}
+
+	void report() const
+	{
+		std::cout << "\nCache simulation:\n";
+
+		uint64_t stall_cycles = 0;
+		if (icache)
+		{
+			icache->report("Instruction cache");
+			stall_cycles += icache->getStallCycles();
+		}
+		if (dcache)
+		{
+			dcache->report("Data cache");
+			stall_cycles += dcache->getStallCycles();
+		}
+
+		std::cout << "Total stall cycles: " << stall_cycles << "\n\n";
+	}
+};
+
+#endif //TRISK_CACHE_HPP
@@ -0,0 +1,664 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_CFG_HPP
+#define TRISK_CFG_HPP
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <set>
+#include <utility>
+
+#include "isa.hpp"
+
+/*
+ * Static control flow graph recovery for a 256 byte TRISK image.
+ *
+ * Instructions are decoded with DECODE_TABLE, i.e. exactly like the emulator decodes them.
+ * Branch targets are mostly loaded into a register with LDI right before the JMP/PCx/CALL that uses them,
+ * so the recovery tracks which registers hold known constants (a tiny constant propagation over the CFG,
+ * merging at join points) and resolves register branches whose target register is known.
+ *
+ * Code that's only reachable through computed addresses (e.g. return addresses pushed with the samples'
+ * software stack convention: LDI C retAddr; ST D C) is found by treating constants that get stored onto the stack
+ * as possible code addresses. Blocks only reached that way are marked speculative.
+ */
+
+//How a basic block ends.
+enum BlockExit : uint8_t
+{
+	BLOCK_FALLTHROUGH,	//Runs into the next block (which is a branch target).
+	BLOCK_HALT,			//HALT, or an opcode that decodes to halt.
+	BLOCK_JUMP,			//Unconditional jump (JMP with a known target, BRA).
+	BLOCK_BRANCH,		//Conditional branch: target + fallthrough.
+	BLOCK_CALL,			//CALL: continues at the fallthrough when the callee returns.
+	BLOCK_RETURN,		//RET
+	BLOCK_INDIRECT		//JMP through a register that doesn't hold a known constant.
+};
+
+inline const char *blockExitName(BlockExit exit)
+{
+	switch (exit)
+	{
+	case BLOCK_FALLTHROUGH:
+		return "fallthrough";
+	case BLOCK_HALT:
+		return "halt";
+	case BLOCK_JUMP:
+		return "jump";
+	case BLOCK_BRANCH:
+		return "branch";
+	case BLOCK_CALL:
+		return "call";
+	case BLOCK_RETURN:
+		return "return";
+	default:
+		return "indirect";
+	}
+}
+
+struct BasicBlock
+{
+	uint8_t start;
+	uint16_t size; //In bytes.
+	std::vector<uint8_t> instructions; //Address of each instruction, in order.
+	BlockExit exit;
+	std::vector<uint8_t> successors;
+	int16_t callee; //Target of the CALL ending this block, -1 if none (or unknown).
+	bool unresolved; //Ends in a register branch/call whose target couldn't be determined.
+	bool speculative; //Only reached through a stored constant, may really be data.
+};
+
+class ControlFlowGraph
+{
+	//Which registers hold known constants at some point in the program.
+	struct RegisterState
+	{
+		uint8_t known; //Bit i set if register i holds a known constant.
+		uint8_t value[NUM_REGISTERS];
+		int16_t origin[NUM_REGISTERS]; //Address of the LDI that loaded the constant, -1 if it was computed.
+
+		RegisterState()
+		{
+			known = 0;
+			for (uint8_t i = 0; i < NUM_REGISTERS; ++i)
+			{
+				value[i] = 0;
+				origin[i] = -1;
+			}
+		}
+
+		bool isKnown(uint8_t reg) const
+		{
+			return (known >> reg) & 1;
+		}
+
+		void set(uint8_t reg, uint8_t v, int16_t from)
+		{
+			known |= 1 << reg;
+			value[reg] = v;
+			origin[reg] = from;
+		}
+
+		void forget(uint8_t reg)
+		{
+			known &= ~(1 << reg);
+			origin[reg] = -1;
+		}
+
+		//Merges other into this one (at a join point). Returns true if this changed.
+		bool meet(const RegisterState &other)
+		{
+			bool changed = false;
+			for (uint8_t i = 0; i < NUM_REGISTERS; ++i)
+			{
+				if (!isKnown(i))
+				{
+					continue;
+				}
+
+				if (!other.isKnown(i) || other.value[i] != value[i])
+				{
+					forget(i);
+					changed = true;
+				}
+				else if (other.origin[i] != origin[i] && origin[i] != -1)
+				{
+					origin[i] = -1;
+					changed = true;
+				}
+			}
+
+			return changed;
+		}
+	};
+
+	//What the analysis knows about each address.
+	struct Site
+	{
+		bool reached;
+		bool speculative;
+		RegisterState state; //On entry to the instruction.
+	};
+
+	const uint8_t *image;
+	Site sites[RAM_SIZE];
+
+public:
+	std::map<uint8_t, BasicBlock> blocks; //Keyed by start address.
+	std::set<uint8_t> code_pointer_loads; //Addresses of LDIs whose constant is used as a code address.
+	std::set<uint8_t> overlaps; //Instruction starts that fall inside another instruction's immediate byte.
+	bool instruction_start[RAM_SIZE];
+	bool leader[RAM_SIZE];
+
+	ControlFlowGraph()
+	{
+		image = nullptr;
+	}
+
+	const DecodedInstruction &decode(uint8_t address) const
+	{
+		return DECODE_TABLE[image[address]];
+	}
+
+	//The immediate byte of the instruction at address.
+	uint8_t immediate(uint8_t address) const
+	{
+		return image[static_cast<uint8_t>(address + 1)];
+	}
+
+	//Target of the relative branch at address.
+	uint8_t relativeTarget(uint8_t address) const
+	{
+		return address + 2 + static_cast<int8_t>(immediate(address));
+	}
+
+	bool isCode(uint8_t address) const
+	{
+		return sites[address].reached;
+	}
+
+	bool isSpeculative(uint8_t address) const
+	{
+		return sites[address].speculative;
+	}
+
+	//The constant register reg is known to hold on entry to the instruction at address. Returns false if it isn't known.
+	bool registerValue(uint8_t address, uint8_t reg, uint8_t &value) const
+	{
+		if (!sites[address].reached || !sites[address].state.isKnown(reg))
+		{
+			return false;
+		}
+
+		value = sites[address].state.value[reg];
+		return true;
+	}
+
+	void build(const uint8_t *program)
+	{
+		image = program;
+		blocks.clear();
+		code_pointer_loads.clear();
+		overlaps.clear();
+
+		for (uint16_t i = 0; i < RAM_SIZE; ++i)
+		{
+			sites[i] = Site { false, false, RegisterState() };
+			instruction_start[i] = false;
+			leader[i] = false;
+		}
+
+		//Everything reachable from the entry point (and the subroutines it CALLs).
+		std::set<uint8_t> candidates;
+		leader[0] = true;
+		propagate(0, RegisterState(), false, candidates);
+		propagateCallees(candidates);
+
+		//Then everything reachable from stored constants that could be code addresses.
+		while (!candidates.empty())
+		{
+			uint8_t candidate = *candidates.begin();
+			candidates.erase(candidates.begin());
+
+			//Already known code is left alone: the constant is more likely data that happens to match an address.
+			if (sites[candidate].reached || insideInstruction(candidate) || !looksLikeCode(candidate))
+			{
+				continue;
+			}
+
+			leader[candidate] = true;
+			speculative_roots.insert(candidate);
+			propagate(candidate, RegisterState(), true, candidates);
+			propagateCallees(candidates);
+		}
+
+		//Every join point is a branch/call target or a fallthrough after a branch, so it's already a leader.
+		formBlocks();
+	}
+
+private:
+	//True if address is the immediate byte of a reached instruction.
+	bool insideInstruction(uint8_t address) const
+	{
+		uint8_t previous = address - 1;
+		return sites[previous].reached && decode(previous).size > 1;
+	}
+
+	/*
+	 * Sanity check for addresses only found as stored constants: the bytes from there to the next control transfer
+	 * must decode to real instructions, without NOPs (zeroed data) or unused opcodes, and without wrapping around.
+	 */
+	bool looksLikeCode(uint8_t address) const
+	{
+		for (uint16_t a = address; a < RAM_SIZE; a += decode(a).size)
+		{
+			const DecodedInstruction &d = decode(a);
+			if (sites[a].reached)
+			{
+				return true;
+			}
+			if (d.operation == OP_NOP || (d.operation == OP_HALT && image[a] != encodeInstruction(INSTRUCTION_SET[OP_HALT], 0, 0)))
+			{
+				return false;
+			}
+			if (a + d.size > RAM_SIZE)
+			{
+				return false;
+			}
+
+			switch (d.operation)
+			{
+			case OP_HALT:
+			case OP_RET:
+			case OP_JMP:
+			case OP_BRA:
+				return true;
+			default:
+				break;
+			}
+		}
+
+		return false;
+	}
+
+	//Analyzes the targets of CALLs found so far. Callees are as speculative as their (first) caller.
+	void propagateCallees(std::set<uint8_t> &candidates)
+	{
+		while (!callees.empty())
+		{
+			std::pair<uint8_t, bool> callee = callees.back();
+			callees.pop_back();
+
+			if (!sites[callee.first].reached)
+			{
+				propagate(callee.first, RegisterState(), callee.second, candidates);
+			}
+		}
+	}
+
+	//Constant propagation & reachability, starting at entry with state.
+	void propagate(uint8_t entry, const RegisterState &entry_state, bool speculative, std::set<uint8_t> &candidates)
+	{
+		std::vector<uint8_t> worklist;
+		visit(entry, entry_state, speculative, worklist);
+
+		while (!worklist.empty())
+		{
+			uint8_t address = worklist.back();
+			worklist.pop_back();
+
+			RegisterState state = sites[address].state;
+			std::vector<uint8_t> targets;
+			analyzeInstruction(address, state, targets, candidates);
+
+			for (uint8_t target : targets)
+			{
+				visit(target, state, speculative, worklist);
+			}
+		}
+	}
+
+	//Merges state into the site at address, queueing it if anything changed.
+	void visit(uint8_t address, const RegisterState &state, bool speculative, std::vector<uint8_t> &worklist)
+	{
+		Site &site = sites[address];
+
+		if (!site.reached)
+		{
+			site.reached = true;
+			site.speculative = speculative;
+			site.state = state;
+			instruction_start[address] = true;
+			if (decode(address).size > 1 && sites[static_cast<uint8_t>(address + 1)].reached)
+			{
+				overlaps.insert(address + 1);
+			}
+			if (insideInstruction(address))
+			{
+				overlaps.insert(address);
+			}
+			worklist.push_back(address);
+		}
+		else if (site.state.meet(state))
+		{
+			worklist.push_back(address);
+		}
+	}
+
+	//Uses the constant in reg as a code address. Returns false if it isn't known.
+	bool useAsCodeAddress(const RegisterState &state, uint8_t reg, uint8_t &target)
+	{
+		if (!state.isKnown(reg))
+		{
+			return false;
+		}
+
+		target = state.value[reg];
+		if (state.origin[reg] != -1)
+		{
+			code_pointer_loads.insert(state.origin[reg]);
+		}
+		leader[target] = true;
+		return true;
+	}
+
+	/*
+	 * Applies the instruction at address to state, and lists where execution can go next.
+	 * Constants stored to memory are added to candidates.
+	 */
+	void analyzeInstruction(uint8_t address, RegisterState &state, std::vector<uint8_t> &targets, std::set<uint8_t> &candidates)
+	{
+		const DecodedInstruction &d = decode(address);
+		uint8_t next = address + d.size;
+		uint8_t target = 0;
+
+		switch (d.operation)
+		{
+		case OP_HALT:
+		case OP_RET:
+			state.forget(STACK_POINTER);
+			return;
+
+		case OP_JMP:
+			if (useAsCodeAddress(state, d.x, target))
+			{
+				targets.push_back(target);
+			}
+			return;
+
+		case OP_PCL:
+		case OP_PCO:
+		case OP_PCS:
+		case OP_PCC:
+		case OP_PCZ:
+			if (useAsCodeAddress(state, d.x, target))
+			{
+				targets.push_back(target);
+			}
+			leader[next] = true;
+			targets.push_back(next);
+			return;
+
+		case OP_BRA:
+			target = relativeTarget(address);
+			leader[target] = true;
+			targets.push_back(target);
+			return;
+
+		case OP_BZ:
+		case OP_BNZ:
+		case OP_BC:
+		case OP_BNC:
+		case OP_BS:
+		case OP_BO:
+		case OP_BL:
+			target = relativeTarget(address);
+			leader[target] = true;
+			leader[next] = true;
+			targets.push_back(target);
+			targets.push_back(next);
+			return;
+
+		case OP_CALL:
+			//The callee is analyzed from scratch, registers passed in are arguments, not constants.
+			if (useAsCodeAddress(state, d.x, target))
+			{
+				callees.push_back(std::make_pair(target, sites[address].speculative));
+			}
+			state.forget(STACK_POINTER);
+			leader[next] = true;
+			targets.push_back(next);
+			return;
+
+		case OP_LDI:
+			state.set(d.x, immediate(address), address);
+			break;
+
+		case OP_SET:
+			if (state.isKnown(d.y))
+			{
+				state.set(d.x, state.value[d.y], state.origin[d.y]);
+			}
+			else
+			{
+				state.forget(d.x);
+			}
+			break;
+
+		case OP_ADD:
+		case OP_SUB:
+			if (state.isKnown(d.x) && state.isKnown(d.y))
+			{
+				uint8_t v = (d.operation == OP_ADD) ? state.value[d.x] + state.value[d.y] : state.value[d.x] - state.value[d.y];
+				state.set(d.x, v, -1);
+			}
+			else
+			{
+				state.forget(d.x);
+			}
+			break;
+
+		case OP_ADDI:
+		case OP_SUBI:
+			if (state.isKnown(d.x))
+			{
+				uint8_t v = (d.operation == OP_ADDI) ? state.value[d.x] + immediate(address) : state.value[d.x] - immediate(address);
+				state.set(d.x, v, -1);
+			}
+			break;
+
+		case OP_ST:
+			//Only stores onto the stack (the software CALL convention pushes return addresses that way).
+			if (d.x == STACK_POINTER && state.isKnown(d.y))
+			{
+				uint8_t value = state.value[d.y];
+				if (state.origin[d.y] != -1)
+				{
+					//Might be a return address. Only counts as a code pointer if it does turn out to be code.
+					pending_pointer_loads[value].insert(state.origin[d.y]);
+				}
+				candidates.insert(value);
+			}
+			break;
+
+		case OP_PUSH:
+			if (state.isKnown(d.x))
+			{
+				candidates.insert(state.value[d.x]);
+			}
+			state.forget(STACK_POINTER);
+			break;
+
+		case OP_POP:
+			state.forget(d.x);
+			state.forget(STACK_POINTER);
+			break;
+
+		case OP_MUL:
+			state.forget(d.x);
+			state.forget(d.y);
+			break;
+
+		case OP_MCPY:
+		case OP_MSET:
+		case OP_MSCAN:
+		case OP_MCMP:
+			state.forget(BLOCK_POINTER);
+			state.forget(BLOCK_VALUE);
+			state.forget(BLOCK_COUNT);
+			break;
+
+		case OP_LD:
+		case OP_RSHIFT:
+		case OP_LSHIFT:
+		case OP_NOT:
+		case OP_AND:
+		case OP_OR:
+			state.forget(d.x);
+			break;
+
+		default:
+			//NOP, CMP, CMPI: no register changes.
+			break;
+		}
+
+		targets.push_back(next);
+	}
+
+	std::vector<std::pair<uint8_t, bool> > callees; //CALL targets waiting to be analyzed, and if they're speculative.
+
+	//LDIs whose constant was stored to memory, keyed by the constant. Code pointers if the constant turns out to be code.
+	std::map<uint8_t, std::set<uint8_t> > pending_pointer_loads;
+	std::set<uint8_t> speculative_roots; //Stored constants that were followed as code.
+
+	void formBlocks()
+	{
+		for (std::map<uint8_t, std::set<uint8_t> >::iterator i = pending_pointer_loads.begin(); i != pending_pointer_loads.end(); ++i)
+		{
+			if (speculative_roots.count(i->first))
+			{
+				code_pointer_loads.insert(i->second.begin(), i->second.end());
+			}
+		}
+		pending_pointer_loads.clear();
+		speculative_roots.clear();
+
+		for (uint16_t start = 0; start < RAM_SIZE; ++start)
+		{
+			if (!leader[start] || !sites[start].reached)
+			{
+				continue;
+			}
+
+			BasicBlock block;
+			block.start = start;
+			block.size = 0;
+			block.exit = BLOCK_FALLTHROUGH;
+			block.callee = -1;
+			block.unresolved = false;
+			block.speculative = sites[start].speculative;
+
+			uint8_t address = start;
+			while (true)
+			{
+				const DecodedInstruction &d = decode(address);
+				block.instructions.push_back(address);
+				block.size += d.size;
+
+				RegisterState state = sites[address].state;
+				uint8_t next = address + d.size;
+				bool ends = true;
+
+				switch (d.operation)
+				{
+				case OP_HALT:
+					block.exit = BLOCK_HALT;
+					break;
+				case OP_RET:
+					block.exit = BLOCK_RETURN;
+					break;
+				case OP_JMP:
+					if (state.isKnown(d.x))
+					{
+						block.exit = BLOCK_JUMP;
+						block.successors.push_back(state.value[d.x]);
+					}
+					else
+					{
+						block.exit = BLOCK_INDIRECT;
+						block.unresolved = true;
+					}
+					break;
+				case OP_PCL:
+				case OP_PCO:
+				case OP_PCS:
+				case OP_PCC:
+				case OP_PCZ:
+					block.exit = BLOCK_BRANCH;
+					if (state.isKnown(d.x))
+					{
+						block.successors.push_back(state.value[d.x]);
+					}
+					else
+					{
+						block.unresolved = true;
+					}
+					block.successors.push_back(next);
+					break;
+				case OP_BRA:
+					block.exit = BLOCK_JUMP;
+					block.successors.push_back(relativeTarget(address));
+					break;
+				case OP_BZ:
+				case OP_BNZ:
+				case OP_BC:
+				case OP_BNC:
+				case OP_BS:
+				case OP_BO:
+				case OP_BL:
+					block.exit = BLOCK_BRANCH;
+					block.successors.push_back(relativeTarget(address));
+					block.successors.push_back(next);
+					break;
+				case OP_CALL:
+					block.exit = BLOCK_CALL;
+					if (state.isKnown(d.x))
+					{
+						block.callee = state.value[d.x];
+					}
+					else
+					{
+						block.unresolved = true;
+					}
+					block.successors.push_back(next);
+					break;
+				default:
+					ends = false;
+					break;
+				}
+
+				if (ends)
+				{
+					break;
+				}
+
+				//Runs into another block (or off into unreached bytes, which shouldn't happen).
+				if (leader[next] || !sites[next].reached || next == start)
+				{
+					if (sites[next].reached)
+					{
+						block.successors.push_back(next);
+					}
+					break;
+				}
+
+				address = next;
+			}
+
+			blocks[start] = block;
+		}
+	}
+};
+
+#endif //TRISK_CFG_HPP
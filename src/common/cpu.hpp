@@ -0,0 +1,1324 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_CPU_HPP
+#define TRISK_CPU_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <type_traits>
+
+#include "isa.hpp"
+#include "blockops.hpp"
+#include "symbolmap.hpp"
+#include "instrumentation.hpp"
+#include "profile.hpp"
+#include "memo.hpp"
+
+//Bitwise functions:
+inline uint8_t setBit(uint8_t number, uint8_t bit, uint8_t value)
+{
+	return (number ^= (-value ^ number) & (1 << bit));
+}
+
+inline bool checkBit(uint8_t number, uint8_t bit)
+{
+	return ((number >> bit) & 1);
+}
+
+//CPU Components
+class RegBank
+{
+private:
+	uint8_t registers[NUM_REGISTERS];
+
+public:
+	RegBank()
+	{
+		for (uint8_t i = 0; i < NUM_REGISTERS; ++i)
+		{
+			registers[i] = 0x00;
+		}
+	}
+
+	//No bounds check: register operands are 2-bit fields, which always fit.
+	uint8_t getRegister(uint8_t x) const
+	{
+		return registers[x];
+	}
+
+	void setRegister(uint8_t x, uint8_t value)
+	{
+		registers[x] = value;
+	}
+};
+
+template <uint8_t AddressBits = ADDRESS_BITS>
+class RAM
+{
+public:
+	//Exactly AddressBits wide, so every address is in range without a mask or a bounds check.
+	typedef typename std::conditional<(AddressBits == 8), uint8_t, uint16_t>::type address_t;
+
+	static const uint32_t SIZE = 1 << AddressBits;
+
+	static_assert(AddressBits == 8 || AddressBits == 16, "Addresses are 8 or 16 bits wide.");
+
+private:
+	uint8_t memory[SIZE];
+
+public:
+	RAM()
+	{
+		for (uint32_t i = 0; i < SIZE; ++i)
+		{
+			memory[i] = 0x00;
+		}
+	}
+
+	//Returns ith byte in RAM.
+	uint8_t getByte(address_t i) const
+	{
+		return memory[i];
+	}
+
+	void setByte(address_t i, uint8_t value)
+	{
+		memory[i] = value;
+		//std::cout << "Set byte " << static_cast<uint16_t>(i) << " to " << static_cast<uint16_t>(value) <<  "\n";
+	}
+
+	//Backing array, for the block memory instructions.
+	uint8_t *getMemory()
+	{
+		return memory;
+	}
+
+	bool loadFromFileObject(std::ifstream &file)
+	{
+		if (!file)
+		{
+			return false;
+		}
+
+		std::streampos end;
+		file.seekg(0, std::ios::end);
+		end = file.tellg();
+		if (end < RAM_SIZE)
+		{
+			std::cout << "Error: Input RAM file is too short!\n";
+			return false;
+		}
+
+		if (end > SIZE)
+		{
+			std::cout << "Warning: RAM file is too big! Program may not function as you expect.\n";
+		}
+
+		file.seekg(0, std::ios::beg);
+
+		//A standard image only fills the start of a wider RAM, the rest stays zeroed.
+		std::streamsize size = std::min<std::streamsize>(end, SIZE);
+		if (!file.read(reinterpret_cast<char* >(memory), size))
+		{
+			std::cout << "Error: Unknown error in reading RAM.\n";
+			return false;
+		}
+
+		return true;
+	}
+
+	//Image of exactly SIZE bytes, e.g. straight out of a mapped archive.
+	void loadFromMemory(const uint8_t *image)
+	{
+		std::memcpy(memory, image, SIZE);
+	}
+
+	void writeOutToMemory(uint8_t *image) const
+	{
+		std::memcpy(image, memory, SIZE);
+	}
+
+	bool writeOutToFileObject(std::ofstream &file)
+	{
+		file.write(reinterpret_cast<char* >(memory), SIZE);
+
+		return true;
+	}
+};
+
+class ALU
+{
+	uint8_t flags; //Only first 5 bits are used.
+
+public:
+	ALU()
+	{
+		flags = 0x00;
+	}
+
+	/*
+	 * Each flag parameter is input as a bit.
+	 * Parameters:
+	 * * c = carry flag
+	 * * z = zero flag
+	 * * s = sign flag
+	 * * o = overflow flag
+	 * * l = L flag
+	 */
+	void setFlags(uint8_t c, uint8_t z, uint8_t s, uint8_t o, uint8_t l)
+	{
+		flags = 0x00;
+		flags = setBit(flags, 4, c);
+		flags = setBit(flags, 3, z);
+		flags = setBit(flags, 2, s);
+		flags = setBit(flags, 1, o);
+		flags = setBit(flags, 0, l);
+	}
+
+	//All of them, as C Z S O L in bits 4 - 0.
+	uint8_t getFlags() const
+	{
+		return flags;
+	}
+
+	bool getCFlag() const
+	{
+		return checkBit(flags, 4);
+	}
+
+	bool getZFlag() const
+	{
+		return checkBit(flags, 3);
+	}
+
+	bool getSFlag() const
+	{
+		return checkBit(flags, 2);
+	}
+
+	bool getOFlag() const
+	{
+		return checkBit(flags, 1);
+	}
+
+	bool getLFlag() const
+	{
+		return checkBit(flags, 0);
+	}
+
+	uint8_t add(uint8_t x, uint8_t y, bool cin = false)
+	{
+		uint8_t sum = x + y;
+
+		//Flags
+		bool c = (sum < x) ? 1 : 0;
+		bool z = (sum == 0x00) ? 1 : 0;
+		bool s = checkBit(sum, 7); //Most significant bit.
+		bool s1 = checkBit(x, 7);
+		bool s2 = checkBit(y, 7);
+		bool o = ((!s1 && !s2 && s) || (s1 && s2 && !s)); //For addition: (!S1 && !S2 && !Sout) || (S1 && S2 && Sout )
+		bool l = (s != o); //Sout XOR Oout
+
+		setFlags(c, z, s, o, l);
+
+		return sum;
+	}
+
+	uint8_t sub(uint8_t x, uint8_t y, bool cin = false)
+	{
+		uint8_t diff = x - y;
+
+		//Flags
+		bool c = (diff > x) ? 1 : 0; //I think this is right.
+		bool z = (diff == 0x00) ? 1 : 0;
+		bool s = checkBit(diff, 7); //Most significant bit.
+		bool s1 = checkBit(x, 7);
+		bool s2 = checkBit(y, 7);
+		bool o = ((!s1 && s2 && s) || (s1 && !s2 && !s)); //For subtraction: ((!S1 && S2 && Sout) || (S1 && !S2 && !Sout))
+		bool l = (s != o); //Sout XOR Oout
+
+		setFlags(c, z, s, o, l);
+
+		return diff;
+	}
+
+	uint8_t bitwiseNot(uint8_t x, bool cin = false)
+	{
+		x = ~x;
+
+		//Flags
+		bool c = 0;
+		bool z = (x == 0x00) ? 1 : 0;
+		bool s = checkBit(x, 7); //Most significant bit.
+		bool o = 0;
+		bool l = (s != o); //Sout XOR Oout
+
+		setFlags(c, z, s, o, l);
+
+		return x;
+	}
+
+	uint8_t bitwiseRightShift(uint8_t x, uint8_t count, bool cin = false)
+	{
+		x = (count < 8) ? x >> count : 0x00;
+
+		//Only z & c flag can change.
+		bool z = (x == 0x00) ? 1 : 0;
+		bool s = checkBit(x, 7); //Most significant bit.
+
+		//o, c, l = input.
+		bool c = getCFlag();
+		bool o = getOFlag();
+		bool l = getLFlag();
+
+		setFlags(c, z, s, o, l);
+
+		return x;
+	}
+
+	uint8_t bitwiseLeftShift(uint8_t x, uint8_t count, bool cin = false)
+	{
+		//c = last bit shifted out. Unchanged if nothing was shifted.
+		bool c = getCFlag();
+		if (count > 0)
+		{
+			c = (count <= 8) ? checkBit(x, 8 - count) : 0;
+		}
+
+		x = (count < 8) ? static_cast<uint8_t>(x << count) : 0x00;
+
+		bool z = (x == 0x00) ? 1 : 0;
+		bool s = checkBit(x, 7); //Most significant bit.
+
+		//o, l = input.
+		bool o = getOFlag();
+		bool l = getLFlag();
+
+		setFlags(c, z, s, o, l);
+
+		return x;
+	}
+
+	//Returns the low byte of x * y, the high byte goes in high.
+	uint8_t multiply(uint8_t x, uint8_t y, uint8_t &high, bool cin = false)
+	{
+		uint16_t product = static_cast<uint16_t>(x) * y;
+		uint8_t low = product & 0xFF;
+		high = product >> 8;
+
+		//Flags
+		bool c = (high != 0x00) ? 1 : 0; //Result didn't fit in the low byte.
+		bool z = (low == 0x00) ? 1 : 0;
+		bool s = checkBit(low, 7); //Most significant bit.
+		bool o = c;
+		bool l = (s != o); //Sout XOR Oout
+
+		setFlags(c, z, s, o, l);
+
+		return low;
+	}
+
+	uint8_t bitwiseAnd(uint8_t x, uint8_t y, bool cin = false)
+	{
+		x &= y;
+
+		//Only z & c flag can change.
+		bool z = (x == 0x00) ? 1 : 0;
+		bool s = checkBit(x, 7); //Most significant bit.
+
+		//o, c, l = input.
+		bool c = getCFlag();
+		bool o = getOFlag();
+		bool l = getLFlag();
+
+		setFlags(c, z, s, o, l);
+
+		return x;
+	}
+
+	uint8_t bitwiseOr(uint8_t x, uint8_t y, bool cin = false)
+	{
+		x |= y;
+
+		//Only z & c flag can change.
+		bool z = (x == 0x00) ? 1 : 0;
+		bool s = checkBit(x, 7); //Most significant bit.
+
+		//o, c, l = input.
+		bool c = getCFlag();
+		bool o = getOFlag();
+		bool l = getLFlag();
+
+		setFlags(c, z, s, o, l);
+
+		return x;
+	}
+};
+
+/*
+ * Memory model that does nothing. The CPU tells its memory model about every access the program makes
+ * (see CPU::fetchByte() & co), which with this one all compiles away.
+ * For one that simulates caches, see CachedMemory in cache.hpp.
+ */
+struct FlatMemory
+{
+	void onFetch(uint32_t) { }
+	void onLoad(uint32_t) { }
+	void onStore(uint32_t) { }
+	void onLoadBlock(uint8_t, uint16_t) { }
+	void onStoreBlock(uint8_t, uint16_t) { }
+};
+
+/*
+ * The machine is a template over its address width, so hardware variants can be evaluated without forking the emulator.
+ * AddressBits = 8 is the standard 256 byte TRISK. With 16, RAM is 64 KiB and the PC is 16 bits wide:
+ * * Execution & relative branches carry on across 256 byte pages, so code can be anywhere in RAM.
+ * * JMP, PCL & co. and CALL go to the register's address in the page the PC is in.
+ * * CALL pushes the whole return address (low byte at the lower address), and RET pops both bytes.
+ * * Data (LD, ST, the stack & block instructions) is in the first 256 bytes, which 8-bit registers can point to.
+ * The encoding is the same, so standard images run unchanged, apart from CALL & RET taking 2 bytes of stack.
+ * Registers are 8 bits & register operands 2-bit fields either way, so the number of registers is fixed.
+ */
+template <class MemoryModel = FlatMemory, class Instrumentation = NoInstrumentation, uint8_t AddressBits = ADDRESS_BITS>
+class CPU
+{
+public:
+	typedef RAM<AddressBits> RAMType;
+	typedef typename RAMType::address_t address_t;
+
+	//Profiles & the subroutine cache only know the standard machine. Memory models take any address.
+	static_assert(AddressBits == ADDRESS_BITS || std::is_same<Instrumentation, NoInstrumentation>::value, "Instrumentation needs the standard address width.");
+
+	static const uint64_t LIMIT_CHECK_INTERVAL = 4096; //How many instructions to execute between checks of the run limits.
+	typedef void(CPU::*CPUFunctionPointer)(uint8_t, uint8_t);
+
+	enum RunResult
+	{
+		RUN_HALTED,
+		RUN_INSTRUCTION_LIMIT,
+		RUN_TIMEOUT
+	};
+
+	bool running;
+
+	const SymbolMap *symbols; //Debug symbols to describe addresses with, if any.
+
+private:
+	RegBank &regbank;
+	RAMType &ram;
+	ALU &alu;
+
+	address_t program_counter; //Don't forget to increment after (almost) every instruction!
+	uint8_t instruction;
+
+	uint64_t instruction_count;
+	uint64_t elapsed_ms;
+
+	MemoryModel memory_model;
+	Instrumentation instrumentation;
+
+	//All memory accesses made by the program go through these, so the memory model sees them.
+	//So does the instrumentation.
+	uint8_t fetchByte(address_t address)
+	{
+		memory_model.onFetch(address);
+		instrumentation.onFetch(address, ram.getByte(address));
+		return ram.getByte(address);
+	}
+
+	uint8_t loadByte(uint8_t address)
+	{
+		memory_model.onLoad(address);
+		instrumentation.onLoad(address, ram.getByte(address));
+		return ram.getByte(address);
+	}
+
+	void storeByte(uint8_t address, uint8_t value)
+	{
+		memory_model.onStore(address);
+		instrumentation.onStore(address);
+		ram.setByte(address, value);
+	}
+
+	//Block instructions' accesses, for the memory model & instrumentation. Loads have to be reported before the block is written.
+	void loadBlock(uint8_t start, uint16_t count)
+	{
+		memory_model.onLoadBlock(start, count);
+		instrumentation.onLoadBlock(ram.getMemory(), start, count);
+	}
+
+	void storeBlock(uint8_t start, uint16_t count)
+	{
+		memory_model.onStoreBlock(start, count);
+		instrumentation.onStoreBlock(start, count);
+	}
+
+	//Where JMP, PCL & co. and CALL to register x go: the same page as the PC (always page 0 on the standard machine).
+	address_t jumpTarget(uint8_t x) const
+	{
+		return static_cast<address_t>((program_counter & (RAMType::SIZE - RAM_SIZE)) | regbank.getRegister(x));
+	}
+
+	//CPU opcodes function pointers.
+	//Could probably have used functors instead. Meh.
+
+	//0x00 0000_0000 -- nop
+	void opNop(uint8_t, uint8_t)
+	{
+		std::cout << "No op.\n";
+
+		++program_counter;
+	}
+
+	//0x01 0000_0001 -- halt
+	void opHalt(uint8_t, uint8_t)
+	{
+		std::cout << "[opHalt()] Halted.\n";
+
+		running = false; //It's really that simple.
+		//Do not increment program counter.
+	}
+
+	//0x5? 0101_xxyy -- x = y
+	void opAssignDirect(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opAssignDirect()] Assign reg to reg (" << static_cast<uint16_t>(x) << ", " << static_cast<uint16_t>(y) << ")\n"; //Casting because uint8_t = char.
+
+		regbank.setRegister(x, regbank.getRegister(y));
+		++program_counter;
+	}
+
+	//0x6? 0110_00xx -- PC = x iff L=1
+	void opPCL(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opPCL()] PC = value of register " << static_cast<uint16_t>(x) << " iff L = 1\n";
+
+		if (alu.getLFlag())
+		{
+			program_counter = jumpTarget(x);
+		}
+		else
+		{
+			++program_counter;
+		}
+	}
+
+	//0x6? 0110_01xx -- PC = x iff O=1
+	void opPCO(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opPCO()] PC = value of register " << static_cast<uint16_t>(x) << " iff O = 1\n";
+
+		if (alu.getOFlag())
+		{
+			program_counter = jumpTarget(x);
+		}
+		else
+		{
+			++program_counter;
+		}
+	}
+
+	//0x6? 0110_10xx -- PC = x iff S=1
+	void opPCS(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opPCS()] PC = value of register " << static_cast<uint16_t>(x) << " iff S = 1\n";
+
+		if (alu.getSFlag())
+		{
+			program_counter = jumpTarget(x);
+		}
+		else
+		{
+			++program_counter;
+		}
+	}
+
+	//0x6? 0110_11xx -- X = (*(PC++))
+	void opLDI(uint8_t x, uint8_t y)
+	{
+		uint8_t value = fetchByte(++program_counter);
+
+		std::cout << "[opLDI()] Register " << static_cast<uint16_t>(x) << " = 0x" << std::hex << static_cast<uint16_t>(value) << std::dec << ".\n";
+
+		regbank.setRegister(x, value);
+		++program_counter;
+	}
+
+	//0x7? 0111_xxyy -- x = *y
+	void opLD(uint8_t x, uint8_t y)
+	{
+		uint8_t value = loadByte(regbank.getRegister(y));
+
+		std::cout << "[opLD()] Register " << static_cast<uint16_t>(x) << " = LD register " << static_cast<uint16_t>(y) << " (0x" << std::hex << static_cast<uint16_t>(value) << std::dec << ").\n";
+
+		regbank.setRegister(x, value);
+		++program_counter;
+	}
+
+	//0x8? 1000_xxyy -- x += y
+	void opAdd(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opADD()] Register " << static_cast<uint16_t>(x) << " += register " << static_cast<uint16_t>(y);
+
+		regbank.setRegister(x, alu.add(regbank.getRegister(x), regbank.getRegister(y), false));
+
+		std::cout << " (result: 0x" << static_cast<uint16_t>(regbank.getRegister(x)) << ").\n";
+
+		++program_counter;
+	}
+
+	//0x9? 1001_xxyy -- x -= y
+	void opSub(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opSUB()] Register " << static_cast<uint16_t>(x) << " -= register " << static_cast<uint16_t>(y) << ". Result: (0x";
+
+		regbank.setRegister(x, alu.sub(regbank.getRegister(x), regbank.getRegister(y), false));
+		++program_counter;
+
+		 std::cout << std::hex << static_cast<uint16_t>(regbank.getRegister(x)) << std::dec << ")\n";
+	}
+
+	//0xA? 1010_xxyy -- x >>= y
+	void opRightShift(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opRightShift()] Register " << static_cast<uint16_t>(x) << " >>= register " << static_cast<uint16_t>(y) << ".";
+
+		regbank.setRegister(x, alu.bitwiseRightShift(regbank.getRegister(x), regbank.getRegister(y), false));
+
+		std::cout << " (result : 0x" << static_cast<uint16_t>(regbank.getRegister(x)) << ")\n";
+
+		++program_counter;
+	}
+
+	//0x2? 0010_xxyy -- x <<= y
+	void opLeftShift(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opLeftShift()] Register " << static_cast<uint16_t>(x) << " <<= register " << static_cast<uint16_t>(y) << ".";
+
+		regbank.setRegister(x, alu.bitwiseLeftShift(regbank.getRegister(x), regbank.getRegister(y), false));
+
+		std::cout << " (result : 0x" << std::hex << static_cast<uint16_t>(regbank.getRegister(x)) << std::dec << ")\n";
+
+		++program_counter;
+	}
+
+	//0x3? 0011_xxyy -- y:x = x * y
+	void opMultiply(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opMultiply()] Register " << static_cast<uint16_t>(y) << ":register " << static_cast<uint16_t>(x) << " = register " << static_cast<uint16_t>(x) << " * register " << static_cast<uint16_t>(y) << ".";
+
+		uint8_t high;
+		uint8_t low = alu.multiply(regbank.getRegister(x), regbank.getRegister(y), high, false);
+
+		//High byte first, so MUL X X leaves the low byte in X.
+		regbank.setRegister(y, high);
+		regbank.setRegister(x, low);
+
+		std::cout << " (result : 0x" << std::hex << static_cast<uint16_t>(high) << ":0x" << static_cast<uint16_t>(low) << std::dec << ")\n";
+
+		++program_counter;
+	}
+
+	//0x4? 0100_00xx -- x += (*(PC++))
+	void opAddImmediate(uint8_t x, uint8_t y)
+	{
+		uint8_t value = fetchByte(program_counter + 1);
+
+		std::cout << "[opADDI()] Register " << static_cast<uint16_t>(x) << " += 0x" << std::hex << static_cast<uint16_t>(value);
+
+		regbank.setRegister(x, alu.add(regbank.getRegister(x), value, false));
+
+		std::cout << " (result: 0x" << static_cast<uint16_t>(regbank.getRegister(x)) << std::dec << ").\n";
+
+		program_counter += 2;
+	}
+
+	//0x4? 0100_01xx -- x -= (*(PC++))
+	void opSubImmediate(uint8_t x, uint8_t y)
+	{
+		uint8_t value = fetchByte(program_counter + 1);
+
+		std::cout << "[opSUBI()] Register " << static_cast<uint16_t>(x) << " -= 0x" << std::hex << static_cast<uint16_t>(value);
+
+		regbank.setRegister(x, alu.sub(regbank.getRegister(x), value, false));
+
+		std::cout << " (result: 0x" << static_cast<uint16_t>(regbank.getRegister(x)) << std::dec << ").\n";
+
+		program_counter += 2;
+	}
+
+	//0x4? 0100_10xx -- x - (*(PC++)) (no store)
+	void opCMPImmediate(uint8_t x, uint8_t y)
+	{
+		uint8_t value = fetchByte(program_counter + 1);
+
+		std::cout << "[opCMPI()] Register " << static_cast<uint16_t>(x) << " - 0x" << std::hex << static_cast<uint16_t>(value) << std::dec << " (no store).\n";
+
+		alu.sub(regbank.getRegister(x), value, false);
+
+		program_counter += 2;
+	}
+
+	/*
+	 * Relative branches: 0x02 - 0x09, followed by a signed displacement from the next instruction.
+	 * All of them share this.
+	 */
+	void branchIf(const char *name, bool condition)
+	{
+		int8_t displacement = static_cast<int8_t>(fetchByte(program_counter + 1));
+
+		std::cout << "[" << name << "()] PC += " << static_cast<int16_t>(displacement) << " (" << (condition ? "true" : "false") << ")\n";
+
+		program_counter += 2;
+		if (condition)
+		{
+			program_counter += displacement;
+		}
+	}
+
+	//0x02 0000_0010 -- PC += d
+	void opBRA(uint8_t, uint8_t)
+	{
+		branchIf("opBRA", true);
+	}
+
+	//0x03 0000_0011 -- PC += d iff Z=1
+	void opBZ(uint8_t, uint8_t)
+	{
+		branchIf("opBZ", alu.getZFlag());
+	}
+
+	//0x04 0000_0100 -- PC += d iff Z=0
+	void opBNZ(uint8_t, uint8_t)
+	{
+		branchIf("opBNZ", !alu.getZFlag());
+	}
+
+	//0x05 0000_0101 -- PC += d iff C=1
+	void opBC(uint8_t, uint8_t)
+	{
+		branchIf("opBC", alu.getCFlag());
+	}
+
+	//0x06 0000_0110 -- PC += d iff C=0
+	void opBNC(uint8_t, uint8_t)
+	{
+		branchIf("opBNC", !alu.getCFlag());
+	}
+
+	//0x07 0000_0111 -- PC += d iff S=1
+	void opBS(uint8_t, uint8_t)
+	{
+		branchIf("opBS", alu.getSFlag());
+	}
+
+	//0x08 0000_1000 -- PC += d iff O=1
+	void opBO(uint8_t, uint8_t)
+	{
+		branchIf("opBO", alu.getOFlag());
+	}
+
+	//0x09 0000_1001 -- PC += d iff L=1
+	void opBL(uint8_t, uint8_t)
+	{
+		branchIf("opBL", alu.getLFlag());
+	}
+
+	/*
+	 * Block memory instructions. Operands are in registers A (pointer), B (pointer/value) and C (count).
+	 * Addresses wrap around at 256. The actual work is done by the kernels in blockops.hpp.
+	 */
+
+	//0x0C 0000_1100 -- memmove(A, B, C), A += C, B += C, C = 0. Flags unchanged.
+	void opBlockCopy(uint8_t, uint8_t)
+	{
+		uint8_t dst = regbank.getRegister(BLOCK_POINTER);
+		uint8_t src = regbank.getRegister(BLOCK_VALUE);
+		uint8_t count = regbank.getRegister(BLOCK_COUNT);
+
+		std::cout << "[opBlockCopy()] Copy 0x" << std::hex << static_cast<uint16_t>(count) << " bytes from 0x" << static_cast<uint16_t>(src) << " to 0x" << static_cast<uint16_t>(dst) << std::dec << ".\n";
+
+		loadBlock(src, count);
+		storeBlock(dst, count);
+		blockCopy(ram.getMemory(), dst, src, count);
+
+		regbank.setRegister(BLOCK_POINTER, dst + count);
+		regbank.setRegister(BLOCK_VALUE, src + count);
+		regbank.setRegister(BLOCK_COUNT, 0);
+		++program_counter;
+	}
+
+	//0x0D 0000_1101 -- memset(A, B, C), A += C, C = 0. Flags unchanged.
+	void opBlockFill(uint8_t, uint8_t)
+	{
+		uint8_t dst = regbank.getRegister(BLOCK_POINTER);
+		uint8_t value = regbank.getRegister(BLOCK_VALUE);
+		uint8_t count = regbank.getRegister(BLOCK_COUNT);
+
+		std::cout << "[opBlockFill()] Fill 0x" << std::hex << static_cast<uint16_t>(count) << " bytes at 0x" << static_cast<uint16_t>(dst) << " with 0x" << static_cast<uint16_t>(value) << std::dec << ".\n";
+
+		storeBlock(dst, count);
+		blockFill(ram.getMemory(), dst, value, count);
+
+		regbank.setRegister(BLOCK_POINTER, dst + count);
+		regbank.setRegister(BLOCK_COUNT, 0);
+		++program_counter;
+	}
+
+	/*
+	 * 0x0E 0000_1110 -- Scan up to C bytes from A for byte B.
+	 * Found: A = address of the byte, C -= bytes skipped, Z = 1.
+	 * Not found: A += C, C = 0, Z = 0.
+	 * All other flags are cleared.
+	 */
+	void opBlockScan(uint8_t, uint8_t)
+	{
+		uint8_t start = regbank.getRegister(BLOCK_POINTER);
+		uint8_t value = regbank.getRegister(BLOCK_VALUE);
+		uint8_t count = regbank.getRegister(BLOCK_COUNT);
+
+		uint16_t offset = blockScan(ram.getMemory(), start, value, count);
+		bool found = offset < count;
+		loadBlock(start, found ? offset + 1 : count);
+
+		std::cout << "[opBlockScan()] Scan 0x" << std::hex << static_cast<uint16_t>(count) << " bytes at 0x" << static_cast<uint16_t>(start) << " for 0x" << static_cast<uint16_t>(value) << std::dec << " (" << (found ? "found" : "not found") << ")\n";
+
+		regbank.setRegister(BLOCK_POINTER, start + offset);
+		regbank.setRegister(BLOCK_COUNT, count - offset);
+		alu.setFlags(0, found, 0, 0, 0);
+		++program_counter;
+	}
+
+	/*
+	 * 0x0F 0000_1111 -- Compare up to C bytes at A and B.
+	 * Mismatch: A & B = addresses of the differing bytes, C -= bytes skipped, flags = CMP *A *B.
+	 * Equal: A += C, B += C, C = 0, flags = CMP of equal values (Z = 1).
+	 */
+	void opBlockCompare(uint8_t, uint8_t)
+	{
+		uint8_t p1 = regbank.getRegister(BLOCK_POINTER);
+		uint8_t p2 = regbank.getRegister(BLOCK_VALUE);
+		uint8_t count = regbank.getRegister(BLOCK_COUNT);
+
+		uint16_t offset = blockCompare(ram.getMemory(), p1, p2, count);
+		bool equal = offset >= count;
+		loadBlock(p1, equal ? count : offset + 1);
+		loadBlock(p2, equal ? count : offset + 1);
+
+		std::cout << "[opBlockCompare()] Compare 0x" << std::hex << static_cast<uint16_t>(count) << " bytes at 0x" << static_cast<uint16_t>(p1) << " and 0x" << static_cast<uint16_t>(p2) << std::dec << " (" << (equal ? "equal" : "differ") << ")\n";
+
+		regbank.setRegister(BLOCK_POINTER, p1 + offset);
+		regbank.setRegister(BLOCK_VALUE, p2 + offset);
+		regbank.setRegister(BLOCK_COUNT, count - offset);
+		if (equal)
+		{
+			alu.sub(0, 0, false);
+		}
+		else
+		{
+			alu.sub(ram.getByte(static_cast<uint8_t>(p1 + offset)), ram.getByte(static_cast<uint8_t>(p2 + offset)), false);
+		}
+		++program_counter;
+	}
+
+	//0xB? 1011_xx00 -- x = ~x
+	void opBitwiseNot(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opBitwiseNot()] Register " << static_cast<uint16_t>(x) << " = ~register " << static_cast<uint16_t>(x) << ".\n";
+
+		regbank.setRegister(x, alu.bitwiseNot(regbank.getRegister(x), false));
+		++program_counter;
+	}
+
+	//0xB? 1011_xx01 -- PC = x
+	void opJMP(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opJMP()] PC = register " << static_cast<uint16_t>(x) << " (" << std::hex << static_cast<uint16_t>(regbank.getRegister(x)) << std::dec << ").\n";
+
+		program_counter = jumpTarget(x);
+	}
+
+	//0xB? 1011_xx10 -- PC = x iff C=1
+	void opPCC(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opPCC()] PC = value of register " << static_cast<uint16_t>(x) << " iff C = 1\n";
+
+		if (alu.getCFlag())
+		{
+			program_counter = jumpTarget(x);
+		}
+		else
+		{
+			++program_counter;
+		}
+	}
+
+	//0xB? 1011_xx11 -- PC = x iff Z=1
+	void opPCZ(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opPCZ[()] PC = value of register " << static_cast<uint16_t>(x) << " iff Z = 1 (";
+
+
+
+		if (alu.getZFlag())
+		{
+			std::cout << "true";
+			program_counter = jumpTarget(x);
+		}
+		else
+		{
+			std::cout << "false";
+			++program_counter;
+		}
+
+		std::cout << ")\n";
+	}
+
+	//0xC? 1100_xxyy -- x &= y
+	void opBitwiseAnd(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opBitwiseAnd()] Register " << static_cast<uint16_t>(x) << " &= register " << static_cast<uint16_t>(y);
+
+		regbank.setRegister(x, alu.bitwiseAnd(regbank.getRegister(x), regbank.getRegister(y), false));
+
+		std::cout << " (result: 0x" << static_cast<uint16_t>(regbank.getRegister(x)) << ").\n";
+
+		++program_counter;
+	}
+
+	//0xD? 1101_xxyy -- x |= y
+	void opBitwiseOr(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opBitwiseOr()] Register " << static_cast<uint16_t>(x) << " |= register " << static_cast<uint16_t>(y) << ".\n";
+
+		regbank.setRegister(x, alu.bitwiseOr(regbank.getRegister(x), regbank.getRegister(y), false));
+
+		++program_counter;
+	}
+
+	//0xE? 1110_xxyy -- x - y (no store)
+	void opCMP(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opCMP()] Register " << static_cast<uint16_t>(x) << " - register " << static_cast<uint16_t>(y) << " (no store).\n";
+
+		alu.sub(regbank.getRegister(x), regbank.getRegister(y), false);
+		++program_counter;
+	}
+
+	//0xF? 1111_yyxx -- *x = y
+	void opSetRAM(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opSetRAM()] Ram pointed to by register " << static_cast<uint16_t>(x) << " (0x" << std::hex << static_cast<uint16_t>(regbank.getRegister(x)) << std::dec << ") = value of register " << static_cast<uint16_t>(y) << " (0x" << std::hex << static_cast<uint16_t>(regbank.getRegister(y)) << std::dec << ").\n";
+
+		storeByte(regbank.getRegister(x), regbank.getRegister(y));
+		++program_counter;
+	}
+
+	//0x1? 0001_00xx -- *(--D) = x
+	void opPush(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opPush()] Push register " << static_cast<uint16_t>(x) << " (0x" << std::hex << static_cast<uint16_t>(regbank.getRegister(x)) << std::dec << ").\n";
+
+		uint8_t value = regbank.getRegister(x);
+		uint8_t sp = regbank.getRegister(STACK_POINTER) - 1;
+		regbank.setRegister(STACK_POINTER, sp);
+		storeByte(sp, value);
+		++program_counter;
+	}
+
+	//0x1? 0001_01xx -- x = *(D++)
+	void opPop(uint8_t x, uint8_t y)
+	{
+		uint8_t sp = regbank.getRegister(STACK_POINTER);
+		uint8_t value = loadByte(sp);
+
+		std::cout << "[opPop()] Pop into register " << static_cast<uint16_t>(x) << " (0x" << std::hex << static_cast<uint16_t>(value) << std::dec << ").\n";
+
+		regbank.setRegister(STACK_POINTER, sp + 1);
+		regbank.setRegister(x, value);
+		++program_counter;
+	}
+
+	//0x1? 0001_10xx -- *(--D) = PC + 1, PC = x (the return address takes 2 bytes with 16-bit addresses)
+	void opCall(uint8_t x, uint8_t y)
+	{
+		std::cout << "[opCall()] Call register " << static_cast<uint16_t>(x) << " (0x" << std::hex << static_cast<uint16_t>(regbank.getRegister(x)) << std::dec << ").\n";
+
+		address_t target = jumpTarget(x);
+		address_t return_address = program_counter + 1;
+		uint8_t sp = regbank.getRegister(STACK_POINTER) - 1;
+		if constexpr (AddressBits > 8)
+		{
+			--sp;
+			storeByte(sp + 1, return_address >> 8);
+		}
+		regbank.setRegister(STACK_POINTER, sp);
+		storeByte(sp, static_cast<uint8_t>(return_address));
+		program_counter = target;
+	}
+
+	//0x1C 0001_1100 -- PC = *(D++) (2 bytes with 16-bit addresses)
+	void opRet(uint8_t, uint8_t)
+	{
+		uint8_t sp = regbank.getRegister(STACK_POINTER);
+
+		address_t target = loadByte(sp);
+		++sp;
+		if constexpr (AddressBits > 8)
+		{
+			target |= loadByte(sp) << 8;
+			++sp;
+		}
+
+		std::cout << "[opRet()] Return to 0x" << std::hex << static_cast<uint16_t>(target) << std::dec << ".\n";
+
+		program_counter = target;
+		regbank.setRegister(STACK_POINTER, sp);
+	}
+
+	//Subroutine cache (see memo.hpp) hooks, around CALL & RET. Only instantiated for instrumentations with MEMOIZE set.
+
+	//After a CALL: if the cache has seen this call before, applies what it did & returns, instead of running it.
+	void memoizeCall(uint64_t max_instructions)
+	{
+		if (max_instructions && instruction_count >= max_instructions)
+		{
+			return;
+		}
+
+		uint8_t registers[NUM_REGISTERS];
+		for (uint16_t r = 0; r < NUM_REGISTERS; ++r)
+		{
+			registers[r] = regbank.getRegister(r);
+		}
+		uint8_t sp = regbank.getRegister(STACK_POINTER);
+		const SubroutineCache::Call *call = instrumentation.enter(program_counter, registers, NUM_REGISTERS, alu.getFlags(), sp, ram.getMemory(), instruction_count, max_instructions ? max_instructions - instruction_count : 0);
+		if (!call)
+		{
+			return;
+		}
+
+		for (const std::pair<uint32_t, uint8_t> &byte : call->writes)
+		{
+			ram.setByte(byte.first, byte.second);
+		}
+		for (uint16_t r = 0; r < NUM_REGISTERS; ++r)
+		{
+			regbank.setRegister(r, call->registers[r]);
+		}
+		alu.setFlags(checkBit(call->flags, 4), checkBit(call->flags, 3), checkBit(call->flags, 2), checkBit(call->flags, 1), checkBit(call->flags, 0));
+
+		//And its RET.
+		program_counter = ram.getByte(sp);
+		regbank.setRegister(STACK_POINTER, sp + 1);
+		instruction_count += call->instructions;
+
+		std::cout << "[memo] Call answered from the cache, " << call->instructions << " instructions skipped. Return to 0x" << std::hex << static_cast<uint16_t>(program_counter) << std::dec << ".\n";
+	}
+
+	//Before a RET: stores the call it returns from, if it can be.
+	void memoizeReturn()
+	{
+		uint8_t registers[NUM_REGISTERS];
+		for (uint16_t r = 0; r < NUM_REGISTERS; ++r)
+		{
+			registers[r] = regbank.getRegister(r);
+		}
+		instrumentation.leave(regbank.getRegister(STACK_POINTER), registers, NUM_REGISTERS, alu.getFlags(), ram.getMemory(), instruction_count);
+	}
+
+public:
+
+	//Every opcode's implementation, built from DECODE_TABLE (see isa.hpp).
+	CPUFunctionPointer opcodes[NUM_OPCODES];
+
+	CPU() :
+		regbank(*(new RegBank())),
+		ram(*(new RAMType())),
+		alu(*(new ALU()))
+	{
+		running = true;
+		symbols = nullptr;
+
+		program_counter = 0x00;
+		instruction = 0x00;
+
+		instruction_count = 0;
+		elapsed_ms = 0;
+
+		//Implementation of each operation.
+		CPUFunctionPointer operations[NUM_OPERATIONS];
+		operations[OP_NOP] = &CPU::opNop;
+		operations[OP_HALT] = &CPU::opHalt;
+		operations[OP_SET] = &CPU::opAssignDirect;
+		operations[OP_PCL] = &CPU::opPCL;
+		operations[OP_PCO] = &CPU::opPCO;
+		operations[OP_PCS] = &CPU::opPCS;
+		operations[OP_LDI] = &CPU::opLDI;
+		operations[OP_LD] = &CPU::opLD;
+		operations[OP_ADD] = &CPU::opAdd;
+		operations[OP_SUB] = &CPU::opSub;
+		operations[OP_RSHIFT] = &CPU::opRightShift;
+		operations[OP_NOT] = &CPU::opBitwiseNot;
+		operations[OP_JMP] = &CPU::opJMP;
+		operations[OP_PCC] = &CPU::opPCC;
+		operations[OP_PCZ] = &CPU::opPCZ;
+		operations[OP_AND] = &CPU::opBitwiseAnd;
+		operations[OP_OR] = &CPU::opBitwiseOr;
+		operations[OP_CMP] = &CPU::opCMP;
+		operations[OP_ST] = &CPU::opSetRAM;
+		operations[OP_PUSH] = &CPU::opPush;
+		operations[OP_POP] = &CPU::opPop;
+		operations[OP_CALL] = &CPU::opCall;
+		operations[OP_RET] = &CPU::opRet;
+		operations[OP_LSHIFT] = &CPU::opLeftShift;
+		operations[OP_MUL] = &CPU::opMultiply;
+		operations[OP_ADDI] = &CPU::opAddImmediate;
+		operations[OP_SUBI] = &CPU::opSubImmediate;
+		operations[OP_CMPI] = &CPU::opCMPImmediate;
+		operations[OP_BRA] = &CPU::opBRA;
+		operations[OP_BZ] = &CPU::opBZ;
+		operations[OP_BNZ] = &CPU::opBNZ;
+		operations[OP_BC] = &CPU::opBC;
+		operations[OP_BNC] = &CPU::opBNC;
+		operations[OP_BS] = &CPU::opBS;
+		operations[OP_BO] = &CPU::opBO;
+		operations[OP_BL] = &CPU::opBL;
+		operations[OP_MCPY] = &CPU::opBlockCopy;
+		operations[OP_MSET] = &CPU::opBlockFill;
+		operations[OP_MSCAN] = &CPU::opBlockScan;
+		operations[OP_MCMP] = &CPU::opBlockCompare;
+
+		//Opcodes that don't encode anything decode to halt.
+		for (uint16_t i = 0; i < NUM_OPCODES; ++i)
+		{
+			opcodes[i] = operations[DECODE_TABLE[i].operation];
+		}
+	}
+
+	void executeInstruction(uint8_t opcode)
+	{
+		if (!running)
+		{
+			return;
+		}
+
+		if (symbols)
+		{
+			std::cout << symbols->describe(program_counter) << " *** ";
+		}
+		std::cout << "Hex representation: 0x" << std::hex << static_cast<uint16_t>(opcode) << std::dec << " *** ";
+
+		const DecodedInstruction &decoded = DECODE_TABLE[opcode];
+		(this->*opcodes[opcode])(decoded.x, decoded.y);
+	}
+
+	bool validateProgram()
+	{
+		//All it does right now is check to make sure you don't have an empty program (only no-ops).
+
+		for (uint32_t i = 0; i < RAMType::SIZE; ++i)
+		{
+			if (ram.getByte(i))
+			{
+				return true;
+			}
+		}
+
+		std::cout << "Warning: Program has no instructions! Just an empty infinite loop, not running this program.\n";
+		return false;
+	}
+
+	//Loads the input program (actually entire RAM file).
+	bool loadRAM(std::string file)
+	{
+		std::ifstream f(file, std::ios::binary);
+
+		if (!f)
+		{
+			std::cout << "Error: failed to open file for input program/RAM: \"" << file << "\"\n";
+			return false;
+		}
+
+		ram.loadFromFileObject(f);
+
+		f.close();
+
+		if (!validateProgram())
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	//Loads a RAMType::SIZE byte image from memory. Returns false if there's nothing to run, like the above.
+	bool loadRAM(const uint8_t *image)
+	{
+		ram.loadFromMemory(image);
+
+		return validateProgram();
+	}
+
+	void writeOutRAM(uint8_t *image) const
+	{
+		ram.writeOutToMemory(image);
+	}
+
+	bool writeOutRAM(std::string file)
+	{
+		std::ofstream f(file, std::ios::binary);
+
+		if (!f)
+		{
+			std::cout << "Error: failed to open file for outputting final state of RAM: \"" << file << "\"\n";
+			return false;
+		}
+
+		ram.writeOutToFileObject(f);
+
+		f.close();
+
+		return true;
+	}
+
+	/*
+	 * Runs until HALT, or until one of the limits is hit.
+	 * Parameters:
+	 * * max_instructions	- instruction budget, 0 = unlimited.
+	 * * timeout_ms			- wall-clock deadline in milliseconds, 0 = unlimited.
+	 * Limits are only checked every LIMIT_CHECK_INTERVAL instructions, so the hot loop stays a plain fetch & execute.
+	 * The budget is still exact, since every batch is clipped to whatever is left of it.
+	 */
+	RunResult run(uint64_t max_instructions = 0, uint64_t timeout_ms = 0)
+	{
+		RunResult result = RUN_HALTED;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point deadline = start + std::chrono::milliseconds(timeout_ms);
+
+		while (running)
+		{
+			uint64_t batch = LIMIT_CHECK_INTERVAL;
+			if (max_instructions)
+			{
+				if (instruction_count >= max_instructions)
+				{
+					result = RUN_INSTRUCTION_LIMIT;
+					break;
+				}
+				batch = std::min(batch, max_instructions - instruction_count);
+			}
+
+			//A call skipped by the subroutine cache counts all its instructions at once, so this isn't a plain count of iterations.
+			uint64_t batch_end = instruction_count + batch;
+			while (instruction_count < batch_end && running)
+			{
+				address_t address = program_counter;
+				instruction = fetchByte(program_counter);
+				if constexpr (Instrumentation::MEMOIZE)
+				{
+					if (DECODE_TABLE[instruction].operation == OP_RET)
+					{
+						memoizeReturn();
+					}
+				}
+				executeInstruction(instruction);
+				//HALT leaves the PC on itself, that isn't a jump.
+				instrumentation.onInstruction(address, running ? program_counter : static_cast<address_t>(address + DECODE_TABLE[instruction].size), instruction);
+
+				++instruction_count;
+				if constexpr (Instrumentation::MEMOIZE)
+				{
+					if (DECODE_TABLE[instruction].operation == OP_CALL)
+					{
+						memoizeCall(max_instructions);
+					}
+				}
+			}
+
+			if (running && timeout_ms && std::chrono::steady_clock::now() >= deadline)
+			{
+				result = RUN_TIMEOUT;
+				break;
+			}
+		}
+
+		elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << "\n\nExecuted " << instruction_count << " instructions.\n\n";
+
+		return result;
+	}
+
+	MemoryModel &getMemoryModel()
+	{
+		return memory_model;
+	}
+
+	Instrumentation &getInstrumentation()
+	{
+		return instrumentation;
+	}
+
+	uint64_t getInstructionCount() const
+	{
+		return instruction_count;
+	}
+
+	//Final machine state, for tools that check other models of the machine against this one (see tgate).
+	const RAMType &getRAM() const
+	{
+		return ram;
+	}
+
+	const RegBank &getRegBank() const
+	{
+		return regbank;
+	}
+
+	const ALU &getALU() const
+	{
+		return alu;
+	}
+
+	address_t getProgramCounter() const
+	{
+		return program_counter;
+	}
+
+	//Back to power on state: everything zeroed, running. Keeps the symbols, memory model & instrumentation.
+	void reset()
+	{
+		regbank = RegBank();
+		ram = RAMType();
+		alu = ALU();
+		running = true;
+		program_counter = 0x00;
+		instruction = 0x00;
+		instruction_count = 0;
+		elapsed_ms = 0;
+	}
+
+	//Prints the machine state & counters. Used to report on runs that were cut short.
+	void dumpCounters() const
+	{
+		SymbolMap no_symbols;
+		std::cout << "Instructions executed: " << instruction_count << "\n" \
+				<< "Elapsed: " << elapsed_ms << " ms\n" \
+				<< "PC: " << (symbols ? *symbols : no_symbols).describe(program_counter) << "\n" << std::hex;
+
+		for (uint16_t i = 0; i < NUM_REGISTERS; ++i)
+		{
+			std::cout << "Register " << static_cast<char>('A' + i) << ": 0x" << static_cast<uint16_t>(regbank.getRegister(i)) << "\n";
+		}
+
+		std::cout << std::dec << "Flags: C=" << alu.getCFlag() << " Z=" << alu.getZFlag() << " S=" << alu.getSFlag() << " O=" << alu.getOFlag() << " L=" << alu.getLFlag() << "\n";
+	}
+};
+
+#endif //TRISK_CPU_HPP
@@ -0,0 +1,204 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_DELTA_HPP
+#define TRISK_DELTA_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "archive.hpp"
+
+/*
+ * Result of a run as a delta against the image it started from: the bytes of RAM that changed, plus the final
+ * registers, flags, PC & instruction count. Most programs only write a few bytes, so this is a fraction of a RAM dump.
+ * tem --delta writes these instead of the final RAM (one per image with --archive), and tdelta expands them back,
+ * given the input image(s).
+ *
+ * File layout: "TDLT" <u8 version>, then one record per run until the end of the file:
+ * 		<u8 status> <u8 flags> <u8 number of registers> <registers> <pc> <instructions> <RAM size>
+ * 		<number of runs> { <gap> <length> <length bytes> }
+ * Flags are C Z S O L in bits 4 - 0, and status is an ArchiveStatus (see archive.hpp).
+ * Numbers without a size are LEB128 varints: 7 bits at a time, low bits first, top bit set on all but the last byte.
+ * A run's gap is the number of unchanged bytes between it and the previous run (or address 0, for the first).
+ */
+
+static const uint8_t DELTA_VERSION = 1;
+
+//Unchanged gaps this short are cheaper to store than to start a new run after.
+static const uint32_t DELTA_MAX_MERGED_GAP = 2;
+
+struct RunDelta
+{
+	struct Run
+	{
+		uint32_t address;
+		std::vector<uint8_t> bytes;
+	};
+
+	uint8_t status = ARCHIVE_HALTED;
+	uint8_t flags = 0;
+	uint32_t pc = 0;
+	uint64_t instructions = 0;
+	std::vector<uint8_t> registers;
+	uint32_t ram_size = 0;
+	std::vector<Run> runs;
+
+	//Records the bytes of after (size bytes of RAM) that differ from before.
+	void diff(const uint8_t *before, const uint8_t *after, uint32_t size)
+	{
+		ram_size = size;
+		runs.clear();
+		for (uint32_t i = 0; i < size; ++i)
+		{
+			if (before[i] == after[i])
+			{
+				continue;
+			}
+
+			if (runs.empty() || i - (runs.back().address + runs.back().bytes.size()) > DELTA_MAX_MERGED_GAP)
+			{
+				runs.push_back(Run { i, std::vector<uint8_t>() });
+			}
+			Run &run = runs.back();
+			for (uint32_t j = run.address + run.bytes.size(); j <= i; ++j)
+			{
+				run.bytes.push_back(after[j]);
+			}
+		}
+	}
+
+	//Turns the input image (ram_size bytes) into the final RAM.
+	void apply(uint8_t *ram) const
+	{
+		for (const Run &run : runs)
+		{
+			std::copy(run.bytes.begin(), run.bytes.end(), ram + run.address);
+		}
+	}
+
+	static void writeHeader(std::ostream &file)
+	{
+		file.write("TDLT", 4);
+		file.put(static_cast<char>(DELTA_VERSION));
+	}
+
+	//Returns false (and complains to log) if this isn't a delta file.
+	static bool readHeader(std::istream &file, const std::string &filename, std::ostream &log = std::cout)
+	{
+		char magic[4];
+		if (!file.read(magic, 4) || std::string(magic, 4) != "TDLT" || file.get() != DELTA_VERSION)
+		{
+			log << "Error: \"" << filename << "\" is not a delta file.\n";
+			return false;
+		}
+		return true;
+	}
+
+	void write(std::ostream &file) const
+	{
+		file.put(static_cast<char>(status));
+		file.put(static_cast<char>(flags));
+		file.put(static_cast<char>(registers.size()));
+		file.write(reinterpret_cast<const char* >(registers.data()), registers.size());
+		writeVarint(file, pc);
+		writeVarint(file, instructions);
+		writeVarint(file, ram_size);
+
+		writeVarint(file, runs.size());
+		uint32_t end = 0;
+		for (const Run &run : runs)
+		{
+			writeVarint(file, run.address - end);
+			writeVarint(file, run.bytes.size());
+			file.write(reinterpret_cast<const char* >(run.bytes.data()), run.bytes.size());
+			end = run.address + run.bytes.size();
+		}
+	}
+
+	//Reads the next record. Returns false at the end of the file, and sets malformed if the record was cut short or is invalid.
+	bool read(std::istream &file, bool &malformed)
+	{
+		malformed = false;
+		int first = file.get();
+		if (first == EOF)
+		{
+			return false;
+		}
+		malformed = true;
+
+		status = first;
+		flags = file.get();
+		int count = file.get();
+		if (!file || count < 0)
+		{
+			return false;
+		}
+		registers.resize(count);
+		uint64_t value, number_of_runs;
+		if (!file.read(reinterpret_cast<char* >(registers.data()), count) || !readVarint(file, value))
+		{
+			return false;
+		}
+		pc = value;
+		if (!readVarint(file, instructions) || !readVarint(file, value) || !readVarint(file, number_of_runs))
+		{
+			return false;
+		}
+		ram_size = value;
+
+		runs.clear();
+		uint64_t end = 0;
+		for (uint64_t i = 0; i < number_of_runs; ++i)
+		{
+			uint64_t gap, length;
+			if (!readVarint(file, gap) || !readVarint(file, length) || end + gap + length > ram_size)
+			{
+				return false;
+			}
+			runs.push_back(Run { static_cast<uint32_t>(end + gap), std::vector<uint8_t>(length) });
+			if (!file.read(reinterpret_cast<char* >(runs.back().bytes.data()), length))
+			{
+				return false;
+			}
+			end += gap + length;
+		}
+
+		malformed = false;
+		return true;
+	}
+
+	static void writeVarint(std::ostream &file, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			file.put(static_cast<char>((value & 0x7F) | 0x80));
+			value >>= 7;
+		}
+		file.put(static_cast<char>(value));
+	}
+
+	static bool readVarint(std::istream &file, uint64_t &value)
+	{
+		value = 0;
+		for (uint8_t shift = 0; shift < 64; shift += 7)
+		{
+			int byte = file.get();
+			if (byte == EOF)
+			{
+				return false;
+			}
+			value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+#endif //TRISK_DELTA_HPP
@@ -0,0 +1,30 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_INSTRUMENTATION_HPP
+#define TRISK_INSTRUMENTATION_HPP
+
+#include <cstdint>
+
+/*
+ * Instrumentation that does nothing. Like the memory model, the CPU takes its instrumentation as a template parameter
+ * and calls its hooks from the run loop. These are all empty & inline, so a plain run's loop compiles to nothing but
+ * fetch & execute. Instrumentations derive from this, and hide the hooks they need.
+ * See Profiling in profile.hpp & SubroutineCache in memo.hpp.
+ */
+struct NoInstrumentation
+{
+	//If set, the CPU offers every CALL & RET to the instrumentation's subroutine cache (see memo.hpp).
+	static const bool MEMOIZE = false;
+
+	//The instruction at address ran, and the next one is at next (for HALT, the address after it).
+	void onInstruction(uint8_t, uint8_t, uint8_t) { }
+
+	//Every memory access the program makes, as the memory model gets them, with the values read.
+	void onFetch(uint8_t, uint8_t) { }
+	void onLoad(uint8_t, uint8_t) { }
+	void onStore(uint8_t) { }
+	void onLoadBlock(const uint8_t *, uint8_t, uint16_t) { }
+	void onStoreBlock(uint8_t, uint16_t) { }
+};
+
+#endif //TRISK_INSTRUMENTATION_HPP
@@ -0,0 +1,270 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_ISA_HPP
+#define TRISK_ISA_HPP
+
+#include <cstdint>
+#include <array>
+
+/*
+ * The one and only description of the instruction set.
+ * Both the assembler (tas) and the emulator (tem) are generated from INSTRUCTION_SET below:
+ * * tas encodes instructions with encodeInstruction().
+ * * tem decodes opcodes with DECODE_TABLE, which is built at compile time.
+ * To add an instruction, add an Operation and a row to INSTRUCTION_SET, then implement it in the CPU.
+ */
+
+static const uint16_t NUM_OPCODES = 256; //8-bit opcodes.
+static const uint8_t NUM_REGISTERS = 4; //Register operands are 2-bit fields.
+static const uint8_t ADDRESS_BITS = 8; //Standard TRISK address width (tem can also emulate a 16-bit variant, see CPU).
+static const uint16_t RAM_SIZE = 1 << ADDRESS_BITS; //How much program memory we have (8-bit CPU/RAM).
+static const uint8_t STACK_POINTER = 3; //PUSH, POP, CALL and RET use register D as the stack pointer. The stack grows down.
+
+//Registers the block memory instructions (MCPY, MSET, MSCAN, MCMP) take their operands from.
+static const uint8_t BLOCK_POINTER = 0; //A: destination / first block.
+static const uint8_t BLOCK_VALUE = 1; //B: source / second block / byte value.
+static const uint8_t BLOCK_COUNT = 2; //C: length in bytes.
+
+enum Operation : uint8_t
+{
+	OP_NOP,
+	OP_HALT,
+	OP_SET,
+	OP_PCL,
+	OP_PCO,
+	OP_PCS,
+	OP_LDI,
+	OP_LD,
+	OP_ADD,
+	OP_SUB,
+	OP_RSHIFT,
+	OP_NOT,
+	OP_JMP,
+	OP_PCC,
+	OP_PCZ,
+	OP_AND,
+	OP_OR,
+	OP_CMP,
+	OP_ST,
+	OP_PUSH,
+	OP_POP,
+	OP_CALL,
+	OP_RET,
+	OP_LSHIFT,
+	OP_MUL,
+	OP_ADDI,
+	OP_SUBI,
+	OP_CMPI,
+	OP_BRA,
+	OP_BZ,
+	OP_BNZ,
+	OP_BC,
+	OP_BNC,
+	OP_BS,
+	OP_BO,
+	OP_BL,
+	OP_MCPY,
+	OP_MSET,
+	OP_MSCAN,
+	OP_MCMP,
+	NUM_OPERATIONS
+};
+
+/*
+ * Where the operands go in the instruction. X is the first operand in the assembly syntax, Y the second.
+ */
+enum OperandLayout : uint8_t
+{
+	LAYOUT_NONE,			//oooo_oooo
+	LAYOUT_X_LOW,			//oooo_ooxx
+	LAYOUT_X_HIGH,			//oooo_xxoo
+	LAYOUT_X_Y,				//oooo_xxyy
+	LAYOUT_Y_X,				//oooo_yyxx
+	LAYOUT_X_LOW_IMMEDIATE,	//oooo_ooxx iiii_iiii (Y is the byte following the opcode)
+	LAYOUT_RELATIVE			//oooo_oooo dddd_dddd (X is the target address, d = X - address of the next instruction, signed)
+};
+
+struct InstructionInfo
+{
+	const char *name;
+	Operation operation;
+	uint8_t base; //Opcode with all operand fields zeroed.
+	OperandLayout layout;
+	uint8_t size; //Size of instruction in bytes.
+	uint8_t num_parameters;
+};
+
+static constexpr InstructionInfo INSTRUCTION_SET[] =
+{
+	{ "NOP",	OP_NOP,		0x00, LAYOUT_NONE,				1, 0 },
+	{ "HALT",	OP_HALT,	0x01, LAYOUT_NONE,				1, 0 },
+	{ "SET",	OP_SET,		0x50, LAYOUT_X_Y,				1, 2 },
+	{ "PCL",	OP_PCL,		0x60, LAYOUT_X_LOW,				1, 1 },
+	{ "PCO",	OP_PCO,		0x64, LAYOUT_X_LOW,				1, 1 },
+	{ "PCS",	OP_PCS,		0x68, LAYOUT_X_LOW,				1, 1 },
+	{ "LDI",	OP_LDI,		0x6C, LAYOUT_X_LOW_IMMEDIATE,	2, 2 },
+	{ "LD",		OP_LD,		0x70, LAYOUT_X_Y,				1, 2 },
+	{ "ADD",	OP_ADD,		0x80, LAYOUT_X_Y,				1, 2 },
+	{ "SUB",	OP_SUB,		0x90, LAYOUT_X_Y,				1, 2 },
+	{ "RSHIFT",	OP_RSHIFT,	0xA0, LAYOUT_X_Y,				1, 2 },
+	{ "NOT",	OP_NOT,		0xB0, LAYOUT_X_HIGH,			1, 1 },
+	{ "JMP",	OP_JMP,		0xB1, LAYOUT_X_HIGH,			1, 1 },
+	{ "PCC",	OP_PCC,		0xB2, LAYOUT_X_HIGH,			1, 1 },
+	{ "PCZ",	OP_PCZ,		0xB3, LAYOUT_X_HIGH,			1, 1 },
+	{ "AND",	OP_AND,		0xC0, LAYOUT_X_Y,				1, 2 },
+	{ "OR",		OP_OR,		0xD0, LAYOUT_X_Y,				1, 2 },
+	{ "CMP",	OP_CMP,		0xE0, LAYOUT_X_Y,				1, 2 },
+	{ "ST",		OP_ST,		0xF0, LAYOUT_Y_X,				1, 2 },
+	{ "PUSH",	OP_PUSH,	0x10, LAYOUT_X_LOW,				1, 1 },
+	{ "POP",	OP_POP,		0x14, LAYOUT_X_LOW,				1, 1 },
+	{ "CALL",	OP_CALL,	0x18, LAYOUT_X_LOW,				1, 1 },
+	{ "RET",	OP_RET,		0x1C, LAYOUT_NONE,				1, 0 },
+	{ "LSHIFT",	OP_LSHIFT,	0x20, LAYOUT_X_Y,				1, 2 },
+	{ "MUL",	OP_MUL,		0x30, LAYOUT_X_Y,				1, 2 },
+	{ "ADDI",	OP_ADDI,	0x40, LAYOUT_X_LOW_IMMEDIATE,	2, 2 },
+	{ "SUBI",	OP_SUBI,	0x44, LAYOUT_X_LOW_IMMEDIATE,	2, 2 },
+	{ "CMPI",	OP_CMPI,	0x48, LAYOUT_X_LOW_IMMEDIATE,	2, 2 },
+	{ "BRA",	OP_BRA,		0x02, LAYOUT_RELATIVE,			2, 1 },
+	{ "BZ",		OP_BZ,		0x03, LAYOUT_RELATIVE,			2, 1 },
+	{ "BNZ",	OP_BNZ,		0x04, LAYOUT_RELATIVE,			2, 1 },
+	{ "BC",		OP_BC,		0x05, LAYOUT_RELATIVE,			2, 1 },
+	{ "BNC",	OP_BNC,		0x06, LAYOUT_RELATIVE,			2, 1 },
+	{ "BS",		OP_BS,		0x07, LAYOUT_RELATIVE,			2, 1 },
+	{ "BO",		OP_BO,		0x08, LAYOUT_RELATIVE,			2, 1 },
+	{ "BL",		OP_BL,		0x09, LAYOUT_RELATIVE,			2, 1 },
+	{ "MCPY",	OP_MCPY,	0x0C, LAYOUT_NONE,				1, 0 },
+	{ "MSET",	OP_MSET,	0x0D, LAYOUT_NONE,				1, 0 },
+	{ "MSCAN",	OP_MSCAN,	0x0E, LAYOUT_NONE,				1, 0 },
+	{ "MCMP",	OP_MCMP,	0x0F, LAYOUT_NONE,				1, 0 }
+};
+
+static constexpr uint16_t NUM_INSTRUCTIONS = sizeof(INSTRUCTION_SET) / sizeof(INSTRUCTION_SET[0]);
+
+//True if operand i (0 = X, 1 = Y) of this layout is a register (as opposed to an immediate or nothing at all).
+constexpr bool isRegisterOperand(OperandLayout layout, uint8_t i)
+{
+	switch (layout)
+	{
+	case LAYOUT_X_LOW:
+	case LAYOUT_X_HIGH:
+	case LAYOUT_X_LOW_IMMEDIATE:
+		return i == 0;
+	case LAYOUT_X_Y:
+	case LAYOUT_Y_X:
+		return i <= 1;
+	default:
+		return false;
+	}
+}
+
+//True if the opcode is followed by a byte of immediate data.
+constexpr bool hasImmediate(OperandLayout layout)
+{
+	return layout == LAYOUT_X_LOW_IMMEDIATE || layout == LAYOUT_RELATIVE;
+}
+
+//Returns the opcode byte. Immediates are not part of it, the caller writes those out after the opcode.
+constexpr uint8_t encodeInstruction(const InstructionInfo &info, uint8_t x, uint8_t y)
+{
+	switch (info.layout)
+	{
+	case LAYOUT_X_LOW:
+	case LAYOUT_X_LOW_IMMEDIATE:
+		return info.base + (x % NUM_REGISTERS);
+	case LAYOUT_X_HIGH:
+		return info.base + ((x % NUM_REGISTERS) << 2);
+	case LAYOUT_X_Y:
+		return info.base + ((x % NUM_REGISTERS) << 2) + (y % NUM_REGISTERS);
+	case LAYOUT_Y_X:
+		return info.base + ((y % NUM_REGISTERS) << 2) + (x % NUM_REGISTERS);
+	default:
+		return info.base;
+	}
+}
+
+/*
+ * What an opcode means. x & y are the register operands in assembly syntax order (0 if unused).
+ * Immediates aren't in here, they're fetched from RAM by the instruction itself.
+ */
+struct DecodedInstruction
+{
+	Operation operation;
+	uint8_t x;
+	uint8_t y;
+	uint8_t size;
+};
+
+constexpr std::array<DecodedInstruction, NUM_OPCODES> buildDecodeTable()
+{
+	//Opcodes nothing encodes to halt the CPU.
+	std::array<DecodedInstruction, NUM_OPCODES> table {};
+	for (uint16_t i = 0; i < NUM_OPCODES; ++i)
+	{
+		table[i] = { OP_HALT, 0, 0, 1 };
+	}
+
+	//Just encode every possible form of every instruction, and record what it was.
+	for (uint16_t i = 0; i < NUM_INSTRUCTIONS; ++i)
+	{
+		const InstructionInfo &info = INSTRUCTION_SET[i];
+		uint8_t x_count = isRegisterOperand(info.layout, 0) ? NUM_REGISTERS : 1;
+		uint8_t y_count = isRegisterOperand(info.layout, 1) ? NUM_REGISTERS : 1;
+
+		for (uint8_t x = 0; x < x_count; ++x)
+		{
+			for (uint8_t y = 0; y < y_count; ++y)
+			{
+				table[encodeInstruction(info, x, y)] = { info.operation, x, y, info.size };
+			}
+		}
+	}
+
+	return table;
+}
+
+static constexpr std::array<DecodedInstruction, NUM_OPCODES> DECODE_TABLE = buildDecodeTable();
+
+//Compile time sanity checks on the table, so the assembler and the emulator can't disagree.
+constexpr bool validateInstructionSet()
+{
+	uint16_t forms = 0; //Number of distinct opcodes the instruction set encodes to.
+	for (uint16_t i = 0; i < NUM_INSTRUCTIONS; ++i)
+	{
+		const InstructionInfo &info = INSTRUCTION_SET[i];
+
+		//Rows are in Operation order, so INSTRUCTION_SET[op] is the row for op.
+		if (info.operation != i)
+		{
+			return false;
+		}
+
+		uint8_t expected_parameters = isRegisterOperand(info.layout, 0) + isRegisterOperand(info.layout, 1) + hasImmediate(info.layout);
+		uint8_t expected_size = hasImmediate(info.layout) ? 2 : 1;
+		if (info.num_parameters != expected_parameters || info.size != expected_size)
+		{
+			return false;
+		}
+
+		uint8_t x_count = isRegisterOperand(info.layout, 0) ? NUM_REGISTERS : 1;
+		uint8_t y_count = isRegisterOperand(info.layout, 1) ? NUM_REGISTERS : 1;
+		forms += x_count * y_count;
+	}
+
+	//Overlapping encodings would overwrite each other in the decode table.
+	uint16_t decoded = 0;
+	for (uint16_t i = 0; i < NUM_OPCODES; ++i)
+	{
+		const DecodedInstruction &d = DECODE_TABLE[i];
+		const InstructionInfo &info = INSTRUCTION_SET[d.operation];
+		if (encodeInstruction(info, d.x, d.y) == i)
+		{
+			++decoded;
+		}
+	}
+
+	return forms == decoded && NUM_INSTRUCTIONS == NUM_OPERATIONS;
+}
+
+static_assert(validateInstructionSet(), "INSTRUCTION_SET is inconsistent (bad operation order, size, parameter count, or overlapping opcodes).");
+
+#endif //TRISK_ISA_HPP
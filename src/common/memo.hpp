@@ -0,0 +1,333 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_MEMO_HPP
+#define TRISK_MEMO_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "isa.hpp"
+#include "instrumentation.hpp"
+
+/*
+ * Memoization of guest subroutines, for tem --memoize.
+ * A call runs from a CALL to the RET that pops the return address it pushed. While a call runs, every byte it reads
+ * before writing it (code included) is recorded with its value, as is every byte it writes. When it returns, the call
+ * is stored under its entry point, registers & flags, along with the registers, flags & RAM it returned with.
+ * A later CALL to the same entry point with the same registers & flags, finding the same values in all the bytes the
+ * stored call read, would run exactly the same instructions: so it isn't run, the stored state is applied instead.
+ * There are no memory mapped devices, so a byte can't change between being read & being checked.
+ *
+ * Calls that aren't a function of those inputs are never stored:
+ * * Self-modifying ones: writing a byte the call executed, or executing a byte it wrote.
+ * * Ones that overwrite their return address, or that don't leave through a RET popping it.
+ * Calls made by pushing a return address & jumping aren't seen (same as StackProfile in profile.hpp).
+ *
+ * This is an instrumentation (see instrumentation.hpp): the CPU hands it every memory access, and with MEMOIZE set,
+ * every CALL (see CPU::memoizeCall()) & RET (CPU::memoizeReturn()).
+ */
+
+static const uint32_t MEMO_MAX_DEPTH = 64; //Calls nested deeper than this aren't stored, nor are the ones they're in.
+static const uint32_t MEMO_MAX_CALLS_PER_KEY = 8; //Stored calls per entry point, registers & flags. The oldest is replaced.
+static const uint32_t MEMO_MAX_CALLS = 1 << 16; //No more are stored after this many.
+
+class SubroutineCache : public NoInstrumentation
+{
+public:
+	static const bool MEMOIZE = true;
+
+	struct Call
+	{
+		std::vector<std::pair<uint32_t, uint8_t> > reads; //Value of each byte read before being written.
+		std::vector<std::pair<uint32_t, uint8_t> > writes; //Final value of each byte written.
+		std::vector<uint32_t> fetched; //Bytes executed, so the calls around a skipped one still catch self-modification.
+		std::vector<uint8_t> registers; //At the RET.
+		uint8_t flags;
+		uint64_t instructions; //From the first instruction of the call to its RET, both included.
+	};
+
+	//Counters, for the report.
+	uint64_t calls;
+	uint64_t hits;
+	uint64_t skipped; //Instructions not run, thanks to hits.
+	uint64_t stored;
+	uint64_t bypassed; //Calls that couldn't be stored.
+
+private:
+	//Per address state of a running call.
+	static const uint8_t READ = 1;
+	static const uint8_t WRITTEN = 2;
+	static const uint8_t FETCHED = 4;
+
+	struct Frame
+	{
+		std::vector<uint8_t> key; //Entry point, registers & flags.
+		uint32_t return_slot; //D after the CALL.
+		uint8_t return_address;
+		uint64_t start; //Instruction count after the CALL.
+		bool cacheable;
+		std::vector<uint8_t> state; //Per address.
+		Call call; //So far. Writes get their values at the RET.
+	};
+
+	uint32_t ram_size;
+	std::vector<Frame> frames; //Reused, frames[depth - 1] is the innermost running call.
+	uint32_t depth;
+	std::map<std::vector<uint8_t>, std::vector<Call> > cache;
+
+	//What a call did to the bytes it touched, seen from frame.
+	void read(Frame &frame, uint32_t address, uint8_t value)
+	{
+		uint8_t &state = frame.state[address];
+		if (!(state & (READ | WRITTEN)))
+		{
+			state |= READ;
+			frame.call.reads.push_back(std::make_pair(address, value));
+		}
+	}
+
+	void fetch(Frame &frame, uint32_t address, uint8_t value)
+	{
+		if (frame.state[address] & WRITTEN)
+		{
+			frame.cacheable = false;
+		}
+		read(frame, address, value);
+		if (!(frame.state[address] & FETCHED))
+		{
+			frame.state[address] |= FETCHED;
+			frame.call.fetched.push_back(address);
+		}
+	}
+
+	void write(Frame &frame, uint32_t address)
+	{
+		uint8_t &state = frame.state[address];
+		if (state & FETCHED)
+		{
+			frame.cacheable = false;
+		}
+		if (!(state & WRITTEN))
+		{
+			state |= WRITTEN;
+			frame.call.writes.push_back(std::make_pair(address, 0));
+		}
+	}
+
+	//A call made from frame, which returned (or was skipped).
+	void merge(Frame &frame, const Call &call)
+	{
+		for (const std::pair<uint32_t, uint8_t> &byte : call.reads)
+		{
+			read(frame, byte.first, byte.second);
+		}
+		for (uint32_t address : call.fetched)
+		{
+			fetch(frame, address, 0); //Already read above.
+		}
+		for (const std::pair<uint32_t, uint8_t> &byte : call.writes)
+		{
+			write(frame, byte.first);
+		}
+	}
+
+	//Pops the innermost call, ready for reuse.
+	void pop()
+	{
+		Frame &frame = frames[--depth];
+		for (const std::pair<uint32_t, uint8_t> &byte : frame.call.reads)
+		{
+			frame.state[byte.first] = 0;
+		}
+		for (const std::pair<uint32_t, uint8_t> &byte : frame.call.writes)
+		{
+			frame.state[byte.first] = 0;
+		}
+		frame.call.reads.clear();
+		frame.call.writes.clear();
+		frame.call.fetched.clear();
+	}
+
+	//Gives up on every running call.
+	void abandon()
+	{
+		bypassed += depth;
+		while (depth)
+		{
+			pop();
+		}
+	}
+
+	static std::vector<uint8_t> makeKey(uint32_t entry, const uint8_t *registers, uint16_t num_registers, uint8_t flags)
+	{
+		std::vector<uint8_t> key { static_cast<uint8_t>(entry), static_cast<uint8_t>(entry >> 8), flags };
+		key.insert(key.end(), registers, registers + num_registers);
+		return key;
+	}
+
+public:
+	explicit SubroutineCache(uint32_t ram_size = RAM_SIZE) :
+		calls(0),
+		hits(0),
+		skipped(0),
+		stored(0),
+		bypassed(0),
+		ram_size(ram_size),
+		frames(MEMO_MAX_DEPTH),
+		depth(0)
+	{
+	}
+
+	//Every memory access the program makes, as the CPU's memory model gets them.
+	void onFetch(uint32_t address, uint8_t value)
+	{
+		if (depth)
+		{
+			fetch(frames[depth - 1], address, value);
+		}
+	}
+
+	void onLoad(uint32_t address, uint8_t value)
+	{
+		if (depth)
+		{
+			read(frames[depth - 1], address, value);
+		}
+	}
+
+	void onStore(uint32_t address)
+	{
+		if (depth)
+		{
+			write(frames[depth - 1], address);
+		}
+	}
+
+	//Block instructions' ranges wrap around at 256, like their addresses.
+	void onLoadBlock(const uint8_t *memory, uint8_t start, uint16_t count)
+	{
+		for (uint16_t i = 0; depth && i < count; ++i)
+		{
+			uint8_t address = start + i;
+			read(frames[depth - 1], address, memory[address]);
+		}
+	}
+
+	void onStoreBlock(uint8_t start, uint16_t count)
+	{
+		for (uint16_t i = 0; depth && i < count; ++i)
+		{
+			write(frames[depth - 1], static_cast<uint8_t>(start + i));
+		}
+	}
+
+	/*
+	 * A CALL to entry just ran, pushing return_address at return_slot, with instruction_count instructions run so far.
+	 * Returns the stored call to apply instead of running it, if one matches memory & takes no more than budget
+	 * instructions (0 = unlimited). Otherwise, starts recording this one & returns null.
+	 */
+	const Call *enter(uint32_t entry, const uint8_t *registers, uint16_t num_registers, uint8_t flags, uint32_t return_slot, const uint8_t *memory, uint64_t instruction_count, uint64_t budget)
+	{
+		++calls;
+		std::vector<uint8_t> key = makeKey(entry, registers, num_registers, flags);
+
+		std::map<std::vector<uint8_t>, std::vector<Call> >::const_iterator found = cache.find(key);
+		if (found != cache.end())
+		{
+			for (const Call &call : found->second)
+			{
+				bool match = !budget || call.instructions <= budget;
+				for (std::size_t i = 0; match && i < call.reads.size(); ++i)
+				{
+					match = memory[call.reads[i].first] == call.reads[i].second;
+				}
+				if (match)
+				{
+					++hits;
+					skipped += call.instructions;
+					if (depth)
+					{
+						merge(frames[depth - 1], call);
+					}
+					return &call;
+				}
+			}
+		}
+
+		if (depth == MEMO_MAX_DEPTH)
+		{
+			abandon();
+		}
+		Frame &frame = frames[depth++];
+		frame.state.resize(ram_size);
+		frame.key.swap(key);
+		frame.return_slot = return_slot;
+		frame.return_address = memory[return_slot];
+		frame.start = instruction_count;
+		frame.cacheable = true;
+		return nullptr;
+	}
+
+	//A RET is about to pop the return address at sp. Stores the innermost call, if this is its RET.
+	void leave(uint32_t sp, const uint8_t *registers, uint16_t num_registers, uint8_t flags, const uint8_t *memory, uint64_t instruction_count)
+	{
+		if (!depth)
+		{
+			return;
+		}
+
+		Frame &frame = frames[depth - 1];
+		if (sp != frame.return_slot || memory[sp] != frame.return_address)
+		{
+			abandon();
+			return;
+		}
+
+		Call &call = frame.call;
+		if (frame.state[sp] & WRITTEN)
+		{
+			frame.cacheable = false;
+		}
+		for (std::pair<uint32_t, uint8_t> &byte : call.writes)
+		{
+			byte.second = memory[byte.first];
+		}
+		call.registers.assign(registers, registers + num_registers);
+		call.flags = flags;
+		call.instructions = instruction_count - frame.start + 1;
+
+		if (depth > 1)
+		{
+			Frame &caller = frames[depth - 2];
+			caller.cacheable = caller.cacheable && frame.cacheable;
+			merge(caller, call);
+		}
+
+		if (!frame.cacheable)
+		{
+			++bypassed;
+		}
+		else if (stored < MEMO_MAX_CALLS)
+		{
+			std::vector<Call> &calls_for_key = cache[frame.key];
+			if (calls_for_key.size() == MEMO_MAX_CALLS_PER_KEY)
+			{
+				calls_for_key.erase(calls_for_key.begin());
+			}
+			calls_for_key.push_back(call);
+			++stored;
+		}
+		pop();
+	}
+
+	void report(std::ostream &log = std::cout) const
+	{
+		log << "\nMemoization: " << calls << " calls, " << hits << " answered from the cache (" << skipped << " instructions skipped), " \
+				<< stored << " stored, " << (bypassed + depth) << " not cacheable (self-modifying, or not returned from).\n";
+	}
+};
+
+#endif //TRISK_MEMO_HPP
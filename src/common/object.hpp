@@ -0,0 +1,341 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_OBJECT_HPP
+#define TRISK_OBJECT_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "isa.hpp"
+
+/*
+ * Relocatable object files, output by tas -c and linked into a program image by tld.
+ *
+ * An object holds one or more named sections of code/data, each assembled as if it started at address 0,
+ * a symbol table (labels defined in the module, and labels it uses but doesn't define),
+ * and relocations: bytes that hold a label's address and have to be patched once the sections are placed.
+ * Labels are local to their module unless exported with GLOBAL.
+ *
+ * File layout (little endian):
+ * 		"TOBJ" <u8 version> <u64 hash of the source it was assembled from>
+ * 		<u16 number of sections> { <string name> <u16 size> <size bytes> }
+ * 		<u16 number of symbols> { <string name> <u8 flags> <u16 section> <u8 offset> }
+ * 		<u16 number of relocations> { <u16 section> <u8 offset> <u16 symbol> <u8 type> }
+ * 	Strings are <u8 length> <bytes>.
+ */
+
+static const uint8_t OBJECT_VERSION = 1;
+
+enum RelocationType : uint8_t
+{
+	RELOC_ABS8,	//Byte = address of the symbol (LDI & co. loading a label).
+	RELOC_REL8	//Byte = address of the symbol - address of the next byte (branch displacement).
+};
+
+static const uint8_t SYMBOL_DEFINED = 1 << 0;
+static const uint8_t SYMBOL_GLOBAL = 1 << 1;
+
+struct ObjectSection
+{
+	std::string name;
+	std::vector<uint8_t> data;
+};
+
+struct ObjectSymbol
+{
+	std::string name;
+	uint8_t flags;
+	uint16_t section; //Only if defined.
+	uint8_t offset; //Into the section.
+};
+
+struct Relocation
+{
+	uint16_t section;
+	uint8_t offset; //Of the byte to patch.
+	uint16_t symbol;
+	RelocationType type;
+};
+
+struct ObjectFile
+{
+	uint64_t source_hash = 0;
+	std::vector<ObjectSection> sections;
+	std::vector<ObjectSymbol> symbols;
+	std::vector<Relocation> relocations;
+
+	bool write(const std::string &filename, std::ostream &log = std::cout) const
+	{
+		std::ofstream file(filename, std::ios::binary);
+
+		if (!file)
+		{
+			log << "Error: Could not open output file \"" << filename << "\"\n";
+			return false;
+		}
+
+		file.write("TOBJ", 4);
+		writeInteger(file, OBJECT_VERSION, 1);
+		writeInteger(file, source_hash, 8);
+
+		writeInteger(file, sections.size(), 2);
+		for (const ObjectSection &section : sections)
+		{
+			writeString(file, section.name);
+			writeInteger(file, section.data.size(), 2);
+			file.write(reinterpret_cast<const char* >(section.data.data()), section.data.size());
+		}
+
+		writeInteger(file, symbols.size(), 2);
+		for (const ObjectSymbol &symbol : symbols)
+		{
+			writeString(file, symbol.name);
+			writeInteger(file, symbol.flags, 1);
+			writeInteger(file, symbol.section, 2);
+			writeInteger(file, symbol.offset, 1);
+		}
+
+		writeInteger(file, relocations.size(), 2);
+		for (const Relocation &relocation : relocations)
+		{
+			writeInteger(file, relocation.section, 2);
+			writeInteger(file, relocation.offset, 1);
+			writeInteger(file, relocation.symbol, 2);
+			writeInteger(file, relocation.type, 1);
+		}
+
+		return static_cast<bool>(file);
+	}
+
+	//Returns false (and complains, unless quiet) if the file is missing or isn't a valid object file.
+	bool read(const std::string &filename, bool quiet = false)
+	{
+		std::ifstream file(filename, std::ios::binary);
+
+		if (!file)
+		{
+			if (!quiet)
+			{
+				std::cout << "Error: Could not open object file \"" << filename << "\"\n";
+			}
+			return false;
+		}
+
+		char magic[4];
+		uint64_t version = 0;
+		if (!file.read(magic, 4) || std::string(magic, 4) != "TOBJ" || !readInteger(file, version, 1) || version != OBJECT_VERSION)
+		{
+			if (!quiet)
+			{
+				std::cout << "Error: \"" << filename << "\" isn't a TRISK object file (or was made by another version of tas).\n";
+			}
+			return false;
+		}
+
+		uint64_t count = 0;
+		bool ok = readInteger(file, source_hash, 8) && readInteger(file, count, 2);
+		sections.resize(ok ? count : 0);
+		for (ObjectSection &section : sections)
+		{
+			uint64_t size = 0;
+			ok = ok && readString(file, section.name) && readInteger(file, size, 2) && size <= RAM_SIZE;
+			section.data.resize(ok ? size : 0);
+			ok = ok && file.read(reinterpret_cast<char* >(section.data.data()), section.data.size());
+		}
+
+		ok = ok && readInteger(file, count, 2);
+		symbols.resize(ok ? count : 0);
+		for (ObjectSymbol &symbol : symbols)
+		{
+			uint64_t flags = 0, section = 0, offset = 0;
+			ok = ok && readString(file, symbol.name) && readInteger(file, flags, 1) && readInteger(file, section, 2) && readInteger(file, offset, 1);
+			symbol.flags = flags;
+			symbol.section = section;
+			symbol.offset = offset;
+			ok = ok && (!(symbol.flags & SYMBOL_DEFINED) || symbol.section < sections.size());
+		}
+
+		ok = ok && readInteger(file, count, 2);
+		relocations.resize(ok ? count : 0);
+		for (Relocation &relocation : relocations)
+		{
+			uint64_t section = 0, offset = 0, symbol = 0, type = 0;
+			ok = ok && readInteger(file, section, 2) && readInteger(file, offset, 1) && readInteger(file, symbol, 2) && readInteger(file, type, 1);
+			relocation.section = section;
+			relocation.offset = offset;
+			relocation.symbol = symbol;
+			relocation.type = static_cast<RelocationType>(type);
+			ok = ok && section < sections.size() && offset < sections[section].data.size() && symbol < symbols.size() && type <= RELOC_REL8;
+		}
+
+		if (!ok)
+		{
+			if (!quiet)
+			{
+				std::cout << "Error: Object file \"" << filename << "\" is corrupt.\n";
+			}
+			return false;
+		}
+
+		return true;
+	}
+
+private:
+	static void writeInteger(std::ofstream &file, uint64_t value, uint8_t bytes)
+	{
+		for (uint8_t i = 0; i < bytes; ++i)
+		{
+			file.put(static_cast<char>(value >> (8 * i)));
+		}
+	}
+
+	static void writeString(std::ofstream &file, const std::string &s)
+	{
+		writeInteger(file, s.size(), 1);
+		file.write(s.data(), s.size());
+	}
+
+	static bool readInteger(std::ifstream &file, uint64_t &value, uint8_t bytes)
+	{
+		value = 0;
+		for (uint8_t i = 0; i < bytes; ++i)
+		{
+			int c = file.get();
+			if (c == EOF)
+			{
+				return false;
+			}
+			value |= static_cast<uint64_t>(c) << (8 * i);
+		}
+		return true;
+	}
+
+	static bool readString(std::ifstream &file, std::string &s)
+	{
+		uint64_t size = 0;
+		if (!readInteger(file, size, 1))
+		{
+			return false;
+		}
+		s.resize(size);
+		return static_cast<bool>(file.read(&s[0], size));
+	}
+};
+
+/*
+ * Lays modules out into a program image and patches their relocations.
+ * Sections with the same name are placed together, in the order the names first appear; within a name, in module order.
+ * So the first module's first section starts at address 0, where execution starts.
+ * names are used in messages, which go to log. Prints the layout unless quiet. Returns false (and complains) on errors.
+ */
+inline bool linkObjects(const std::vector<ObjectFile> &modules, const std::vector<std::string> &names, uint8_t *image, bool quiet = false, std::ostream &log = std::cout)
+{
+	//Layout.
+	std::vector<std::string> order;
+	for (const ObjectFile &module : modules)
+	{
+		for (const ObjectSection &section : module.sections)
+		{
+			bool seen = false;
+			for (const std::string &name : order)
+			{
+				seen = seen || name == section.name;
+			}
+			if (!seen)
+			{
+				order.push_back(section.name);
+			}
+		}
+	}
+
+	std::vector<std::vector<uint16_t> > bases(modules.size()); //Address of each module's sections.
+	uint16_t address = 0;
+	for (const std::string &name : order)
+	{
+		for (std::size_t m = 0; m < modules.size(); ++m)
+		{
+			bases[m].resize(modules[m].sections.size());
+			for (std::size_t s = 0; s < modules[m].sections.size(); ++s)
+			{
+				const ObjectSection &section = modules[m].sections[s];
+				if (section.name != name)
+				{
+					continue;
+				}
+
+				if (address + section.data.size() > RAM_SIZE)
+				{
+					log << "Error: Program exceeds max size allowed on this architecture! (section " << name << " of " << names[m] << ")\n";
+					return false;
+				}
+
+				if (!quiet)
+				{
+					log << "Section " << name << " of " << names[m] << " at " << address << " (" << section.data.size() << " bytes)\n";
+				}
+
+				bases[m][s] = address;
+				std::copy(section.data.begin(), section.data.end(), image + address);
+				address += section.data.size();
+			}
+		}
+	}
+
+	//Exported symbols.
+	std::map<std::string, std::pair<uint8_t, std::size_t> > globals; //Name -> address & defining module.
+	for (std::size_t m = 0; m < modules.size(); ++m)
+	{
+		for (const ObjectSymbol &symbol : modules[m].symbols)
+		{
+			if (!(symbol.flags & SYMBOL_DEFINED) || !(symbol.flags & SYMBOL_GLOBAL))
+			{
+				continue;
+			}
+
+			std::map<std::string, std::pair<uint8_t, std::size_t> >::iterator existing = globals.find(symbol.name);
+			if (existing != globals.end())
+			{
+				log << "Error: Symbol \"" << symbol.name << "\" defined in both " << names[existing->second.second] << " and " << names[m] << "\n";
+				return false;
+			}
+
+			globals[symbol.name] = std::make_pair(static_cast<uint8_t>(bases[m][symbol.section] + symbol.offset), m);
+		}
+	}
+
+	//Patch.
+	for (std::size_t m = 0; m < modules.size(); ++m)
+	{
+		for (const Relocation &relocation : modules[m].relocations)
+		{
+			const ObjectSymbol &symbol = modules[m].symbols[relocation.symbol];
+			uint8_t target;
+
+			if (symbol.flags & SYMBOL_DEFINED)
+			{
+				target = bases[m][symbol.section] + symbol.offset;
+			}
+			else if (globals.count(symbol.name))
+			{
+				target = globals[symbol.name].first;
+			}
+			else
+			{
+				log << "Error: Undefined symbol \"" << symbol.name << "\" referenced in " << names[m] << "\n";
+				return false;
+			}
+
+			uint8_t location = bases[m][relocation.section] + relocation.offset;
+			image[location] = (relocation.type == RELOC_ABS8) ? target : static_cast<uint8_t>(target - (location + 1));
+		}
+	}
+
+	return true;
+}
+
+#endif //TRISK_OBJECT_HPP
@@ -0,0 +1,269 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_PROFILE_HPP
+#define TRISK_PROFILE_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "isa.hpp"
+#include "symbolmap.hpp"
+#include "instrumentation.hpp"
+
+/*
+ * Execution profile of a program run: how many times each address was executed, and how many times each jump
+ * (any instruction that didn't continue with the next one: taken branches, jumps, calls & returns) went from where to where.
+ * Collected by tem --profile, written out by tem --profile-out, and read by tas -P to lay the program out along its hot paths.
+ *
+ * The file is plain text, one record per line, addresses in decimal:
+ * 		IMAGE <hash of the image profiled, in hex>
+ * 		COUNT <address> <times executed>
+ * 		JUMP <from address> <to address> <times taken>
+ * The IMAGE record lets tas -P tell a profile of some other build of the program from one it can use.
+ */
+
+struct ExecutionProfile
+{
+	std::vector<uint64_t> counts; //By address.
+	std::map<std::pair<uint16_t, uint16_t>, uint64_t> jumps; //(from, to) -> times taken.
+	uint64_t image_hash = 0; //See hashImage(). 0 if the profile doesn't say.
+
+	explicit ExecutionProfile(uint32_t size = 0) :
+		counts(size, 0)
+	{
+	}
+
+	//Instruction of size bytes at from ran, and the next one is at to.
+	void record(uint16_t from, uint16_t to, uint8_t size)
+	{
+		++counts[from];
+		if (to != static_cast<uint16_t>((from + size) & (counts.size() - 1)))
+		{
+			++jumps[std::make_pair(from, to)];
+		}
+	}
+
+	uint64_t count(uint16_t address) const
+	{
+		return (address < counts.size()) ? counts[address] : 0;
+	}
+
+	//Times the instruction at from jumped anywhere.
+	uint64_t taken(uint16_t from) const
+	{
+		uint64_t total = 0;
+		for (std::map<std::pair<uint16_t, uint16_t>, uint64_t>::const_iterator i = jumps.lower_bound(std::make_pair(from, 0)); i != jumps.end() && i->first.first == from; ++i)
+		{
+			total += i->second;
+		}
+		return total;
+	}
+
+	//FNV-1a of a program image.
+	static uint64_t hashImage(const uint8_t *image, uint32_t size)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		for (uint32_t i = 0; i < size; ++i)
+		{
+			hash ^= image[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	//Returns false (and complains to log) if the file can't be written.
+	bool write(const std::string &filename, std::ostream &log = std::cout) const
+	{
+		std::ofstream file(filename);
+		if (!file)
+		{
+			log << "Error: Could not open output file \"" << filename << "\"\n";
+			return false;
+		}
+
+		if (image_hash)
+		{
+			file << "IMAGE " << std::hex << image_hash << std::dec << "\n";
+		}
+		for (uint32_t address = 0; address < counts.size(); ++address)
+		{
+			if (counts[address])
+			{
+				file << "COUNT " << address << " " << counts[address] << "\n";
+			}
+		}
+		for (const std::pair<const std::pair<uint16_t, uint16_t>, uint64_t> &jump : jumps)
+		{
+			file << "JUMP " << jump.first.first << " " << jump.first.second << " " << jump.second << "\n";
+		}
+
+		return static_cast<bool>(file);
+	}
+
+	//Returns false (and complains to log) if the file is missing or malformed. Addresses must be below size.
+	bool read(const std::string &filename, uint32_t size, std::ostream &log = std::cout)
+	{
+		std::ifstream file(filename);
+		if (!file)
+		{
+			log << "Error: Could not open profile \"" << filename << "\"\n";
+			return false;
+		}
+
+		counts.assign(size, 0);
+		jumps.clear();
+		image_hash = 0;
+		std::string line;
+		uint32_t line_number = 0;
+		while (std::getline(file, line))
+		{
+			++line_number;
+			std::istringstream fields(line);
+			std::string kind;
+			uint32_t from = 0, to = 0;
+			uint64_t times = 0;
+			if (!(fields >> kind))
+			{
+				continue;
+			}
+
+			if (kind == "IMAGE" && (fields >> std::hex >> image_hash))
+			{
+				continue;
+			}
+			else if (kind == "COUNT" && (fields >> from >> times) && from < size)
+			{
+				counts[from] += times;
+			}
+			else if (kind == "JUMP" && (fields >> from >> to >> times) && from < size && to < size)
+			{
+				jumps[std::make_pair(from, to)] += times;
+			}
+			else
+			{
+				log << "Error: \"" << filename << "\" line " << line_number << ": Invalid profile record.\n";
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
+
+/*
+ * Instructions executed per guest call stack, for flame graphs & the like.
+ * Routines are tracked through CALL & RET (so calls made by pushing a return address & jumping aren't seen),
+ * and each is named after the address it was called at. The outermost frame is the program's entry point.
+ * Stacks are kept as a tree, each node a routine called from its parent, so recording an instruction is just a count.
+ *
+ * Written out in the folded format that perf script output is turned into by stackcollapse-perf.pl,
+ * one line per stack, outermost routine first:
+ * 		<routine>;<routine>;... <instructions executed>
+ * so guest stacks go through the same flame graph tools (flamegraph.pl, speedscope, ...) as perf's host side ones.
+ */
+
+struct StackProfile
+{
+	struct Node
+	{
+		uint32_t parent;
+		uint16_t entry; //Address of the routine.
+		uint64_t count; //Instructions executed in it (not in its callees).
+	};
+
+	std::vector<Node> nodes; //nodes[0] is the entry point.
+	std::map<std::pair<uint32_t, uint16_t>, uint32_t> children; //(parent node, entry) -> node.
+	uint32_t current;
+
+	explicit StackProfile(uint16_t entry = 0) :
+		nodes(1, Node { 0, entry, 0 }),
+		current(0)
+	{
+	}
+
+	//Instruction of this operation ran in the current routine, and the next one is at to.
+	void record(Operation operation, uint16_t to)
+	{
+		++nodes[current].count;
+		if (operation == OP_CALL)
+		{
+			std::pair<std::map<std::pair<uint32_t, uint16_t>, uint32_t>::iterator, bool> inserted = children.insert(std::make_pair(std::make_pair(current, to), static_cast<uint32_t>(nodes.size())));
+			if (inserted.second)
+			{
+				nodes.push_back(Node { current, to, 0 });
+			}
+			current = inserted.first->second;
+		}
+		else if (operation == OP_RET && current)
+		{
+			current = nodes[current].parent;
+		}
+	}
+
+	//Routine names are labels from symbols where there are any, addresses otherwise. Returns false (and complains to log) if the file can't be written.
+	bool write(const std::string &filename, const SymbolMap &symbols, std::ostream &log = std::cout) const
+	{
+		std::ofstream file(filename);
+		if (!file)
+		{
+			log << "Error: Could not open output file \"" << filename << "\"\n";
+			return false;
+		}
+
+		//Parents are always created before their children, so their paths are known by the time the children need them.
+		std::vector<std::string> paths(nodes.size());
+		for (uint32_t i = 0; i < nodes.size(); ++i)
+		{
+			std::string name = symbols.label(nodes[i].entry);
+			if (name.empty())
+			{
+				std::ostringstream address;
+				address << "0x" << std::hex << nodes[i].entry;
+				name = address.str();
+			}
+			paths[i] = i ? paths[nodes[i].parent] + ";" + name : name;
+
+			if (nodes[i].count)
+			{
+				file << paths[i] << " " << nodes[i].count << "\n";
+			}
+		}
+
+		return static_cast<bool>(file);
+	}
+};
+
+/*
+ * Instrumentation (see instrumentation.hpp) that profiles the run: Counts for an ExecutionProfile, Stacks for a StackProfile.
+ * Both are compile time switches, so the run loop only has the recording that was asked for.
+ */
+template <bool Counts, bool Stacks>
+struct Profiling : NoInstrumentation
+{
+	ExecutionProfile profile;
+	StackProfile stacks;
+
+	Profiling() :
+		profile(Counts ? RAM_SIZE : 0)
+	{
+	}
+
+	void onInstruction(uint8_t address, uint8_t next, uint8_t opcode)
+	{
+		if (Counts)
+		{
+			profile.record(address, next, DECODE_TABLE[opcode].size);
+		}
+		if (Stacks)
+		{
+			stacks.record(DECODE_TABLE[opcode].operation, next);
+		}
+	}
+};
+
+#endif //TRISK_PROFILE_HPP
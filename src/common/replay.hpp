@@ -0,0 +1,191 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_REPLAY_HPP
+#define TRISK_REPLAY_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "isa.hpp"
+#include "delta.hpp"
+
+/*
+ * Replay logs: everything that decided how a tem run turned out, other than the program itself, so the run can be
+ * reproduced exactly somewhere else. The machine has no devices, so the only input from outside the program is the
+ * wall clock, through --timeout-ms: which instruction a run was stopped at depends on how busy the host was.
+ * tem --record logs that by instruction count, and tem --replay runs the image again, stopping at the same instruction.
+ * The replay is just a run with an instruction limit, so it goes at full speed.
+ *
+ * File layout: "TRPL" <u8 version> <u64 FNV-1a of the initial RAM> <u8 address bits> <max instructions> <timeout ms>
+ * 		<number of events> { <instructions since the previous event> <u8 event> }
+ * 		<u64 FNV-1a of the final RAM> <final instruction count>
+ * Numbers without a size are varints, as in delta files (see delta.hpp). The final state is there to check the replay against.
+ */
+
+static const uint8_t REPLAY_VERSION = 3;
+
+enum ReplayEvent : uint8_t
+{
+	REPLAY_TIMEOUT //Stopped by the wall-clock deadline.
+};
+
+struct ReplayLog
+{
+	struct Event
+	{
+		uint64_t instruction; //Instruction count when it happened.
+		uint8_t event; //ReplayEvent
+	};
+
+	uint64_t image_hash = 0;
+	uint8_t address_bits = ADDRESS_BITS; //Machine variant the run was on.
+	uint64_t max_instructions = 0;
+	uint64_t timeout_ms = 0;
+	std::vector<Event> events;
+	uint64_t final_hash = 0;
+	uint64_t final_instructions = 0;
+
+	static uint64_t hashRAM(const uint8_t *ram, uint32_t size)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		for (uint32_t i = 0; i < size; ++i)
+		{
+			hash ^= ram[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	//The instruction limit that ends the run where the recorded one ended (0 = none).
+	uint64_t stopAt() const
+	{
+		for (const Event &event : events)
+		{
+			if (event.event == REPLAY_TIMEOUT)
+			{
+				return event.instruction;
+			}
+		}
+		return max_instructions;
+	}
+
+	bool timedOut() const
+	{
+		return !events.empty() && events.back().event == REPLAY_TIMEOUT;
+	}
+
+	//Returns false (and complains to log) if the file can't be written.
+	bool write(const std::string &filename, std::ostream &log = std::cout) const
+	{
+		std::ofstream file(filename, std::ios::binary);
+		if (!file)
+		{
+			log << "Error: Could not open output file \"" << filename << "\"\n";
+			return false;
+		}
+
+		file.write("TRPL", 4);
+		file.put(static_cast<char>(REPLAY_VERSION));
+		writeInteger(file, image_hash);
+		file.put(static_cast<char>(address_bits));
+		RunDelta::writeVarint(file, max_instructions);
+		RunDelta::writeVarint(file, timeout_ms);
+
+		RunDelta::writeVarint(file, events.size());
+		uint64_t previous = 0;
+		for (const Event &event : events)
+		{
+			RunDelta::writeVarint(file, event.instruction - previous);
+			file.put(static_cast<char>(event.event));
+			previous = event.instruction;
+		}
+
+		writeInteger(file, final_hash);
+		RunDelta::writeVarint(file, final_instructions);
+
+		if (!file)
+		{
+			log << "Error: Could not write output file \"" << filename << "\"\n";
+			return false;
+		}
+		return true;
+	}
+
+	//Returns false (and complains to log) if the file can't be read or isn't a replay log.
+	bool read(const std::string &filename, std::ostream &log = std::cout)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		if (!file)
+		{
+			log << "Error: Could not open replay log \"" << filename << "\"\n";
+			return false;
+		}
+
+		char magic[4];
+		uint64_t count;
+		if (!file.read(magic, 4) || std::string(magic, 4) != "TRPL" || file.get() != REPLAY_VERSION || !readInteger(file, image_hash))
+		{
+			log << "Error: \"" << filename << "\" is not a replay log.\n";
+			return false;
+		}
+		int bits = file.get();
+		address_bits = static_cast<uint8_t>(bits);
+		if ((bits != 8 && bits != 16) || !RunDelta::readVarint(file, max_instructions) || !RunDelta::readVarint(file, timeout_ms) || !RunDelta::readVarint(file, count))
+		{
+			log << "Error: \"" << filename << "\" is not a valid replay log.\n";
+			return false;
+		}
+
+		events.clear();
+		uint64_t previous = 0;
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			uint64_t gap;
+			int event;
+			if (!RunDelta::readVarint(file, gap) || (event = file.get()) != REPLAY_TIMEOUT)
+			{
+				log << "Error: \"" << filename << "\" has an invalid event.\n";
+				return false;
+			}
+			previous += gap;
+			events.push_back(Event { previous, static_cast<uint8_t>(event) });
+		}
+
+		if (!readInteger(file, final_hash) || !RunDelta::readVarint(file, final_instructions))
+		{
+			log << "Error: \"" << filename << "\" is cut short.\n";
+			return false;
+		}
+		return true;
+	}
+
+private:
+	//Little endian, 8 bytes.
+	static void writeInteger(std::ostream &file, uint64_t value)
+	{
+		for (uint8_t i = 0; i < 8; ++i)
+		{
+			file.put(static_cast<char>(value >> (8 * i)));
+		}
+	}
+
+	static bool readInteger(std::istream &file, uint64_t &value)
+	{
+		value = 0;
+		for (uint8_t i = 0; i < 8; ++i)
+		{
+			int byte = file.get();
+			if (byte == EOF)
+			{
+				return false;
+			}
+			value |= static_cast<uint64_t>(byte) << (8 * i);
+		}
+		return true;
+	}
+};
+
+#endif //TRISK_REPLAY_HPP
@@ -0,0 +1,187 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_SYMBOLMAP_HPP
+#define TRISK_SYMBOLMAP_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <iterator>
+
+/*
+ * Debug symbols for a program image: the labels, and which source line & kind of statement (code or BYTE data)
+ * each address came from. tas writes them next to the program it assembles, as <program file>.sym,
+ * and tem reads them to report addresses as label+offset & source line in traces, profiles and errors.
+ *
+ * The file is plain text, one record per line, addresses in decimal:
+ * 		SOURCE <source file>
+ * 		LABEL <address> <name>
+ * 		CODE <address> <size> <line>
+ * 		DATA <address> <line>
+ */
+
+class SymbolMap
+{
+public:
+	struct Statement
+	{
+		bool code; //Instruction, or BYTE data.
+		uint16_t size;
+		uint32_t line;
+	};
+
+	std::string source;
+
+private:
+	std::multimap<uint16_t, std::string> labels; //By address.
+	std::map<uint16_t, Statement> statements; //By first address.
+
+public:
+	static std::string filenameFor(const std::string &program)
+	{
+		return program + ".sym";
+	}
+
+	void addLabel(uint16_t address, const std::string &name)
+	{
+		labels.insert(std::make_pair(address, name));
+	}
+
+	void addStatement(uint16_t address, bool code, uint16_t size, uint32_t line)
+	{
+		statements[address] = Statement { code, size, line };
+	}
+
+	bool empty() const
+	{
+		return labels.empty() && statements.empty();
+	}
+
+	//Statement address is part of, nullptr if none.
+	const Statement *statementAt(uint16_t address) const
+	{
+		std::map<uint16_t, Statement>::const_iterator i = statements.upper_bound(address);
+		if (i == statements.begin())
+		{
+			return nullptr;
+		}
+		--i;
+		return (address < i->first + i->second.size) ? &i->second : nullptr;
+	}
+
+	//"<label>" or "<label>+<offset>" for the closest label at or before address, "" if there's none.
+	std::string label(uint16_t address, bool offset = true) const
+	{
+		std::multimap<uint16_t, std::string>::const_iterator i = labels.upper_bound(address);
+		if (i == labels.begin())
+		{
+			return "";
+		}
+		uint16_t start = (--i)->first;
+		while (i != labels.begin() && std::prev(i)->first == start)
+		{
+			--i; //First label defined at start.
+		}
+		return (address == start || !offset) ? i->second : i->second + "+" + std::to_string(address - start);
+	}
+
+	//E.g. "0x1c loop+2 (strlen.tas:14)", or just the address when nothing's known about it.
+	std::string describe(uint16_t address) const
+	{
+		std::ostringstream text;
+		text << "0x" << std::hex << address << std::dec;
+
+		std::string name = label(address);
+		if (!name.empty())
+		{
+			text << " " << name;
+		}
+		const Statement *statement = statementAt(address);
+		if (statement)
+		{
+			text << " (" << source << ":" << statement->line << (statement->code ? "" : ", data") << ")";
+		}
+		return text.str();
+	}
+
+	//Returns false (and complains to log) if the file can't be written.
+	bool write(const std::string &filename, std::ostream &log = std::cout) const
+	{
+		std::ofstream file(filename);
+		if (!file)
+		{
+			log << "Error: Could not open output file \"" << filename << "\"\n";
+			return false;
+		}
+
+		file << "SOURCE " << source << "\n";
+		for (const std::pair<const uint16_t, std::string> &label : labels)
+		{
+			file << "LABEL " << label.first << " " << label.second << "\n";
+		}
+		for (const std::pair<const uint16_t, Statement> &statement : statements)
+		{
+			if (statement.second.code)
+			{
+				file << "CODE " << statement.first << " " << statement.second.size << " " << statement.second.line << "\n";
+			}
+			else
+			{
+				file << "DATA " << statement.first << " " << statement.second.line << "\n";
+			}
+		}
+
+		return static_cast<bool>(file);
+	}
+
+	//Returns false if there's no such file. Complains if it's there but malformed.
+	bool read(const std::string &filename)
+	{
+		std::ifstream file(filename);
+		if (!file)
+		{
+			return false;
+		}
+
+		std::string line;
+		uint32_t line_number = 0;
+		while (std::getline(file, line))
+		{
+			++line_number;
+			std::istringstream fields(line);
+			std::string kind, name;
+			uint32_t address = 0, size = 1, source_line = 0;
+			bool ok = static_cast<bool>(fields >> kind);
+			if (ok && kind == "SOURCE")
+			{
+				std::getline(fields >> std::ws, source);
+			}
+			else if (ok && kind == "LABEL" && (fields >> address >> name) && address <= UINT16_MAX)
+			{
+				addLabel(address, name);
+			}
+			else if (ok && kind == "CODE" && (fields >> address >> size >> source_line) && address <= UINT16_MAX)
+			{
+				addStatement(address, true, size, source_line);
+			}
+			else if (ok && kind == "DATA" && (fields >> address >> source_line) && address <= UINT16_MAX)
+			{
+				addStatement(address, false, 1, source_line);
+			}
+			else if (ok)
+			{
+				std::cout << "Error: \"" << filename << "\" line " << line_number << ": Invalid symbol record.\n";
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
+
+#endif //TRISK_SYMBOLMAP_HPP
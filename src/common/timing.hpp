@@ -0,0 +1,122 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_TIMING_HPP
+#define TRISK_TIMING_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cctype>
+
+#include "isa.hpp"
+
+/*
+ * How many cycles each instruction takes on the hardware build.
+ * The default model: one cycle per byte fetched plus one to execute, one more for each RAM access,
+ * MUL takes 3 extra cycles in the multiplier. Block instructions also take a number of cycles per byte
+ * they touch (per_byte * bytes processed).
+ */
+
+struct CycleCost
+{
+	uint16_t base;
+	uint16_t per_byte; //Only used by the block instructions.
+};
+
+class CycleTable
+{
+	CycleCost costs[NUM_OPERATIONS];
+
+public:
+	CycleTable()
+	{
+		for (uint16_t i = 0; i < NUM_OPERATIONS; ++i)
+		{
+			costs[i] = CycleCost { static_cast<uint16_t>(INSTRUCTION_SET[i].size + 1), 0 };
+		}
+
+		//RAM accesses.
+		costs[OP_LD].base += 1;
+		costs[OP_ST].base += 1;
+		costs[OP_PUSH].base += 1;
+		costs[OP_POP].base += 1;
+		costs[OP_CALL].base += 1;
+		costs[OP_RET].base += 1;
+		costs[OP_MUL].base += 3;
+
+		costs[OP_MCPY] = CycleCost { 3, 2 }; //A load & a store per byte.
+		costs[OP_MSET] = CycleCost { 3, 1 };
+		costs[OP_MSCAN] = CycleCost { 3, 1 };
+		costs[OP_MCMP] = CycleCost { 3, 2 }; //Two loads per byte.
+	}
+
+	const CycleCost &operator[](Operation operation) const
+	{
+		return costs[operation];
+	}
+
+	/*
+	 * Overrides costs with the ones in a file. One instruction per line: <mnemonic> <base cycles> [<cycles per byte>]
+	 * Anything after a ';' is a comment. Returns false (and complains) on errors.
+	 */
+	bool load(const std::string &filename)
+	{
+		std::ifstream file(filename);
+
+		if (!file)
+		{
+			std::cout << "Error: failed to open cycle table: \"" << filename << "\"\n";
+			return false;
+		}
+
+		std::string line;
+		uint32_t line_number = 0;
+		while (std::getline(file, line))
+		{
+			++line_number;
+
+			std::size_t comment_index = line.find(";");
+			if (comment_index != std::string::npos)
+			{
+				line.erase(comment_index);
+			}
+
+			std::stringstream ss(line);
+			std::string name;
+			if (!(ss >> name))
+			{
+				continue; //Empty line.
+			}
+
+			for (auto & c: name)
+			{
+				c = toupper(c);
+			}
+
+			uint16_t i;
+			for (i = 0; i < NUM_OPERATIONS; ++i)
+			{
+				if (name == INSTRUCTION_SET[i].name)
+				{
+					break;
+				}
+			}
+
+			CycleCost cost = { 0, 0 };
+			if (i == NUM_OPERATIONS || !(ss >> cost.base))
+			{
+				std::cout << "Error: " << filename << ":" << line_number << ": expected \"<mnemonic> <base cycles> [<cycles per byte>]\".\n";
+				return false;
+			}
+			ss >> cost.per_byte;
+
+			costs[i] = cost;
+		}
+
+		return true;
+	}
+};
+
+#endif //TRISK_TIMING_HPP
@@ -0,0 +1,263 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_CLEXER_HPP
+#define TRISK_CLEXER_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cctype>
+#include <cstring>
+
+/*
+ * Splits C source into tokens. Comments and preprocessor lines (#include & co.) are skipped.
+ * Numbers are decimal, hexadecimal (0x..) or character constants, and must fit in 8 bits once used.
+ */
+
+enum CTokenKind
+{
+	CTOKEN_IDENTIFIER,	//Keywords too.
+	CTOKEN_NUMBER,
+	CTOKEN_STRING,
+	CTOKEN_PUNCTUATOR,
+	CTOKEN_END
+};
+
+struct CToken
+{
+	CTokenKind kind;
+	std::string text; //Contents for strings, escapes already replaced.
+	uint32_t value; //For numbers.
+	uint32_t line; //Both start at 1.
+	uint32_t column;
+};
+
+//Prefix for error messages about token.
+inline std::string location(const CToken &token)
+{
+	return "line " + std::to_string(token.line) + ", column " + std::to_string(token.column) + ": ";
+}
+
+//Complains about token & throws.
+[[noreturn]] inline void compileError(const CToken &token, const std::string &message)
+{
+	std::cout << "Error: " << location(token) << message << "\n";
+	throw 0;
+}
+
+class CLexer
+{
+	const std::string &source;
+	std::size_t i;
+	uint32_t line;
+	std::size_t line_start;
+
+	CToken make(CTokenKind kind, std::size_t start) const
+	{
+		return CToken { kind, "", 0, line, static_cast<uint32_t>(start - line_start + 1) };
+	}
+
+	char peek(std::size_t ahead = 0) const
+	{
+		return (i + ahead < source.size()) ? source[i + ahead] : '\0';
+	}
+
+	void newLine()
+	{
+		++line;
+		line_start = i;
+	}
+
+	//Reads one (possibly escaped) character of a string or character constant.
+	char readCharacter(const CToken &token)
+	{
+		char c = source[i++];
+		if (c != '\\')
+		{
+			return c;
+		}
+
+		if (i >= source.size())
+		{
+			compileError(token, "Unterminated escape sequence.");
+		}
+
+		c = source[i++];
+		switch (c)
+		{
+		case 'n': return '\n';
+		case 't': return '\t';
+		case 'r': return '\r';
+		case '0': return '\0';
+		case '\\': return '\\';
+		case '\'': return '\'';
+		case '"': return '"';
+		default:
+			compileError(token, std::string("Unknown escape sequence \"\\") + c + "\".");
+		}
+	}
+
+public:
+	CLexer(const std::string &source_code) :
+		source(source_code)
+	{
+		i = 0;
+		line = 1;
+		line_start = 0;
+	}
+
+	//Throws on error.
+	void tokenize(std::vector<CToken> &tokens)
+	{
+		static const char *PUNCTUATORS[] = { "<<=", ">>=", "++", "--", "+=", "-=", "*=", "&=", "|=", "^=", "<<", ">>", "==", "!=", "<=", ">=", "&&", "||" };
+
+		bool line_begins = true;
+		while (i < source.size())
+		{
+			char c = source[i];
+
+			if (c == '\n')
+			{
+				++i;
+				newLine();
+				line_begins = true;
+				continue;
+			}
+			if (isspace(static_cast<unsigned char>(c)))
+			{
+				++i;
+				continue;
+			}
+			if (c == '#' && line_begins)
+			{
+				while (i < source.size() && source[i] != '\n')
+				{
+					++i;
+				}
+				continue;
+			}
+			line_begins = false;
+
+			if (c == '/' && peek(1) == '/')
+			{
+				while (i < source.size() && source[i] != '\n')
+				{
+					++i;
+				}
+				continue;
+			}
+			if (c == '/' && peek(1) == '*')
+			{
+				CToken start = make(CTOKEN_PUNCTUATOR, i);
+				for (i += 2; !(peek() == '*' && peek(1) == '/'); ++i)
+				{
+					if (i >= source.size())
+					{
+						compileError(start, "Unterminated comment.");
+					}
+					if (source[i] == '\n')
+					{
+						newLine();
+						line_start = i + 1;
+					}
+				}
+				i += 2;
+				continue;
+			}
+
+			std::size_t start = i;
+			if (isalpha(static_cast<unsigned char>(c)) || c == '_')
+			{
+				CToken token = make(CTOKEN_IDENTIFIER, start);
+				while (isalnum(static_cast<unsigned char>(peek())) || peek() == '_')
+				{
+					++i;
+				}
+				token.text = source.substr(start, i - start);
+				tokens.push_back(token);
+			}
+			else if (isdigit(static_cast<unsigned char>(c)))
+			{
+				CToken token = make(CTOKEN_NUMBER, start);
+				bool hex = (c == '0' && (peek(1) == 'x' || peek(1) == 'X'));
+				i += hex ? 2 : 0;
+				while (isalnum(static_cast<unsigned char>(peek())))
+				{
+					++i;
+				}
+				token.text = source.substr(start, i - start);
+
+				std::size_t digits = hex ? 2 : 0;
+				//Allow the usual integer suffixes.
+				std::size_t end = token.text.find_last_not_of("uUlL") + 1;
+				if (end <= digits || token.text.substr(digits, end - digits).find_first_not_of(hex ? "0123456789abcdefABCDEF" : "0123456789") != std::string::npos || end - digits > 8)
+				{
+					compileError(token, "Invalid number \"" + token.text + "\".");
+				}
+				token.value = std::stoul(token.text.substr(digits, end - digits), nullptr, hex ? 16 : 10);
+				tokens.push_back(token);
+			}
+			else if (c == '\'')
+			{
+				CToken token = make(CTOKEN_NUMBER, start);
+				++i;
+				if (peek() == '\'' || peek() == '\n' || i >= source.size())
+				{
+					compileError(token, "Empty character constant.");
+				}
+				token.value = static_cast<uint8_t>(readCharacter(token));
+				if (peek() != '\'')
+				{
+					compileError(token, "Unterminated character constant.");
+				}
+				++i;
+				token.text = source.substr(start, i - start);
+				tokens.push_back(token);
+			}
+			else if (c == '"')
+			{
+				CToken token = make(CTOKEN_STRING, start);
+				++i;
+				while (peek() != '"')
+				{
+					if (i >= source.size() || peek() == '\n')
+					{
+						compileError(token, "Unterminated string.");
+					}
+					token.text += readCharacter(token);
+				}
+				++i;
+				tokens.push_back(token);
+			}
+			else
+			{
+				CToken token = make(CTOKEN_PUNCTUATOR, start);
+				for (const char *punctuator : PUNCTUATORS)
+				{
+					if (source.compare(i, strlen(punctuator), punctuator) == 0)
+					{
+						token.text = punctuator;
+						break;
+					}
+				}
+				if (token.text.empty())
+				{
+					if (strchr("{}()[];,=+-*&|^~!<>?:", c) == nullptr)
+					{
+						compileError(token, std::string("Unexpected character '") + c + "'.");
+					}
+					token.text = std::string(1, c);
+				}
+				i += token.text.size();
+				tokens.push_back(token);
+			}
+		}
+
+		CToken end = make(CTOKEN_END, i);
+		end.text = "end of file";
+		tokens.push_back(end);
+	}
+};
+
+#endif //TRISK_CLEXER_HPP
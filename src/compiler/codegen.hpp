@@ -0,0 +1,677 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_CODEGEN_HPP
+#define TRISK_CODEGEN_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <map>
+#include <algorithm>
+
+#include "isa.hpp"
+#include "ir.hpp"
+#include "optimizer.hpp"
+
+/*
+ * Turns register allocated IR into tas source.
+ *
+ * Calling convention (the one the *_stack samples use):
+ * * Arguments in A & B, return value in A. C holds the callee's address for CALL.
+ * * D is the stack pointer, growing down. Locals that live in memory are at D + offset, below the return address:
+ *   functions start with SUBI D <frame size> & end with ADDI D <frame size>, RET.
+ * * All registers are caller saved: registers still needed after a call are PUSHed before it & POPped after.
+ * * Functions that don't call anything & have an empty frame may use D as a register (see regalloc.hpp). They store it
+ *   in <label>.sp on entry & load it back before returning. main doesn't, as it never returns.
+ * main comes first, so execution starts there, and ends with HALT. Globals are laid out after the code.
+ *
+ * Blocks are laid out so that most jumps become fall throughs, and compares against 0 are left out when the
+ * instruction before already set Z for that register.
+ *
+ * The stack starts at the top of RAM & nothing stops it growing down into the globals, so checkStack() warns
+ * when the program & the deepest chain of calls it can make don't fit in RAM together.
+ */
+
+class CodeGenerator
+{
+	IRFunction *function;
+	const std::vector<int> *colors;
+	std::ostringstream out;
+
+	int zero_register; //Register the Z flag tells whether it's 0, -1 if none.
+
+	//Stack a function uses, for checkStack().
+	struct StackUse
+	{
+		std::string name;
+		uint16_t own; //Frame & pushes, not counting calls.
+		std::vector<std::pair<std::string, uint16_t> > calls; //Callee label, & the stack the function had in use at the call.
+	};
+	std::map<std::string, StackUse> stack_use; //By function label.
+	uint16_t stack_depth; //Bytes pushed in the function being generated, on top of its frame.
+	uint32_t image_size; //Bytes generated so far.
+
+	static const char *registerName(int reg)
+	{
+		static const char *NAMES[] = { "A", "B", "C", "D" };
+		return NAMES[reg];
+	}
+
+	int reg(VReg v) const
+	{
+		return (*colors)[v];
+	}
+
+	std::string blockLabel(uint32_t block) const
+	{
+		return function->label + ".L" + std::to_string(block);
+	}
+
+	void line(const std::string &text)
+	{
+		out << "\t" << text << "\n";
+
+		std::string mnemonic = text.substr(0, text.find(' '));
+		uint8_t size = 1; //BYTE
+		for (const InstructionInfo &info : INSTRUCTION_SET)
+		{
+			if (mnemonic == info.name)
+			{
+				size = info.size;
+				break;
+			}
+		}
+		image_size += size;
+	}
+
+	//Instruction on registers, keeping track of what Z says.
+	void op(const char *mnemonic, int x, int y = -1)
+	{
+		std::string text = mnemonic;
+		text += std::string(" ") + registerName(x);
+		if (y >= 0)
+		{
+			text += std::string(" ") + registerName(y);
+		}
+		line(text);
+
+		std::string name = mnemonic;
+		StackUse &use = stack_use[function->label];
+		if (name == "PUSH")
+		{
+			++stack_depth;
+			use.own = std::max<uint16_t>(use.own, function->frame_size + stack_depth);
+		}
+		else if (name == "POP")
+		{
+			--stack_depth;
+		}
+
+		static const char *SETS_Z[] = { "ADD", "SUB", "AND", "OR", "LSHIFT", "RSHIFT", "NOT", "MUL" };
+		for (const char *alu : SETS_Z)
+		{
+			if (name == alu)
+			{
+				zero_register = x;
+				return;
+			}
+		}
+		if (name == "CMP")
+		{
+			zero_register = -1;
+		}
+		else if ((name == "SET" || name == "LD" || name == "POP") && zero_register == x)
+		{
+			zero_register = -1; //Overwritten without touching the flags.
+		}
+	}
+
+	void immediate(const char *mnemonic, int x, const std::string &value)
+	{
+		line(std::string(mnemonic) + " " + registerName(x) + " " + value);
+		std::string name = mnemonic;
+		if (name == "ADDI" || name == "SUBI")
+		{
+			zero_register = x;
+		}
+		else if (name == "CMPI")
+		{
+			zero_register = (value == "0") ? x : -1;
+		}
+		else if (zero_register == x)
+		{
+			zero_register = -1; //LDI
+		}
+	}
+
+	void set(int x, int y)
+	{
+		if (x != y)
+		{
+			op("SET", x, y);
+		}
+	}
+
+	//Sets register moves[i].first to moves[i].second, all at once. Cycles go through scratch, or the stack if there's none.
+	void parallelMove(std::vector<std::pair<int, int> > moves, int scratch = -1)
+	{
+		moves.erase(std::remove_if(moves.begin(), moves.end(), [](const std::pair<int, int> &move) { return move.first == move.second; }), moves.end());
+
+		std::vector<int> stacked; //Destinations waiting for a value that was pushed.
+		while (!moves.empty() || !stacked.empty())
+		{
+			bool progress = false;
+			for (std::size_t i = 0; i < moves.size(); ++i)
+			{
+				bool blocked = false;
+				for (std::size_t j = 0; j < moves.size(); ++j)
+				{
+					blocked = blocked || (j != i && moves[j].second == moves[i].first);
+				}
+				if (!blocked)
+				{
+					set(moves[i].first, moves[i].second);
+					moves.erase(moves.begin() + i);
+					progress = true;
+					break;
+				}
+			}
+			if (progress)
+			{
+				continue;
+			}
+
+			if (moves.empty())
+			{
+				op("POP", stacked.back());
+				stacked.pop_back();
+				continue;
+			}
+
+			//A cycle: put one source aside, and move it into its destination last.
+			if (scratch >= 0)
+			{
+				set(scratch, moves[0].second);
+				moves[0].second = scratch;
+				continue;
+			}
+			op("PUSH", moves[0].second);
+			stacked.push_back(moves[0].first);
+			moves.erase(moves.begin());
+		}
+	}
+
+	std::string savedStackPointer() const
+	{
+		return function->label + ".sp";
+	}
+
+	void epilogue()
+	{
+		if (function->borrows_stack_pointer && !function->is_main)
+		{
+			//A has the return value.
+			immediate("LDI", 1, savedStackPointer());
+			op("LD", 3, 1);
+		}
+		if (function->frame_size)
+		{
+			immediate("ADDI", 3, std::to_string(function->frame_size));
+		}
+	}
+
+	void frameAddress(int x, uint32_t object)
+	{
+		set(x, 3);
+		uint16_t offset = function->frame[object].offset;
+		if (offset)
+		{
+			immediate("ADDI", x, std::to_string(offset));
+		}
+	}
+
+	void call(IRInstruction &instruction, const VRegSet &live_after)
+	{
+		//Save whatever is still needed after the call.
+		std::vector<int> saved;
+		for (VReg v : live_after)
+		{
+			int r = reg(v);
+			if (v != instruction.d && std::find(saved.begin(), saved.end(), r) == saved.end())
+			{
+				saved.push_back(r);
+			}
+		}
+		std::sort(saved.begin(), saved.end());
+		for (int r : saved)
+		{
+			op("PUSH", r);
+		}
+
+		std::vector<std::pair<int, int> > moves;
+		for (std::size_t n = 0; n < instruction.arguments.size(); ++n)
+		{
+			moves.push_back(std::make_pair(static_cast<int>(n), reg(instruction.arguments[n])));
+		}
+		parallelMove(moves);
+
+		immediate("LDI", 2, instruction.label);
+		stack_use[function->label].calls.push_back(std::make_pair(instruction.label, function->frame_size + stack_depth));
+		op("CALL", 2);
+		zero_register = -1;
+
+		if (instruction.d != NO_VREG && live_after.count(instruction.d))
+		{
+			set(reg(instruction.d), 0);
+		}
+		for (std::size_t i = saved.size(); i-- > 0; )
+		{
+			op("POP", saved[i]);
+		}
+	}
+
+	//d = a <op> b, with only two operand instructions.
+	void twoAddress(const char *mnemonic, const IRInstruction &instruction, bool commutative)
+	{
+		int d = reg(instruction.d), a = reg(instruction.a), b = reg(instruction.b);
+		if (d == a)
+		{
+			op(mnemonic, d, b);
+		}
+		else if (d == b && commutative)
+		{
+			op(mnemonic, d, a);
+		}
+		else
+		{
+			set(d, a);
+			op(mnemonic, d, b);
+		}
+	}
+
+	void instruction(IRInstruction &instruction, const VRegSet &live_after)
+	{
+		switch (instruction.opcode)
+		{
+		case IR_CONST:
+			immediate("LDI", reg(instruction.d), std::to_string(instruction.value));
+			break;
+
+		case IR_COPY:
+			set(reg(instruction.d), reg(instruction.a));
+			break;
+
+		case IR_ADD:
+		case IR_SUB:
+			if (instruction.immediate)
+			{
+				set(reg(instruction.d), reg(instruction.a));
+				immediate(instruction.opcode == IR_ADD ? "ADDI" : "SUBI", reg(instruction.d), std::to_string(instruction.value));
+			}
+			else
+			{
+				twoAddress(instruction.opcode == IR_ADD ? "ADD" : "SUB", instruction, instruction.opcode == IR_ADD);
+			}
+			break;
+
+		case IR_AND:
+			twoAddress("AND", instruction, true);
+			break;
+
+		case IR_OR:
+			twoAddress("OR", instruction, true);
+			break;
+
+		case IR_MUL:
+			twoAddress("MUL", instruction, false);
+			break;
+
+		case IR_SHL:
+			if (instruction.immediate)
+			{
+				//x << 1 is x + x.
+				set(reg(instruction.d), reg(instruction.a));
+				for (uint8_t i = 0; i < instruction.value; ++i)
+				{
+					op("ADD", reg(instruction.d), reg(instruction.d));
+				}
+			}
+			else
+			{
+				twoAddress("LSHIFT", instruction, false);
+			}
+			break;
+
+		case IR_SHR:
+			twoAddress("RSHIFT", instruction, false);
+			break;
+
+		case IR_NOT:
+			set(reg(instruction.d), reg(instruction.a));
+			op("NOT", reg(instruction.d));
+			break;
+
+		case IR_LOAD:
+			op("LD", reg(instruction.d), reg(instruction.a));
+			break;
+
+		case IR_STORE:
+			op("ST", reg(instruction.a), reg(instruction.b));
+			break;
+
+		case IR_GLOBAL_ADDRESS:
+			immediate("LDI", reg(instruction.d), instruction.label);
+			break;
+
+		case IR_FRAME_ADDRESS:
+			frameAddress(reg(instruction.d), instruction.object);
+			break;
+
+		case IR_FRAME_LOAD:
+			if (function->frame[instruction.object].offset == 0)
+			{
+				op("LD", reg(instruction.d), 3);
+			}
+			else
+			{
+				frameAddress(reg(instruction.d), instruction.object);
+				op("LD", reg(instruction.d), reg(instruction.d));
+			}
+			break;
+
+		case IR_FRAME_STORE:
+			if (function->frame[instruction.object].offset == 0)
+			{
+				op("ST", 3, reg(instruction.a));
+			}
+			else
+			{
+				//No register to spare for the address, so move D there & back.
+				std::string offset = std::to_string(function->frame[instruction.object].offset);
+				immediate("ADDI", 3, offset);
+				op("ST", 3, reg(instruction.a));
+				immediate("SUBI", 3, offset);
+				zero_register = -1;
+			}
+			break;
+
+		case IR_CALL:
+			call(instruction, live_after);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	static const char *branchMnemonic(Condition condition)
+	{
+		static const char *MNEMONICS[] = { "BZ", "BNZ", "BC", "BNC" };
+		return MNEMONICS[condition];
+	}
+
+	void terminator(IRInstruction &instruction, int next_block)
+	{
+		switch (instruction.opcode)
+		{
+		case IR_JUMP:
+			if (static_cast<int>(instruction.targets[0]) != next_block)
+			{
+				line("BRA " + blockLabel(instruction.targets[0]));
+			}
+			break;
+
+		case IR_BRANCH:
+		{
+			int a = reg(instruction.a);
+			bool zero_test = instruction.immediate && instruction.value == 0 && (instruction.condition == COND_EQ || instruction.condition == COND_NE);
+			if (!(zero_test && zero_register == a))
+			{
+				if (instruction.immediate)
+				{
+					immediate("CMPI", a, std::to_string(instruction.value));
+				}
+				else
+				{
+					op("CMP", a, reg(instruction.b));
+				}
+			}
+
+			uint32_t if_true = instruction.targets[0], if_false = instruction.targets[1];
+			if (static_cast<int>(if_false) == next_block)
+			{
+				line(std::string(branchMnemonic(instruction.condition)) + " " + blockLabel(if_true));
+			}
+			else if (static_cast<int>(if_true) == next_block)
+			{
+				line(std::string(branchMnemonic(invertCondition(instruction.condition))) + " " + blockLabel(if_false));
+			}
+			else
+			{
+				line(std::string(branchMnemonic(instruction.condition)) + " " + blockLabel(if_true));
+				line("BRA " + blockLabel(if_false));
+			}
+			break;
+		}
+
+		case IR_RETURN:
+			if (instruction.a != NO_VREG)
+			{
+				set(0, reg(instruction.a));
+			}
+			epilogue();
+			line("RET");
+			break;
+
+		default:
+			line("HALT");
+			break;
+		}
+	}
+
+	//Order to emit blocks in: each block followed by a successor that isn't placed yet, if any, preferring earlier blocks.
+	std::vector<uint32_t> layout() const
+	{
+		std::vector<uint32_t> order;
+		std::vector<bool> placed(function->blocks.size(), false);
+		uint32_t next = 0;
+		while (order.size() < function->blocks.size())
+		{
+			order.push_back(next);
+			placed[next] = true;
+
+			std::vector<uint32_t> successors = function->blocks[next].successors();
+			std::sort(successors.begin(), successors.end());
+			uint32_t follow = UINT32_MAX;
+			for (uint32_t successor : successors)
+			{
+				if (!placed[successor])
+				{
+					follow = successor;
+					break;
+				}
+			}
+			for (uint32_t b = 0; b < function->blocks.size() && follow == UINT32_MAX; ++b)
+			{
+				if (!placed[b])
+				{
+					follow = b;
+				}
+			}
+			next = follow;
+		}
+		return order;
+	}
+
+	void generateFunction(IRFunction &ir_function, const std::vector<int> &register_colors)
+	{
+		function = &ir_function;
+		colors = &register_colors;
+
+		Liveness liveness;
+		liveness.compute(*function);
+		std::vector<std::vector<uint32_t> > preds = predecessors(*function);
+		std::vector<uint32_t> order = layout();
+
+		out << "\n; " << function->name << "\n" << function->label << ":\n";
+		zero_register = -1;
+		stack_use[function->label] = StackUse { function->name, function->frame_size, {} };
+		stack_depth = 0;
+		if (function->frame_size)
+		{
+			immediate("SUBI", 3, std::to_string(function->frame_size));
+		}
+		bool saves_stack_pointer = function->borrows_stack_pointer && !function->is_main;
+		if (saves_stack_pointer)
+		{
+			//C isn't a parameter, so it's free.
+			immediate("LDI", 2, savedStackPointer());
+			op("ST", 2, 3);
+		}
+
+		std::vector<std::pair<int, int> > moves;
+		for (std::size_t n = 0; n < function->parameters.size(); ++n)
+		{
+			VReg parameter = function->parameters[n];
+			if (reg(parameter) >= 0)
+			{
+				moves.push_back(std::make_pair(reg(parameter), static_cast<int>(n)));
+			}
+		}
+		//With D borrowed there's no stack for a swap, but then C is free: the only cycle possible is A <-> B.
+		parallelMove(moves, saves_stack_pointer ? 2 : -1);
+
+		for (std::size_t position = 0; position < order.size(); ++position)
+		{
+			uint32_t b = order[position];
+			IRBlock &block = function->blocks[b];
+
+			bool only_falls_through = b == 0 || (position > 0 && preds[b].size() == 1 && preds[b][0] == order[position - 1]);
+			if (!only_falls_through)
+			{
+				zero_register = -1;
+			}
+			if (b != 0)
+			{
+				out << blockLabel(b) << ":\n";
+			}
+
+			//What's live after each instruction, for saving registers across calls.
+			std::vector<VRegSet> live_after(block.instructions.size());
+			VRegSet live = liveness.live_out[b];
+			for (std::size_t i = block.instructions.size(); i-- > 0; )
+			{
+				live_after[i] = live;
+				Liveness::step(block.instructions[i], live);
+			}
+
+			for (std::size_t i = 0; i + 1 < block.instructions.size(); ++i)
+			{
+				instruction(block.instructions[i], live_after[i]);
+			}
+			int next_block = (position + 1 < order.size()) ? static_cast<int>(order[position + 1]) : -1;
+			terminator(block.terminator(), next_block);
+		}
+	}
+
+	/*
+	 * Worst case stack the function with label needs, including the return address of the call that got there
+	 * & the calls it makes. depth is the stack in use when it's entered, and path the functions called to get there.
+	 * A call back into a function on the path isn't followed: its level of recursion is counted once, and what
+	 * each more level costs goes in recursive, by label.
+	 */
+	uint32_t stackNeeded(const std::string &label, uint32_t depth, std::vector<std::pair<std::string, uint32_t> > &path, std::map<std::string, uint32_t> &recursive) const
+	{
+		const StackUse &use = stack_use.at(label);
+		uint32_t needed = use.own;
+		path.push_back(std::make_pair(label, depth));
+		for (const std::pair<std::string, uint16_t> &call : use.calls)
+		{
+			uint32_t callee_depth = depth + call.second + 1;
+			std::vector<std::pair<std::string, uint32_t> >::const_iterator on_path = std::find_if(path.begin(), path.end(), [&call](const std::pair<std::string, uint32_t> &entry) { return entry.first == call.first; });
+			if (on_path != path.end())
+			{
+				recursive[call.first] = std::max(recursive[call.first], callee_depth - on_path->second);
+				continue;
+			}
+			needed = std::max(needed, call.second + 1 + stackNeeded(call.first, callee_depth, path, recursive));
+		}
+		path.pop_back();
+		return needed;
+	}
+
+public:
+	CodeGenerator()
+	{
+		function = nullptr;
+		colors = nullptr;
+		zero_register = -1;
+		stack_depth = 0;
+		image_size = 0;
+	}
+
+	//colors[i] are the registers of program.functions[i]'s vregs.
+	std::string generate(IRProgram &program, const std::vector<std::vector<int> > &colors, const std::string &source_name)
+	{
+		out.str("");
+		out << "; Compiled from " << source_name << " by tcc.\n";
+		stack_use.clear();
+		image_size = 0;
+		std::vector<std::string> saved_stack_pointers;
+		for (std::size_t i = 0; i < program.functions.size(); ++i)
+		{
+			generateFunction(program.functions[i], colors[i]);
+			if (function->borrows_stack_pointer && !function->is_main)
+			{
+				saved_stack_pointers.push_back(savedStackPointer());
+			}
+		}
+
+		if (!program.globals.empty() || !saved_stack_pointers.empty())
+		{
+			out << "\n; Globals\n";
+		}
+		for (const std::string &label : saved_stack_pointers)
+		{
+			out << label << ":\n";
+			line("BYTE 0");
+		}
+		for (const IRGlobal &global : program.globals)
+		{
+			out << global.label << ":\n";
+			for (uint8_t byte : global.bytes)
+			{
+				line("BYTE " + std::to_string(byte));
+			}
+		}
+		return out.str();
+	}
+
+	//Warns (to log) if the program generate() last made & its stack may not fit in RAM together.
+	void checkStack(const IRProgram &program, const std::string &source_name, std::ostream &log = std::cout) const
+	{
+		if (program.functions.empty() || image_size > RAM_SIZE)
+		{
+			return; //tas says it doesn't fit.
+		}
+
+		std::vector<std::pair<std::string, uint32_t> > path;
+		std::map<std::string, uint32_t> recursive;
+		uint32_t stack = stackNeeded(program.functions[0].label, 0, path, recursive);
+		if (image_size + stack > RAM_SIZE)
+		{
+			log << "Warning: " << source_name << " compiles to " << image_size << " bytes, and needs up to " << stack << ((stack == 1) ? " byte" : " bytes") << " of stack" \
+					<< (recursive.empty() ? "" : " without recursing") << ": over the " << RAM_SIZE << " bytes of RAM, so the stack would overwrite the globals.\n";
+			return;
+		}
+		for (const std::pair<const std::string, uint32_t> &function : recursive)
+		{
+			log << "Warning: " << stack_use.at(function.first).name << "() is recursive, so its stack use can't be bounded. Each level past the first takes " << function.second \
+					<< ((function.second == 1) ? " byte" : " bytes") << ", and there's room for " << (RAM_SIZE - image_size - stack) / function.second << " of them before the stack overwrites the globals.\n";
+		}
+	}
+};
+
+#endif //TRISK_CODEGEN_HPP
@@ -0,0 +1,116 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <vector>
+
+#include "clexer.hpp"
+#include "parser.hpp"
+#include "ir.hpp"
+#include "optimizer.hpp"
+#include "regalloc.hpp"
+#include "codegen.hpp"
+
+/*
+ * tcc -- compiles a small subset of C (see parser.hpp) into tas source.
+ *
+ * Stages:
+ * * clexer.hpp: C source -> tokens.
+ * * parser.hpp: tokens -> AST, with names resolved.
+ * * ir.hpp: AST -> three address code over virtual registers, in basic blocks.
+ * * optimizer.hpp: constant propagation, common subexpression & dead code elimination, control flow cleanup.
+ * * regalloc.hpp: virtual registers -> A, B & C (& D in leaf functions), spilling to the stack frame when they run out.
+ * * codegen.hpp: IR -> tas source, following the calling convention of the *_stack samples.
+ */
+
+void displayUsageInstructions(std::string default_input, std::string default_output)
+{
+	std::cout << "Program usage: \n" \
+			<< "\n$> tcc <input C file> <output assembly file>\n\n" \
+			<< "Default input: " << default_input \
+			<< "\nDefault output: " << default_output << "\n";
+}
+
+//Throws on error.
+std::string compile(const std::string &source, const std::string &source_name)
+{
+	std::vector<CToken> tokens;
+	CLexer(source).tokenize(tokens);
+
+	TranslationUnit unit;
+	CParser(tokens, unit).parse();
+
+	IRProgram program;
+	IRBuilder(unit, program).build();
+
+	std::vector<std::vector<int> > colors;
+	for (IRFunction &function : program.functions)
+	{
+		Optimizer(function).optimize();
+
+		RegisterAllocator allocator(function);
+		allocator.allocate();
+		colors.push_back(allocator.colors);
+	}
+
+	CodeGenerator generator;
+	std::string assembly = generator.generate(program, colors, source_name);
+	generator.checkStack(program, source_name);
+	return assembly;
+}
+
+int main(int argc, char **argv)
+{
+	std::string input_filename = "program.c";
+	std::string output_filename = "program.tas";
+
+	if (argc >= 2 && !strcmp(argv[1], "-h"))
+	{
+		displayUsageInstructions(input_filename, output_filename);
+		return 0;
+	}
+
+	if (argc >= 2)
+	{
+		input_filename = argv[1];
+	}
+	if (argc >= 3)
+	{
+		output_filename = argv[2];
+	}
+
+	std::ifstream input_file(input_filename);
+	if (!input_file)
+	{
+		std::cout << "Error: failed to open file for input: \"" << input_filename << "\"\n";
+		displayUsageInstructions(input_filename, output_filename);
+		return 1;
+	}
+	std::stringstream source;
+	source << input_file.rdbuf();
+
+	std::string assembly;
+	try
+	{
+		assembly = compile(source.str(), input_filename);
+	}
+	catch (int)
+	{
+		return 1;
+	}
+
+	std::ofstream output_file(output_filename);
+	if (!output_file)
+	{
+		std::cout << "Error: failed to open file for output: \"" << output_filename << "\"\n";
+		return 1;
+	}
+	output_file << assembly;
+	output_file.close();
+
+	return 0;
+}
@@ -0,0 +1,1030 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_IR_HPP
+#define TRISK_IR_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include "parser.hpp"
+
+/*
+ * tcc's intermediate representation: each function is a list of basic blocks of three address instructions
+ * over an unlimited number of virtual registers ("vregs"), later mapped onto A - C by the register allocator.
+ * Every block ends with exactly one terminator (IR_JUMP, IR_BRANCH, IR_RETURN or IR_HALT).
+ * Variables that live in registers keep one vreg for their whole life, so vregs can be assigned more than once.
+ */
+
+typedef uint32_t VReg;
+static const VReg NO_VREG = UINT32_MAX;
+
+enum IROpcode
+{
+	IR_CONST,			//d = value
+	IR_COPY,			//d = a
+	IR_ADD,				//d = a + b (or + value if immediate)
+	IR_SUB,				//d = a - b (or - value if immediate)
+	IR_AND,				//d = a & b
+	IR_OR,				//d = a | b
+	IR_SHL,				//d = a << b (or << value if immediate)
+	IR_SHR,				//d = a >> b
+	IR_MUL,				//d = a * b, and b = the high byte of the product.
+	IR_NOT,				//d = ~a
+	IR_LOAD,			//d = *a
+	IR_STORE,			//*a = b
+	IR_GLOBAL_ADDRESS,	//d = &label
+	IR_FRAME_ADDRESS,	//d = &frame[object]
+	IR_FRAME_LOAD,		//d = frame[object]
+	IR_FRAME_STORE,		//frame[object] = a
+	IR_CALL,			//d = label(arguments), d is NO_VREG for void functions.
+
+	//Terminators.
+	IR_JUMP,			//goto targets[0]
+	IR_BRANCH,			//if (a condition b (or value if immediate)) goto targets[0], else goto targets[1]
+	IR_RETURN,			//return a (NO_VREG for void).
+	IR_HALT				//End of main.
+};
+
+//All comparisons are unsigned. > and <= are turned into these by swapping operands.
+enum Condition
+{
+	COND_EQ,
+	COND_NE,
+	COND_LT,
+	COND_GE
+};
+
+inline Condition invertCondition(Condition condition)
+{
+	static const Condition INVERSE[] = { COND_NE, COND_EQ, COND_GE, COND_LT };
+	return INVERSE[condition];
+}
+
+inline bool testCondition(Condition condition, uint8_t a, uint8_t b)
+{
+	switch (condition)
+	{
+	case COND_EQ: return a == b;
+	case COND_NE: return a != b;
+	case COND_LT: return a < b;
+	default: return a >= b;
+	}
+}
+
+struct IRInstruction
+{
+	IROpcode opcode;
+	VReg d;
+	VReg a;
+	VReg b;
+	bool immediate; //b is value instead.
+	uint8_t value;
+	Condition condition;
+	std::string label; //IR_GLOBAL_ADDRESS, IR_CALL
+	uint32_t object; //IR_FRAME_*
+	std::vector<VReg> arguments; //IR_CALL
+	uint32_t targets[2]; //Blocks, for terminators.
+
+	bool isTerminator() const
+	{
+		return opcode >= IR_JUMP;
+	}
+
+	//Without side effects, so it can be removed when d isn't used.
+	bool isPure() const
+	{
+		return opcode != IR_STORE && opcode != IR_FRAME_STORE && opcode != IR_CALL && !isTerminator();
+	}
+
+	//Registers read, as pointers so they can be renamed.
+	std::vector<VReg* > uses()
+	{
+		std::vector<VReg* > result;
+		switch (opcode)
+		{
+		case IR_CONST:
+		case IR_GLOBAL_ADDRESS:
+		case IR_FRAME_ADDRESS:
+		case IR_FRAME_LOAD:
+		case IR_JUMP:
+		case IR_HALT:
+			break;
+		case IR_CALL:
+			for (VReg &argument : arguments)
+			{
+				result.push_back(&argument);
+			}
+			break;
+		case IR_RETURN:
+			if (a != NO_VREG)
+			{
+				result.push_back(&a);
+			}
+			break;
+		case IR_COPY:
+		case IR_NOT:
+		case IR_LOAD:
+		case IR_FRAME_STORE:
+			result.push_back(&a);
+			break;
+		default:
+			result.push_back(&a);
+			if (!immediate)
+			{
+				result.push_back(&b);
+			}
+			break;
+		}
+		return result;
+	}
+
+	//Registers written.
+	std::vector<VReg* > defs()
+	{
+		std::vector<VReg* > result;
+		if (d != NO_VREG && opcode != IR_STORE && opcode != IR_FRAME_STORE && !isTerminator())
+		{
+			result.push_back(&d);
+		}
+		if (opcode == IR_MUL)
+		{
+			result.push_back(&b);
+		}
+		return result;
+	}
+};
+
+struct IRBlock
+{
+	std::vector<IRInstruction> instructions; //Last one is the terminator.
+	uint32_t loop_depth; //For spill costs.
+
+	IRInstruction &terminator()
+	{
+		return instructions.back();
+	}
+
+	std::vector<uint32_t> successors() const
+	{
+		const IRInstruction &last = instructions.back();
+		if (last.opcode == IR_JUMP)
+		{
+			return { last.targets[0] };
+		}
+		if (last.opcode == IR_BRANCH)
+		{
+			return { last.targets[0], last.targets[1] };
+		}
+		return {};
+	}
+};
+
+//Memory on the stack: address taken locals, local arrays & spilled vregs.
+struct FrameObject
+{
+	uint16_t size;
+	uint16_t offset; //From D, once laid out.
+};
+
+struct IRFunction
+{
+	std::string name;
+	std::string label;
+	bool is_main;
+	std::vector<IRBlock> blocks; //blocks[0] is the entry.
+	std::vector<VReg> parameters; //Arrive in A & B.
+	std::vector<FrameObject> frame;
+	uint32_t vreg_count;
+	uint16_t frame_size;
+	bool borrows_stack_pointer; //D is allocated too, & saved in <label>.sp meanwhile.
+
+	VReg newVReg()
+	{
+		return vreg_count++;
+	}
+};
+
+struct IRGlobal
+{
+	std::string label;
+	std::vector<uint8_t> bytes;
+};
+
+struct IRProgram
+{
+	std::vector<IRFunction> functions; //main first.
+	std::vector<IRGlobal> globals;
+};
+
+inline IRInstruction makeInstruction(IROpcode opcode, VReg d = NO_VREG, VReg a = NO_VREG, VReg b = NO_VREG)
+{
+	IRInstruction instruction;
+	instruction.opcode = opcode;
+	instruction.d = d;
+	instruction.a = a;
+	instruction.b = b;
+	instruction.immediate = false;
+	instruction.value = 0;
+	instruction.condition = COND_EQ;
+	instruction.object = 0;
+	instruction.targets[0] = instruction.targets[1] = 0;
+	return instruction;
+}
+
+//Assembly label for a C name. Labels are case insensitive, and can't be a single character or an instruction.
+inline std::string cLabel(const std::string &name)
+{
+	return "_" + name;
+}
+
+/*
+ * Lowers the AST into IR. Register locals become vregs, everything else is reached through loads & stores.
+ * while & for loops are emitted with their test at the bottom (plus one guard test at the top),
+ * so each iteration only takes the one branch back.
+ */
+class IRBuilder
+{
+	const TranslationUnit &unit;
+	IRProgram &program;
+
+	IRFunction *function;
+	uint32_t current; //Block being appended to.
+	uint32_t loop_depth;
+	const Function *source_function;
+	std::map<const Variable*, VReg> registers; //Register locals & promoted globals.
+	std::map<const Variable*, uint32_t> objects; //Frame locals.
+	std::set<const Variable* > promoted; //Globals kept in registers.
+	std::set<const Variable* > written; //Globals the function assigns to.
+	std::vector<uint32_t> break_targets;
+	std::vector<uint32_t> continue_targets;
+
+	//Where an lvalue lives.
+	struct Place
+	{
+		enum Kind
+		{
+			PLACE_REGISTER,
+			PLACE_FRAME,
+			PLACE_MEMORY
+		} kind;
+		VReg reg; //The variable for PLACE_REGISTER, the address for PLACE_MEMORY.
+		uint32_t object;
+	};
+
+	uint32_t newBlock()
+	{
+		function->blocks.push_back(IRBlock { {}, loop_depth });
+		return function->blocks.size() - 1;
+	}
+
+	bool terminated() const
+	{
+		const IRBlock &block = function->blocks[current];
+		return !block.instructions.empty() && block.instructions.back().isTerminator();
+	}
+
+	void emit(const IRInstruction &instruction)
+	{
+		if (terminated())
+		{
+			//Unreachable code, e.g. after a return. Give it a block of its own, which will be dropped.
+			current = newBlock();
+		}
+		function->blocks[current].instructions.push_back(instruction);
+	}
+
+	void jump(uint32_t target)
+	{
+		IRInstruction instruction = makeInstruction(IR_JUMP);
+		instruction.targets[0] = target;
+		emit(instruction);
+	}
+
+	void branch(Condition condition, VReg a, VReg b, uint32_t if_true, uint32_t if_false)
+	{
+		IRInstruction instruction = makeInstruction(IR_BRANCH, NO_VREG, a, b);
+		instruction.condition = condition;
+		instruction.targets[0] = if_true;
+		instruction.targets[1] = if_false;
+		emit(instruction);
+	}
+
+	void startBlock(uint32_t block)
+	{
+		if (!terminated())
+		{
+			jump(block);
+		}
+		current = block;
+	}
+
+	VReg constant(uint8_t value)
+	{
+		VReg d = function->newVReg();
+		IRInstruction instruction = makeInstruction(IR_CONST, d);
+		instruction.value = value;
+		emit(instruction);
+		return d;
+	}
+
+	VReg binary(IROpcode opcode, VReg a, VReg b)
+	{
+		VReg d = function->newVReg();
+		if (opcode == IR_MUL)
+		{
+			//MUL overwrites b with the high byte.
+			VReg clobbered = function->newVReg();
+			emit(makeInstruction(IR_COPY, clobbered, b));
+			b = clobbered;
+		}
+		emit(makeInstruction(opcode, d, a, b));
+		return d;
+	}
+
+	//C operator to IR, for the ones that are a single instruction (or two for ^).
+	VReg arithmetic(const CToken &token, const std::string &op, VReg a, VReg b)
+	{
+		if (op == "+") return binary(IR_ADD, a, b);
+		if (op == "-") return binary(IR_SUB, a, b);
+		if (op == "*") return binary(IR_MUL, a, b);
+		if (op == "&") return binary(IR_AND, a, b);
+		if (op == "|") return binary(IR_OR, a, b);
+		if (op == "<<") return binary(IR_SHL, a, b);
+		if (op == ">>") return binary(IR_SHR, a, b);
+		if (op == "^")
+		{
+			//No XOR instruction: a ^ b == (a | b) - (a & b).
+			return binary(IR_SUB, binary(IR_OR, a, b), binary(IR_AND, a, b));
+		}
+		compileError(token, "Unsupported operator \"" + op + "\".");
+	}
+
+	Place place(const Expr &e)
+	{
+		if (e.kind == EXPR_VARIABLE)
+		{
+			const Variable *variable = e.variable;
+			std::map<const Variable*, VReg>::const_iterator in_register = registers.find(variable);
+			if (in_register != registers.end())
+			{
+				return Place { Place::PLACE_REGISTER, in_register->second, 0 };
+			}
+			if (!variable->global && !variable->type.array_length)
+			{
+				return Place { Place::PLACE_FRAME, NO_VREG, objects.at(variable) };
+			}
+			return Place { Place::PLACE_MEMORY, address(e), 0 };
+		}
+		if (e.kind == EXPR_INDEX)
+		{
+			return Place { Place::PLACE_MEMORY, binary(IR_ADD, value(*e.operands[0]), value(*e.operands[1])), 0 };
+		}
+		//*pointer
+		return Place { Place::PLACE_MEMORY, value(*e.operands[0]), 0 };
+	}
+
+	//Address of a variable in memory.
+	VReg address(const Expr &e)
+	{
+		const Variable *variable = e.variable;
+		VReg d = function->newVReg();
+		if (variable->global)
+		{
+			IRInstruction instruction = makeInstruction(IR_GLOBAL_ADDRESS, d);
+			instruction.label = variable->label;
+			emit(instruction);
+		}
+		else
+		{
+			IRInstruction instruction = makeInstruction(IR_FRAME_ADDRESS, d);
+			instruction.object = objects.at(variable);
+			emit(instruction);
+		}
+		return d;
+	}
+
+	VReg read(const Place &where)
+	{
+		switch (where.kind)
+		{
+		case Place::PLACE_REGISTER:
+			return where.reg;
+		case Place::PLACE_FRAME:
+		{
+			VReg d = function->newVReg();
+			IRInstruction instruction = makeInstruction(IR_FRAME_LOAD, d);
+			instruction.object = where.object;
+			emit(instruction);
+			return d;
+		}
+		default:
+		{
+			VReg d = function->newVReg();
+			emit(makeInstruction(IR_LOAD, d, where.reg));
+			return d;
+		}
+		}
+	}
+
+	void write(const Place &where, VReg v)
+	{
+		switch (where.kind)
+		{
+		case Place::PLACE_REGISTER:
+			emit(makeInstruction(IR_COPY, where.reg, v));
+			break;
+		case Place::PLACE_FRAME:
+		{
+			IRInstruction instruction = makeInstruction(IR_FRAME_STORE, NO_VREG, v);
+			instruction.object = where.object;
+			emit(instruction);
+			break;
+		}
+		default:
+			emit(makeInstruction(IR_STORE, NO_VREG, where.reg, v));
+			break;
+		}
+	}
+
+	//Value of a comparison, && or || etc. as 0 or 1.
+	VReg booleanValue(const Expr &e)
+	{
+		VReg d = function->newVReg();
+		uint32_t if_true = newBlock(), if_false = newBlock(), join = newBlock();
+		condition(e, if_true, if_false);
+
+		current = if_true;
+		IRInstruction one = makeInstruction(IR_CONST, d);
+		one.value = 1;
+		emit(one);
+		jump(join);
+
+		current = if_false;
+		IRInstruction zero = makeInstruction(IR_CONST, d);
+		zero.value = 0;
+		emit(zero);
+		jump(join);
+
+		current = join;
+		return d;
+	}
+
+	static bool isComparison(const Expr &e)
+	{
+		static const char *OPS[] = { "==", "!=", "<", ">", "<=", ">=" };
+		if (e.kind != EXPR_BINARY)
+		{
+			return false;
+		}
+		for (const char *op : OPS)
+		{
+			if (e.op == op)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static bool isLogical(const Expr &e)
+	{
+		return isComparison(e) || (e.kind == EXPR_BINARY && (e.op == "&&" || e.op == "||")) || (e.kind == EXPR_UNARY && e.op == "!");
+	}
+
+	//Branches to if_true or if_false depending on e.
+	void condition(const Expr &e, uint32_t if_true, uint32_t if_false)
+	{
+		if (e.kind == EXPR_NUMBER)
+		{
+			jump(e.value ? if_true : if_false);
+			return;
+		}
+		if (e.kind == EXPR_UNARY && e.op == "!")
+		{
+			condition(*e.operands[0], if_false, if_true);
+			return;
+		}
+		if (e.kind == EXPR_BINARY && (e.op == "&&" || e.op == "||"))
+		{
+			uint32_t second = newBlock();
+			if (e.op == "&&")
+			{
+				condition(*e.operands[0], second, if_false);
+			}
+			else
+			{
+				condition(*e.operands[0], if_true, second);
+			}
+			current = second;
+			condition(*e.operands[1], if_true, if_false);
+			return;
+		}
+		if (isComparison(e))
+		{
+			VReg a = value(*e.operands[0]);
+			VReg b = value(*e.operands[1]);
+			if (e.op == "==") branch(COND_EQ, a, b, if_true, if_false);
+			else if (e.op == "!=") branch(COND_NE, a, b, if_true, if_false);
+			else if (e.op == "<") branch(COND_LT, a, b, if_true, if_false);
+			else if (e.op == ">=") branch(COND_GE, a, b, if_true, if_false);
+			else if (e.op == ">") branch(COND_LT, b, a, if_true, if_false);
+			else branch(COND_GE, b, a, if_true, if_false); //<=
+			return;
+		}
+
+		branch(COND_NE, value(e), constant(0), if_true, if_false);
+	}
+
+	VReg call(const Expr &e)
+	{
+		std::map<std::string, Function* >::const_iterator found = unit.function_names.find(e.callee);
+		if (found == unit.function_names.end())
+		{
+			compileError(e.token, "Call to undeclared function \"" + e.callee + "\".");
+		}
+		const Function &callee = *found->second;
+		if (callee.parameters.size() != e.operands.size())
+		{
+			compileError(e.token, "\"" + e.callee + "\" takes " + std::to_string(callee.parameters.size()) + " arguments, not " + std::to_string(e.operands.size()) + ".");
+		}
+		if (callee.name == "main")
+		{
+			compileError(e.token, "main can't be called (it ends with HALT).");
+		}
+
+		std::vector<VReg> arguments;
+		for (const std::unique_ptr<Expr> &argument : e.operands)
+		{
+			arguments.push_back(value(*argument));
+		}
+
+		bool returns = !callee.return_type.is_void || callee.return_type.pointers;
+		IRInstruction instruction = makeInstruction(IR_CALL, returns ? function->newVReg() : NO_VREG);
+		instruction.label = cLabel(callee.name);
+		instruction.arguments = arguments;
+		emit(instruction);
+		return instruction.d;
+	}
+
+	//Evaluates e, returns the vreg holding its value. NO_VREG for calls to void functions.
+	VReg expression(const Expr &e)
+	{
+		switch (e.kind)
+		{
+		case EXPR_NUMBER:
+			return constant(e.value);
+
+		case EXPR_VARIABLE:
+			if (e.variable->type.array_length)
+			{
+				return address(e); //Arrays decay to pointers.
+			}
+			return read(place(e));
+
+		case EXPR_CALL:
+			return call(e);
+
+		case EXPR_UNARY:
+			if (e.op == "!")
+			{
+				return booleanValue(e);
+			}
+			if (e.op == "~")
+			{
+				VReg d = function->newVReg();
+				emit(makeInstruction(IR_NOT, d, value(*e.operands[0])));
+				return d;
+			}
+			if (e.op == "-")
+			{
+				return binary(IR_SUB, constant(0), value(*e.operands[0]));
+			}
+			if (e.op == "*")
+			{
+				return read(place(e));
+			}
+			//&
+			{
+				const Expr &operand = *e.operands[0];
+				if (operand.kind == EXPR_VARIABLE)
+				{
+					return address(operand);
+				}
+				return place(operand).reg;
+			}
+
+		case EXPR_BINARY:
+			if (isLogical(e))
+			{
+				return booleanValue(e);
+			}
+			return arithmetic(e.token, e.op, value(*e.operands[0]), value(*e.operands[1]));
+
+		case EXPR_ASSIGN:
+		{
+			if (e.op == "=")
+			{
+				//Value first, so an address isn't kept in a register across a call on the right.
+				VReg v = value(*e.operands[1]);
+				write(place(*e.operands[0]), v);
+				return v;
+			}
+			Place where = place(*e.operands[0]);
+			VReg old = read(where);
+			VReg v = arithmetic(e.token, e.op.substr(0, e.op.size() - 1), old, value(*e.operands[1]));
+			write(where, v);
+			return v;
+		}
+
+		case EXPR_INCREMENT:
+		{
+			Place where = place(*e.operands[0]);
+			VReg old = read(where);
+			if (!e.prefix && where.kind == Place::PLACE_REGISTER)
+			{
+				//old is the variable itself, which is about to change.
+				VReg copy = function->newVReg();
+				emit(makeInstruction(IR_COPY, copy, old));
+				old = copy;
+			}
+			VReg v = binary(e.op == "++" ? IR_ADD : IR_SUB, old, constant(1));
+			write(where, v);
+			return e.prefix ? v : old;
+		}
+
+		case EXPR_CONDITIONAL:
+		{
+			VReg d = function->newVReg();
+			uint32_t if_true = newBlock(), if_false = newBlock(), join = newBlock();
+			condition(*e.operands[0], if_true, if_false);
+
+			current = if_true;
+			emit(makeInstruction(IR_COPY, d, value(*e.operands[1])));
+			jump(join);
+
+			current = if_false;
+			emit(makeInstruction(IR_COPY, d, value(*e.operands[2])));
+			jump(join);
+
+			current = join;
+			return d;
+		}
+
+		default: //EXPR_INDEX
+			return read(place(e));
+		}
+	}
+
+	//Like expression(), but the value has to exist.
+	VReg value(const Expr &e)
+	{
+		VReg v = expression(e);
+		if (v == NO_VREG)
+		{
+			compileError(e.token, "Using the value of a void function.");
+		}
+		return v;
+	}
+
+	void declare(const Variable *variable)
+	{
+		if (variable->inMemory())
+		{
+			objects[variable] = function->frame.size();
+			function->frame.push_back(FrameObject { variable->size(), 0 });
+		}
+		else
+		{
+			registers[variable] = function->newVReg();
+		}
+	}
+
+	void loop(const Stmt *init, const Expr *test, const Expr *step, const Stmt &body, bool test_first)
+	{
+		if (init)
+		{
+			statement(*init);
+		}
+
+		++loop_depth;
+		uint32_t top = newBlock(), next = newBlock(), exit;
+		--loop_depth;
+		exit = newBlock();
+
+		if (test_first && test)
+		{
+			condition(*test, top, exit); //Guard.
+		}
+		startBlock(top);
+
+		++loop_depth;
+		break_targets.push_back(exit);
+		continue_targets.push_back(next);
+		statement(body);
+		break_targets.pop_back();
+		continue_targets.pop_back();
+
+		startBlock(next);
+		if (step)
+		{
+			expression(*step);
+		}
+		if (test)
+		{
+			condition(*test, top, exit);
+		}
+		else
+		{
+			jump(top);
+		}
+		--loop_depth;
+
+		current = exit;
+	}
+
+	void statement(const Stmt &s)
+	{
+		switch (s.kind)
+		{
+		case STMT_BLOCK:
+			for (const std::unique_ptr<Stmt> &child : s.body)
+			{
+				statement(*child);
+			}
+			break;
+
+		case STMT_EXPR:
+			expression(*s.value);
+			break;
+
+		case STMT_DECLARATION:
+			declare(s.variable);
+			if (s.value)
+			{
+				VReg v = value(*s.value);
+				Expr variable = { EXPR_VARIABLE, s.token, "", 0, false, s.variable, "", {}, 0 };
+				write(place(variable), v);
+			}
+			break;
+
+		case STMT_IF:
+		{
+			uint32_t if_true = newBlock(), join = newBlock();
+			uint32_t if_false = (s.body.size() > 1) ? newBlock() : join;
+			condition(*s.condition, if_true, if_false);
+			current = if_true;
+			statement(*s.body[0]);
+			if (s.body.size() > 1)
+			{
+				//The then-arm goes on past the else-arm, not into it.
+				if (!terminated())
+				{
+					jump(join);
+				}
+				current = if_false;
+				statement(*s.body[1]);
+			}
+			startBlock(join);
+			break;
+		}
+
+		case STMT_WHILE:
+			loop(nullptr, s.condition.get(), nullptr, *s.body[0], true);
+			break;
+
+		case STMT_DO:
+			loop(nullptr, s.condition.get(), nullptr, *s.body[0], false);
+			break;
+
+		case STMT_FOR:
+			loop(s.body[0].get(), s.condition.get(), s.step.get(), *s.body[1], true);
+			break;
+
+		case STMT_RETURN:
+		{
+			bool returns = !source_function->return_type.is_void || source_function->return_type.pointers;
+			if (s.value && !returns)
+			{
+				compileError(s.token, "Returning a value from a void function.");
+			}
+			if (!s.value && returns && !function->is_main)
+			{
+				compileError(s.token, "Missing return value.");
+			}
+			VReg v = s.value ? value(*s.value) : NO_VREG;
+			exit(v);
+			break;
+		}
+
+		case STMT_BREAK:
+		case STMT_CONTINUE:
+		{
+			std::vector<uint32_t> &targets = (s.kind == STMT_BREAK) ? break_targets : continue_targets;
+			if (targets.empty())
+			{
+				compileError(s.token, s.token.text + " outside of a loop.");
+			}
+			jump(targets.back());
+			break;
+		}
+		}
+	}
+
+	//Finds the globals the function uses & assigns to, and whether it calls anything.
+	bool scan(const Expr &e, std::set<const Variable* > &used)
+	{
+		bool calls = (e.kind == EXPR_CALL);
+		if (e.kind == EXPR_VARIABLE && e.variable->global)
+		{
+			used.insert(e.variable);
+		}
+		if ((e.kind == EXPR_ASSIGN || e.kind == EXPR_INCREMENT) && e.operands[0]->kind == EXPR_VARIABLE)
+		{
+			written.insert(e.operands[0]->variable);
+		}
+		for (const std::unique_ptr<Expr> &operand : e.operands)
+		{
+			calls = scan(*operand, used) || calls;
+		}
+		return calls;
+	}
+
+	bool scan(const Stmt &s, std::set<const Variable* > &used)
+	{
+		bool calls = false;
+		for (const Expr *e : { s.value.get(), s.condition.get(), s.step.get() })
+		{
+			calls = (e && scan(*e, used)) || calls;
+		}
+		for (const std::unique_ptr<Stmt> &child : s.body)
+		{
+			calls = (child && scan(*child, used)) || calls;
+		}
+		return calls;
+	}
+
+	/*
+	 * A function that calls nothing can keep the scalar globals it uses in registers: load them on entry,
+	 * store the ones it changes on the way out. Nothing else can see them in between, as long as their address
+	 * is never taken anywhere (reaching a global through a pointer to another object is undefined behaviour).
+	 */
+	void promoteGlobals(const Function &source)
+	{
+		std::set<const Variable* > used;
+		if (scan(*source.body, used))
+		{
+			return;
+		}
+		for (const Variable *global : used)
+		{
+			if (global->type.array_length || global->address_taken)
+			{
+				continue;
+			}
+			promoted.insert(global);
+			VReg address = function->newVReg();
+			IRInstruction instruction = makeInstruction(IR_GLOBAL_ADDRESS, address);
+			instruction.label = global->label;
+			emit(instruction);
+			registers[global] = function->newVReg();
+			emit(makeInstruction(IR_LOAD, registers[global], address));
+		}
+	}
+
+	//Returns from the function, after storing the promoted globals back.
+	void exit(VReg v)
+	{
+		for (const Variable *global : promoted)
+		{
+			if (written.count(global))
+			{
+				VReg address = function->newVReg();
+				IRInstruction instruction = makeInstruction(IR_GLOBAL_ADDRESS, address);
+				instruction.label = global->label;
+				emit(instruction);
+				emit(makeInstruction(IR_STORE, NO_VREG, address, registers[global]));
+			}
+		}
+		emit(makeInstruction(function->is_main ? IR_HALT : IR_RETURN, NO_VREG, function->is_main ? NO_VREG : v));
+	}
+
+	void lowerFunction(const Function &source)
+	{
+		program.functions.emplace_back();
+		function = &program.functions.back();
+		function->name = source.name;
+		function->label = cLabel(source.name);
+		function->is_main = (source.name == "main");
+		function->vreg_count = 0;
+		function->frame_size = 0;
+		function->borrows_stack_pointer = false;
+		source_function = &source;
+		registers.clear();
+		objects.clear();
+		promoted.clear();
+		written.clear();
+		loop_depth = 0;
+
+		current = newBlock();
+		promoteGlobals(source);
+		for (const Variable *parameter : source.parameters)
+		{
+			//Parameters arrive in registers. Copy the ones that have to live in memory there.
+			VReg v = function->newVReg();
+			function->parameters.push_back(v);
+			declare(parameter);
+			if (parameter->inMemory())
+			{
+				IRInstruction instruction = makeInstruction(IR_FRAME_STORE, NO_VREG, v);
+				instruction.object = objects[parameter];
+				emit(instruction);
+			}
+			else
+			{
+				emit(makeInstruction(IR_COPY, registers[parameter], v));
+			}
+		}
+
+		statement(*source.body);
+		if (!terminated())
+		{
+			exit(NO_VREG);
+		}
+	}
+
+public:
+	IRBuilder(const TranslationUnit &translation_unit, IRProgram &ir_program) :
+		unit(translation_unit), program(ir_program)
+	{
+		function = nullptr;
+		current = 0;
+		loop_depth = 0;
+		source_function = nullptr;
+	}
+
+	//Throws on error.
+	void build()
+	{
+		//C is case sensitive, labels aren't.
+		std::map<std::string, std::string> names;
+		std::vector<std::string> all;
+		for (const Variable *global : unit.globals)
+		{
+			all.push_back(global->name);
+		}
+		for (const std::unique_ptr<Function> &source : unit.functions)
+		{
+			all.push_back(source->name);
+		}
+		for (const std::string &name : all)
+		{
+			std::string upper = name;
+			for (char &c : upper)
+			{
+				c = toupper(static_cast<unsigned char>(c));
+			}
+			if (names.count(upper))
+			{
+				std::cout << "Error: \"" << name << "\" and \"" << names[upper] << "\" only differ in case, which assembly labels don't tell apart.\n";
+				throw 0;
+			}
+			names[upper] = name;
+		}
+
+		for (Variable *global : unit.globals)
+		{
+			global->label = cLabel(global->name);
+		}
+
+		std::map<std::string, Function* >::const_iterator main = unit.function_names.find("main");
+		if (main == unit.function_names.end())
+		{
+			std::cout << "Error: There's no main function.\n";
+			throw 0;
+		}
+		if (!main->second->parameters.empty())
+		{
+			compileError(main->second->token, "main can't have parameters.");
+		}
+
+		//main first, since execution starts at address 0.
+		lowerFunction(*main->second);
+		for (const std::unique_ptr<Function> &source : unit.functions)
+		{
+			if (source.get() != main->second)
+			{
+				lowerFunction(*source);
+			}
+		}
+
+		for (const Variable *global : unit.globals)
+		{
+			program.globals.push_back(IRGlobal { global->label, global->initializer });
+		}
+	}
+};
+
+#endif //TRISK_IR_HPP
@@ -0,0 +1,847 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_OPTIMIZER_HPP
+#define TRISK_OPTIMIZER_HPP
+
+#include <cstdint>
+#include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <tuple>
+#include <iterator>
+
+#include "cpu.hpp"
+#include "ir.hpp"
+
+/*
+ * Machine independent IR optimizations:
+ * * Constant propagation over the control flow graph, only following edges that can be taken, which also folds branches.
+ *   Constants are computed with the CPU's own ALU, so folding matches tem exactly.
+ * * Use of the immediate forms (ADDI, SUBI, CMPI) & algebraic identities.
+ * * Common subexpression elimination, including loads of values already loaded or stored.
+ * * Dead code elimination.
+ * * Jump threading & merging of straight line blocks.
+ */
+
+typedef std::set<VReg> VRegSet;
+
+//live_in & live_out of every block.
+struct Liveness
+{
+	std::vector<VRegSet> live_in;
+	std::vector<VRegSet> live_out;
+
+	void compute(IRFunction &function)
+	{
+		std::size_t count = function.blocks.size();
+		live_in.assign(count, VRegSet());
+		live_out.assign(count, VRegSet());
+
+		//Blocks' own uses (before any def) & defs.
+		std::vector<VRegSet> uses(count), defs(count);
+		for (std::size_t b = 0; b < count; ++b)
+		{
+			for (IRInstruction &instruction : function.blocks[b].instructions)
+			{
+				for (VReg *use : instruction.uses())
+				{
+					if (!defs[b].count(*use))
+					{
+						uses[b].insert(*use);
+					}
+				}
+				for (VReg *def : instruction.defs())
+				{
+					defs[b].insert(*def);
+				}
+			}
+		}
+
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			for (std::size_t b = count; b-- > 0; )
+			{
+				VRegSet out;
+				for (uint32_t successor : function.blocks[b].successors())
+				{
+					out.insert(live_in[successor].begin(), live_in[successor].end());
+				}
+
+				VRegSet in = uses[b];
+				for (VReg v : out)
+				{
+					if (!defs[b].count(v))
+					{
+						in.insert(v);
+					}
+				}
+
+				if (in != live_in[b] || out != live_out[b])
+				{
+					live_in[b].swap(in);
+					live_out[b].swap(out);
+					changed = true;
+				}
+			}
+		}
+	}
+
+	//Steps live backwards over instruction: live after it -> live before it.
+	static void step(IRInstruction &instruction, VRegSet &live)
+	{
+		for (VReg *def : instruction.defs())
+		{
+			live.erase(*def);
+		}
+		for (VReg *use : instruction.uses())
+		{
+			live.insert(*use);
+		}
+	}
+};
+
+inline std::vector<std::vector<uint32_t> > predecessors(const IRFunction &function)
+{
+	std::vector<std::vector<uint32_t> > result(function.blocks.size());
+	for (uint32_t b = 0; b < function.blocks.size(); ++b)
+	{
+		for (uint32_t successor : function.blocks[b].successors())
+		{
+			result[successor].push_back(b);
+		}
+	}
+	return result;
+}
+
+//Drops blocks that can't be reached from the entry, renumbering the rest in order.
+inline bool removeUnreachable(IRFunction &function)
+{
+	std::vector<bool> reachable(function.blocks.size(), false);
+	std::vector<uint32_t> work = { 0 };
+	reachable[0] = true;
+	while (!work.empty())
+	{
+		uint32_t b = work.back();
+		work.pop_back();
+		for (uint32_t successor : function.blocks[b].successors())
+		{
+			if (!reachable[successor])
+			{
+				reachable[successor] = true;
+				work.push_back(successor);
+			}
+		}
+	}
+
+	std::vector<uint32_t> renumbered(function.blocks.size(), 0);
+	std::vector<IRBlock> kept;
+	for (uint32_t b = 0; b < function.blocks.size(); ++b)
+	{
+		if (reachable[b])
+		{
+			renumbered[b] = kept.size();
+			kept.push_back(std::move(function.blocks[b]));
+		}
+	}
+	bool changed = kept.size() != function.blocks.size();
+	for (IRBlock &block : kept)
+	{
+		IRInstruction &last = block.terminator();
+		last.targets[0] = renumbered[last.targets[0]];
+		last.targets[1] = renumbered[last.targets[1]];
+	}
+	function.blocks.swap(kept);
+	return changed;
+}
+
+class Optimizer
+{
+	//What constant propagation knows about a vreg.
+	struct Lattice
+	{
+		enum State
+		{
+			UNDEFINED, //No definition seen yet.
+			CONSTANT,
+			VARYING
+		} state;
+		uint8_t value;
+
+		bool operator!=(const Lattice &other) const
+		{
+			return state != other.state || (state == CONSTANT && value != other.value);
+		}
+
+		static Lattice meet(const Lattice &x, const Lattice &y)
+		{
+			if (x.state == UNDEFINED) return y;
+			if (y.state == UNDEFINED) return x;
+			if (x.state == CONSTANT && y.state == CONSTANT && x.value == y.value) return x;
+			return Lattice { VARYING, 0 };
+		}
+	};
+
+	typedef std::vector<Lattice> State;
+
+	IRFunction &function;
+
+	static Lattice constant(uint8_t value)
+	{
+		return Lattice { Lattice::CONSTANT, value };
+	}
+
+	static Lattice varying()
+	{
+		return Lattice { Lattice::VARYING, 0 };
+	}
+
+	//Value of operand b, which can be an immediate.
+	static Lattice operandB(const IRInstruction &instruction, const State &state)
+	{
+		return instruction.immediate ? constant(instruction.value) : state[instruction.b];
+	}
+
+	//Updates state with the effect of instruction.
+	static void transfer(const IRInstruction &instruction, State &state)
+	{
+		switch (instruction.opcode)
+		{
+		case IR_CONST:
+			state[instruction.d] = constant(instruction.value);
+			return;
+
+		case IR_COPY:
+			state[instruction.d] = state[instruction.a];
+			return;
+
+		case IR_ADD:
+		case IR_SUB:
+		case IR_AND:
+		case IR_OR:
+		case IR_SHL:
+		case IR_SHR:
+		case IR_MUL:
+		{
+			Lattice a = state[instruction.a], b = operandB(instruction, state);
+			Lattice result;
+			Lattice high = varying();
+
+			//Results that don't depend on the other operand.
+			bool a_zero = (a.state == Lattice::CONSTANT && a.value == 0), b_zero = (b.state == Lattice::CONSTANT && b.value == 0);
+			if ((instruction.opcode == IR_AND || instruction.opcode == IR_MUL) && (a_zero || b_zero))
+			{
+				result = constant(0);
+				high = constant(0);
+			}
+			else if (instruction.opcode == IR_OR && ((a.state == Lattice::CONSTANT && a.value == 0xFF) || (b.state == Lattice::CONSTANT && b.value == 0xFF)))
+			{
+				result = constant(0xFF);
+			}
+			else if ((instruction.opcode == IR_SHL || instruction.opcode == IR_SHR) && a_zero)
+			{
+				result = constant(0);
+			}
+			else if (a.state == Lattice::VARYING || b.state == Lattice::VARYING)
+			{
+				result = varying();
+			}
+			else if (a.state == Lattice::UNDEFINED || b.state == Lattice::UNDEFINED)
+			{
+				result = Lattice { Lattice::UNDEFINED, 0 };
+				high = result;
+			}
+			else
+			{
+				result = constant(evaluate(instruction.opcode, a.value, b.value, high.value));
+				high.state = Lattice::CONSTANT;
+			}
+
+			if (instruction.opcode == IR_MUL)
+			{
+				state[instruction.b] = high;
+			}
+			state[instruction.d] = result;
+			return;
+		}
+
+		case IR_NOT:
+		{
+			Lattice a = state[instruction.a];
+			state[instruction.d] = (a.state == Lattice::CONSTANT) ? constant(~a.value) : a;
+			return;
+		}
+
+		default:
+			for (VReg *def : const_cast<IRInstruction&>(instruction).defs())
+			{
+				state[*def] = varying();
+			}
+			return;
+		}
+	}
+
+public:
+	//Same results as the CPU.
+	static uint8_t evaluate(IROpcode opcode, uint8_t a, uint8_t b, uint8_t &high)
+	{
+		ALU alu;
+		high = 0;
+		switch (opcode)
+		{
+		case IR_ADD: return alu.add(a, b);
+		case IR_SUB: return alu.sub(a, b);
+		case IR_AND: return alu.bitwiseAnd(a, b);
+		case IR_OR: return alu.bitwiseOr(a, b);
+		case IR_SHL: return alu.bitwiseLeftShift(a, b);
+		case IR_SHR: return alu.bitwiseRightShift(a, b);
+		default: return alu.multiply(a, b, high);
+		}
+	}
+
+private:
+	//Returns the branch's outcome: 0 = not taken, 1 = taken, 2 = unknown.
+	static int branchOutcome(const IRInstruction &instruction, const State &state)
+	{
+		Lattice a = state[instruction.a], b = operandB(instruction, state);
+		if (a.state == Lattice::CONSTANT && b.state == Lattice::CONSTANT)
+		{
+			return testCondition(instruction.condition, a.value, b.value) ? 1 : 0;
+		}
+		if (b.state == Lattice::CONSTANT && b.value == 0 && (instruction.condition == COND_LT || instruction.condition == COND_GE))
+		{
+			return (instruction.condition == COND_GE) ? 1 : 0; //Unsigned.
+		}
+		if (!instruction.immediate && instruction.a == instruction.b)
+		{
+			return testCondition(instruction.condition, 0, 0) ? 1 : 0;
+		}
+		return 2;
+	}
+
+	//Folds constants & branches. Returns true if anything changed.
+	bool propagateConstants()
+	{
+		std::size_t count = function.blocks.size();
+		std::vector<State> in(count, State(function.vreg_count, Lattice { Lattice::UNDEFINED, 0 }));
+		std::vector<bool> executable(count, false);
+		for (VReg parameter : function.parameters)
+		{
+			in[0][parameter] = varying();
+		}
+
+		std::vector<uint32_t> work = { 0 };
+		executable[0] = true;
+		while (!work.empty())
+		{
+			uint32_t b = work.back();
+			work.pop_back();
+
+			State state = in[b];
+			IRBlock &block = function.blocks[b];
+			for (const IRInstruction &instruction : block.instructions)
+			{
+				transfer(instruction, state);
+			}
+
+			const IRInstruction &last = block.instructions.back();
+			std::vector<uint32_t> successors = block.successors();
+			if (last.opcode == IR_BRANCH)
+			{
+				int outcome = branchOutcome(last, state);
+				if (outcome != 2)
+				{
+					successors = { last.targets[outcome ? 0 : 1] };
+				}
+			}
+
+			for (uint32_t successor : successors)
+			{
+				bool changed = !executable[successor];
+				State &target = in[successor];
+				for (VReg v = 0; v < function.vreg_count; ++v)
+				{
+					Lattice merged = Lattice::meet(target[v], state[v]);
+					if (merged != target[v])
+					{
+						target[v] = merged;
+						changed = true;
+					}
+				}
+				if (changed)
+				{
+					executable[successor] = true;
+					work.push_back(successor);
+				}
+			}
+		}
+
+		//Rewrite with what's known.
+		bool changed = false;
+		for (uint32_t b = 0; b < count; ++b)
+		{
+			if (!executable[b])
+			{
+				continue;
+			}
+
+			State state = in[b];
+			std::vector<IRInstruction> rewritten;
+			for (IRInstruction instruction : function.blocks[b].instructions)
+			{
+				changed = rewrite(instruction, state, rewritten) || changed;
+				transfer(rewritten.back(), state);
+			}
+			function.blocks[b].instructions.swap(rewritten);
+		}
+
+		for (uint32_t b = 0; b < count; ++b)
+		{
+			if (!executable[b])
+			{
+				//Make it unreachable from the executable blocks' point of view too.
+				function.blocks[b].instructions.assign(1, makeInstruction(IR_HALT));
+			}
+		}
+		return removeUnreachable(function) || changed;
+	}
+
+	//Appends instruction, simplified given state, to rewritten.
+	bool rewrite(IRInstruction instruction, const State &state, std::vector<IRInstruction> &rewritten)
+	{
+		bool changed = false;
+		switch (instruction.opcode)
+		{
+		case IR_COPY:
+		case IR_NOT:
+		case IR_ADD:
+		case IR_SUB:
+		case IR_AND:
+		case IR_OR:
+		case IR_SHL:
+		case IR_SHR:
+		{
+			State after = state;
+			transfer(instruction, after);
+			if (after[instruction.d].state == Lattice::CONSTANT)
+			{
+				IRInstruction folded = makeInstruction(IR_CONST, instruction.d);
+				folded.value = after[instruction.d].value;
+				rewritten.push_back(folded);
+				return true;
+			}
+			if (instruction.opcode == IR_COPY || instruction.opcode == IR_NOT)
+			{
+				break;
+			}
+
+			Lattice a = state[instruction.a], b = operandB(instruction, state);
+			bool commutative = instruction.opcode == IR_ADD || instruction.opcode == IR_AND || instruction.opcode == IR_OR;
+			if (commutative && a.state == Lattice::CONSTANT && b.state != Lattice::CONSTANT)
+			{
+				std::swap(instruction.a, instruction.b);
+				std::swap(a, b);
+				changed = true;
+			}
+			if (b.state != Lattice::CONSTANT)
+			{
+				break;
+			}
+
+			//Identities.
+			bool identity = (b.value == 0 && (instruction.opcode == IR_ADD || instruction.opcode == IR_SUB || instruction.opcode == IR_OR ||
+							instruction.opcode == IR_SHL || instruction.opcode == IR_SHR)) || (b.value == 0xFF && instruction.opcode == IR_AND);
+			if (identity)
+			{
+				rewritten.push_back(makeInstruction(IR_COPY, instruction.d, instruction.a));
+				return true;
+			}
+
+			//Immediate forms.
+			if (!instruction.immediate && (instruction.opcode == IR_ADD || instruction.opcode == IR_SUB || instruction.opcode == IR_SHL))
+			{
+				instruction.b = NO_VREG;
+				instruction.immediate = true;
+				instruction.value = b.value;
+				changed = true;
+			}
+			break;
+		}
+
+		case IR_MUL:
+		{
+			Lattice a = state[instruction.a], b = state[instruction.b];
+			State after = state;
+			transfer(instruction, after);
+			if (after[instruction.d].state == Lattice::CONSTANT && after[instruction.b].state == Lattice::CONSTANT)
+			{
+				IRInstruction low = makeInstruction(IR_CONST, instruction.d);
+				low.value = after[instruction.d].value;
+				IRInstruction high = makeInstruction(IR_CONST, instruction.b);
+				high.value = after[instruction.b].value;
+				rewritten.push_back(high);
+				rewritten.push_back(low);
+				return true;
+			}
+
+			//Multiplying by 1, 2 or 4 is cheaper as a copy or shift. The high byte is always a fresh copy no one reads.
+			VReg source = instruction.a;
+			if (a.state == Lattice::CONSTANT && b.state != Lattice::CONSTANT)
+			{
+				source = instruction.b;
+				b = a;
+			}
+			if (b.state == Lattice::CONSTANT && (b.value == 1 || b.value == 2 || b.value == 4))
+			{
+				IRInstruction shift = makeInstruction(IR_SHL, instruction.d, source);
+				shift.immediate = true;
+				shift.value = (b.value == 2) ? 1 : 2;
+				rewritten.push_back((b.value == 1) ? makeInstruction(IR_COPY, instruction.d, source) : shift);
+				return true;
+			}
+			break;
+		}
+
+		case IR_BRANCH:
+		{
+			int outcome = branchOutcome(instruction, state);
+			if (outcome != 2)
+			{
+				IRInstruction jump = makeInstruction(IR_JUMP);
+				jump.targets[0] = instruction.targets[outcome ? 0 : 1];
+				rewritten.push_back(jump);
+				return true;
+			}
+
+			Lattice a = state[instruction.a], b = operandB(instruction, state);
+			if (a.state == Lattice::CONSTANT && b.state != Lattice::CONSTANT)
+			{
+				//Constant on the right: k < x == x >= k + 1, k >= x == x < k + 1.
+				uint8_t k = a.value;
+				instruction.a = instruction.b;
+				instruction.b = NO_VREG;
+				instruction.immediate = true;
+				if (instruction.condition == COND_EQ || instruction.condition == COND_NE)
+				{
+					instruction.value = k;
+				}
+				else if (k == 0xFF)
+				{
+					//255 < x is never true, 255 >= x always is.
+					IRInstruction jump = makeInstruction(IR_JUMP);
+					jump.targets[0] = instruction.targets[instruction.condition == COND_LT ? 1 : 0];
+					rewritten.push_back(jump);
+					return true;
+				}
+				else
+				{
+					instruction.value = k + 1;
+					instruction.condition = invertCondition(instruction.condition);
+				}
+				rewritten.push_back(instruction);
+				return true;
+			}
+			if (!instruction.immediate && b.state == Lattice::CONSTANT)
+			{
+				instruction.b = NO_VREG;
+				instruction.immediate = true;
+				instruction.value = b.value;
+				changed = true;
+			}
+			if (instruction.targets[0] == instruction.targets[1])
+			{
+				IRInstruction jump = makeInstruction(IR_JUMP);
+				jump.targets[0] = instruction.targets[0];
+				rewritten.push_back(jump);
+				return true;
+			}
+			break;
+		}
+
+		default:
+			break;
+		}
+
+		rewritten.push_back(instruction);
+		return changed;
+	}
+
+	//Removes instructions whose results are never used.
+	bool eliminateDeadCode()
+	{
+		bool changed = false;
+		bool again = true;
+		while (again)
+		{
+			again = false;
+			Liveness liveness;
+			liveness.compute(function);
+			for (uint32_t b = 0; b < function.blocks.size(); ++b)
+			{
+				std::vector<IRInstruction> &instructions = function.blocks[b].instructions;
+				VRegSet live = liveness.live_out[b];
+				std::vector<IRInstruction> kept;
+				for (std::size_t i = instructions.size(); i-- > 0; )
+				{
+					IRInstruction &instruction = instructions[i];
+					bool dead = instruction.isPure();
+					for (VReg *def : instruction.defs())
+					{
+						dead = dead && !live.count(*def);
+					}
+					if (instruction.opcode == IR_COPY && instruction.d == instruction.a)
+					{
+						dead = true;
+					}
+					if (dead)
+					{
+						again = true;
+						continue;
+					}
+					Liveness::step(instruction, live);
+					kept.push_back(instruction);
+				}
+				std::reverse(kept.begin(), kept.end());
+				instructions.swap(kept);
+			}
+			changed = changed || again;
+		}
+		return changed;
+	}
+
+	//What an instruction computes, to recognize the same computation later.
+	struct Expression
+	{
+		IROpcode opcode;
+		VReg a;
+		VReg b;
+		int immediate; //-1 if none.
+		uint32_t object;
+
+		bool operator<(const Expression &other) const
+		{
+			return std::tie(opcode, a, b, immediate, object) < std::tie(other.opcode, other.a, other.b, other.immediate, other.object);
+		}
+	};
+
+	static bool isMemory(IROpcode opcode)
+	{
+		return opcode == IR_LOAD || opcode == IR_FRAME_LOAD;
+	}
+
+	static Expression expressionOf(const IRInstruction &instruction)
+	{
+		Expression e = { instruction.opcode, instruction.a, instruction.immediate ? NO_VREG : instruction.b,
+				instruction.immediate ? instruction.value : -1, instruction.opcode == IR_FRAME_LOAD ? instruction.object : 0 };
+		bool commutative = instruction.opcode == IR_ADD || instruction.opcode == IR_AND || instruction.opcode == IR_OR;
+		if (commutative && e.b != NO_VREG && e.b < e.a)
+		{
+			std::swap(e.a, e.b);
+		}
+		if (instruction.opcode == IR_NOT || instruction.opcode == IR_FRAME_LOAD)
+		{
+			e.b = NO_VREG;
+		}
+		if (instruction.opcode == IR_FRAME_LOAD)
+		{
+			e.a = NO_VREG;
+		}
+		return e;
+	}
+
+	/*
+	 * Reuses values that are already in a vreg: the same arithmetic on the same operands, loads of an address
+	 * that was loaded or stored since the last store or call. Works on extended basic blocks (blocks with a single
+	 * predecessor continue from it), which covers the tests of && and ||.
+	 * Constants & addresses aren't reused: they take one LDI to recompute, less than keeping them in a register.
+	 */
+	bool eliminateCommonSubexpressions()
+	{
+		typedef std::map<Expression, VReg> Available;
+
+		//Reverse postorder, so a block's single predecessor is done before it.
+		std::vector<uint32_t> order;
+		std::vector<bool> visited(function.blocks.size(), false);
+		std::vector<std::pair<uint32_t, std::size_t> > stack = { std::make_pair(0u, std::size_t(0)) };
+		visited[0] = true;
+		while (!stack.empty())
+		{
+			uint32_t b = stack.back().first;
+			std::vector<uint32_t> successors = function.blocks[b].successors();
+			if (stack.back().second < successors.size())
+			{
+				uint32_t successor = successors[stack.back().second++];
+				if (!visited[successor])
+				{
+					visited[successor] = true;
+					stack.push_back(std::make_pair(successor, std::size_t(0)));
+				}
+				continue;
+			}
+			order.push_back(b);
+			stack.pop_back();
+		}
+		std::reverse(order.begin(), order.end());
+
+		std::vector<std::vector<uint32_t> > preds = predecessors(function);
+		std::vector<Available> out(function.blocks.size());
+		bool changed = false;
+		for (uint32_t b : order)
+		{
+			Available available;
+			if (preds[b].size() == 1 && b != 0)
+			{
+				available = out[preds[b][0]];
+			}
+
+			for (IRInstruction &instruction : function.blocks[b].instructions)
+			{
+				IROpcode opcode = instruction.opcode;
+				bool computable = (opcode >= IR_ADD && opcode <= IR_SHR) || opcode == IR_NOT || isMemory(opcode);
+				Expression e = {};
+				if (computable)
+				{
+					e = expressionOf(instruction);
+					Available::const_iterator found = available.find(e);
+					if (found != available.end() && found->second != instruction.d)
+					{
+						instruction = makeInstruction(IR_COPY, instruction.d, found->second);
+						changed = true;
+					}
+				}
+
+				//Forget what this changes.
+				if (opcode == IR_STORE || opcode == IR_FRAME_STORE || opcode == IR_CALL)
+				{
+					for (Available::iterator i = available.begin(); i != available.end(); )
+					{
+						i = isMemory(i->first.opcode) ? available.erase(i) : std::next(i);
+					}
+				}
+				for (VReg *def : instruction.defs())
+				{
+					for (Available::iterator i = available.begin(); i != available.end(); )
+					{
+						bool stale = i->first.a == *def || i->first.b == *def || i->second == *def;
+						i = stale ? available.erase(i) : std::next(i);
+					}
+				}
+
+				//Remember what this computes.
+				if (computable && e.a != instruction.d && e.b != instruction.d)
+				{
+					available[e] = instruction.d;
+				}
+				if (opcode == IR_STORE)
+				{
+					available[Expression { IR_LOAD, instruction.a, NO_VREG, -1, 0 }] = instruction.b;
+				}
+				if (opcode == IR_FRAME_STORE)
+				{
+					available[Expression { IR_FRAME_LOAD, NO_VREG, NO_VREG, -1, instruction.object }] = instruction.a;
+				}
+			}
+			out[b].swap(available);
+		}
+		return changed;
+	}
+
+	//Threads jumps to empty blocks & merges blocks with their only successor, if they're its only predecessor.
+	bool simplifyControlFlow()
+	{
+		bool changed = false;
+
+		//Where a block that only jumps ends up.
+		std::vector<uint32_t> forward(function.blocks.size());
+		for (uint32_t b = 0; b < function.blocks.size(); ++b)
+		{
+			forward[b] = b;
+		}
+		for (uint32_t b = 1; b < function.blocks.size(); ++b)
+		{
+			uint32_t target = b;
+			for (std::size_t hops = 0; hops < function.blocks.size(); ++hops)
+			{
+				IRBlock &block = function.blocks[target];
+				if (block.instructions.size() != 1 || block.terminator().opcode != IR_JUMP || block.terminator().targets[0] == target)
+				{
+					break;
+				}
+				target = block.terminator().targets[0];
+			}
+			forward[b] = target;
+		}
+		for (IRBlock &block : function.blocks)
+		{
+			IRInstruction &last = block.terminator();
+			for (uint32_t i = 0; i < 2; ++i)
+			{
+				if (forward[last.targets[i]] != last.targets[i])
+				{
+					last.targets[i] = forward[last.targets[i]];
+					changed = true;
+				}
+			}
+			if (last.opcode == IR_BRANCH && last.targets[0] == last.targets[1])
+			{
+				uint32_t target = last.targets[0];
+				last = makeInstruction(IR_JUMP);
+				last.targets[0] = target;
+				changed = true;
+			}
+		}
+		changed = removeUnreachable(function) || changed;
+
+		std::vector<std::vector<uint32_t> > preds = predecessors(function);
+		for (uint32_t b = 0; b < function.blocks.size(); ++b)
+		{
+			IRBlock &block = function.blocks[b];
+			while (block.terminator().opcode == IR_JUMP)
+			{
+				uint32_t successor = block.terminator().targets[0];
+				if (successor == b || successor == 0 || preds[successor].size() != 1)
+				{
+					break;
+				}
+				block.instructions.pop_back();
+				std::vector<IRInstruction> &moved = function.blocks[successor].instructions;
+				block.instructions.insert(block.instructions.end(), moved.begin(), moved.end());
+				//The successor is now unreachable. Whatever it jumped to has block as predecessor instead.
+				moved.assign(1, makeInstruction(IR_HALT));
+				for (uint32_t next : block.successors())
+				{
+					std::replace(preds[next].begin(), preds[next].end(), successor, b);
+				}
+				preds[successor].clear();
+				changed = true;
+			}
+		}
+		return removeUnreachable(function) || changed;
+	}
+
+public:
+	Optimizer(IRFunction &ir_function) :
+		function(ir_function)
+	{
+	}
+
+	void optimize()
+	{
+		removeUnreachable(function);
+		for (uint32_t round = 0; round < 16; ++round)
+		{
+			bool changed = propagateConstants();
+			changed = eliminateCommonSubexpressions() || changed;
+			changed = eliminateDeadCode() || changed;
+			changed = simplifyControlFlow() || changed;
+			if (!changed)
+			{
+				break;
+			}
+		}
+	}
+};
+
+#endif //TRISK_OPTIMIZER_HPP
@@ -0,0 +1,950 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_PARSER_HPP
+#define TRISK_PARSER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+#include "isa.hpp"
+#include "clexer.hpp"
+
+/*
+ * Parses the C subset tcc compiles into an AST, resolving variable names as it goes.
+ *
+ * Every value is a byte: uint8_t, char, int, unsigned (& co.) all mean an 8-bit unsigned integer,
+ * and pointers are 8-bit addresses. Supported:
+ * * Global & local variables, arrays of bytes (globals can be initialized with numbers or a string), pointers.
+ * * Functions of up to 2 parameters (passed in registers A & B, C is needed for CALL), returning a byte in A or void.
+ * * if/else, while, do/while, for, break, continue, return.
+ * * All the integer operators except / and %, assignment operators, ++/--, ?:, &&/||, casts, [] and pointer arithmetic.
+ */
+
+static const uint8_t MAX_PARAMETERS = 2;
+
+struct CType
+{
+	bool is_void;
+	uint8_t pointers; //Levels of indirection.
+	uint16_t array_length; //0 if it's not an array.
+};
+
+struct Variable
+{
+	std::string name;
+	CType type;
+	CToken token;
+	bool global;
+	bool address_taken; //&variable is used somewhere, so it has to live in memory.
+	std::vector<uint8_t> initializer; //Globals only, padded to size.
+	std::string label; //Globals only.
+
+	//Bytes it takes in memory.
+	uint16_t size() const
+	{
+		return type.array_length ? type.array_length : 1;
+	}
+
+	//Arrays & address taken locals live in memory, other locals in registers.
+	bool inMemory() const
+	{
+		return global || address_taken || type.array_length;
+	}
+};
+
+enum ExprKind
+{
+	EXPR_NUMBER,
+	EXPR_VARIABLE,		//String literals too, as anonymous global arrays.
+	EXPR_CALL,
+	EXPR_UNARY,			//op: - ~ ! * &
+	EXPR_BINARY,		//op: + - * & | ^ << >> == != < > <= >= && ||
+	EXPR_ASSIGN,		//op: = += -= *= &= |= ^= <<= >>=
+	EXPR_INCREMENT,		//op: ++ --, prefix or postfix.
+	EXPR_CONDITIONAL,	//operands: condition, then, else.
+	EXPR_INDEX			//operands: pointer, index.
+};
+
+struct Expr
+{
+	ExprKind kind;
+	CToken token;
+	std::string op;
+	uint32_t value; //EXPR_NUMBER
+	bool prefix; //EXPR_INCREMENT
+	Variable *variable; //EXPR_VARIABLE
+	std::string callee; //EXPR_CALL
+	std::vector<std::unique_ptr<Expr> > operands;
+	uint8_t pointers; //Levels of indirection of the result, arrays count as pointers.
+};
+
+enum StmtKind
+{
+	STMT_BLOCK,
+	STMT_EXPR,
+	STMT_DECLARATION,	//variable, optional value.
+	STMT_IF,			//condition, body[0], optional body[1].
+	STMT_WHILE,			//condition, body[0].
+	STMT_DO,			//body[0], condition.
+	STMT_FOR,			//body[0] = init (optional), condition (optional), step (optional), body[1].
+	STMT_RETURN,		//optional value.
+	STMT_BREAK,
+	STMT_CONTINUE
+};
+
+struct Stmt
+{
+	StmtKind kind;
+	CToken token;
+	std::unique_ptr<Expr> value; //Expression, initial value, returned value.
+	std::unique_ptr<Expr> condition;
+	std::unique_ptr<Expr> step;
+	std::vector<std::unique_ptr<Stmt> > body;
+	Variable *variable;
+};
+
+struct Function
+{
+	std::string name;
+	CType return_type;
+	CToken token;
+	std::vector<Variable* > parameters;
+	std::unique_ptr<Stmt> body; //nullptr until defined.
+};
+
+struct TranslationUnit
+{
+	std::vector<std::unique_ptr<Variable> > variables; //Owns every variable, locals too.
+	std::vector<Variable* > globals; //In order of definition, string literals included.
+	std::vector<std::unique_ptr<Function> > functions; //In order of first declaration.
+	std::map<std::string, Function* > function_names;
+};
+
+class CParser
+{
+	const std::vector<CToken> &tokens;
+	std::size_t position;
+	TranslationUnit &unit;
+
+	std::vector<std::map<std::string, Variable* > > scopes; //Innermost last. scopes[0] are the globals.
+	uint32_t string_count;
+
+	const CToken &peek(std::size_t ahead = 0) const
+	{
+		return tokens[std::min(position + ahead, tokens.size() - 1)];
+	}
+
+	const CToken &next()
+	{
+		const CToken &token = peek();
+		if (token.kind != CTOKEN_END)
+		{
+			++position;
+		}
+		return token;
+	}
+
+	bool is(const char *text, std::size_t ahead = 0) const
+	{
+		const CToken &token = peek(ahead);
+		return (token.kind == CTOKEN_PUNCTUATOR || token.kind == CTOKEN_IDENTIFIER) && token.text == text;
+	}
+
+	bool accept(const char *text)
+	{
+		if (is(text))
+		{
+			++position;
+			return true;
+		}
+		return false;
+	}
+
+	const CToken &expect(const char *text)
+	{
+		if (!is(text))
+		{
+			compileError(peek(), std::string("Expected \"") + text + "\" instead of \"" + peek().text + "\".");
+		}
+		return next();
+	}
+
+	static bool isTypeWord(const std::string &word)
+	{
+		static const char *WORDS[] = { "void", "uint8_t", "int8_t", "char", "int", "short", "long", "unsigned", "signed", "const", "register", "static", "volatile" };
+		for (const char *type_word : WORDS)
+		{
+			if (word == type_word)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool startsType(std::size_t ahead = 0) const
+	{
+		return peek(ahead).kind == CTOKEN_IDENTIFIER && isTypeWord(peek(ahead).text);
+	}
+
+	//Type words, without the *s. Everything but void is a byte.
+	CType parseBaseType()
+	{
+		CType type = { false, 0, 0 };
+		bool any = false;
+		while (startsType())
+		{
+			type.is_void = type.is_void || peek().text == "void";
+			next();
+			any = true;
+		}
+		if (!any)
+		{
+			compileError(peek(), "Expected a type instead of \"" + peek().text + "\".");
+		}
+		return type;
+	}
+
+	CType parsePointers(CType type)
+	{
+		while (accept("*"))
+		{
+			++type.pointers;
+			while (accept("const") || accept("volatile"))
+			{
+			}
+		}
+		return type;
+	}
+
+	Variable *newVariable(const CToken &token, const CType &type, bool global)
+	{
+		if (type.is_void && type.pointers == 0)
+		{
+			compileError(token, "Variable \"" + token.text + "\" can't be void.");
+		}
+
+		unit.variables.emplace_back(new Variable { token.text, type, token, global, false, std::vector<uint8_t>(), "" });
+		Variable *variable = unit.variables.back().get();
+
+		std::map<std::string, Variable* > &scope = global ? scopes.front() : scopes.back();
+		if (scope.count(token.text) || (global && unit.function_names.count(token.text)))
+		{
+			compileError(token, "Redefinition of \"" + token.text + "\".");
+		}
+		scope[token.text] = variable;
+
+		if (global)
+		{
+			unit.globals.push_back(variable);
+		}
+		return variable;
+	}
+
+	Variable *findVariable(const std::string &name) const
+	{
+		for (std::size_t i = scopes.size(); i-- > 0; )
+		{
+			std::map<std::string, Variable* >::const_iterator found = scopes[i].find(name);
+			if (found != scopes[i].end())
+			{
+				return found->second;
+			}
+		}
+		return nullptr;
+	}
+
+	std::unique_ptr<Expr> makeExpr(ExprKind kind, const CToken &token, const std::string &op = "")
+	{
+		return std::unique_ptr<Expr>(new Expr { kind, token, op, 0, false, nullptr, "", {}, 0 });
+	}
+
+	static uint8_t constantByte(const CToken &token, uint32_t value)
+	{
+		if (value > 255)
+		{
+			compileError(token, "Constant " + std::to_string(value) + " doesn't fit in a byte.");
+		}
+		return value;
+	}
+
+	static void requireLvalue(const Expr &e)
+	{
+		bool lvalue = (e.kind == EXPR_VARIABLE && !e.variable->type.array_length) || e.kind == EXPR_INDEX || (e.kind == EXPR_UNARY && e.op == "*");
+		if (!lvalue)
+		{
+			compileError(e.token, "Can't assign to this.");
+		}
+	}
+
+	std::unique_ptr<Expr> parsePrimary()
+	{
+		const CToken &token = next();
+
+		if (token.kind == CTOKEN_NUMBER)
+		{
+			std::unique_ptr<Expr> e = makeExpr(EXPR_NUMBER, token);
+			e->value = constantByte(token, token.value);
+			return e;
+		}
+
+		if (token.kind == CTOKEN_STRING)
+		{
+			//An anonymous global array.
+			std::string text = token.text;
+			while (peek().kind == CTOKEN_STRING) //"abc" "def"
+			{
+				text += next().text;
+			}
+			CToken name = token;
+			name.text = "string." + std::to_string(string_count++); //Can't clash with a C name.
+			if (text.size() >= RAM_SIZE)
+			{
+				compileError(token, "String doesn't fit in RAM.");
+			}
+			Variable *variable = newVariable(name, CType { false, 0, static_cast<uint16_t>(text.size() + 1) }, true);
+			variable->initializer.assign(text.begin(), text.end());
+			variable->initializer.push_back(0);
+
+			std::unique_ptr<Expr> e = makeExpr(EXPR_VARIABLE, token);
+			e->variable = variable;
+			e->pointers = 1;
+			return e;
+		}
+
+		if (token.kind == CTOKEN_IDENTIFIER && !isTypeWord(token.text))
+		{
+			if (is("("))
+			{
+				std::unique_ptr<Expr> e = makeExpr(EXPR_CALL, token);
+				e->callee = token.text;
+				next();
+				if (!is(")"))
+				{
+					do
+					{
+						e->operands.push_back(parseAssignment());
+					} while (accept(","));
+				}
+				expect(")");
+				return e;
+			}
+
+			Variable *variable = findVariable(token.text);
+			if (variable == nullptr)
+			{
+				compileError(token, "Undeclared variable \"" + token.text + "\".");
+			}
+			std::unique_ptr<Expr> e = makeExpr(EXPR_VARIABLE, token);
+			e->variable = variable;
+			e->pointers = variable->type.pointers + (variable->type.array_length ? 1 : 0);
+			return e;
+		}
+
+		if (token.kind == CTOKEN_PUNCTUATOR && token.text == "(")
+		{
+			std::unique_ptr<Expr> e = parseExpression();
+			expect(")");
+			return e;
+		}
+
+		compileError(token, "Expected an expression instead of \"" + token.text + "\".");
+	}
+
+	std::unique_ptr<Expr> parsePostfix()
+	{
+		std::unique_ptr<Expr> e = parsePrimary();
+		for (;;)
+		{
+			const CToken &token = peek();
+			if (accept("["))
+			{
+				std::unique_ptr<Expr> index = makeExpr(EXPR_INDEX, token);
+				index->pointers = e->pointers;
+				index->operands.push_back(std::move(e));
+				index->operands.push_back(parseExpression());
+				expect("]");
+				if (index->pointers == 0 && index->operands[1]->pointers == 0)
+				{
+					compileError(token, "Indexing something that isn't a pointer or an array.");
+				}
+				index->pointers = std::max(index->operands[0]->pointers, index->operands[1]->pointers) - 1;
+				e = std::move(index);
+			}
+			else if (is("++") || is("--"))
+			{
+				requireLvalue(*e);
+				std::unique_ptr<Expr> increment = makeExpr(EXPR_INCREMENT, token, next().text);
+				increment->pointers = e->pointers;
+				increment->operands.push_back(std::move(e));
+				e = std::move(increment);
+			}
+			else
+			{
+				return e;
+			}
+		}
+	}
+
+	std::unique_ptr<Expr> parseUnary()
+	{
+		const CToken &token = peek();
+
+		if (is("++") || is("--"))
+		{
+			std::unique_ptr<Expr> e = makeExpr(EXPR_INCREMENT, token, next().text);
+			e->prefix = true;
+			e->operands.push_back(parseUnary());
+			requireLvalue(*e->operands[0]);
+			e->pointers = e->operands[0]->pointers;
+			return e;
+		}
+
+		if (is("-") || is("~") || is("!") || is("*") || is("&") || is("+"))
+		{
+			std::string op = next().text;
+			std::unique_ptr<Expr> operand = parseUnary();
+			if (op == "+")
+			{
+				return operand;
+			}
+
+			std::unique_ptr<Expr> e = makeExpr(EXPR_UNARY, token, op);
+			if (op == "*")
+			{
+				if (operand->pointers == 0)
+				{
+					compileError(token, "Dereferencing something that isn't a pointer.");
+				}
+				e->pointers = operand->pointers - 1;
+			}
+			else if (op == "&")
+			{
+				if (operand->kind == EXPR_VARIABLE)
+				{
+					operand->variable->address_taken = true;
+				}
+				else if (operand->kind != EXPR_INDEX && !(operand->kind == EXPR_UNARY && operand->op == "*"))
+				{
+					compileError(token, "Can't take the address of this.");
+				}
+				e->pointers = operand->pointers + (operand->kind == EXPR_VARIABLE && operand->variable->type.array_length ? 0 : 1);
+			}
+			e->operands.push_back(std::move(operand));
+			return e;
+		}
+
+		//Cast: only changes the type.
+		if (is("(") && startsType(1))
+		{
+			next();
+			CType type = parsePointers(parseBaseType());
+			expect(")");
+			std::unique_ptr<Expr> e = parseUnary();
+			e->pointers = type.pointers;
+			return e;
+		}
+
+		if (is("sizeof"))
+		{
+			compileError(token, "sizeof isn't supported.");
+		}
+
+		return parsePostfix();
+	}
+
+	static int precedence(const CToken &token)
+	{
+		static const std::map<std::string, int> PRECEDENCE =
+		{
+			{ "||", 1 }, { "&&", 2 }, { "|", 3 }, { "^", 4 }, { "&", 5 }, { "==", 6 }, { "!=", 6 },
+			{ "<", 7 }, { ">", 7 }, { "<=", 7 }, { ">=", 7 }, { "<<", 8 }, { ">>", 8 }, { "+", 9 }, { "-", 9 },
+			{ "*", 10 }, { "/", 10 }, { "%", 10 }
+		};
+		if (token.kind != CTOKEN_PUNCTUATOR)
+		{
+			return 0;
+		}
+		std::map<std::string, int>::const_iterator found = PRECEDENCE.find(token.text);
+		return (found == PRECEDENCE.end()) ? 0 : found->second;
+	}
+
+	std::unique_ptr<Expr> parseBinary(int minimum)
+	{
+		std::unique_ptr<Expr> left = parseUnary();
+		while (precedence(peek()) >= minimum)
+		{
+			const CToken &token = next();
+			if (token.text == "/" || token.text == "%")
+			{
+				compileError(token, "Division isn't supported (TRISK has no divide instruction).");
+			}
+
+			std::unique_ptr<Expr> e = makeExpr(EXPR_BINARY, token, token.text);
+			e->operands.push_back(std::move(left));
+			e->operands.push_back(parseBinary(precedence(token) + 1));
+
+			uint8_t p0 = e->operands[0]->pointers, p1 = e->operands[1]->pointers;
+			if (token.text == "+")
+			{
+				e->pointers = std::max(p0, p1);
+			}
+			else if (token.text == "-")
+			{
+				e->pointers = (p1 == 0) ? p0 : 0; //pointer - pointer is a number.
+			}
+			left = std::move(e);
+		}
+		return left;
+	}
+
+	std::unique_ptr<Expr> parseConditional()
+	{
+		std::unique_ptr<Expr> condition = parseBinary(1);
+		if (!is("?"))
+		{
+			return condition;
+		}
+
+		std::unique_ptr<Expr> e = makeExpr(EXPR_CONDITIONAL, next());
+		e->operands.push_back(std::move(condition));
+		e->operands.push_back(parseExpression());
+		expect(":");
+		e->operands.push_back(parseConditional());
+		e->pointers = std::max(e->operands[1]->pointers, e->operands[2]->pointers);
+		return e;
+	}
+
+	std::unique_ptr<Expr> parseAssignment()
+	{
+		std::unique_ptr<Expr> target = parseConditional();
+
+		static const char *ASSIGNMENTS[] = { "=", "+=", "-=", "*=", "&=", "|=", "^=", "<<=", ">>=" };
+		for (const char *op : ASSIGNMENTS)
+		{
+			if (is(op))
+			{
+				requireLvalue(*target);
+				std::unique_ptr<Expr> e = makeExpr(EXPR_ASSIGN, next(), op);
+				e->pointers = target->pointers;
+				e->operands.push_back(std::move(target));
+				e->operands.push_back(parseAssignment());
+				return e;
+			}
+		}
+		if (is("/=") || is("%="))
+		{
+			compileError(peek(), "Division isn't supported (TRISK has no divide instruction).");
+		}
+		return target;
+	}
+
+	std::unique_ptr<Expr> parseExpression()
+	{
+		return parseAssignment();
+	}
+
+	std::unique_ptr<Stmt> makeStmt(StmtKind kind, const CToken &token)
+	{
+		return std::unique_ptr<Stmt>(new Stmt { kind, token, nullptr, nullptr, nullptr, {}, nullptr });
+	}
+
+	//Declaration of one or more locals, into a block of STMT_DECLARATIONs.
+	std::unique_ptr<Stmt> parseLocalDeclaration()
+	{
+		std::unique_ptr<Stmt> block = makeStmt(STMT_BLOCK, peek());
+		CType base = parseBaseType();
+		do
+		{
+			CType type = parsePointers(base);
+			const CToken &name = next();
+			if (name.kind != CTOKEN_IDENTIFIER || isTypeWord(name.text))
+			{
+				compileError(name, "Expected a variable name instead of \"" + name.text + "\".");
+			}
+			if (accept("["))
+			{
+				const CToken &length = next();
+				if (length.kind != CTOKEN_NUMBER || length.value == 0 || length.value > RAM_SIZE)
+				{
+					compileError(length, "Local arrays need a size (1 - 256).");
+				}
+				type.array_length = length.value;
+				expect("]");
+			}
+
+			std::unique_ptr<Stmt> declaration = makeStmt(STMT_DECLARATION, name);
+			if (accept("="))
+			{
+				if (type.array_length)
+				{
+					compileError(name, "Local arrays can't be initialized.");
+				}
+				declaration->value = parseAssignment();
+			}
+			declaration->variable = newVariable(name, type, false); //After the initializer, which can't see it.
+			block->body.push_back(std::move(declaration));
+		} while (accept(","));
+		expect(";");
+		return block;
+	}
+
+	std::unique_ptr<Stmt> parseStatement()
+	{
+		const CToken &token = peek();
+
+		if (startsType())
+		{
+			return parseLocalDeclaration();
+		}
+
+		if (accept("{"))
+		{
+			std::unique_ptr<Stmt> block = makeStmt(STMT_BLOCK, token);
+			scopes.emplace_back();
+			while (!accept("}"))
+			{
+				if (peek().kind == CTOKEN_END)
+				{
+					compileError(token, "Unterminated block.");
+				}
+				block->body.push_back(parseStatement());
+			}
+			scopes.pop_back();
+			return block;
+		}
+
+		if (accept("if"))
+		{
+			std::unique_ptr<Stmt> s = makeStmt(STMT_IF, token);
+			expect("(");
+			s->condition = parseExpression();
+			expect(")");
+			s->body.push_back(parseStatement());
+			if (accept("else"))
+			{
+				s->body.push_back(parseStatement());
+			}
+			return s;
+		}
+
+		if (accept("while"))
+		{
+			std::unique_ptr<Stmt> s = makeStmt(STMT_WHILE, token);
+			expect("(");
+			s->condition = parseExpression();
+			expect(")");
+			s->body.push_back(parseStatement());
+			return s;
+		}
+
+		if (accept("do"))
+		{
+			std::unique_ptr<Stmt> s = makeStmt(STMT_DO, token);
+			s->body.push_back(parseStatement());
+			expect("while");
+			expect("(");
+			s->condition = parseExpression();
+			expect(")");
+			expect(";");
+			return s;
+		}
+
+		if (accept("for"))
+		{
+			std::unique_ptr<Stmt> s = makeStmt(STMT_FOR, token);
+			scopes.emplace_back(); //for (uint8_t i = 0; ...
+			expect("(");
+			if (startsType())
+			{
+				s->body.push_back(parseLocalDeclaration());
+			}
+			else
+			{
+				s->body.push_back(nullptr);
+				if (!accept(";"))
+				{
+					std::unique_ptr<Stmt> init = makeStmt(STMT_EXPR, peek());
+					init->value = parseExpression();
+					s->body[0] = std::move(init);
+					expect(";");
+				}
+			}
+			if (!is(";"))
+			{
+				s->condition = parseExpression();
+			}
+			expect(";");
+			if (!is(")"))
+			{
+				s->step = parseExpression();
+			}
+			expect(")");
+			s->body.push_back(parseStatement());
+			scopes.pop_back();
+			return s;
+		}
+
+		if (accept("return"))
+		{
+			std::unique_ptr<Stmt> s = makeStmt(STMT_RETURN, token);
+			if (!is(";"))
+			{
+				s->value = parseExpression();
+			}
+			expect(";");
+			return s;
+		}
+
+		if (accept("break") || accept("continue"))
+		{
+			std::unique_ptr<Stmt> s = makeStmt(token.text == "break" ? STMT_BREAK : STMT_CONTINUE, token);
+			expect(";");
+			return s;
+		}
+
+		if (accept(";"))
+		{
+			return makeStmt(STMT_BLOCK, token);
+		}
+
+		std::unique_ptr<Stmt> s = makeStmt(STMT_EXPR, token);
+		s->value = parseExpression();
+		expect(";");
+		return s;
+	}
+
+	//Global initializer: a number, a string, or a list of numbers in braces.
+	void parseInitializer(Variable &variable)
+	{
+		const CToken &token = peek();
+		if (token.kind == CTOKEN_STRING)
+		{
+			if (!variable.type.array_length)
+			{
+				compileError(token, "Only arrays can be initialized with a string.");
+			}
+			std::string text;
+			while (peek().kind == CTOKEN_STRING)
+			{
+				text += next().text;
+			}
+			variable.initializer.assign(text.begin(), text.end());
+			variable.initializer.push_back(0);
+		}
+		else if (accept("{"))
+		{
+			do
+			{
+				if (is("}"))
+				{
+					break; //Trailing comma.
+				}
+				const CToken &value = next();
+				if (value.kind != CTOKEN_NUMBER)
+				{
+					compileError(value, "Global initializers have to be numbers.");
+				}
+				variable.initializer.push_back(constantByte(value, value.value));
+			} while (accept(","));
+			expect("}");
+		}
+		else
+		{
+			bool negative = accept("-");
+			const CToken &value = next();
+			if (value.kind != CTOKEN_NUMBER)
+			{
+				compileError(value, "Global initializers have to be numbers.");
+			}
+			variable.initializer.push_back(static_cast<uint8_t>(negative ? -constantByte(value, value.value) : constantByte(value, value.value)));
+		}
+	}
+
+	void parseGlobalVariable(const CToken &name, CType type)
+	{
+		bool unsized = false;
+		if (accept("["))
+		{
+			if (is("]"))
+			{
+				unsized = true;
+			}
+			else
+			{
+				const CToken &length = next();
+				if (length.kind != CTOKEN_NUMBER || length.value == 0 || length.value > RAM_SIZE)
+				{
+					compileError(length, "Arrays need a size (1 - 256).");
+				}
+				type.array_length = length.value;
+			}
+			expect("]");
+		}
+		if (unsized)
+		{
+			type.array_length = 1; //Until the initializer says.
+		}
+
+		Variable *variable = newVariable(name, type, true);
+		if (accept("="))
+		{
+			parseInitializer(*variable);
+		}
+		else if (unsized)
+		{
+			compileError(name, "Arrays without a size need an initializer.");
+		}
+
+		if (unsized)
+		{
+			variable->type.array_length = std::max<std::size_t>(1, variable->initializer.size());
+		}
+		if (variable->initializer.size() > variable->size())
+		{
+			compileError(name, "Too many initializers for \"" + name.text + "\".");
+		}
+		variable->initializer.resize(variable->size(), 0);
+	}
+
+	//Returns false for a prototype, leaving its ; to the caller.
+	bool parseFunction(const CToken &name, CType return_type)
+	{
+		Function *function;
+		std::map<std::string, Function* >::iterator existing = unit.function_names.find(name.text);
+		if (existing != unit.function_names.end())
+		{
+			function = existing->second;
+		}
+		else
+		{
+			if (scopes[0].count(name.text))
+			{
+				compileError(name, "Redefinition of \"" + name.text + "\".");
+			}
+			unit.functions.emplace_back(new Function { name.text, return_type, name, {}, nullptr });
+			function = unit.functions.back().get();
+			unit.function_names[name.text] = function;
+		}
+
+		scopes.emplace_back();
+		std::vector<Variable* > parameters;
+		expect("(");
+		if (is("void") && is(")", 1))
+		{
+			next();
+		}
+		else if (!is(")"))
+		{
+			do
+			{
+				CType type = parsePointers(parseBaseType());
+				const CToken &parameter = next();
+				if (parameter.kind != CTOKEN_IDENTIFIER || isTypeWord(parameter.text))
+				{
+					//Prototype without parameter names.
+					CToken unnamed = parameter;
+					unnamed.text = "parameter." + std::to_string(parameters.size());
+					--position;
+					parameters.push_back(newVariable(unnamed, type, false));
+					continue;
+				}
+				parameters.push_back(newVariable(parameter, type, false));
+			} while (accept(","));
+		}
+		expect(")");
+
+		if (parameters.size() > MAX_PARAMETERS)
+		{
+			compileError(name, "Functions can have at most " + std::to_string(MAX_PARAMETERS) + " parameters (they're passed in registers A & B).");
+		}
+		if (existing != unit.function_names.end() && (function->parameters.size() != parameters.size() || function->return_type.is_void != return_type.is_void))
+		{
+			compileError(name, "\"" + name.text + "\" doesn't match its earlier declaration.");
+		}
+
+		if (!is("{"))
+		{
+			if (!function->body)
+			{
+				function->parameters = parameters;
+			}
+			scopes.pop_back();
+			return false;
+		}
+
+		if (function->body)
+		{
+			compileError(name, "Redefinition of \"" + name.text + "\".");
+		}
+		function->parameters = parameters;
+		function->token = name;
+		function->body = parseStatement();
+		scopes.pop_back();
+		return true;
+	}
+
+public:
+	CParser(const std::vector<CToken> &source_tokens, TranslationUnit &translation_unit) :
+		tokens(source_tokens), unit(translation_unit)
+	{
+		position = 0;
+		string_count = 0;
+		scopes.emplace_back();
+	}
+
+	//Throws on error.
+	void parse()
+	{
+		while (peek().kind != CTOKEN_END)
+		{
+			if (accept(";"))
+			{
+				continue;
+			}
+
+			CType base = parseBaseType();
+			bool definition = false;
+			do
+			{
+				CType type = parsePointers(base);
+				const CToken &name = next();
+				if (name.kind != CTOKEN_IDENTIFIER || isTypeWord(name.text))
+				{
+					compileError(name, "Expected a name instead of \"" + name.text + "\".");
+				}
+
+				if (is("("))
+				{
+					definition = parseFunction(name, type);
+					if (definition)
+					{
+						break; //No ; after a function body.
+					}
+				}
+				else
+				{
+					parseGlobalVariable(name, type);
+				}
+			} while (accept(","));
+
+			if (!definition)
+			{
+				expect(";");
+			}
+		}
+
+		for (const std::unique_ptr<Function> &function : unit.functions)
+		{
+			if (!function->body)
+			{
+				compileError(function->token, "Function \"" + function->name + "\" is declared but never defined.");
+			}
+		}
+	}
+};
+
+#endif //TRISK_PARSER_HPP
@@ -0,0 +1,660 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_REGALLOC_HPP
+#define TRISK_REGALLOC_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
+
+#include "ir.hpp"
+#include "optimizer.hpp"
+
+/*
+ * Maps vregs onto registers A - C by coloring the interference graph (Chaitin/Briggs):
+ * * Copies between vregs that don't interfere are coalesced away when that can't make the graph harder to color (Briggs' test).
+ * * Vregs are colored in simplify/select order, preferring the register they're passed or returned in,
+ *   then the register of the vreg they're copied from/to or computed from, so fewer SETs are needed.
+ * * Vregs that can't be colored are spilled to the stack frame: reloaded before every use & stored after every def,
+ *   cheapest first (uses weighted by 10 ^ loop depth), or recomputed instead if they only ever hold one constant.
+ * D is the stack pointer. Functions that don't call anything & have nothing in their frame don't need it, so they
+ * get D as a 4th register if that avoids spilling; codegen saves it in a global around the function.
+ */
+
+static const uint8_t ALLOCATABLE_REGISTERS = 3;
+static const uint8_t LEAF_REGISTERS = 4;
+
+class RegisterAllocator
+{
+	IRFunction &function;
+	uint8_t registers; //How many can be used.
+
+	std::vector<std::set<VReg> > adjacency;
+	std::vector<double> costs;
+	std::vector<bool> present; //Appears in the function.
+	std::vector<bool> unspillable; //Spill temporaries.
+	std::vector<int> hints; //Register a vreg is passed or returned in, -1 if none.
+	std::vector<std::vector<VReg> > affinities; //Vregs it would be nice to share a register with.
+	std::vector<std::pair<VReg, VReg> > copies;
+
+	static double weight(uint32_t loop_depth)
+	{
+		double result = 1;
+		for (uint32_t i = 0; i < std::min<uint32_t>(loop_depth, 4); ++i)
+		{
+			result *= 10;
+		}
+		return result;
+	}
+
+	void addEdge(VReg x, VReg y)
+	{
+		if (x != y)
+		{
+			adjacency[x].insert(y);
+			adjacency[y].insert(x);
+		}
+	}
+
+	void hint(VReg v, int reg)
+	{
+		if (hints[v] < 0)
+		{
+			hints[v] = reg;
+		}
+	}
+
+	void build()
+	{
+		uint32_t count = function.vreg_count;
+		adjacency.assign(count, std::set<VReg>());
+		costs.assign(count, 0);
+		present.assign(count, false);
+		hints.assign(count, -1);
+		affinities.assign(count, std::vector<VReg>());
+		copies.clear();
+		unspillable.resize(count, false);
+
+		Liveness liveness;
+		liveness.compute(function);
+
+		for (uint32_t b = 0; b < function.blocks.size(); ++b)
+		{
+			IRBlock &block = function.blocks[b];
+			VRegSet live = liveness.live_out[b];
+			for (std::size_t i = block.instructions.size(); i-- > 0; )
+			{
+				IRInstruction &instruction = block.instructions[i];
+				std::vector<VReg* > defs = instruction.defs();
+				std::vector<VReg* > uses = instruction.uses();
+
+				for (VReg *def : defs)
+				{
+					for (VReg other : live)
+					{
+						if (!(instruction.opcode == IR_COPY && other == instruction.a))
+						{
+							addEdge(*def, other);
+						}
+					}
+					for (VReg *other : defs)
+					{
+						addEdge(*def, *other);
+					}
+				}
+
+				//Two address code: d = a - b becomes SET d a, SUB d b, so d can't be where b is.
+				bool commutative = instruction.opcode == IR_ADD || instruction.opcode == IR_AND || instruction.opcode == IR_OR || instruction.opcode == IR_MUL;
+				if ((instruction.opcode == IR_SUB || instruction.opcode == IR_SHL || instruction.opcode == IR_SHR) && !instruction.immediate && instruction.a != instruction.b)
+				{
+					addEdge(instruction.d, instruction.b);
+				}
+
+				double cost = weight(block.loop_depth);
+				for (VReg *v : defs)
+				{
+					costs[*v] += cost;
+					present[*v] = true;
+				}
+				for (VReg *v : uses)
+				{
+					costs[*v] += cost;
+					present[*v] = true;
+				}
+
+				switch (instruction.opcode)
+				{
+				case IR_COPY:
+					copies.push_back(std::make_pair(instruction.d, instruction.a));
+					affinities[instruction.d].push_back(instruction.a);
+					affinities[instruction.a].push_back(instruction.d);
+					break;
+				case IR_CALL:
+					for (std::size_t n = 0; n < instruction.arguments.size(); ++n)
+					{
+						hint(instruction.arguments[n], n);
+					}
+					if (instruction.d != NO_VREG)
+					{
+						hint(instruction.d, 0);
+					}
+					break;
+				case IR_RETURN:
+					if (instruction.a != NO_VREG)
+					{
+						hint(instruction.a, 0);
+					}
+					break;
+				case IR_ADD:
+				case IR_SUB:
+				case IR_AND:
+				case IR_OR:
+				case IR_SHL:
+				case IR_SHR:
+				case IR_MUL:
+				case IR_NOT:
+					affinities[instruction.d].push_back(instruction.a);
+					affinities[instruction.a].push_back(instruction.d);
+					if (commutative && !instruction.immediate)
+					{
+						affinities[instruction.d].push_back(instruction.b);
+					}
+					break;
+				default:
+					break;
+				}
+
+				Liveness::step(instruction, live);
+			}
+		}
+
+		//Parameters are all defined on entry.
+		for (std::size_t n = 0; n < function.parameters.size(); ++n)
+		{
+			VReg parameter = function.parameters[n];
+			present[parameter] = true;
+			hint(parameter, n);
+			for (VReg other : liveness.live_in[0])
+			{
+				addEdge(parameter, other);
+			}
+			for (VReg other : function.parameters)
+			{
+				addEdge(parameter, other);
+			}
+		}
+	}
+
+	//Briggs' conservative coalescing. Returns true if any copy was removed.
+	bool coalesce()
+	{
+		std::vector<VReg> merged_into(function.vreg_count);
+		for (VReg v = 0; v < function.vreg_count; ++v)
+		{
+			merged_into[v] = v;
+		}
+
+		bool any = false;
+		for (std::pair<VReg, VReg> copy : copies)
+		{
+			VReg x = copy.first, y = copy.second;
+			while (merged_into[x] != x) x = merged_into[x];
+			while (merged_into[y] != y) y = merged_into[y];
+			if (x == y || adjacency[x].count(y) || (unspillable[x] != unspillable[y]))
+			{
+				continue;
+			}
+			if (hints[x] >= 0 && hints[y] >= 0 && hints[x] != hints[y])
+			{
+				continue;
+			}
+
+			//Safe if the merged node has fewer than K neighbours of significant degree.
+			std::set<VReg> neighbours = adjacency[x];
+			neighbours.insert(adjacency[y].begin(), adjacency[y].end());
+			uint32_t significant = 0;
+			for (VReg n : neighbours)
+			{
+				std::size_t degree = adjacency[n].size();
+				if (adjacency[n].count(x) && adjacency[n].count(y))
+				{
+					--degree;
+				}
+				significant += (degree >= registers) ? 1 : 0;
+			}
+			if (significant >= registers)
+			{
+				continue;
+			}
+
+			//Keep x, where the parameters stay.
+			if (std::find(function.parameters.begin(), function.parameters.end(), y) != function.parameters.end())
+			{
+				std::swap(x, y);
+			}
+			merged_into[y] = x;
+			for (VReg n : adjacency[y])
+			{
+				adjacency[n].erase(y);
+				addEdge(x, n);
+			}
+			adjacency[y].clear();
+			hint(x, hints[y]);
+			any = true;
+		}
+
+		if (!any)
+		{
+			return false;
+		}
+
+		for (IRBlock &block : function.blocks)
+		{
+			std::vector<IRInstruction> kept;
+			for (IRInstruction &instruction : block.instructions)
+			{
+				auto resolve = [&merged_into](VReg *v)
+				{
+					while (merged_into[*v] != *v)
+					{
+						*v = merged_into[*v];
+					}
+				};
+				for (VReg *v : instruction.uses())
+				{
+					resolve(v);
+				}
+				for (VReg *v : instruction.defs())
+				{
+					resolve(v);
+				}
+				if (instruction.opcode != IR_COPY || instruction.d != instruction.a)
+				{
+					kept.push_back(instruction);
+				}
+			}
+			block.instructions.swap(kept);
+		}
+		for (VReg &parameter : function.parameters)
+		{
+			while (merged_into[parameter] != parameter)
+			{
+				parameter = merged_into[parameter];
+			}
+		}
+		return true;
+	}
+
+	//Simplify & select. Returns the vregs that couldn't be colored.
+	std::vector<VReg> color()
+	{
+		uint32_t count = function.vreg_count;
+		colors.assign(count, -1);
+
+		std::vector<std::size_t> degrees(count);
+		std::vector<bool> removed(count, true);
+		std::size_t remaining = 0;
+		for (VReg v = 0; v < count; ++v)
+		{
+			if (present[v])
+			{
+				degrees[v] = adjacency[v].size();
+				removed[v] = false;
+				++remaining;
+			}
+		}
+
+		std::vector<VReg> stack;
+		while (remaining > 0)
+		{
+			VReg pick = NO_VREG;
+			for (VReg v = 0; v < count && pick == NO_VREG; ++v)
+			{
+				if (!removed[v] && degrees[v] < registers)
+				{
+					pick = v;
+				}
+			}
+			if (pick == NO_VREG)
+			{
+				//Potential spill: cheapest per neighbour freed, and temporaries last.
+				double best = 0;
+				for (VReg v = 0; v < count; ++v)
+				{
+					if (removed[v])
+					{
+						continue;
+					}
+					double score = (unspillable[v] ? 1e30 : costs[v]) / degrees[v];
+					if (pick == NO_VREG || score < best)
+					{
+						pick = v;
+						best = score;
+					}
+				}
+			}
+
+			removed[pick] = true;
+			--remaining;
+			stack.push_back(pick);
+			for (VReg n : adjacency[pick])
+			{
+				--degrees[n];
+			}
+		}
+
+		std::vector<VReg> spilled;
+		while (!stack.empty())
+		{
+			VReg v = stack.back();
+			stack.pop_back();
+
+			bool free[LEAF_REGISTERS];
+			std::fill(free, free + LEAF_REGISTERS, true);
+			for (VReg n : adjacency[v])
+			{
+				if (colors[n] >= 0)
+				{
+					free[colors[n]] = false;
+				}
+			}
+
+			int choice = -1;
+			if (hints[v] >= 0 && hints[v] < registers && free[hints[v]])
+			{
+				choice = hints[v];
+			}
+			for (std::size_t i = 0; i < affinities[v].size() && choice < 0; ++i)
+			{
+				VReg partner = affinities[v][i];
+				int preferred = (colors[partner] >= 0) ? colors[partner] : hints[partner];
+				if (preferred >= 0 && preferred < registers && free[preferred])
+				{
+					choice = preferred;
+				}
+			}
+			//Otherwise leave the registers neighbours still to be colored are passed in to them, if possible.
+			bool wanted[LEAF_REGISTERS] = {};
+			for (VReg n : adjacency[v])
+			{
+				if (colors[n] < 0 && hints[n] >= 0)
+				{
+					wanted[hints[n]] = true;
+				}
+			}
+			for (int reg = 0; reg < registers && choice < 0; ++reg)
+			{
+				if (free[reg] && !wanted[reg])
+				{
+					choice = reg;
+				}
+			}
+			for (int reg = 0; reg < registers && choice < 0; ++reg)
+			{
+				if (free[reg])
+				{
+					choice = reg;
+				}
+			}
+
+			if (choice < 0)
+			{
+				spilled.push_back(v);
+			}
+			colors[v] = choice;
+		}
+		return spilled;
+	}
+
+	VReg temporary()
+	{
+		VReg t = function.newVReg();
+		unspillable.resize(function.vreg_count, false);
+		unspillable[t] = true;
+		return t;
+	}
+
+	void spill(const std::vector<VReg> &spilled)
+	{
+		for (VReg v : spilled)
+		{
+			//Only ever one constant? Then just load it again where needed.
+			bool rematerialize = true;
+			int constant = -1;
+			for (IRBlock &block : function.blocks)
+			{
+				for (IRInstruction &instruction : block.instructions)
+				{
+					for (VReg *def : instruction.defs())
+					{
+						if (*def == v)
+						{
+							rematerialize = rematerialize && instruction.opcode == IR_CONST && (constant < 0 || constant == instruction.value);
+							constant = instruction.value;
+						}
+					}
+				}
+			}
+			rematerialize = rematerialize && constant >= 0;
+
+			uint32_t slot = function.frame.size();
+			if (!rematerialize)
+			{
+				function.frame.push_back(FrameObject { 1, 0 });
+			}
+
+			for (IRBlock &block : function.blocks)
+			{
+				std::vector<IRInstruction> rewritten;
+				for (IRInstruction instruction : block.instructions)
+				{
+					bool used = false, defined = false;
+					for (VReg *use : instruction.uses())
+					{
+						used = used || *use == v;
+					}
+					for (VReg *def : instruction.defs())
+					{
+						defined = defined || *def == v;
+					}
+					if (!used && !defined)
+					{
+						rewritten.push_back(instruction);
+						continue;
+					}
+					if (rematerialize && defined)
+					{
+						continue; //The constant's def goes, it's recomputed at its uses.
+					}
+
+					VReg t = temporary();
+					for (VReg *use : instruction.uses())
+					{
+						*use = (*use == v) ? t : *use;
+					}
+					for (VReg *def : instruction.defs())
+					{
+						*def = (*def == v) ? t : *def;
+					}
+
+					if (used)
+					{
+						IRInstruction reload = makeInstruction(rematerialize ? IR_CONST : IR_FRAME_LOAD, t);
+						reload.value = rematerialize ? constant : 0;
+						reload.object = slot;
+						rewritten.push_back(reload);
+					}
+					rewritten.push_back(instruction);
+					if (defined)
+					{
+						IRInstruction store = makeInstruction(IR_FRAME_STORE, NO_VREG, t);
+						store.object = slot;
+						rewritten.push_back(store);
+					}
+				}
+				block.instructions.swap(rewritten);
+			}
+
+			std::vector<VReg>::iterator parameter = std::find(function.parameters.begin(), function.parameters.end(), v);
+			if (parameter != function.parameters.end())
+			{
+				VReg t = temporary();
+				*parameter = t;
+				IRInstruction store = makeInstruction(IR_FRAME_STORE, NO_VREG, t);
+				store.object = slot;
+				std::vector<IRInstruction> &entry = function.blocks[0].instructions;
+				entry.insert(entry.begin(), store);
+			}
+		}
+	}
+
+	//Constants that don't fit an instruction's immediate go in a register.
+	void legalize()
+	{
+		for (IRBlock &block : function.blocks)
+		{
+			std::vector<IRInstruction> rewritten;
+			for (IRInstruction instruction : block.instructions)
+			{
+				if (instruction.opcode == IR_SHL && instruction.immediate && instruction.value > 2)
+				{
+					IRInstruction constant = makeInstruction(IR_CONST, function.newVReg());
+					constant.value = instruction.value;
+					rewritten.push_back(constant);
+					instruction.immediate = false;
+					instruction.b = constant.d;
+				}
+				rewritten.push_back(instruction);
+			}
+			block.instructions.swap(rewritten);
+		}
+	}
+
+	//Heaviest used frame object first, so it's at D + 0 and reachable without computing its address.
+	void layoutFrame()
+	{
+		std::vector<double> weights(function.frame.size(), 0);
+		for (IRBlock &block : function.blocks)
+		{
+			for (IRInstruction &instruction : block.instructions)
+			{
+				if (instruction.opcode == IR_FRAME_ADDRESS || instruction.opcode == IR_FRAME_LOAD || instruction.opcode == IR_FRAME_STORE)
+				{
+					weights[instruction.object] += weight(block.loop_depth);
+				}
+			}
+		}
+
+		std::vector<uint32_t> order(function.frame.size());
+		for (uint32_t i = 0; i < order.size(); ++i)
+		{
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [&weights](uint32_t x, uint32_t y) { return weights[x] > weights[y]; });
+
+		uint32_t offset = 0;
+		for (uint32_t i : order)
+		{
+			function.frame[i].offset = offset;
+			offset += function.frame[i].size;
+		}
+		if (offset >= RAM_SIZE)
+		{
+			std::cout << "Error: The locals of " << function.name << " don't fit in RAM.\n";
+			throw 0;
+		}
+		function.frame_size = offset;
+	}
+
+	//No calls & an empty frame: nothing needs D.
+	bool leaf() const
+	{
+		if (!function.frame.empty())
+		{
+			return false;
+		}
+		for (const IRBlock &block : function.blocks)
+		{
+			for (const IRInstruction &instruction : block.instructions)
+			{
+				if (instruction.opcode == IR_CALL)
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	bool colorWithoutSpilling()
+	{
+		build();
+		while (coalesce())
+		{
+			build();
+		}
+		return color().empty();
+	}
+
+public:
+	std::vector<int> colors; //Register of every vreg (0 = A), -1 for unused ones.
+
+	RegisterAllocator(IRFunction &ir_function) :
+		function(ir_function)
+	{
+		registers = ALLOCATABLE_REGISTERS;
+	}
+
+	//Throws on error.
+	void allocate()
+	{
+		legalize();
+		if (leaf() && !colorWithoutSpilling())
+		{
+			IRFunction snapshot = function;
+			registers = LEAF_REGISTERS;
+			if (colorWithoutSpilling())
+			{
+				function.borrows_stack_pointer = true;
+				layoutFrame();
+				return;
+			}
+			function = snapshot;
+			registers = ALLOCATABLE_REGISTERS;
+		}
+
+		for (uint32_t round = 0; round < 256; ++round)
+		{
+			build();
+			while (coalesce())
+			{
+				build();
+			}
+
+			std::vector<VReg> spilled = color();
+			if (spilled.empty())
+			{
+				layoutFrame();
+				return;
+			}
+			//Spill one at a time: with only 3 registers, spilling one vreg often frees enough room for the others.
+			VReg cheapest = spilled[0];
+			for (VReg v : spilled)
+			{
+				double score = (unspillable[v] ? 1e30 : costs[v]) / std::max<std::size_t>(1, adjacency[v].size());
+				if (score < (unspillable[cheapest] ? 1e30 : costs[cheapest]) / std::max<std::size_t>(1, adjacency[cheapest].size()))
+				{
+					cheapest = v;
+				}
+			}
+			spill({ cheapest });
+		}
+		std::cout << "Error: Ran out of registers in " << function.name << ".\n";
+		throw 0;
+	}
+};
+
+#endif //TRISK_REGALLOC_HPP
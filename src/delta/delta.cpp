@@ -0,0 +1,153 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include "isa.hpp"
+#include "archive.hpp"
+#include "delta.hpp"
+
+void displayUsageInstructions()
+{
+	std::cout << "Program usage: \n" \
+			<< "\n$> tdelta <input program file> <delta file> <output RAM file>\n" \
+			<< "$> tdelta --archive <input archive> <delta file> <output archive>\n\n" \
+			<< "Expands the output of tem --delta back into the final RAM it stands for, given the program it was run on,\n" \
+			<< "and prints the final state. With --archive, expands the deltas of tem --archive --delta into the output\n" \
+			<< "archive tem --archive would have written.\n";
+}
+
+static void printDelta(const RunDelta &delta)
+{
+	std::cout << archiveStatusName(delta.status) << ", " << delta.instructions << " instructions, " << delta.runs.size() << " changed runs, PC=0x" << std::hex << delta.pc;
+	for (std::size_t r = 0; r < delta.registers.size(); ++r)
+	{
+		std::cout << " " << static_cast<char>('A' + r) << "=0x" << static_cast<uint16_t>(delta.registers[r]);
+	}
+	std::cout << std::dec << " flags C=" << ((delta.flags >> 4) & 1) << " Z=" << ((delta.flags >> 3) & 1) << " S=" << ((delta.flags >> 2) & 1) \
+			<< " O=" << ((delta.flags >> 1) & 1) << " L=" << (delta.flags & 1) << "\n";
+}
+
+//Opens a delta file & checks its header.
+static bool openDeltas(const std::string &filename, std::ifstream &file)
+{
+	file.open(filename, std::ios::binary);
+	if (!file)
+	{
+		std::cout << "Error: failed to open delta file: \"" << filename << "\"\n";
+		return false;
+	}
+	return RunDelta::readHeader(file, filename);
+}
+
+static int expandImage(const std::string &input_filename, const std::string &delta_filename, const std::string &output_filename)
+{
+	std::ifstream deltas;
+	RunDelta delta;
+	bool malformed;
+	if (!openDeltas(delta_filename, deltas))
+	{
+		return 1;
+	}
+	if (!delta.read(deltas, malformed))
+	{
+		std::cout << "Error: \"" << delta_filename << "\" has no valid delta record.\n";
+		return 1;
+	}
+
+	//Loaded the way tem loads it: at least a standard image, anything past the RAM ignored, the rest zeroes.
+	std::ifstream input(input_filename, std::ios::binary);
+	if (!input)
+	{
+		std::cout << "Error: failed to open file for input program/RAM: \"" << input_filename << "\"\n";
+		return 1;
+	}
+	std::vector<uint8_t> ram(delta.ram_size, 0);
+	input.read(reinterpret_cast<char* >(ram.data()), ram.size());
+	if (input.gcount() < std::min<std::streamsize>(delta.ram_size, RAM_SIZE))
+	{
+		std::cout << "Error: Input RAM file is too short!\n";
+		return 1;
+	}
+
+	delta.apply(ram.data());
+
+	std::ofstream output(output_filename, std::ios::binary);
+	if (!output || !output.write(reinterpret_cast<const char* >(ram.data()), ram.size()))
+	{
+		std::cout << "Error: failed to open file for outputting final state of RAM: \"" << output_filename << "\"\n";
+		return 1;
+	}
+
+	printDelta(delta);
+	return 0;
+}
+
+static int expandArchive(const std::string &input_filename, const std::string &delta_filename, const std::string &output_filename)
+{
+	ImageArchive input, output;
+	std::ifstream deltas;
+	if (!input.open(input_filename) || !openDeltas(delta_filename, deltas))
+	{
+		return 1;
+	}
+	if (!ImageArchive::createLike(output_filename, input) || !output.open(output_filename, true))
+	{
+		return 1;
+	}
+
+	RunDelta delta;
+	bool malformed = false;
+	uint32_t i = 0;
+	for (; i < output.count() && delta.read(deltas, malformed); ++i)
+	{
+		if (delta.ram_size != output.imageSize() || delta.pc >= delta.ram_size || delta.registers.size() > sizeof(ArchiveEntry::registers))
+		{
+			std::cout << "Error: \"" << delta_filename << "\" record " << i << " doesn't fit the archive's images.\n";
+			return 1;
+		}
+
+		delta.apply(output.image(i));
+		ArchiveEntry &entry = output.entry(i);
+		entry.status = delta.status;
+		entry.instructions = delta.instructions;
+		entry.flags = delta.flags;
+		entry.pc = static_cast<uint8_t>(delta.pc);
+		std::copy(delta.registers.begin(), delta.registers.end(), entry.registers);
+	}
+
+	if (malformed || i != output.count() || deltas.peek() != EOF)
+	{
+		std::cout << "Error: \"" << delta_filename << "\" doesn't have a valid record for each of the " << output.count() << " images in \"" << input_filename << "\".\n";
+		return 1;
+	}
+
+	std::cout << "Expanded " << i << " images into \"" << output_filename << "\".\n";
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+	{
+		displayUsageInstructions();
+		return 0;
+	}
+
+	if (argc == 5 && !strcmp(argv[1], "--archive"))
+	{
+		return expandArchive(argv[2], argv[3], argv[4]);
+	}
+	else if (argc == 4 && argv[1][0] != '-')
+	{
+		return expandImage(argv[1], argv[2], argv[3]);
+	}
+
+	displayUsageInstructions();
+	return 1;
+}
@@ -0,0 +1,333 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <cstring>
+
+#include "isa.hpp"
+#include "cfg.hpp"
+
+/*
+ * tdis -- disassembles a program image output by the assembler.
+ *
+ * Recovers the control flow graph (see cfg.hpp) and writes out:
+ * 		- a listing, which tas can assemble back into the same image (unless instructions overlap).
+ * 			Unreached bytes are listed as data (BYTE), block leaders get L_XX labels. Trailing zeroes are left out.
+ * 		- a block index, one line per basic block, for tools that want to work on blocks.
+ * 			Fields are tab separated:
+ * 				start	size	instructions	exit	successors	callee	flags
+ * 			Addresses are hex (0xXX), lists are comma separated, "-" means none.
+ * 			flags is a comma separated list of: unresolved, speculative.
+ */
+
+void displayUsageInstructions(std::string default_input, std::string default_listing, std::string default_index)
+{
+	std::cout << "Program usage: \n" \
+			<< "\n$> tdis <input program file> <output listing file> <output block index file>\n\n" \
+			<< "Default input: " << default_input \
+			<< "\nDefault listing: " << default_listing \
+			<< "\nDefault block index: " << default_index << "\n";
+}
+
+std::string hexByte(uint8_t byte)
+{
+	std::stringstream ss;
+	ss << "0x" << std::hex << std::setw(2) << std::setfill('0') << static_cast<uint16_t>(byte);
+	return ss.str();
+}
+
+std::string label(uint8_t address)
+{
+	std::stringstream ss;
+	ss << "L_" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << static_cast<uint16_t>(address);
+	return ss.str();
+}
+
+char registerName(uint8_t reg)
+{
+	return 'A' + reg;
+}
+
+//Returns the instruction at address in assembly syntax.
+std::string disassembleInstruction(const ControlFlowGraph &cfg, const uint8_t *image, uint8_t address)
+{
+	const DecodedInstruction &d = cfg.decode(address);
+	const InstructionInfo &info = INSTRUCTION_SET[d.operation];
+	std::stringstream ss;
+
+	if (d.operation == OP_HALT && image[address] != encodeInstruction(info, 0, 0))
+	{
+		//Unused opcode, halts the CPU. Keep the byte as is.
+		ss << "BYTE " << static_cast<uint16_t>(image[address]);
+		return ss.str();
+	}
+
+	ss << info.name;
+
+	switch (info.layout)
+	{
+	case LAYOUT_X_LOW:
+	case LAYOUT_X_HIGH:
+		ss << " " << registerName(d.x);
+		break;
+	case LAYOUT_X_Y:
+	case LAYOUT_Y_X:
+		ss << " " << registerName(d.x) << " " << registerName(d.y);
+		break;
+	case LAYOUT_X_LOW_IMMEDIATE:
+		ss << " " << registerName(d.x) << " ";
+		if (cfg.code_pointer_loads.count(address) && cfg.leader[cfg.immediate(address)])
+		{
+			ss << label(cfg.immediate(address));
+		}
+		else
+		{
+			ss << static_cast<uint16_t>(cfg.immediate(address));
+		}
+		break;
+	case LAYOUT_RELATIVE:
+		ss << " " << label(cfg.relativeTarget(address));
+		break;
+	default:
+		break;
+	}
+
+	return ss.str();
+}
+
+bool writeListing(const ControlFlowGraph &cfg, const uint8_t *image, std::string input_filename, std::string filename)
+{
+	std::ofstream output_file(filename);
+
+	if (!output_file)
+	{
+		std::cout << "Error: failed to open file for output: \"" << filename << "\"\n";
+		return false;
+	}
+
+	uint16_t code_bytes = 0;
+	for (uint16_t i = 0; i < RAM_SIZE; ++i)
+	{
+		if (cfg.isCode(i))
+		{
+			code_bytes += cfg.decode(i).size;
+		}
+	}
+
+	output_file << "; Disassembly of " << input_filename << "\n" \
+			<< "; " << cfg.blocks.size() << " basic blocks, " << code_bytes << " bytes of code.\n";
+
+	for (uint8_t overlap : cfg.overlaps)
+	{
+		output_file << "; Warning: instructions overlap at " << hexByte(overlap) << ", listing won't reassemble to the same image.\n";
+	}
+
+	//Trailing zeroes are left out, tas pads the image with them anyway.
+	uint16_t image_end = RAM_SIZE;
+	while (image_end > 0 && image[image_end - 1] == 0 && !cfg.isCode(image_end - 1))
+	{
+		--image_end;
+	}
+
+	uint16_t address = 0;
+	while (address < image_end)
+	{
+		if (cfg.leader[address] && cfg.isCode(address))
+		{
+			std::map<uint8_t, BasicBlock>::const_iterator block = cfg.blocks.find(address);
+			output_file << "\n" << label(address) << ":";
+			if (block != cfg.blocks.end() && block->second.speculative)
+			{
+				output_file << "\t\t\t\t; speculative: only reached through a stored constant";
+			}
+			output_file << "\n";
+		}
+
+		std::stringstream bytes;
+		uint16_t size = 1;
+		std::string text;
+
+		if (cfg.isCode(address) && !(cfg.overlaps.count(address) && address > 0 && cfg.isCode(address - 1)))
+		{
+			size = cfg.decode(address).size;
+			text = disassembleInstruction(cfg, image, address);
+		}
+		else
+		{
+			text = "BYTE " + std::to_string(image[address]);
+		}
+
+		//Don't run off the end of the image (an instruction at 0xFF reads its immediate from 0x00).
+		if (address + size > RAM_SIZE)
+		{
+			size = RAM_SIZE - address;
+			text = "BYTE " + std::to_string(image[address]);
+		}
+
+		for (uint16_t i = 0; i < size; ++i)
+		{
+			bytes << " " << std::hex << std::setw(2) << std::setfill('0') << static_cast<uint16_t>(image[address + i]);
+		}
+
+		output_file << "\t" << text << std::string(text.size() < 16 ? 16 - text.size() : 1, ' ') \
+				<< "; " << hexByte(address) << ":" << bytes.str() << "\n";
+
+		address += size;
+	}
+
+	if (image_end < RAM_SIZE)
+	{
+		output_file << "\t; " << hexByte(image_end) << " - 0xff: zero\n";
+	}
+
+	output_file.close();
+	return true;
+}
+
+bool writeBlockIndex(const ControlFlowGraph &cfg, std::string filename)
+{
+	std::ofstream output_file(filename);
+
+	if (!output_file)
+	{
+		std::cout << "Error: failed to open file for output: \"" << filename << "\"\n";
+		return false;
+	}
+
+	output_file << "#start\tsize\tinstructions\texit\tsuccessors\tcallee\tflags\n";
+
+	for (std::map<uint8_t, BasicBlock>::const_iterator i = cfg.blocks.begin(); i != cfg.blocks.end(); ++i)
+	{
+		const BasicBlock &block = i->second;
+
+		std::string successors;
+		for (uint8_t successor : block.successors)
+		{
+			successors += (successors.empty() ? "" : ",") + hexByte(successor);
+		}
+
+		std::string flags;
+		if (block.unresolved)
+		{
+			flags = "unresolved";
+		}
+		if (block.speculative)
+		{
+			flags += (flags.empty() ? "" : ",") + std::string("speculative");
+		}
+
+		output_file << hexByte(block.start) << "\t" << block.size << "\t" << block.instructions.size() << "\t" \
+				<< blockExitName(block.exit) << "\t" \
+				<< (successors.empty() ? "-" : successors) << "\t" \
+				<< (block.callee == -1 ? "-" : hexByte(block.callee)) << "\t" \
+				<< (flags.empty() ? "-" : flags) << "\n";
+	}
+
+	output_file.close();
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	std::string input_filename = "program.bin";
+	std::string listing_filename = "program.lst";
+	std::string index_filename = "program.blocks";
+
+	if (argc > 4)
+	{
+		displayUsageInstructions(input_filename, listing_filename, index_filename);
+		return 1;
+	}
+
+	if (argc >= 2)
+	{
+		if (!strcmp(argv[1], "-h"))
+		{
+			displayUsageInstructions(input_filename, listing_filename, index_filename);
+			return 0;
+		}
+	}
+
+	//Parse command line parameters.
+	for (int i = 1; (i < argc) && (i < 4); ++i)
+	{
+		if (i == 1)
+		{
+			input_filename = std::string(argv[i]);
+		}
+		else if (i == 2)
+		{
+			listing_filename = std::string(argv[i]);
+		}
+		else if (i == 3)
+		{
+			index_filename = std::string(argv[i]);
+		}
+	}
+
+	std::ifstream input_file(input_filename, std::ios::binary);
+
+	if (!input_file)
+	{
+		std::cout << "Error: failed to open file for input program: \"" << input_filename << "\"\n";
+		return 1;
+	}
+
+	std::streampos end;
+	input_file.seekg(0, std::ios::end);
+	end = input_file.tellg();
+	if (end < RAM_SIZE)
+	{
+		std::cout << "Error: Input program file is too short!\n";
+		input_file.close();
+		return 1;
+	}
+
+	if (end > RAM_SIZE)
+	{
+		std::cout << "Warning: Input program file is too big! Only the first " << RAM_SIZE << " bytes are disassembled.\n";
+	}
+
+	input_file.seekg(0, std::ios::beg);
+
+	uint8_t program_memory[RAM_SIZE];
+
+	if (!input_file.read(reinterpret_cast<char* >(program_memory), RAM_SIZE))
+	{
+		std::cout << "Error: Unknown error in reading in program file.\n";
+		input_file.close();
+		return 1;
+	}
+
+	input_file.close();
+
+	ControlFlowGraph cfg;
+	cfg.build(program_memory);
+
+	uint16_t unresolved = 0;
+	for (std::map<uint8_t, BasicBlock>::const_iterator i = cfg.blocks.begin(); i != cfg.blocks.end(); ++i)
+	{
+		if (i->second.unresolved)
+		{
+			++unresolved;
+		}
+	}
+
+	std::cout << "Recovered " << cfg.blocks.size() << " basic blocks (" << unresolved << " ending in unresolved register branches).\n";
+
+	if (!writeListing(cfg, program_memory, input_filename, listing_filename))
+	{
+		return 1;
+	}
+
+	if (!writeBlockIndex(cfg, index_filename))
+	{
+		return 1;
+	}
+
+	return 0;
+}
@@ -4,868 +4,675 @@
 #include <iostream>
 #include <fstream>
 #include <cstring>
-
-//Bitwise functions:
-uint8_t setBit(uint8_t number, uint8_t bit, uint8_t value)
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+
+#include "cpu.hpp"
+#include "cache.hpp"
+#include "symbolmap.hpp"
+#include "profile.hpp"
+#include "archive.hpp"
+#include "delta.hpp"
+#include "memo.hpp"
+#include "replay.hpp"
+
+//Exit codes, so whatever is scheduling tem can tell why a run ended.
+static const int EXIT_OK = 0;
+static const int EXIT_USAGE = 1;
+static const int EXIT_INSTRUCTION_LIMIT = 2;
+static const int EXIT_TIMEOUT = 3;
+
+//Everything set on the command line.
+struct EmulatorOptions
 {
-	return (number ^= (-value ^ number) & (1 << bit));
-}
+	std::string input_file;
+	std::string output_file;
 
-bool checkBit(uint8_t number, uint8_t bit)
-{
-	return ((number >> bit) & 1);
-}
+	uint64_t max_instructions = 0;
+	uint64_t timeout_ms = 0;
 
-//CPU Components
-class RegBank
-{
-public:
-	static const uint8_t NUM_REGISTERS = 4;
+	uint64_t address_bits = ADDRESS_BITS; //Machine variant (see CPU in cpu.hpp).
 
-private:
-	uint8_t registers[NUM_REGISTERS];
+	//Cache simulation. Without either of these the CPU runs with FlatMemory, i.e. no simulation overhead at all.
+	bool use_icache = false;
+	bool use_dcache = false;
+	CacheConfig icache;
+	CacheConfig dcache;
 
-public:
-	RegBank()
-	{
-		for (uint8_t i = 0; i < NUM_REGISTERS; ++i)
-		{
-			registers[i] = 0x00;
-		}
-	}
+	//Debug symbols, <input file>.sym (as written by tas) unless given.
+	std::string symbols_file;
+	bool profile = false;
+	std::string profile_file; //Written for tas -P, if set.
+	std::string stacks_file; //Instructions per call stack, for flame graphs, if set.
 
-	uint8_t getRegister(uint8_t x) const
-	{
-		if (x >= NUM_REGISTERS)
-		{
-			return 0;
-		}
+	bool archive = false; //Input & output files are image archives (see archive.hpp).
+	bool delta = false; //Output only what changed (see delta.hpp).
+	bool memoize = false; //Skip calls seen before (see memo.hpp).
 
-		return registers[x];
-	}
+	//Replay logs (see replay.hpp).
+	std::string record_file;
+	std::string replay_file;
+	ReplayLog replay; //Read from replay_file, which also sets the variant & limits.
+};
 
-	void setRegister(uint8_t x, uint8_t value)
-	{
-		if (x >= NUM_REGISTERS)
-		{
-			return;
-		}
+void displayUsageInstructions(std::string default_input, std::string default_output)
+{
+	std::cout << "Program usage: \n" \
+			<< "\n$> tem [options] <input program file> <output RAM file>\n\n" \
+			<< "Options:\n" \
+			<< "\t--max-instructions <n>\tStop after executing n instructions (exit code " << EXIT_INSTRUCTION_LIMIT << ").\n" \
+			<< "\t--timeout-ms <n>\tStop after n milliseconds of wall-clock time (exit code " << EXIT_TIMEOUT << ").\n" \
+			<< "\tA run stopped by a limit still writes out the partial state of RAM.\n" \
+			<< "\t--addr-bits <8|16>\tEmulate the variant with this address width (default " << static_cast<uint16_t>(ADDRESS_BITS) << "). With 16, RAM is 64 KiB,\n" \
+			<< "\t\t\t\tcode runs in any 256 byte page & CALL pushes 2 byte return addresses.\n" \
+			<< "\t--icache <spec>\t\tSimulate an instruction cache & report hit/miss rates and stall cycles.\n" \
+			<< "\t--dcache <spec>\t\tSimulate a data cache (LD, ST, stack & block instructions).\n" \
+			<< "\tCache spec: <size>,<associativity>,<line size>[,<lru|fifo|random>[,<miss penalty>]], e.g. 64,2,4,lru,10\n" \
+			<< "\t--symbols <file>\tDebug symbols to show addresses as labels & source lines with (default: <input program file>.sym, if there is one).\n" \
+			<< "\t--profile\t\tCount the instructions executed per label & source line (per address without symbols).\n" \
+			<< "\t--profile-out <file>\tWrite the execution counts & jumps taken to file, for tas -P.\n" \
+			<< "\t--profile-stacks <file>\tWrite the instructions executed per call stack (CALL/RET) to file, folded for flame graphs.\n" \
+			<< "\t--archive\t\tThe input & output files are image archives (see tpack). Runs every image in the input,\n" \
+			<< "\t\t\t\tand writes their final RAMs & outcomes to the output. The limits apply to each image.\n" \
+			<< "\t--delta\t\t\tInstead of the final RAM, write only the bytes that changed, plus the final registers, flags,\n" \
+			<< "\t\t\t\tPC & instruction count (one record per image with --archive). tdelta expands it back.\n" \
+			<< "\t--memoize\t\tRemember what each CALL did, and skip calls made again with the same registers, flags\n" \
+			<< "\t\t\t\t& memory contents, applying what they did instead. Reports how many calls were skipped.\n" \
+			<< "\t--record <file>\t\tLog where the run was stopped by --timeout-ms, if it was, for --replay.\n" \
+			<< "\t--replay <file>\t\tRun the recorded image again, on the recorded variant & with the recorded limits,\n" \
+			<< "\t\t\t\tstopping where the recorded run was stopped, and check it ends the same way.\n\n" \
+			<< "Default input: " << default_input \
+			<< "\nDefault output: " << default_output << "\n";
+}
 
-		registers[x] = value;
+//Parses a whole decimal number into value. Returns false (and complains) if that's not all there is, or it's too big.
+bool parseCount(const char *option, const char *text, uint64_t &value)
+{
+	const char *end = text + strlen(text);
+	std::from_chars_result result = std::from_chars(text, end, value);
+	if (result.ec != std::errc() || result.ptr != end)
+	{
+		std::cout << "Error: " << option << " takes a whole number (at most " << UINT64_MAX << "), not \"" << text << "\".\n";
+		return false;
 	}
-};
+	return true;
+}
 
-class RAM
+//Memory model setup & reporting. Nothing to do without caches.
+void setUpMemoryModel(FlatMemory &, const EmulatorOptions &)
 {
-public:
-	static const uint16_t RAM_SIZE = 256; //8-bit RAM.
+}
 
-private:
-	uint8_t memory[RAM_SIZE];
+void reportMemoryModel(const FlatMemory &)
+{
+}
 
-public:
-	RAM()
+void setUpMemoryModel(CachedMemory &memory, const EmulatorOptions &options)
+{
+	if (options.use_icache)
 	{
-		for (uint16_t i = 0; i < RAM_SIZE; ++i)
-		{
-			memory[i] = 0x00;
-		}
+		memory.icache = new CacheModel(options.icache);
 	}
-
-	//Returns ith byte in RAM.
-	uint8_t getByte(uint8_t i) const
+	if (options.use_dcache)
 	{
-		return memory[i];
+		memory.dcache = new CacheModel(options.dcache);
 	}
+}
 
-	void setByte(uint8_t i, uint8_t value)
+void reportMemoryModel(const CachedMemory &memory)
+{
+	memory.report();
+}
+
+//Prints rows biggest count first, with their share of total.
+void printProfileTable(const std::string &title, std::vector<std::pair<std::string, uint64_t> > rows, uint64_t total)
+{
+	std::stable_sort(rows.begin(), rows.end(), [](const std::pair<std::string, uint64_t> &x, const std::pair<std::string, uint64_t> &y) { return x.second > y.second; });
+
+	std::cout << title << ":\n";
+	for (const std::pair<std::string, uint64_t> &row : rows)
 	{
-		memory[i] = value;
-		//std::cout << "Set byte " << static_cast<uint16_t>(i) << " to " << static_cast<uint16_t>(value) <<  "\n";
+		std::cout << "\t" << row.second << "\t" << (100.0 * row.second / total) << "%\t" << row.first << "\n";
 	}
+}
 
-	bool loadFromFileObject(std::ifstream &file)
+//Where the executed instructions went: per label & per source line, or with no symbols, per address.
+void reportProfile(const std::vector<uint64_t> &counts, const SymbolMap &symbols)
+{
+	uint64_t total = 0;
+	std::map<std::string, uint64_t> labels;
+	std::map<uint32_t, uint64_t> lines;
+	std::vector<std::pair<std::string, uint64_t> > addresses;
+	for (uint32_t address = 0; address < counts.size(); ++address)
 	{
-		if (!file)
-		{
-			return false;
-		}
-
-		std::streampos end;
-		file.seekg(0, std::ios::end);
-		end = file.tellg();
-		if (end < RAM_SIZE)
+		uint64_t count = counts[address];
+		if (!count)
 		{
-			std::cout << "Error: Input RAM file is too short!\n";
-			return false;
+			continue;
 		}
+		total += count;
 
-		if (end > RAM_SIZE)
+		std::string label = symbols.label(address, false);
+		labels[label.empty() ? "(no label)" : label] += count;
+		const SymbolMap::Statement *statement = symbols.statementAt(address);
+		if (statement)
 		{
-			std::cout << "Warning: RAM file is too big! Program may not function as you expect.\n";
+			lines[statement->line] += count;
 		}
-
-		file.seekg(0, std::ios::beg);
-
-		if (!file.read(reinterpret_cast<char* >(memory), RAM_SIZE))
-		{
-			std::cout << "Error: Unknown error in reading RAM.\n";
-			return false;
-		}
-
-		return true;
-	}
-
-	bool writeOutToFileObject(std::ofstream &file)
-	{
-		file.write(reinterpret_cast<char* >(memory), RAM_SIZE);
-
-		return true;
+		addresses.push_back(std::make_pair(symbols.describe(address), count));
 	}
-};
 
-class ALU
-{
-	uint8_t flags; //Only first 5 bits are used.
-
-public:
-	ALU()
+	std::cout << "\nProfile (" << total << " instructions):\n";
+	if (symbols.empty())
 	{
-		flags = 0x00;
+		printProfileTable("By address", addresses, total);
+		return;
 	}
+	printProfileTable("By label", std::vector<std::pair<std::string, uint64_t> >(labels.begin(), labels.end()), total);
 
-	/*
-	 * Each flag parameter is input as a bit.
-	 * Parameters:
-	 * * c = carry flag
-	 * * z = zero flag
-	 * * s = sign flag
-	 * * o = overflow flag
-	 * * l = L flag
-	 */
-	void setFlags(uint8_t c, uint8_t z, uint8_t s, uint8_t o, uint8_t l)
+	std::vector<std::pair<std::string, uint64_t> > rows;
+	for (const std::pair<const uint32_t, uint64_t> &line : lines)
 	{
-		flags = 0x00;
-		flags = setBit(flags, 4, c);
-		flags = setBit(flags, 3, z);
-		flags = setBit(flags, 2, s);
-		flags = setBit(flags, 1, o);
-		flags = setBit(flags, 0, l);
+		rows.push_back(std::make_pair(symbols.source + ":" + std::to_string(line.first), line.second));
 	}
+	printProfileTable("By line", rows, total);
+}
 
-	bool getCFlag() const
-	{
-		return checkBit(flags, 4);
-	}
+//Instrumentation setup, given the image the run starts from. Only profiles need anything.
+template <class Instrumentation>
+void setUpInstrumentation(Instrumentation &, const std::vector<uint8_t> &)
+{
+}
 
-	bool getZFlag() const
-	{
-		return checkBit(flags, 3);
-	}
+template <bool Counts, bool Stacks>
+void setUpInstrumentation(Profiling<Counts, Stacks> &profiling, const std::vector<uint8_t> &image)
+{
+	profiling.profile.image_hash = ExecutionProfile::hashImage(image.data(), image.size());
+}
 
-	bool getSFlag() const
-	{
-		return checkBit(flags, 2);
-	}
+//Instrumentation reporting. Returns false if an output file couldn't be written.
+bool reportInstrumentation(const NoInstrumentation &, const EmulatorOptions &, const SymbolMap &)
+{
+	return true;
+}
 
-	bool getOFlag() const
+template <bool Counts, bool Stacks>
+bool reportInstrumentation(const Profiling<Counts, Stacks> &profiling, const EmulatorOptions &options, const SymbolMap &symbols)
+{
+	if (options.profile)
 	{
-		return checkBit(flags, 1);
+		reportProfile(profiling.profile.counts, symbols);
 	}
-
-	bool getLFlag() const
+	if (!options.profile_file.empty() && !profiling.profile.write(options.profile_file))
 	{
-		return checkBit(flags, 0);
+		return false;
 	}
+	return options.stacks_file.empty() || profiling.stacks.write(options.stacks_file, symbols);
+}
 
-	uint8_t add(uint8_t x, uint8_t y, bool cin = false)
-	{
-		uint8_t sum = x + y;
-
-		//Flags
-		bool c = (sum < x) ? 1 : 0;
-		bool z = (sum == 0x00) ? 1 : 0;
-		bool s = checkBit(sum, 7); //Most significant bit.
-		bool s1 = checkBit(x, 7);
-		bool s2 = checkBit(y, 7);
-		bool o = ((!s1 && !s2 && s) || (s1 && s2 && !s)); //For addition: (!S1 && !S2 && !Sout) || (S1 && S2 && Sout )
-		bool l = (s != o); //Sout XOR Oout
+bool reportInstrumentation(const SubroutineCache &memo, const EmulatorOptions &, const SymbolMap &)
+{
+	memo.report();
+	return true;
+}
 
-		setFlags(c, z, s, o, l);
+template <class Machine>
+ArchiveStatus runStatus(typename Machine::RunResult result)
+{
+	return (result == Machine::RUN_INSTRUCTION_LIMIT) ? ARCHIVE_INSTRUCTION_LIMIT : (result == Machine::RUN_TIMEOUT) ? ARCHIVE_TIMEOUT : ARCHIVE_HALTED;
+}
 
-		return sum;
-	}
+//The final state of cpu as a delta against the RAM it started with.
+template <class Machine>
+RunDelta runDelta(const Machine &cpu, uint8_t status, const uint8_t *initial_ram)
+{
+	std::vector<uint8_t> ram(Machine::RAMType::SIZE);
+	cpu.writeOutRAM(ram.data());
 
-	uint8_t sub(uint8_t x, uint8_t y, bool cin = false)
+	RunDelta delta;
+	delta.diff(initial_ram, ram.data(), ram.size());
+	delta.status = status;
+	delta.flags = cpu.getALU().getFlags();
+	delta.pc = cpu.getProgramCounter();
+	delta.instructions = cpu.getInstructionCount();
+	for (uint16_t r = 0; r < NUM_REGISTERS; ++r)
 	{
-		uint8_t diff = x - y;
-
-		//Flags
-		bool c = (diff > x) ? 1 : 0; //I think this is right.
-		bool z = (diff == 0x00) ? 1 : 0;
-		bool s = checkBit(diff, 7); //Most significant bit.
-		bool s1 = checkBit(x, 7);
-		bool s2 = checkBit(y, 7);
-		bool o = ((!s1 && s2 && s) || (s1 && !s2 && !s)); //For subtraction: ((!S1 && S2 && Sout) || (S1 && !S2 && !Sout))
-		bool l = (s != o); //Sout XOR Oout
-
-		setFlags(c, z, s, o, l);
-
-		return diff;
+		delta.registers.push_back(cpu.getRegBank().getRegister(r));
 	}
+	return delta;
+}
 
-	uint8_t bitwiseNot(uint8_t x, bool cin = false)
-	{
-		x = ~x;
-
-		//Flags
-		bool c = 0;
-		bool z = (x == 0x00) ? 1 : 0;
-		bool s = checkBit(x, 7); //Most significant bit.
-		bool o = 0;
-		bool l = (s != o); //Sout XOR Oout
-
-		setFlags(c, z, s, o, l);
-
-		return x;
-	}
+//Runs the program on one particular machine. Returns the exit code.
+template <class MemoryModel, class Instrumentation, uint8_t AddressBits = ADDRESS_BITS>
+int runProgram(const EmulatorOptions &options)
+{
+	typedef CPU<MemoryModel, Instrumentation, AddressBits> Machine;
+	Machine &cpu = *(new Machine());
 
-	uint8_t bitwiseRightShift(uint8_t x, uint8_t count, bool cin = false)
+	if (!cpu.loadRAM(options.input_file))
 	{
-		x >>= count;
-
-		//Only z & c flag can change.
-		bool z = (x == 0x00) ? 1 : 0;
-		bool s = checkBit(x, 7); //Most significant bit.
-
-		//o, c, l = input.
-		bool c = getCFlag();
-		bool o = getOFlag();
-		bool l = getLFlag();
-
-		setFlags(c, z, s, o, l);
-
-		return x;
+		return EXIT_OK;
 	}
 
-	uint8_t bitwiseAnd(uint8_t x, uint8_t y, bool cin = false)
-	{
-		x &= y;
-
-		//Only z & c flag can change.
-		bool z = (x == 0x00) ? 1 : 0;
-		bool s = checkBit(x, 7); //Most significant bit.
-
-		//o, c, l = input.
-		bool c = getCFlag();
-		bool o = getOFlag();
-		bool l = getLFlag();
+	setUpMemoryModel(cpu.getMemoryModel(), options);
 
-		setFlags(c, z, s, o, l);
-
-		return x;
+	SymbolMap symbols;
+	std::string symbols_file = options.symbols_file.empty() ? SymbolMap::filenameFor(options.input_file) : options.symbols_file;
+	if (symbols.read(symbols_file))
+	{
+		cpu.symbols = &symbols;
 	}
-
-	uint8_t bitwiseOr(uint8_t x, uint8_t y, bool cin = false)
+	else if (!options.symbols_file.empty())
 	{
-		x |= y;
-
-		//Only z & c flag can change.
-		bool z = (x == 0x00) ? 1 : 0;
-		bool s = checkBit(x, 7); //Most significant bit.
-
-		//o, c, l = input.
-		bool c = getCFlag();
-		bool o = getOFlag();
-		bool l = getLFlag();
-
-		setFlags(c, z, s, o, l);
-
-		return x;
+		std::cout << "Error: Could not open symbols file \"" << symbols_file << "\"\n";
+		return EXIT_USAGE;
 	}
-};
-
-class CPU
-{
-public:
-	static const uint16_t NUM_OP_CODES = 256; //8-bit CPU.
-	typedef void(CPU::*CPUFunctionPointer)(uint8_t, uint8_t);
-
-	bool running;
 
-private:
-	RegBank &regbank;
-	RAM &ram;
-	ALU &alu;
+	std::vector<uint8_t> initial_ram(Machine::RAMType::SIZE);
+	cpu.writeOutRAM(initial_ram.data());
+	setUpInstrumentation(cpu.getInstrumentation(), initial_ram);
 
-	uint8_t program_counter; //Don't forget to increment after (almost) every instruction!
-	uint8_t instruction;
-
-
-	//CPU opcodes function pointers.
-	//Could probably have used functors instead. Meh.
-
-	//0x00 0000_0000 -- nop
-	void opNop(uint8_t, uint8_t)
+	bool replaying = !options.replay_file.empty();
+	if (replaying && ReplayLog::hashRAM(initial_ram.data(), initial_ram.size()) != options.replay.image_hash)
 	{
-		std::cout << "No op.\n";
-
-		++program_counter;
+		std::cout << "Error: \"" << options.replay_file << "\" was recorded running a different image.\n";
+		return EXIT_USAGE;
 	}
 
-	//0x01 0000_0001 -- halt
-	void opHalt(uint8_t, uint8_t)
+	//A replay stops at the instruction the recorded run was stopped at, it doesn't need the clock.
+	typename Machine::RunResult result = replaying ? cpu.run(options.replay.stopAt()) : cpu.run(options.max_instructions, options.timeout_ms);
+	if (replaying && result == Machine::RUN_INSTRUCTION_LIMIT && options.replay.timedOut())
 	{
-		std::cout << "[opHalt()] Halted.\n";
-
-		running = false; //It's really that simple.
-		//Do not increment program counter.
+		result = Machine::RUN_TIMEOUT;
 	}
 
-	//0x5? 0101_xxyy -- x = y
-	void opAssignDirect(uint8_t x, uint8_t y)
+	reportMemoryModel(cpu.getMemoryModel());
+	if (!reportInstrumentation(cpu.getInstrumentation(), options, symbols))
 	{
-		std::cout << "[opAssignDirect()] Assign reg to reg (" << static_cast<uint16_t>(x) << ", " << static_cast<uint16_t>(y) << ")\n"; //Casting because uint8_t = char.
-
-		regbank.setRegister(x, regbank.getRegister(y));
-		++program_counter;
+		return EXIT_USAGE;
 	}
 
-	//0x6? 0110_00xx -- PC = x iff L=1
-	void opPCL(uint8_t x, uint8_t y)
+	//Save final program state. If a limit was hit, this is a partial snapshot.
+	if (options.delta)
 	{
-		std::cout << "[opPCL()] PC = value of register " << static_cast<uint16_t>(x) << " iff L = 1\n";
-
-		if (alu.getLFlag())
-		{
-			program_counter = regbank.getRegister(x);
-		}
-		else
+		std::ofstream output(options.output_file, std::ios::binary);
+		if (!output)
 		{
-			++program_counter;
+			std::cout << "Error: failed to open file for outputting final state of RAM: \"" << options.output_file << "\"\n";
+			return EXIT_USAGE;
 		}
+		RunDelta::writeHeader(output);
+		runDelta(cpu, runStatus<Machine>(result), initial_ram.data()).write(output);
 	}
-
-	//0x6? 0110_01xx -- PC = x iff O=1
-	void opPCO(uint8_t x, uint8_t y)
+	else
 	{
-		std::cout << "[opPCO()] PC = value of register " << static_cast<uint16_t>(x) << " iff O = 1\n";
-
-		if (alu.getOFlag())
-		{
-			program_counter = regbank.getRegister(x);
-		}
-		else
-		{
-			++program_counter;
-		}
+		cpu.writeOutRAM(options.output_file);
 	}
 
-	//0x6? 0110_10xx -- PC = x iff S=1
-	void opPCS(uint8_t x, uint8_t y)
+	if (!options.record_file.empty() || replaying)
 	{
-		std::cout << "[opPCS()] PC = value of register " << static_cast<uint16_t>(x) << " iff S = 1\n";
+		std::vector<uint8_t> final_ram(Machine::RAMType::SIZE);
+		cpu.writeOutRAM(final_ram.data());
+		uint64_t final_hash = ReplayLog::hashRAM(final_ram.data(), final_ram.size());
 
-		if (alu.getSFlag())
+		if (!options.record_file.empty())
 		{
-			program_counter = regbank.getRegister(x);
+			ReplayLog replay_log;
+			replay_log.image_hash = ReplayLog::hashRAM(initial_ram.data(), initial_ram.size());
+			replay_log.address_bits = AddressBits;
+			replay_log.max_instructions = options.max_instructions;
+			replay_log.timeout_ms = options.timeout_ms;
+			if (result == Machine::RUN_TIMEOUT)
+			{
+				replay_log.events.push_back(ReplayLog::Event { cpu.getInstructionCount(), REPLAY_TIMEOUT });
+			}
+			replay_log.final_hash = final_hash;
+			replay_log.final_instructions = cpu.getInstructionCount();
+			if (!replay_log.write(options.record_file))
+			{
+				return EXIT_USAGE;
+			}
+		}
+		else if (final_hash != options.replay.final_hash || cpu.getInstructionCount() != options.replay.final_instructions)
+		{
+			std::cout << "Error: The replay of \"" << options.replay_file << "\" ended differently from the recorded run.\n";
+			return EXIT_USAGE;
 		}
 		else
 		{
-			++program_counter;
+			std::cout << "Replay of \"" << options.replay_file << "\" ended the same as the recorded run.\n";
 		}
 	}
 
-	//0x6? 0110_11xx -- X = (*(PC++))
-	void opLDI(uint8_t x, uint8_t y)
+	if (result == Machine::RUN_INSTRUCTION_LIMIT)
 	{
-		std::cout << "[opLDI()] Register " << static_cast<uint16_t>(x) << " = 0x" << std::hex << static_cast<uint16_t>(ram.getByte(program_counter + 1)) << std::dec << ".\n";
-
-		regbank.setRegister(x, ram.getByte(++program_counter));
-		++program_counter;
+		std::cout << "Error: Instruction limit of " << options.max_instructions << " reached, program stopped.\n";
+		cpu.dumpCounters();
+		return EXIT_INSTRUCTION_LIMIT;
 	}
-
-	//0x7? 0111_xxyy -- x = *y
-	void opLD(uint8_t x, uint8_t y)
+	else if (result == Machine::RUN_TIMEOUT)
 	{
-		std::cout << "[opLD()] Register " << static_cast<uint16_t>(x) << " = LD register " << static_cast<uint16_t>(y) << " (0x" << std::hex << static_cast<uint16_t>(ram.getByte(regbank.getRegister(y))) << std::dec << ").\n";
-
-		regbank.setRegister(x, ram.getByte(regbank.getRegister(y)));
-		++program_counter;
+		std::cout << "Error: Timeout of " << options.timeout_ms << " ms reached, program stopped.\n";
+		cpu.dumpCounters();
+		return EXIT_TIMEOUT;
 	}
 
-	//0x8? 1000_xxyy -- x += y
-	void opAdd(uint8_t x, uint8_t y)
-	{
-		std::cout << "[opADD()] Register " << static_cast<uint16_t>(x) << " += register " << static_cast<uint16_t>(y);
-
-		regbank.setRegister(x, alu.add(regbank.getRegister(x), regbank.getRegister(y), false));
-
-		std::cout << " (result: 0x" << static_cast<uint16_t>(regbank.getRegister(x)) << ").\n";
+	return EXIT_OK;
+}
 
-		++program_counter;
-	}
+/*
+ * Runs every image in the input archive, and writes the results to an output archive of the same shape,
+ * or with --delta, a delta file with a record per image.
+ * Images are loaded straight from the mapped input, and RAMs written straight to the mapped output.
+ * Returns the exit code.
+ */
+int runArchive(const EmulatorOptions &options)
+{
+	typedef CPU<FlatMemory> Machine;
 
-	//0x9? 1001_xxyy -- x -= y
-	void opSub(uint8_t x, uint8_t y)
+	ImageArchive input;
+	if (!input.open(options.input_file))
 	{
-		std::cout << "[opSUB()] Register " << static_cast<uint16_t>(x) << " -= register " << static_cast<uint16_t>(y) << ". Result: (0x";
-
-		regbank.setRegister(x, alu.sub(regbank.getRegister(x), regbank.getRegister(y), false));
-		++program_counter;
-
-		 std::cout << std::hex << static_cast<uint16_t>(regbank.getRegister(x)) << std::dec << ")\n";
+		return EXIT_USAGE;
 	}
-
-	//0xA? 1010_xxyy -- x >>= y
-	void opRightShift(uint8_t x, uint8_t y)
+	if (input.imageSize() != RAM_SIZE)
 	{
-		std::cout << "[opRightShift()] Register " << static_cast<uint16_t>(x) << " >>= register " << static_cast<uint16_t>(y) << ".";
-
-		regbank.setRegister(x, alu.bitwiseRightShift(regbank.getRegister(x), regbank.getRegister(y), false));
-
-		std::cout << " (result : 0x" << static_cast<uint16_t>(regbank.getRegister(x)) << ")\n";
-
-		++program_counter;
+		std::cout << "Error: \"" << options.input_file << "\" holds " << input.imageSize() << " byte images, the machine has " << RAM_SIZE << " bytes of RAM.\n";
+		return EXIT_USAGE;
 	}
 
-	//0xB? 1011_xx00 -- x = ~x
-	void opBitwiseNot(uint8_t x, uint8_t y)
+	ImageArchive output;
+	std::ofstream deltas;
+	if (options.delta)
 	{
-		std::cout << "[opBitwiseNot()] Register " << static_cast<uint16_t>(x) << " = ~register " << static_cast<uint16_t>(x) << ".\n";
-
-		regbank.setRegister(x, alu.bitwiseNot(regbank.getRegister(x), false));
-		++program_counter;
+		deltas.open(options.output_file, std::ios::binary);
+		if (!deltas)
+		{
+			std::cout << "Error: Could not open output file \"" << options.output_file << "\"\n";
+			return EXIT_USAGE;
+		}
+		RunDelta::writeHeader(deltas);
 	}
-
-	//0xB? 1011_xx01 -- PC = x
-	void opJMP(uint8_t x, uint8_t y)
+	else if (!ImageArchive::createLike(options.output_file, input) || !output.open(options.output_file, true))
 	{
-		std::cout << "[opJMP()] PC = register " << static_cast<uint16_t>(x) << " (" << std::hex << static_cast<uint16_t>(regbank.getRegister(x)) << std::dec << ").\n";
-
-		program_counter = regbank.getRegister(x);
+		return EXIT_USAGE;
 	}
 
-	//0xB? 1011_xx10 -- PC = x iff C=1
-	void opPCC(uint8_t x, uint8_t y)
-	{
-		std::cout << "[opPCC()] PC = value of register " << static_cast<uint16_t>(x) << " iff C = 1\n";
+	Machine &cpu = *(new Machine());
+	uint64_t outcomes[ARCHIVE_EMPTY + 1] = {};
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-		if (alu.getCFlag())
-		{
-			program_counter = regbank.getRegister(x);
-		}
-		else
+	//No per instruction trace, that would take far longer than running the images.
+	std::cout.setstate(std::ios::failbit);
+	for (uint32_t i = 0; i < input.count(); ++i)
+	{
+		ArchiveStatus status = ARCHIVE_EMPTY;
+		cpu.reset();
+		if (cpu.loadRAM(input.image(i)))
 		{
-			++program_counter;
+			status = runStatus<Machine>(cpu.run(options.max_instructions, options.timeout_ms));
 		}
-	}
-
-	//0xB? 1011_xx11 -- PC = x iff Z=1
-	void opPCZ(uint8_t x, uint8_t y)
-	{
-		std::cout << "[opPCZ[()] PC = value of register " << static_cast<uint16_t>(x) << " iff Z = 1 (";
-
-
+		++outcomes[status];
 
-		if (alu.getZFlag())
+		if (options.delta)
 		{
-			std::cout << "true";
-			program_counter = regbank.getRegister(x);
+			runDelta(cpu, status, input.image(i)).write(deltas);
+			continue;
 		}
-		else
+
+		ArchiveEntry &entry = output.entry(i);
+		cpu.writeOutRAM(output.image(i));
+		entry.status = status;
+		entry.instructions = cpu.getInstructionCount();
+		entry.flags = cpu.getALU().getFlags();
+		entry.pc = cpu.getProgramCounter();
+		for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
 		{
-			std::cout << "false";
-			++program_counter;
+			entry.registers[r] = cpu.getRegBank().getRegister(r);
 		}
-
-		std::cout << ")\n";
 	}
+	std::cout.clear();
 
-	//0xC? 1100_xxyy -- x &= y
-	void opBitwiseAnd(uint8_t x, uint8_t y)
-	{
-		std::cout << "[opBitwiseAnd()] Register " << static_cast<uint16_t>(x) << " &= register " << static_cast<uint16_t>(y);
-
-		regbank.setRegister(x, alu.bitwiseAnd(regbank.getRegister(x), regbank.getRegister(y), false));
+	uint64_t elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Ran " << input.count() << " images in " << elapsed_ms << " ms: " << outcomes[ARCHIVE_HALTED] << " halted, " \
+			<< outcomes[ARCHIVE_INSTRUCTION_LIMIT] << " hit the instruction limit, " << outcomes[ARCHIVE_TIMEOUT] << " timed out, " \
+			<< outcomes[ARCHIVE_EMPTY] << " empty (not run).\n";
 
-		std::cout << " (result: 0x" << static_cast<uint16_t>(regbank.getRegister(x)) << ").\n";
-
-		++program_counter;
+	if (options.delta && !deltas.flush())
+	{
+		std::cout << "Error: Could not write output file \"" << options.output_file << "\"\n";
+		return EXIT_USAGE;
 	}
+	return EXIT_OK;
+}
 
-	//0xD? 1101_xxyy -- x |= y
-	void opBitwiseOr(uint8_t x, uint8_t y)
+//Only what's asked for gets compiled into the run loop.
+template <class MemoryModel>
+int runInstrumented(const EmulatorOptions &options)
+{
+	if (options.memoize)
 	{
-		std::cout << "[opBitwiseOr()] Register " << static_cast<uint16_t>(x) << " |= register " << static_cast<uint16_t>(y) << ".\n";
-
-		regbank.setRegister(x, alu.bitwiseOr(regbank.getRegister(x), regbank.getRegister(y), false));
-
-		++program_counter;
+		return runProgram<MemoryModel, SubroutineCache>(options);
 	}
 
-	//0xE? 1110_xxyy -- x - y (no store)
-	void opCMP(uint8_t x, uint8_t y)
+	bool counts = options.profile || !options.profile_file.empty();
+	bool stacks = !options.stacks_file.empty();
+	if (counts && stacks)
 	{
-		std::cout << "[opCMP()] Register " << static_cast<uint16_t>(x) << " - register " << static_cast<uint16_t>(y) << " (no store).\n";
-
-		alu.sub(regbank.getRegister(x), regbank.getRegister(y), false);
-		++program_counter;
+		return runProgram<MemoryModel, Profiling<true, true> >(options);
 	}
-
-	//0xF? 1111_xxyy -- *y = x
-	void opSetRAM(uint8_t x, uint8_t y)
+	else if (counts)
 	{
-		std::cout << "[opSetRAM()] Ram pointed to by register " << static_cast<uint16_t>(y) << " (0x" << std::hex << static_cast<uint16_t>(regbank.getRegister(y)) << std::dec << ") = value of register " << static_cast<uint16_t>(x) << " (0x" << std::hex << static_cast<uint16_t>(regbank.getRegister(x)) << std::dec << ").\n";
-
-		ram.setByte(regbank.getRegister(y), regbank.getRegister(x));
-		++program_counter;
+		return runProgram<MemoryModel, Profiling<true, false> >(options);
 	}
-
-public:
-
-	CPUFunctionPointer opcodes[NUM_OP_CODES];
-
-	CPU() :
-		regbank(*(new RegBank())),
-		ram(*(new RAM())),
-		alu(*(new ALU()))
+	else if (stacks)
 	{
-		running = true;
-
-		program_counter = 0x00;
-		instruction = 0x00;
-
-		uint16_t i = 0;
-		//Initialize blank opcodes.
-		for (i = 0; i < NUM_OP_CODES; ++i)
-		{
-			opcodes[i] = &CPU::opHalt;
-		}
-
-		//Set opcodes.
-		opcodes[0x00] = &CPU::opNop;
-		//0x01 is already halt
-		//0101xxyy: x = y
-		for (i = 0x50; i <= 0x5F; ++i) //x = y
-		{
-			opcodes[i] = &CPU::opAssignDirect;
-		}
-
-		for (i = 0x60; i <= 0x63; ++i) //PC = x iff L = 1
-		{
-			opcodes[i] = &CPU::opPCL;
-		}
-
-		for (i = 0x64; i <= 0x67; ++i) //PC = x iff O = 1
-		{
-			opcodes[i] = &CPU::opPCO;
-		}
-
-		for (i = 0x68; i <= 0x6B; ++i) //PC = x iff S = 1
-		{
-			opcodes[i] = &CPU::opPCS;
-		}
-
-		for (i = 0x6C; i <= 0x6F; ++i) //x = (*(PC++))
-		{
-			opcodes[i] = &CPU::opLDI;
-		}
-
-		for (i = 0x70; i <= 0x7F; ++i) //x *= y
-		{
-			opcodes[i] = &CPU::opLD;
-		}
-
-		for (i = 0x80; i <= 0x8F; ++i) //x += y
-		{
-			opcodes[i] = &CPU::opAdd;
-		}
-
-		for (i = 0x90; i <= 0x9F; ++i) //x -= y
-		{
-			opcodes[i] = &CPU::opSub;
-		}
-
-		for (i = 0xA0; i <= 0xAF; ++i) //x >>= y
-		{
-			opcodes[i] = &CPU::opRightShift;
-		}
-
-		for (i = 0xB0; i <= 0xBF; i += 4) //x ~= x
-		{
-			opcodes[i] = &CPU::opBitwiseNot;
-		}
-
-		for (i = 0xB1; i <= 0xBF; i += 4) //pc = x
-		{
-			opcodes[i] = &CPU::opJMP;
-		}
+		return runProgram<MemoryModel, Profiling<false, true> >(options);
+	}
 
-		for (i = 0xB2; i <= 0xBF; i += 4) //PC = x iff C = 1
-		{
-			opcodes[i] = &CPU::opPCC;
-		}
+	return runProgram<MemoryModel, NoInstrumentation>(options);
+}
 
-		for (i = 0xB3; i <= 0xBF; i += 4) //PC = x iff Z = 1
-		{
-			opcodes[i] = &CPU::opPCZ;
-		}
+int main(int argc, char **argv)
+{
+	/*
+	 * Basically:
+	 * * Run assembler on your assembly program (or use a hex editor and create a 256 byte file).
+	 * * Run emulator with your program fed into it.
+	 * Note that program will abort given a RAM file that is too small (needs to be at least 256 bytes.
+	 * Note that anything over 256 bytes is not loaded (unless emulating the 16-bit variant).
+	 * Also, if your program has no actual instructions (just a file full of only no-ops (0x00)),
+	    this emulator will abort (because that'd be a rather dull infinite loop).
+	 */
 
-		for (i = 0xC0; i <= 0xCF; ++i) //x &= y
-		{
-			opcodes[i] = &CPU::opBitwiseAnd;
-		}
+	/*
+	 * Instruction implementation:
+	 * * Only vaguely simulates the CPU components.
+	 * * Just reads in a bunch of uint8_ts and uses them to index into an array of function pointers that execute the opcode
+	    that instruction represents.
+	 */
 
-		for (i = 0xD0; i <= 0xDF; ++i) //x |= y
-		{
-			opcodes[i] = &CPU::opBitwiseOr;
-		}
+	//std::string input_file = "program.bin";
+	//std::string output_file = "ram.bin";
 
-		for (i = 0xE0; i <= 0xEF; ++i) //x - y
-		{
-			opcodes[i] = &CPU::opCMP;
-		}
+	EmulatorOptions options;
 
-		for (i = 0xF0; i <= 0xFF; ++i) //x = *y
-		{
-			opcodes[i] = &CPU::opSetRAM;
-		}
-	}
+	/*
+	 * If no inputs, then grab in the input file from stdin.
+	 */
 
-	void executeInstruction(uint8_t opcode)
+	//Parse command line parameters. Options first, then the 2 positional arguments.
+	int num_positional = 0;
+	for (int i = 1; i < argc; ++i)
 	{
-		if (static_cast<uint16_t>(opcode) > NUM_OP_CODES || !running)
-		{
-			return;
-		}
-
-		std::cout << "Hex representation: 0x" << std::hex << static_cast<uint16_t>(opcode) << std::dec << " *** ";
-
-		//Specific cases:
-		if (opcode >= 0x50 && opcode <= 0x5F) //Register x = y
+		if (!strcmp(argv[i], "-h"))
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, opcode%4); //opAssignDirect()
+			displayUsageInstructions(options.input_file, options.output_file);
+			return EXIT_USAGE;
 		}
-		else if (opcode >= 0x60 && opcode <= 0x63) //PC = x iff L = 1
+		else if (!strcmp(argv[i], "--max-instructions") && i + 1 < argc)
 		{
-			(this->*opcodes[opcode])(opcode%4, 0x00); //opPCL()
+			if (!parseCount(argv[i], argv[i + 1], options.max_instructions))
+			{
+				displayUsageInstructions(options.input_file, options.output_file);
+				return EXIT_USAGE;
+			}
+			++i;
 		}
-		else if (opcode >= 0x64 && opcode <= 0x67) //PC = x iff O = 1
+		else if (!strcmp(argv[i], "--timeout-ms") && i + 1 < argc)
 		{
-			(this->*opcodes[opcode])(opcode%4, 0x00); //opPCO()
+			if (!parseCount(argv[i], argv[i + 1], options.timeout_ms))
+			{
+				displayUsageInstructions(options.input_file, options.output_file);
+				return EXIT_USAGE;
+			}
+			++i;
 		}
-		else if (opcode >= 0x68 && opcode <= 0x6B) //PC = x iff S = 1
+		else if (!strcmp(argv[i], "--addr-bits") && i + 1 < argc)
 		{
-			(this->*opcodes[opcode])(opcode%4, 0x00);//opPCS()
+			if (!parseCount(argv[i], argv[i + 1], options.address_bits))
+			{
+				displayUsageInstructions(options.input_file, options.output_file);
+				return EXIT_USAGE;
+			}
+			if (options.address_bits != 8 && options.address_bits != 16)
+			{
+				std::cout << "Error: --addr-bits takes 8 or 16, not " << options.address_bits << ".\n";
+				displayUsageInstructions(options.input_file, options.output_file);
+				return EXIT_USAGE;
+			}
+			++i;
 		}
-		else if (opcode >= 0x6C && opcode <= 0x6F) //x = (*(PC++))
+		else if (!strcmp(argv[i], "--icache") && i + 1 < argc)
 		{
-			(this->*opcodes[opcode])(opcode%4, 0x00); //opLDI()
+			if (!options.icache.parse(argv[++i]))
+			{
+				return EXIT_USAGE;
+			}
+			options.use_icache = true;
 		}
-		else if (opcode >= 0x70 && opcode <= 0x7F) //x = *y
+		else if (!strcmp(argv[i], "--symbols") && i + 1 < argc)
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, opcode%4); //opLD()
+			options.symbols_file = argv[++i];
 		}
-		else if (opcode >= 0x80 && opcode <= 0x8F) //x += y
+		else if (!strcmp(argv[i], "--profile"))
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, opcode%4); //opAdd()
+			options.profile = true;
 		}
-		else if (opcode >= 0x90 && opcode <= 0x9F) //x -= y
+		else if (!strcmp(argv[i], "--profile-out") && i + 1 < argc)
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, opcode%4); //opSub()
+			options.profile_file = argv[++i];
 		}
-		else if (opcode >= 0xA0 && opcode <= 0xAF) //x >>= y
+		else if (!strcmp(argv[i], "--profile-stacks") && i + 1 < argc)
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, opcode%4); //opRightShift()
+			options.stacks_file = argv[++i];
 		}
-		else if (opcode >= 0xB0 && opcode <= 0xBF && (opcode%4 == 0)) //x ~= x
+		else if (!strcmp(argv[i], "--archive"))
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, 0); //opBitwiseNot()
+			options.archive = true;
 		}
-		else if (opcode >= 0xB0 && opcode <= 0xBF && (opcode%4 == 1)) //PC = x
+		else if (!strcmp(argv[i], "--delta"))
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, 0); //opJMP()
+			options.delta = true;
 		}
-		else if (opcode >= 0xB0 && opcode <= 0xBF && (opcode%4 == 2)) //PC = x iff C = 1
+		else if (!strcmp(argv[i], "--memoize"))
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, 0); //opPCC()
+			options.memoize = true;
 		}
-		else if (opcode >= 0xB0 && opcode <= 0xBF && (opcode%4 == 3)) //PC = x iff Z = 1
+		else if (!strcmp(argv[i], "--record") && i + 1 < argc)
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, 0); //opPCZ()
+			options.record_file = argv[++i];
 		}
-		else if (opcode >= 0xC0 && opcode <= 0xCF) //x &= y
+		else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, opcode%4); //opBitwiseAnd()
+			options.replay_file = argv[++i];
 		}
-		else if (opcode >= 0xD0 && opcode <= 0xDF) //x |= y
+		else if (!strcmp(argv[i], "--dcache") && i + 1 < argc)
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, opcode%4); //opBitwiseOr()
+			if (!options.dcache.parse(argv[++i]))
+			{
+				return EXIT_USAGE;
+			}
+			options.use_dcache = true;
 		}
-		else if (opcode >= 0xE0 && opcode <= 0xEF) //x - y
+		else if (argv[i][0] == '-' || num_positional >= 2)
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, opcode%4); //opCMP()
+			displayUsageInstructions(options.input_file, options.output_file);
+			return EXIT_USAGE; //Blarg. They doin' it wrong.
 		}
-		else if (opcode >= 0xF0 && opcode <= 0xFF) //*y = x
+		else if (num_positional++ == 0)
 		{
-			(this->*opcodes[opcode])((opcode >> 2)%4, opcode%4); //opSetRAM()
+			options.input_file = std::string(argv[i]);
 		}
-		//General case:
 		else
 		{
-			(this->*opcodes[opcode])(0x00, 0x00);
+			options.output_file = std::string(argv[i]);
 		}
 	}
 
-	bool validateProgram()
+	//Skipped calls are neither profiled nor seen by the caches.
+	if (options.memoize && (options.use_icache || options.use_dcache || options.profile || !options.profile_file.empty() || !options.stacks_file.empty() || options.archive))
 	{
-		//All it does right now is check to make sure you don't have an empty program (only no-ops).
-
-		for (uint16_t i = 0; i < ram.RAM_SIZE; ++i)
-		{
-			if (ram.getByte(i))
-			{
-				return true;
-			}
-		}
-
-		std::cout << "Warning: Program has no instructions! Just an empty infinite loop, not running this program.\n";
-		return false;
+		std::cout << "Error: --memoize can't be combined with caches, profiles or --archive: it skips the instructions they would count.\n";
+		return EXIT_USAGE;
 	}
 
-	//Loads the input program (actually entire RAM file).
-	bool loadRAM(std::string file)
+	//Profiles & the subroutine cache only know 8-bit addresses, and archives hold standard images.
+	if (options.address_bits != ADDRESS_BITS && (options.profile || !options.profile_file.empty() || !options.stacks_file.empty() || options.memoize || options.archive))
 	{
-		std::ifstream f(file, std::ios::binary);
-
-		if (!f)
-		{
-			std::cout << "Error: failed to open file for input program/RAM: \"" << file << "\"\n";
-			return false;
-		}
-
-		ram.loadFromFileObject(f);
-
-		f.close();
-
-		if (!validateProgram())
-		{
-			return false;
-		}
-
-		return true;
+		std::cout << "Error: --addr-bits " << options.address_bits << " can't be combined with profiles, --memoize or --archive.\n";
+		return EXIT_USAGE;
 	}
 
-	bool writeOutRAM(std::string file)
+	if ((!options.record_file.empty() || !options.replay_file.empty()) && options.archive)
 	{
-		std::ofstream f(file, std::ios::binary);
-
-		if (!f)
-		{
-			std::cout << "Error: failed to open file for outputting final state of RAM: \"" << file << "\"\n";
-			return false;
-		}
-
-		ram.writeOutToFileObject(f);
-
-		f.close();
-
-		return true;
+		std::cout << "Error: --record & --replay are for single runs, not --archive.\n";
+		return EXIT_USAGE;
 	}
-
-	void run()
+	if (!options.replay_file.empty())
 	{
-		uint64_t count = 0;
-		while (running)
+		if (!options.record_file.empty() || options.max_instructions || options.timeout_ms || options.address_bits != ADDRESS_BITS)
 		{
-			instruction = ram.getByte(program_counter);
-			executeInstruction(instruction);
-
-			++count;
+			std::cout << "Error: --replay takes the machine variant & limits from the log, and can't be recorded again.\n";
+			return EXIT_USAGE;
 		}
-
-		std::cout << "\n\nExecuted " << count << " instructions.\n\n";
-	}
-};
-
-void displayUsageInstructions(std::string default_input, std::string default_output)
-{
-	std::cout << "Program usage: \n" \
-			<< "\n$> tem <input program file> <output RAM file>\n\n" \
-			<< "Default input: " << default_input \
-			<< "\nDefault output: " << default_output << "\n";
-}
-
-int main(int argc, char **argv)
-{
-	/*
-	 * Basically:
-	 * * Run assembler on your assembly program (or use a hex editor and create a 256 byte file).
-	 * * Run emulator with your program fed into it.
-	 * Note that program will abort given a RAM file that is too small (needs to be at least 256 bytes.
-	 * Note that anything over 256 bytes is not loaded.
-	 * Also, if your program has no actual instructions (just a file full of only no-ops (0x00)),
-	    this emulator will abort (because that'd be a rather dull infinite loop).
-	 */
-
-	/*
-	 * Instruction implementation:
-	 * * Only vaguely simulates the CPU components.
-	 * * Just reads in a bunch of uint8_ts and uses them to index into an array of function pointers that execute the opcode
-	    that instruction represents.
-	 */
-
-	//std::string input_file = "program.bin";
-	//std::string output_file = "ram.bin";
-
-	std::string input_file;
-	std::string output_file;
-
-	/*
-	 * If no inputs, then grab in the input file from stdin.
-	 */
-
-	//I'm going to set a hard limit on the command line arguments to 3 (2 actual useable arguments) for now.
-	if (argc > 3)
-	{
-		displayUsageInstructions(input_file, output_file);
-		return 1; //Blarg. They doin' it wrong.
+		if (!options.replay.read(options.replay_file))
+		{
+			return EXIT_USAGE;
+		}
+		options.address_bits = options.replay.address_bits;
+		options.max_instructions = options.replay.max_instructions;
+		options.timeout_ms = options.replay.timeout_ms;
 	}
 
-	if (argc >= 2)
+	if (options.archive)
 	{
-		if (!strcmp(argv[1], "-h"))
+		if (options.use_icache || options.use_dcache || options.profile || !options.profile_file.empty() || !options.stacks_file.empty() || !options.symbols_file.empty())
 		{
-			displayUsageInstructions(input_file, output_file);
-			return 1;
+			std::cout << "Error: --archive can't be combined with caches, profiles or symbols, those are for looking into one program.\n";
+			return EXIT_USAGE;
 		}
+		return runArchive(options);
 	}
 
-	//Parse command line parameters.
-	for (int i = 1; (i < argc) && (i < 3); ++i)
+	//Each variant is its own instantiation of the machine. The wide one takes caches, but nothing else (see above).
+	if (options.address_bits == 16)
 	{
-		if (i == 1)
+		if (options.use_icache || options.use_dcache)
 		{
-			input_file = std::string(argv[i]);
-		}
-		else if (i == 2)
-		{
-			output_file = std::string(argv[i]);
+			return runProgram<CachedMemory, NoInstrumentation, 16>(options);
 		}
+		return runProgram<FlatMemory, NoInstrumentation, 16>(options);
 	}
 
-	CPU cpu;
-
-	if (!cpu.loadRAM(input_file))
+	if (options.use_icache || options.use_dcache)
 	{
-		return 0;
+		return runInstrumented<CachedMemory>(options);
 	}
 
-	cpu.run();
-
-	//Save final program state.
-	cpu.writeOutRAM(output_file);
-
-	return 0;
+	return runInstrumented<FlatMemory>(options);
 }
@@ -0,0 +1,440 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_DATAPATH_HPP
+#define TRISK_DATAPATH_HPP
+
+#include <cstdint>
+
+#include "isa.hpp"
+#include "gates.hpp"
+
+/*
+ * Gate level model of the TRISK datapath: register bank, ALU, PC logic, instruction decoder & RAM ports,
+ * wired the way the Logisim model is, one clock cycle per step().
+ * Every signal is bit-sliced (see gates.hpp), so a Datapath is NUM_LANES independent machines, each with its own program,
+ * all clocked together. Machines that halt (or hit the instruction limit) just stop latching anything.
+ *
+ * Everything but the block memory instructions takes one cycle. Those take one cycle per byte plus one to finish,
+ * counting bytes in the index latch I, and keep the opcode in IR while they're busy. Registers & flags only change
+ * on the finishing cycle. MCPY copies forwards, or backwards when the destination overlaps the end of the source,
+ * which is what memmove() does; copies that overlap both ways (possible only when the blocks wrap around RAM)
+ * can't be done a byte at a time, so those machines are stopped & flagged as unsupported.
+ */
+
+class Datapath
+{
+public:
+	static const uint8_t COUNT_BITS = 48; //Width of the instruction counters.
+
+	Byte memory[RAM_SIZE];
+	Byte registers[NUM_REGISTERS];
+	Byte pc;
+	Byte ir; //Opcode of the block instruction in progress.
+	Byte index; //I: bytes done by the block instruction in progress.
+	Lanes c, z, s, o, l; //Flags.
+	Lanes running;
+	Lanes busy; //In the middle of a block instruction.
+	Lanes unsupported; //Stopped on a block copy this datapath can't do.
+	Lanes limited; //Stopped by the instruction limit.
+	Lanes count[COUNT_BITS]; //Instructions retired, bit-sliced counter.
+
+	Datapath()
+	{
+		Byte zero = constantByte(0);
+		for (uint16_t a = 0; a < RAM_SIZE; ++a)
+		{
+			memory[a] = zero;
+		}
+		for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+		{
+			registers[r] = zero;
+		}
+		pc = ir = index = zero;
+		c = z = s = o = l = 0;
+		running = busy = unsupported = limited = 0;
+		for (uint8_t b = 0; b < COUNT_BITS; ++b)
+		{
+			count[b] = 0;
+		}
+	}
+
+	//Puts a RAM_SIZE byte program image into lane, and starts it.
+	void load(unsigned lane, const uint8_t *image)
+	{
+		for (uint16_t a = 0; a < RAM_SIZE; ++a)
+		{
+			setLane(memory[a], lane, image[a]);
+		}
+		setLane(running, lane, true);
+	}
+
+	void readRAM(unsigned lane, uint8_t *image) const
+	{
+		for (uint16_t a = 0; a < RAM_SIZE; ++a)
+		{
+			image[a] = getLane(memory[a], lane);
+		}
+	}
+
+	uint64_t instructionCount(unsigned lane) const
+	{
+		uint64_t value = 0;
+		for (uint8_t b = 0; b < COUNT_BITS; ++b)
+		{
+			value |= static_cast<uint64_t>(getLane(count[b], lane)) << b;
+		}
+		return value;
+	}
+
+	//Flags of a lane, as C Z S O L in bits 4 - 0.
+	uint8_t flags(unsigned lane) const
+	{
+		return (getLane(c, lane) << 4) | (getLane(z, lane) << 3) | (getLane(s, lane) << 2) | (getLane(o, lane) << 1) | getLane(l, lane);
+	}
+
+	/*
+	 * Clocks until every machine has stopped. Returns the number of cycles.
+	 * max_instructions stops each machine after that many instructions, like tem's, 0 = unlimited.
+	 */
+	uint64_t run(uint64_t max_instructions = 0)
+	{
+		uint64_t cycles = 0;
+		while (running)
+		{
+			step();
+			++cycles;
+
+			//A machine retires at most an instruction per cycle, so none can be at the limit before then.
+			if (max_instructions && cycles >= max_instructions)
+			{
+				Lanes at_limit = running;
+				for (uint8_t b = 0; b < COUNT_BITS; ++b)
+				{
+					at_limit &= ((max_instructions >> b) & 1) ? count[b] : ~count[b];
+				}
+				limited |= at_limit;
+				running &= ~at_limit;
+			}
+		}
+		return cycles;
+	}
+
+	//One clock cycle.
+	void step()
+	{
+		Lanes active = running;
+		if (!active)
+		{
+			return;
+		}
+
+		//Fetch & decode.
+		Lanes lines[RAM_SIZE];
+		decodeAddress(pc, lines);
+		Byte opcode = mux(busy, readMemory(lines), ir);
+
+		Lanes op[NUM_OPERATIONS] = {};
+		Lanes valid = 0, x_high = 0, y_high = 0;
+		for (uint16_t i = 0; i < NUM_INSTRUCTIONS; ++i)
+		{
+			const InstructionInfo &info = INSTRUCTION_SET[i];
+			uint8_t fixed = fixedBits(info.layout);
+			Lanes match = ALL_LANES;
+			for (uint8_t b = 0; b < 8; ++b)
+			{
+				if ((fixed >> b) & 1)
+				{
+					match &= ((info.base >> b) & 1) ? opcode.bit[b] : ~opcode.bit[b];
+				}
+			}
+			op[info.operation] |= match;
+			valid |= match;
+			if (info.layout == LAYOUT_X_HIGH || info.layout == LAYOUT_X_Y)
+			{
+				x_high |= match;
+			}
+			if (info.layout == LAYOUT_Y_X)
+			{
+				y_high |= match;
+			}
+		}
+		op[OP_HALT] |= ~valid; //Opcodes nothing encodes halt, as in tem.
+
+		Lanes immediate_ops = op[OP_LDI] | op[OP_ADDI] | op[OP_SUBI] | op[OP_CMPI];
+		Lanes branch_ops = op[OP_BRA] | op[OP_BZ] | op[OP_BNZ] | op[OP_BC] | op[OP_BNC] | op[OP_BS] | op[OP_BO] | op[OP_BL];
+		Lanes block_ops = op[OP_MCPY] | op[OP_MSET] | op[OP_MSCAN] | op[OP_MCMP];
+
+		//Register bank read ports.
+		Lanes x_lines[NUM_REGISTERS], y_lines[NUM_REGISTERS];
+		decode2(mux(x_high, opcode.bit[0], opcode.bit[2]), mux(x_high, opcode.bit[1], opcode.bit[3]), x_lines);
+		decode2(mux(y_high, opcode.bit[0], opcode.bit[2]), mux(y_high, opcode.bit[1], opcode.bit[3]), y_lines);
+		Byte rx = readRegister(x_lines);
+		Byte ry = readRegister(y_lines);
+		const Byte &block_a = registers[BLOCK_POINTER];
+		const Byte &block_b = registers[BLOCK_VALUE];
+		const Byte &block_c = registers[BLOCK_COUNT];
+		const Byte &sp = registers[STACK_POINTER];
+
+		//Immediate, the byte after the opcode.
+		Byte pc1 = increment(pc);
+		Byte pc2 = increment(pc1);
+		Byte immediate = constantByte(0);
+		if (active & (immediate_ops | branch_ops))
+		{
+			decodeAddress(pc1, lines);
+			immediate = readMemory(lines);
+		}
+
+		//Block instruction addressing. A block is done when I reaches C.
+		Lanes at_end = equal(index, block_c);
+		Byte a_i = add(block_a, index);
+		Byte b_i = add(block_b, index);
+
+		Lanes borrow;
+		subtract(subtract(block_a, block_b), block_c, borrow);
+		Lanes forward = isZero(subtract(block_a, block_b)) | ~borrow;
+		subtract(subtract(block_b, block_a), block_c, borrow);
+		Lanes backward = ~forward & ~borrow;
+
+		Lanes cannot_copy = active & op[OP_MCPY] & ~forward & ~backward;
+		unsupported |= cannot_copy;
+		running &= ~cannot_copy;
+		active &= ~cannot_copy;
+
+		Byte copy_index = mux(backward, index, subtract(decrement(block_c), index));
+		Byte copy_src = add(block_b, copy_index);
+		Byte copy_dst = add(block_a, copy_index);
+
+		//Data read ports: LD, POP/RET, and the block instructions' source bytes.
+		Byte data = constantByte(0), data2 = constantByte(0);
+		if (active & (op[OP_LD] | op[OP_POP] | op[OP_RET] | block_ops))
+		{
+			Byte address = gate(op[OP_LD], ry);
+			orInto(address, gate(op[OP_POP] | op[OP_RET], sp));
+			orInto(address, gate(op[OP_MSCAN] | op[OP_MCMP], a_i));
+			orInto(address, gate(op[OP_MCPY], copy_src));
+			decodeAddress(address, lines);
+			data = readMemory(lines);
+		}
+		if (active & op[OP_MCMP])
+		{
+			decodeAddress(b_i, lines);
+			data2 = readMemory(lines);
+		}
+
+		Lanes hit = op[OP_MSCAN] & equal(data, block_b) & ~at_end;
+		Lanes mismatch = op[OP_MCMP] & ~equal(data, data2) & ~at_end;
+		Lanes block_step = block_ops & ~(at_end | hit | mismatch);
+		Lanes block_finish = block_ops & ~block_step;
+
+		//Branch conditions, from the flags as they were before this cycle.
+		Lanes taken = op[OP_BRA] | (op[OP_BZ] & z) | (op[OP_BNZ] & ~z) | (op[OP_BC] & c) | (op[OP_BNC] & ~c) | (op[OP_BS] & s) | (op[OP_BO] & o) | (op[OP_BL] & l);
+		Lanes jump = op[OP_JMP] | op[OP_CALL] | (op[OP_PCL] & l) | (op[OP_PCO] & o) | (op[OP_PCS] & s) | (op[OP_PCC] & c) | (op[OP_PCZ] & z);
+
+		//ALU.
+		Byte operand = mux(immediate_ops, ry, immediate);
+		Lanes carry = 0;
+		Byte sum = add(rx, operand, carry);
+		Lanes difference_borrow;
+		Byte difference = subtract(rx, operand, difference_borrow);
+		Byte shifted_right = shiftRight(rx, ry);
+		Word shifted_left = shiftLeftWide(rx, ry);
+		Word product = multiply(rx, ry);
+		Byte product_low = wordByte(product, 0);
+		Byte product_high = wordByte(product, 1);
+		Byte inverted = bitwiseNot(rx);
+		Byte anded = bitwiseAnd(rx, ry);
+		Byte ored = bitwiseOr(rx, ry);
+
+		Lanes block_compare_borrow;
+		Byte block_difference = subtract(gate(mismatch, data), gate(mismatch, data2), block_compare_borrow);
+
+		//Flags. Each group of instructions sets the ones it changes, the rest keep their value.
+		Lanes new_c = c, new_z = z, new_s = s, new_o = o, new_l = l;
+		Lanes adds = op[OP_ADD] | op[OP_ADDI];
+		Lanes subtracts = op[OP_SUB] | op[OP_SUBI] | op[OP_CMP] | op[OP_CMPI];
+		setFlags(adds, carry, sum, addOverflow(rx, operand, sum), new_c, new_z, new_s, new_o, new_l);
+		setFlags(subtracts, difference_borrow, difference, subtractOverflow(rx, operand, difference), new_c, new_z, new_s, new_o, new_l);
+		setFlags(op[OP_MCMP] & block_finish, block_compare_borrow, block_difference, subtractOverflow(gate(mismatch, data), gate(mismatch, data2), block_difference), new_c, new_z, new_s, new_o, new_l);
+		setFlags(op[OP_NOT], 0, inverted, 0, new_c, new_z, new_s, new_o, new_l);
+		Lanes product_overflow = ~isZero(product_high);
+		setFlags(op[OP_MUL], product_overflow, product_low, product_overflow, new_c, new_z, new_s, new_o, new_l);
+		setZeroSign(op[OP_AND], anded, new_z, new_s);
+		setZeroSign(op[OP_OR], ored, new_z, new_s);
+		setZeroSign(op[OP_RSHIFT], shifted_right, new_z, new_s);
+		setZeroSign(op[OP_LSHIFT], wordByte(shifted_left, 0), new_z, new_s);
+		new_c = mux(op[OP_LSHIFT] & ~isZero(ry), new_c, shifted_left.bit[8]); //Last bit shifted out, unchanged if nothing was.
+		Lanes scan_finish = op[OP_MSCAN] & block_finish;
+		new_c &= ~scan_finish;
+		new_z = mux(scan_finish, new_z, hit);
+		new_s &= ~scan_finish;
+		new_o &= ~scan_finish;
+		new_l &= ~scan_finish;
+
+		c = mux(active, c, new_c);
+		z = mux(active, z, new_z);
+		s = mux(active, s, new_s);
+		o = mux(active, o, new_o);
+		l = mux(active, l, new_l);
+
+		//RAM write port: ST, PUSH/CALL, and the block instructions' destination bytes.
+		Byte stack_below = decrement(sp);
+		Lanes write = active & (op[OP_ST] | op[OP_PUSH] | op[OP_CALL] | ((op[OP_MSET] | op[OP_MCPY]) & block_step));
+		if (write)
+		{
+			Byte address = gate(op[OP_ST], rx);
+			orInto(address, gate(op[OP_PUSH] | op[OP_CALL], stack_below));
+			orInto(address, gate(op[OP_MSET], a_i));
+			orInto(address, gate(op[OP_MCPY], copy_dst));
+			Byte value = gate(op[OP_ST], ry);
+			orInto(value, gate(op[OP_PUSH], rx));
+			orInto(value, gate(op[OP_CALL], pc1));
+			orInto(value, gate(op[OP_MSET], block_b));
+			orInto(value, gate(op[OP_MCPY], data));
+
+			decodeAddress(address, lines);
+			for (uint16_t a = 0; a < RAM_SIZE; ++a)
+			{
+				Lanes enable = lines[a] & write;
+				if (enable)
+				{
+					memory[a] = mux(enable, memory[a], value);
+				}
+			}
+		}
+
+		//Next PC.
+		Lanes hold = op[OP_HALT] | block_step;
+		Lanes skip = (immediate_ops | branch_ops) & ~taken;
+		Lanes next = ~(taken | jump | hold | skip | op[OP_RET]);
+
+		Byte next_pc = gate(next, pc1);
+		orInto(next_pc, gate(skip, pc2));
+		orInto(next_pc, gate(taken, add(pc2, immediate)));
+		orInto(next_pc, gate(jump, rx));
+		orInto(next_pc, gate(op[OP_RET], data));
+		orInto(next_pc, gate(hold, pc));
+		pc = mux(active, pc, next_pc);
+
+		//Register bank write ports, in order: stack pointer, MUL's high byte, block instruction results, X.
+		Byte result = gate(op[OP_SET], ry);
+		orInto(result, gate(op[OP_LDI], immediate));
+		orInto(result, gate(op[OP_LD] | op[OP_POP], data));
+		orInto(result, gate(op[OP_ADD] | op[OP_ADDI], sum));
+		orInto(result, gate(op[OP_SUB] | op[OP_SUBI], difference));
+		orInto(result, gate(op[OP_RSHIFT], shifted_right));
+		orInto(result, gate(op[OP_LSHIFT], wordByte(shifted_left, 0)));
+		orInto(result, gate(op[OP_NOT], inverted));
+		orInto(result, gate(op[OP_AND], anded));
+		orInto(result, gate(op[OP_OR], ored));
+		orInto(result, gate(op[OP_MUL], product_low));
+		Lanes write_x = active & (op[OP_SET] | op[OP_LDI] | op[OP_LD] | op[OP_POP] | op[OP_ADD] | op[OP_ADDI] | op[OP_SUB] | op[OP_SUBI]
+				| op[OP_RSHIFT] | op[OP_LSHIFT] | op[OP_NOT] | op[OP_AND] | op[OP_OR] | op[OP_MUL]);
+
+		Byte new_sp = mux(active & (op[OP_PUSH] | op[OP_CALL]), sp, stack_below);
+		new_sp = mux(active & (op[OP_POP] | op[OP_RET]), new_sp, increment(sp));
+		registers[STACK_POINTER] = new_sp;
+
+		Lanes finish = active & block_finish;
+		Byte new_c_register = subtract(block_c, index);
+		registers[BLOCK_POINTER] = mux(finish, registers[BLOCK_POINTER], a_i);
+		registers[BLOCK_VALUE] = mux(finish & (op[OP_MCPY] | op[OP_MCMP]), registers[BLOCK_VALUE], b_i);
+		registers[BLOCK_COUNT] = mux(finish, registers[BLOCK_COUNT], new_c_register);
+
+		for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+		{
+			registers[r] = mux(active & op[OP_MUL] & y_lines[r], registers[r], product_high);
+			registers[r] = mux(write_x & x_lines[r], registers[r], result);
+		}
+
+		//Block instruction latches.
+		Lanes stepping = active & block_step;
+		index = gate(stepping, increment(index));
+		busy = mux(active, busy, stepping);
+		ir = mux(active, ir, opcode);
+
+		//Retire.
+		Lanes retire = active & ~block_step;
+		for (uint8_t b = 0; b < COUNT_BITS && retire; ++b)
+		{
+			Lanes bit = count[b];
+			count[b] = bit ^ retire;
+			retire &= bit;
+		}
+		running &= ~(active & op[OP_HALT]);
+	}
+
+private:
+	//Opcode bits that aren't operand fields.
+	static uint8_t fixedBits(OperandLayout layout)
+	{
+		switch (layout)
+		{
+		case LAYOUT_X_LOW:
+		case LAYOUT_X_LOW_IMMEDIATE:
+			return 0xFC;
+		case LAYOUT_X_HIGH:
+			return 0xF3;
+		case LAYOUT_X_Y:
+		case LAYOUT_Y_X:
+			return 0xF0;
+		default:
+			return 0xFF;
+		}
+	}
+
+	//AND-OR array over the address lines. Lines no machine selects are skipped, they'd add nothing.
+	Byte readMemory(const Lanes lines[RAM_SIZE]) const
+	{
+		Byte value = constantByte(0);
+		for (uint16_t a = 0; a < RAM_SIZE; ++a)
+		{
+			if (lines[a])
+			{
+				orInto(value, gate(lines[a], memory[a]));
+			}
+		}
+		return value;
+	}
+
+	Byte readRegister(const Lanes lines[NUM_REGISTERS]) const
+	{
+		Byte value = constantByte(0);
+		for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+		{
+			orInto(value, gate(lines[r], registers[r]));
+		}
+		return value;
+	}
+
+	//Same as ALU::add: (!S1 && !S2 && Sout) || (S1 && S2 && !Sout)
+	static Lanes addOverflow(const Byte &a, const Byte &b, const Byte &sum)
+	{
+		return (~a.bit[7] & ~b.bit[7] & sum.bit[7]) | (a.bit[7] & b.bit[7] & ~sum.bit[7]);
+	}
+
+	//Same as ALU::sub: (!S1 && S2 && Sout) || (S1 && !S2 && !Sout)
+	static Lanes subtractOverflow(const Byte &a, const Byte &b, const Byte &difference)
+	{
+		return (~a.bit[7] & b.bit[7] & difference.bit[7]) | (a.bit[7] & ~b.bit[7] & ~difference.bit[7]);
+	}
+
+	//All 5 flags from a result, in the lanes where select is set. L = S XOR O.
+	static void setFlags(Lanes select, Lanes carry, const Byte &value, Lanes overflow, Lanes &new_c, Lanes &new_z, Lanes &new_s, Lanes &new_o, Lanes &new_l)
+	{
+		new_c = mux(select, new_c, carry);
+		new_z = mux(select, new_z, isZero(value));
+		new_s = mux(select, new_s, value.bit[7]);
+		new_o = mux(select, new_o, overflow);
+		new_l = mux(select, new_l, value.bit[7] ^ overflow);
+	}
+
+	//Just Z & S, for the logic instructions.
+	static void setZeroSign(Lanes select, const Byte &value, Lanes &new_z, Lanes &new_s)
+	{
+		new_z = mux(select, new_z, isZero(value));
+		new_s = mux(select, new_s, value.bit[7]);
+	}
+};
+
+#endif //TRISK_DATAPATH_HPP
@@ -0,0 +1,329 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#ifndef TRISK_GATES_HPP
+#define TRISK_GATES_HPP
+
+#include <cstdint>
+
+/*
+ * Bit-sliced logic. Every signal is a Lanes word, whose bit i is the signal's value in machine (lane) i,
+ * so each of the gates below is the same gate evaluated in 64 independent machines at once.
+ * Multi-bit signals are arrays of signals, least significant bit first: Byte for the 8-bit datapath,
+ * Word for the 16-bit product of the multiplier.
+ * Everything is built from AND, OR, XOR & NOT on whole words, the way the hardware builds it from gates.
+ */
+
+typedef uint64_t Lanes;
+static const unsigned NUM_LANES = 64;
+static const Lanes ALL_LANES = ~static_cast<Lanes>(0);
+
+struct Byte
+{
+	Lanes bit[8];
+};
+
+struct Word
+{
+	Lanes bit[16];
+};
+
+//The same constant in every lane.
+inline Byte constantByte(uint8_t value)
+{
+	Byte result;
+	for (uint8_t b = 0; b < 8; ++b)
+	{
+		result.bit[b] = ((value >> b) & 1) ? ALL_LANES : 0;
+	}
+	return result;
+}
+
+//2:1 multiplexer: b in the lanes where select is set, a in the others.
+inline Lanes mux(Lanes select, Lanes a, Lanes b)
+{
+	return (a & ~select) | (b & select);
+}
+
+inline Byte mux(Lanes select, const Byte &a, const Byte &b)
+{
+	Byte result;
+	for (uint8_t b_ = 0; b_ < 8; ++b_)
+	{
+		result.bit[b_] = mux(select, a.bit[b_], b.bit[b_]);
+	}
+	return result;
+}
+
+//value in the lanes where enable is set, 0 in the others. ORing enabled values together makes a multiplexer out of one-hot selects.
+inline Byte gate(Lanes enable, const Byte &value)
+{
+	Byte result;
+	for (uint8_t b = 0; b < 8; ++b)
+	{
+		result.bit[b] = value.bit[b] & enable;
+	}
+	return result;
+}
+
+inline void orInto(Byte &into, const Byte &value)
+{
+	for (uint8_t b = 0; b < 8; ++b)
+	{
+		into.bit[b] |= value.bit[b];
+	}
+}
+
+inline Byte bitwiseAnd(const Byte &a, const Byte &b)
+{
+	Byte result;
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		result.bit[i] = a.bit[i] & b.bit[i];
+	}
+	return result;
+}
+
+inline Byte bitwiseOr(const Byte &a, const Byte &b)
+{
+	Byte result;
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		result.bit[i] = a.bit[i] | b.bit[i];
+	}
+	return result;
+}
+
+inline Byte bitwiseNot(const Byte &a)
+{
+	Byte result;
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		result.bit[i] = ~a.bit[i];
+	}
+	return result;
+}
+
+//8 input NOR.
+inline Lanes isZero(const Byte &a)
+{
+	Lanes any = 0;
+	for (uint8_t b = 0; b < 8; ++b)
+	{
+		any |= a.bit[b];
+	}
+	return ~any;
+}
+
+inline Lanes equal(const Byte &a, const Byte &b)
+{
+	Lanes differ = 0;
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		differ |= a.bit[i] ^ b.bit[i];
+	}
+	return ~differ;
+}
+
+//Ripple carry adder: a + b + carry. carry is replaced by the carry out of the top bit.
+inline Byte add(const Byte &a, const Byte &b, Lanes &carry)
+{
+	Byte sum;
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		Lanes half = a.bit[i] ^ b.bit[i];
+		sum.bit[i] = half ^ carry;
+		carry = (a.bit[i] & b.bit[i]) | (half & carry);
+	}
+	return sum;
+}
+
+inline Byte add(const Byte &a, const Byte &b)
+{
+	Lanes carry = 0;
+	return add(a, b, carry);
+}
+
+//a - b, as a + ~b + 1. borrow is set where b > a (the carry out is clear).
+inline Byte subtract(const Byte &a, const Byte &b, Lanes &borrow)
+{
+	Lanes carry = ALL_LANES;
+	Byte difference = add(a, bitwiseNot(b), carry);
+	borrow = ~carry;
+	return difference;
+}
+
+inline Byte subtract(const Byte &a, const Byte &b)
+{
+	Lanes borrow;
+	return subtract(a, b, borrow);
+}
+
+//a + 1, a half adder chain.
+inline Byte increment(const Byte &a)
+{
+	Byte result;
+	Lanes carry = ALL_LANES;
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		result.bit[i] = a.bit[i] ^ carry;
+		carry &= a.bit[i];
+	}
+	return result;
+}
+
+//a - 1.
+inline Byte decrement(const Byte &a)
+{
+	Byte result;
+	Lanes borrow = ALL_LANES;
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		result.bit[i] = a.bit[i] ^ borrow;
+		borrow &= ~a.bit[i];
+	}
+	return result;
+}
+
+//Barrel shifter, a stage per bit of count (1, 2 & 4), and 0 for counts of 8 or more.
+inline Byte shiftRight(const Byte &a, const Byte &count)
+{
+	Byte result = a;
+	for (uint8_t stage = 0; stage < 3; ++stage)
+	{
+		uint8_t distance = 1 << stage;
+		Byte shifted;
+		for (uint8_t i = 0; i < 8; ++i)
+		{
+			shifted.bit[i] = (i + distance < 8) ? result.bit[i + distance] : 0;
+		}
+		result = mux(count.bit[stage], result, shifted);
+	}
+
+	Lanes too_far = count.bit[3] | count.bit[4] | count.bit[5] | count.bit[6] | count.bit[7];
+	return gate(~too_far, result);
+}
+
+/*
+ * a << count, 16 bits wide so the bit shifted out last is bit 8 of the result (for counts of 1 - 8).
+ * A stage per bit of count (1, 2, 4 & 8), and 0 for counts of 16 or more.
+ */
+inline Word shiftLeftWide(const Byte &a, const Byte &count)
+{
+	Word result;
+	for (uint8_t i = 0; i < 16; ++i)
+	{
+		result.bit[i] = (i < 8) ? a.bit[i] : 0;
+	}
+	for (uint8_t stage = 0; stage < 4; ++stage)
+	{
+		uint8_t distance = 1 << stage;
+		for (uint8_t i = 16; i-- > 0;)
+		{
+			Lanes shifted = (i >= distance) ? result.bit[i - distance] : 0;
+			result.bit[i] = mux(count.bit[stage], result.bit[i], shifted);
+		}
+	}
+
+	Lanes too_far = count.bit[4] | count.bit[5] | count.bit[6] | count.bit[7];
+	for (uint8_t i = 0; i < 16; ++i)
+	{
+		result.bit[i] &= ~too_far;
+	}
+	return result;
+}
+
+//Array multiplier: the sum of a << i for every bit i set in b, through a row of adders per bit.
+inline Word multiply(const Byte &a, const Byte &b)
+{
+	Word product;
+	for (uint8_t i = 0; i < 16; ++i)
+	{
+		product.bit[i] = (i < 8) ? (a.bit[i] & b.bit[0]) : 0;
+	}
+	for (uint8_t row = 1; row < 8; ++row)
+	{
+		Lanes carry = 0;
+		for (uint8_t i = row; i < 16; ++i)
+		{
+			Lanes partial = (i - row < 8) ? (a.bit[i - row] & b.bit[row]) : 0;
+			Lanes half = product.bit[i] ^ partial;
+			Lanes sum = half ^ carry;
+			carry = (product.bit[i] & partial) | (half & carry);
+			product.bit[i] = sum;
+		}
+	}
+	return product;
+}
+
+//Low or high byte of a Word.
+inline Byte wordByte(const Word &word, uint8_t which)
+{
+	Byte result;
+	for (uint8_t b = 0; b < 8; ++b)
+	{
+		result.bit[b] = word.bit[which * 8 + b];
+	}
+	return result;
+}
+
+//One select line per value of the 2 bits (bit1:bit0).
+inline void decode2(Lanes bit0, Lanes bit1, Lanes lines[4])
+{
+	lines[0] = ~bit1 & ~bit0;
+	lines[1] = ~bit1 & bit0;
+	lines[2] = bit1 & ~bit0;
+	lines[3] = bit1 & bit0;
+}
+
+//One select line per address: lines[a] is set in the lanes whose address is a. Two 4 to 16 decoders, then a 256 AND array.
+inline void decodeAddress(const Byte &address, Lanes lines[256])
+{
+	Lanes quarters[4][4];
+	for (uint8_t q = 0; q < 4; ++q)
+	{
+		decode2(address.bit[2 * q], address.bit[2 * q + 1], quarters[q]);
+	}
+
+	Lanes low[16], high[16];
+	for (uint8_t i = 0; i < 16; ++i)
+	{
+		low[i] = quarters[0][i & 3] & quarters[1][i >> 2];
+		high[i] = quarters[2][i & 3] & quarters[3][i >> 2];
+	}
+
+	for (uint16_t a = 0; a < 256; ++a)
+	{
+		lines[a] = high[a >> 4] & low[a & 15];
+	}
+}
+
+//Sets lane's value of signal to value.
+inline void setLane(Lanes &signal, unsigned lane, bool value)
+{
+	signal = (signal & ~(static_cast<Lanes>(1) << lane)) | (static_cast<Lanes>(value) << lane);
+}
+
+inline void setLane(Byte &signal, unsigned lane, uint8_t value)
+{
+	for (uint8_t b = 0; b < 8; ++b)
+	{
+		setLane(signal.bit[b], lane, (value >> b) & 1);
+	}
+}
+
+inline bool getLane(Lanes signal, unsigned lane)
+{
+	return (signal >> lane) & 1;
+}
+
+inline uint8_t getLane(const Byte &signal, unsigned lane)
+{
+	uint8_t value = 0;
+	for (uint8_t b = 0; b < 8; ++b)
+	{
+		value |= static_cast<uint8_t>(getLane(signal.bit[b], lane)) << b;
+	}
+	return value;
+}
+
+#endif //TRISK_GATES_HPP
@@ -0,0 +1,313 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "isa.hpp"
+#include "cpu.hpp"
+#include "datapath.hpp"
+
+struct Image
+{
+	std::string filename;
+	uint8_t memory[RAM_SIZE];
+};
+
+//Same checks as bin2logisim: at least RAM_SIZE bytes, anything past that is ignored.
+static bool loadImage(const std::string &filename, Image &image)
+{
+	std::ifstream input_file(filename, std::ios::binary);
+
+	if (!input_file)
+	{
+		std::cout << "Error: failed to open file for input program: \"" << filename << "\"\n";
+		return false;
+	}
+
+	std::streampos end;
+	input_file.seekg(0, std::ios::end);
+	end = input_file.tellg();
+	if (end < RAM_SIZE)
+	{
+		std::cout << "Error: \"" << filename << "\": Input RAM file is too short!\n";
+		return false;
+	}
+
+	if (end > RAM_SIZE)
+	{
+		std::cout << "Warning: \"" << filename << "\": RAM file is too big! Program may not function as you expect.\n";
+	}
+
+	input_file.seekg(0, std::ios::beg);
+	if (!input_file.read(reinterpret_cast<char* >(image.memory), RAM_SIZE))
+	{
+		std::cout << "Error: \"" << filename << "\": Unknown error in reading in RAM file.\n";
+		return false;
+	}
+
+	image.filename = filename;
+	return true;
+}
+
+static std::string hexByte(uint8_t value)
+{
+	static const char DIGITS[] = "0123456789abcdef";
+	return std::string("0x") + DIGITS[value >> 4] + DIGITS[value & 0xF];
+}
+
+static std::string formatFlags(uint8_t flags)
+{
+	return std::string("C=") + std::to_string((flags >> 4) & 1) + " Z=" + std::to_string((flags >> 3) & 1) + " S=" + std::to_string((flags >> 2) & 1)
+			+ " O=" + std::to_string((flags >> 1) & 1) + " L=" + std::to_string(flags & 1);
+}
+
+/*
+ * Runs image on tem's CPU (quietly) and prints every way lane of datapath ended up different from it.
+ * Returns true if they match.
+ */
+static bool checkAgainstEmulator(CPU<> &reference, const Image &image, const Datapath &datapath, unsigned lane, uint64_t max_instructions)
+{
+	reference.reset();
+	std::cout.setstate(std::ios::failbit);
+	reference.loadRAM(image.filename);
+	CPU<>::RunResult result = reference.run(max_instructions);
+	std::cout.clear();
+
+	bool match = true;
+	uint8_t ram[RAM_SIZE];
+	datapath.readRAM(lane, ram);
+	for (uint16_t a = 0; a < RAM_SIZE; ++a)
+	{
+		uint8_t expected = reference.getRAM().getByte(a);
+		if (ram[a] != expected)
+		{
+			std::cout << "\tRAM " << hexByte(a) << ": gate " << hexByte(ram[a]) << ", tem " << hexByte(expected) << "\n";
+			match = false;
+		}
+	}
+
+	for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+	{
+		uint8_t value = getLane(datapath.registers[r], lane);
+		uint8_t expected = reference.getRegBank().getRegister(r);
+		if (value != expected)
+		{
+			std::cout << "\tRegister " << static_cast<char>('A' + r) << ": gate " << hexByte(value) << ", tem " << hexByte(expected) << "\n";
+			match = false;
+		}
+	}
+
+	const ALU &alu = reference.getALU();
+	uint8_t expected_flags = (alu.getCFlag() << 4) | (alu.getZFlag() << 3) | (alu.getSFlag() << 2) | (alu.getOFlag() << 1) | alu.getLFlag();
+	if (datapath.flags(lane) != expected_flags)
+	{
+		std::cout << "\tFlags: gate " << formatFlags(datapath.flags(lane)) << ", tem " << formatFlags(expected_flags) << "\n";
+		match = false;
+	}
+
+	uint8_t pc = getLane(datapath.pc, lane);
+	if (pc != reference.getProgramCounter())
+	{
+		std::cout << "\tPC: gate " << hexByte(pc) << ", tem " << hexByte(reference.getProgramCounter()) << "\n";
+		match = false;
+	}
+
+	uint64_t count = datapath.instructionCount(lane);
+	if (count != reference.getInstructionCount())
+	{
+		std::cout << "\tInstructions: gate " << count << ", tem " << reference.getInstructionCount() << "\n";
+		match = false;
+	}
+
+	bool limited = getLane(datapath.limited, lane);
+	if (limited != (result == CPU<>::RUN_INSTRUCTION_LIMIT))
+	{
+		std::cout << "\tInstruction limit: gate " << (limited ? "reached" : "not reached") << ", tem " << (limited ? "not reached" : "reached") << "\n";
+		match = false;
+	}
+
+	return match;
+}
+
+void displayUsageInstructions()
+{
+	std::cout << "Program usage: \n" \
+			<< "\n$> tgate [options] <program file>...\n\n" \
+			<< "Runs programs on a gate level model of the TRISK datapath, " << NUM_LANES << " at a time (one per bit of a machine word),\n" \
+			<< "then runs each of them on tem's CPU and checks that RAM, registers, flags, PC & instruction count came out the same.\n" \
+			<< "Program files are the same RAM images bin2logisim takes.\n\n" \
+			<< "Options:\n" \
+			<< "  --max-instructions <n>  Stop each program after n instructions, like tem's. Default: unlimited.\n" \
+			<< "  --no-check              Just run the gate level model, don't compare against tem.\n" \
+			<< "  --write-ram             Write the final RAM of each program to <program file>.gate.ram.\n";
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::string> input_filenames;
+	uint64_t max_instructions = 0;
+	bool check = true;
+	bool write_ram = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-h"))
+		{
+			displayUsageInstructions();
+			return 0;
+		}
+		else if (!strcmp(argv[i], "--max-instructions") && i + 1 < argc)
+		{
+			//Digits only: strtoull would take a sign, and give 0 (unlimited) for anything else.
+			char *end;
+			errno = 0;
+			max_instructions = std::strtoull(argv[++i], &end, 10);
+			if (!isdigit(static_cast<unsigned char>(argv[i][0])) || *end || errno == ERANGE)
+			{
+				std::cout << "Error: --max-instructions takes a whole number (at most " << UINT64_MAX << "), not \"" << argv[i] << "\".\n";
+				displayUsageInstructions();
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i], "--no-check"))
+		{
+			check = false;
+		}
+		else if (!strcmp(argv[i], "--write-ram"))
+		{
+			write_ram = true;
+		}
+		else if (argv[i][0] == '-')
+		{
+			displayUsageInstructions();
+			return 1;
+		}
+		else
+		{
+			input_filenames.push_back(argv[i]);
+		}
+	}
+
+	if (input_filenames.empty())
+	{
+		displayUsageInstructions();
+		return 1;
+	}
+
+	std::vector<Image> images;
+	images.reserve(input_filenames.size());
+	for (const std::string &filename : input_filenames)
+	{
+		images.emplace_back();
+		if (!loadImage(filename, images.back()))
+		{
+			return 1;
+		}
+
+		//Same as tem, which won't run an empty program.
+		bool empty = true;
+		for (uint16_t a = 0; a < RAM_SIZE && empty; ++a)
+		{
+			empty = !images.back().memory[a];
+		}
+		if (empty)
+		{
+			std::cout << "Warning: \"" << filename << "\" has no instructions! Just an empty infinite loop, not running this program.\n";
+			images.pop_back();
+		}
+	}
+
+	CPU<> reference;
+	uint32_t matched = 0, differed = 0, unsupported = 0, limited = 0;
+	uint64_t total_cycles = 0, total_instructions = 0;
+	std::chrono::steady_clock::duration gate_time(0);
+
+	for (std::size_t first = 0; first < images.size(); first += NUM_LANES)
+	{
+		std::size_t lanes = std::min<std::size_t>(NUM_LANES, images.size() - first);
+		Datapath datapath;
+		for (unsigned lane = 0; lane < lanes; ++lane)
+		{
+			datapath.load(lane, images[first + lane].memory);
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		total_cycles += datapath.run(max_instructions);
+		gate_time += std::chrono::steady_clock::now() - start;
+
+		for (unsigned lane = 0; lane < lanes; ++lane)
+		{
+			const Image &image = images[first + lane];
+			uint64_t count = datapath.instructionCount(lane);
+			total_instructions += count;
+
+			std::cout << image.filename << ": " << count << " instructions";
+			if (getLane(datapath.limited, lane))
+			{
+				std::cout << ", instruction limit reached";
+				++limited;
+			}
+
+			if (write_ram)
+			{
+				uint8_t ram[RAM_SIZE];
+				datapath.readRAM(lane, ram);
+				std::string output_filename = image.filename + ".gate.ram";
+				std::ofstream output_file(output_filename, std::ios::binary);
+				if (!output_file.write(reinterpret_cast<const char* >(ram), RAM_SIZE))
+				{
+					std::cout << "\nError: failed to open file for outputting final state of RAM: \"" << output_filename << "\"\n";
+					return 1;
+				}
+			}
+
+			if (getLane(datapath.unsupported, lane))
+			{
+				std::cout << ", stopped on an MCPY whose blocks overlap at both ends, not checked.\n";
+				++unsupported;
+			}
+			else if (!check)
+			{
+				std::cout << ".\n";
+			}
+			else
+			{
+				//Differences are printed under the name.
+				std::cout << ":\n";
+				if (checkAgainstEmulator(reference, image, datapath, lane, max_instructions))
+				{
+					std::cout << "\tMatches tem.\n";
+					++matched;
+				}
+				else
+				{
+					++differed;
+				}
+			}
+		}
+	}
+
+	uint64_t gate_us = std::chrono::duration_cast<std::chrono::microseconds>(gate_time).count();
+	std::cout << "\n" << images.size() << " programs";
+	if (check)
+	{
+		std::cout << ": " << matched << " match tem, " << differed << " differ";
+	}
+	std::cout << ", " << unsupported << " unsupported, " << limited << " hit the instruction limit.\n";
+	std::cout << "Gate level model: " << total_cycles << " cycles, " << total_instructions << " instructions in " << gate_us / 1000.0 << " ms";
+	if (gate_us)
+	{
+		std::cout << " (" << static_cast<uint64_t>(total_instructions * 1000000.0 / gate_us) << " instructions/s)";
+	}
+	std::cout << ".\n";
+
+	return differed ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <vector>
+
+#include "isa.hpp"
+#include "object.hpp"
+
+/*
+ * tld -- links object files output by tas -c into a program image that can be run in the emulator.
+ * See object.hpp for the object format & how sections are laid out.
+ */
+
+void displayUsageInstructions(std::string default_output)
+{
+	std::cout << "Program usage: \n" \
+			<< "\n$> tld <output binary file> <input object file> [<input object file> ...]\n\n" \
+			<< "Execution starts at the first section of the first object file.\n" \
+			<< "Default output: " << default_output << "\n";
+}
+
+int main(int argc, char **argv)
+{
+	std::string output_filename = "program.bin";
+
+	if (argc >= 2 && !strcmp(argv[1], "-h"))
+	{
+		displayUsageInstructions(output_filename);
+		return 0;
+	}
+
+	if (argc < 3)
+	{
+		displayUsageInstructions(output_filename);
+		return 1;
+	}
+
+	output_filename = argv[1];
+
+	std::vector<std::string> input_filenames(argv + 2, argv + argc);
+	std::vector<ObjectFile> modules(input_filenames.size());
+	for (std::size_t i = 0; i < modules.size(); ++i)
+	{
+		if (!modules[i].read(input_filenames[i]))
+		{
+			return 1;
+		}
+	}
+
+	uint8_t program_memory[RAM_SIZE] = {};
+	if (!linkObjects(modules, input_filenames, program_memory))
+	{
+		return 1;
+	}
+
+	std::ofstream output_file(output_filename, std::ios::binary);
+
+	if (!output_file)
+	{
+		std::cout << "Error: failed to open file for output: \"" << output_filename << "\"\n";
+		return 1;
+	}
+
+	output_file.write(reinterpret_cast<char* >(program_memory), RAM_SIZE);
+	output_file.close();
+
+	return 0;
+}
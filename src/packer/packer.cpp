@@ -0,0 +1,169 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include "isa.hpp"
+#include "archive.hpp"
+
+void displayUsageInstructions()
+{
+	std::cout << "Program usage: \n" \
+			<< "\n$> tpack <archive> <program file>...\n" \
+			<< "$> tpack -l <archive>\n" \
+			<< "$> tpack -x <archive> [<directory>]\n\n" \
+			<< "Packs " << RAM_SIZE << " byte program images into an archive for tem --archive, lists what's in an archive\n" \
+			<< "(with the outcome of each run, for archives written by tem), or unpacks the images into files named as they were packed (without their directories).\n";
+}
+
+//Reads exactly RAM_SIZE bytes into image. Unlike tem, a bigger file is an error: nothing is silently left out of an archive.
+static bool readImage(const std::string &filename, uint8_t *image)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		std::cout << "Error: failed to open file for input program: \"" << filename << "\"\n";
+		return false;
+	}
+
+	file.seekg(0, std::ios::end);
+	std::streamoff size = file.tellg();
+	if (size != RAM_SIZE)
+	{
+		std::cout << "Error: \"" << filename << "\" is " << size << " bytes, program images are " << RAM_SIZE << ".\n";
+		return false;
+	}
+
+	file.seekg(0, std::ios::beg);
+	if (!file.read(reinterpret_cast<char* >(image), RAM_SIZE))
+	{
+		std::cout << "Error: Unknown error in reading \"" << filename << "\".\n";
+		return false;
+	}
+	return true;
+}
+
+//Images are stored under their file names, without the directories, so they unpack into the directory given to -x.
+static int pack(const std::string &archive_filename, const std::vector<std::string> &filenames)
+{
+	std::vector<std::string> names;
+	for (const std::string &filename : filenames)
+	{
+		std::string name = filename.substr(filename.find_last_of('/') + 1);
+		if (std::find(names.begin(), names.end(), name) != names.end())
+		{
+			std::cout << "Error: More than one image named \"" << name << "\", they would unpack into the same file.\n";
+			return 1;
+		}
+		names.push_back(name);
+	}
+
+	if (!ImageArchive::create(archive_filename, names, RAM_SIZE))
+	{
+		return 1;
+	}
+
+	ImageArchive archive;
+	if (!archive.open(archive_filename, true))
+	{
+		return 1;
+	}
+
+	for (uint32_t i = 0; i < archive.count(); ++i)
+	{
+		if (!readImage(filenames[i], archive.image(i)))
+		{
+			return 1;
+		}
+	}
+
+	std::cout << "Packed " << archive.count() << " images into \"" << archive_filename << "\".\n";
+	return 0;
+}
+
+static int list(const std::string &archive_filename)
+{
+	ImageArchive archive;
+	if (!archive.open(archive_filename))
+	{
+		return 1;
+	}
+
+	std::cout << archive.count() << " images of " << archive.imageSize() << " bytes.\n";
+	for (uint32_t i = 0; i < archive.count(); ++i)
+	{
+		const ArchiveEntry &entry = archive.entry(i);
+		std::cout << i << "\t" << archive.name(i) << "\t" << archiveStatusName(entry.status);
+		if (entry.status != ARCHIVE_NOT_RUN && entry.status != ARCHIVE_EMPTY)
+		{
+			std::cout << "\t" << entry.instructions << " instructions\tPC=0x" << std::hex << static_cast<uint16_t>(entry.pc);
+			for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+			{
+				std::cout << " " << static_cast<char>('A' + r) << "=0x" << static_cast<uint16_t>(entry.registers[r]);
+			}
+			std::cout << std::dec << " flags C=" << ((entry.flags >> 4) & 1) << " Z=" << ((entry.flags >> 3) & 1) << " S=" << ((entry.flags >> 2) & 1) \
+					<< " O=" << ((entry.flags >> 1) & 1) << " L=" << (entry.flags & 1);
+		}
+		std::cout << "\n";
+	}
+	return 0;
+}
+
+static int unpack(const std::string &archive_filename, const std::string &directory)
+{
+	ImageArchive archive;
+	if (!archive.open(archive_filename))
+	{
+		return 1;
+	}
+
+	for (uint32_t i = 0; i < archive.count(); ++i)
+	{
+		//Checked when the archive was opened too, this is what keeps the files inside directory.
+		if (!validArchiveName(archive.name(i)))
+		{
+			std::cout << "Error: Image " << i << " has an invalid name, not unpacking it.\n";
+			return 1;
+		}
+		std::string filename = directory + "/" + std::string(archive.name(i));
+		std::ofstream file(filename, std::ios::binary);
+		if (!file || !file.write(reinterpret_cast<const char* >(archive.image(i)), archive.imageSize()))
+		{
+			std::cout << "Error: Could not open output file \"" << filename << "\"\n";
+			return 1;
+		}
+	}
+
+	std::cout << "Unpacked " << archive.count() << " images into \"" << directory << "\".\n";
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2 || !strcmp(argv[1], "-h"))
+	{
+		displayUsageInstructions();
+		return (argc < 2) ? 1 : 0;
+	}
+
+	if (!strcmp(argv[1], "-l") && argc == 3)
+	{
+		return list(argv[2]);
+	}
+	else if (!strcmp(argv[1], "-x") && (argc == 3 || argc == 4))
+	{
+		return unpack(argv[2], (argc == 4) ? argv[3] : ".");
+	}
+	else if (argv[1][0] != '-' && argc >= 3)
+	{
+		return pack(argv[1], std::vector<std::string>(argv + 2, argv + argc));
+	}
+
+	displayUsageInstructions();
+	return 1;
+}
@@ -0,0 +1,829 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <set>
+#include <random>
+#include <algorithm>
+
+#include "isa.hpp"
+#include "batchcpu.hpp"
+
+/*
+ * tsopt -- superoptimizer for short straight line TRISK sequences.
+ *
+ * Given a reference sequence (or a table of input -> output register values), searches every sequence of
+ * register/flag instructions (see BatchCPU::supports()) shortest first for one that computes the same thing.
+ * Registers & flags are all 8-bit or less, so this is feasible for a few instructions:
+ * * Candidates are run on a batch of test inputs with BatchCPU, sharing the work for common prefixes.
+ *   Most are rejected by the first few inputs.
+ * * A candidate that passes every test is then checked against the reference on every possible input
+ *   (if the inputs have no more than 24 bits between them), or on a million random ones.
+ * Candidates may only read registers the reference reads before writing (or that they wrote themselves),
+ * so registers that aren't inputs can't change the result.
+ * The result is printed as tas source, ready to be used as a peephole rule.
+ */
+
+static const uint8_t ALL_REGISTERS = (1 << NUM_REGISTERS) - 1;
+static const uint8_t ALL_FLAGS = 0x1F; //C Z S O L in bits 4 - 0, same as BatchCPU::flags().
+static const char FLAG_NAMES[] = "CZSOL";
+static const uint32_t EXHAUSTIVE_BITS = 24; //Inputs with up to this many bits are verified exhaustively.
+static const uint32_t RANDOM_CHECKS = 1 << 20; //Otherwise, on this many random inputs.
+static const uint32_t CHUNK = 1 << 16; //Lanes per BatchCPU run when verifying.
+
+//Registers op reads & writes, as masks.
+static uint8_t readsRegisters(const MicroOp &op)
+{
+	switch (op.operation)
+	{
+	case OP_SET:
+		return 1 << op.y;
+	case OP_ADD:
+	case OP_SUB:
+	case OP_RSHIFT:
+	case OP_LSHIFT:
+	case OP_MUL:
+	case OP_AND:
+	case OP_OR:
+	case OP_CMP:
+		return (1 << op.x) | (1 << op.y);
+	case OP_NOT:
+	case OP_ADDI:
+	case OP_SUBI:
+	case OP_CMPI:
+		return 1 << op.x;
+	default:
+		return 0;
+	}
+}
+
+static uint8_t writesRegisters(const MicroOp &op)
+{
+	switch (op.operation)
+	{
+	case OP_NOP:
+	case OP_CMP:
+	case OP_CMPI:
+		return 0;
+	case OP_MUL:
+		return (1 << op.x) | (1 << op.y);
+	default:
+		return 1 << op.x;
+	}
+}
+
+static uint32_t sequenceBytes(const std::vector<MicroOp> &ops)
+{
+	uint32_t bytes = 0;
+	for (const MicroOp &op : ops)
+	{
+		bytes += INSTRUCTION_SET[op.operation].size;
+	}
+
+	return bytes;
+}
+
+static std::string formatOp(const MicroOp &op)
+{
+	const InstructionInfo &info = INSTRUCTION_SET[op.operation];
+	std::string text = info.name;
+	if (isRegisterOperand(info.layout, 0))
+	{
+		text += std::string(" ") + static_cast<char>('A' + op.x);
+	}
+	if (isRegisterOperand(info.layout, 1))
+	{
+		text += std::string(" ") + static_cast<char>('A' + op.y);
+	}
+	else if (hasImmediate(info.layout))
+	{
+		text += " " + std::to_string(op.y);
+	}
+
+	return text;
+}
+
+static bool parseRegister(const std::string &text, uint8_t &reg)
+{
+	if (text.size() == 1 && toupper(text[0]) >= 'A' && toupper(text[0]) < 'A' + NUM_REGISTERS)
+	{
+		reg = toupper(text[0]) - 'A';
+		return true;
+	}
+	if (text.size() == 1 && text[0] >= '0' && text[0] < '0' + NUM_REGISTERS)
+	{
+		reg = text[0] - '0';
+		return true;
+	}
+
+	return false;
+}
+
+static bool parseByte(const std::string &text, uint8_t &value)
+{
+	if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos || text.size() > 3 || std::stoi(text) > 255)
+	{
+		return false;
+	}
+
+	value = std::stoi(text);
+	return true;
+}
+
+//Parses a mask of registers ("AC") or flags ("CZ"). Returns false (and complains) on anything else.
+static bool parseMask(const std::string &text, const char *names, uint8_t count, uint8_t &mask)
+{
+	mask = 0;
+	for (char c : text)
+	{
+		const char *name = strchr(names, toupper(c));
+		if (name == nullptr || name - names >= count)
+		{
+			std::cout << "Error: \"" << text << "\" isn't a list of " << (names == FLAG_NAMES ? "flags" : "registers") << ".\n";
+			return false;
+		}
+		mask |= 1 << ((names == FLAG_NAMES) ? (4 - (name - names)) : (name - names));
+	}
+
+	return true;
+}
+
+/*
+ * Reads straight line code in tas syntax, one instruction per line, ';' starts a comment.
+ * Immediates that appear in it are added to constants. Returns false (and complains) on errors.
+ */
+static bool loadSequence(const std::string &filename, std::vector<MicroOp> &ops, std::set<uint8_t> &constants)
+{
+	std::ifstream file(filename);
+	if (!file)
+	{
+		std::cout << "Error: Could not open sequence file \"" << filename << "\"\n";
+		return false;
+	}
+
+	std::string line;
+	for (uint32_t line_number = 1; std::getline(file, line); ++line_number)
+	{
+		std::istringstream words(line.substr(0, line.find(';')));
+		std::string mnemonic;
+		if (!(words >> mnemonic))
+		{
+			continue;
+		}
+
+		const InstructionInfo *info = nullptr;
+		for (const InstructionInfo &i : INSTRUCTION_SET)
+		{
+			if (strcasecmp(i.name, mnemonic.c_str()) == 0)
+			{
+				info = &i;
+			}
+		}
+		if (info == nullptr || !BatchCPU::supports(info->operation))
+		{
+			std::cout << "Error: " << filename << " line " << line_number << ": \"" << mnemonic << "\" isn't a register/flag instruction. Only straight line code without memory accesses can be superoptimized.\n";
+			return false;
+		}
+
+		MicroOp op = { info->operation, 0, 0 };
+		std::string x, y, extra;
+		bool ok = (words >> x) || info->num_parameters < 1;
+		ok = ok && ((words >> y) || info->num_parameters < 2) && !(words >> extra);
+		ok = ok && (!isRegisterOperand(info->layout, 0) || parseRegister(x, op.x));
+		ok = ok && (!isRegisterOperand(info->layout, 1) || parseRegister(y, op.y));
+		ok = ok && (!hasImmediate(info->layout) || parseByte(y, op.y));
+		if (!ok)
+		{
+			std::cout << "Error: " << filename << " line " << line_number << ": Bad operands for " << info->name << " (registers are A - D, immediates 0 - 255, labels aren't allowed).\n";
+			return false;
+		}
+
+		if (hasImmediate(info->layout))
+		{
+			constants.insert(op.y);
+		}
+		ops.push_back(op);
+	}
+
+	return true;
+}
+
+//What a sequence has to compute, and the inputs it's tested on.
+struct Specification
+{
+	uint8_t inputs = 0; //Registers the result depends on.
+	uint8_t outputs = ALL_REGISTERS; //Registers that have to end up the same. Others are scratch.
+	uint8_t flags = 0; //Flags that have to end up the same.
+
+	//Test inputs, and what each one should produce.
+	BatchCPU tests;
+	std::vector<uint8_t> expected[NUM_REGISTERS];
+	std::vector<uint8_t> expected_flags;
+	std::vector<uint8_t> output_masks; //Per test, in table mode rows can check different registers...
+	std::vector<uint8_t> flag_masks; //...and flags.
+
+	void addTest(const uint8_t *registers, uint8_t flags_in, const uint8_t *result, uint8_t flags_out, uint8_t output_mask, uint8_t flag_mask)
+	{
+		for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+		{
+			tests.registers[r].push_back(registers[r]);
+			expected[r].push_back(result[r]);
+		}
+		tests.alus.push_back(ALU());
+		tests.setFlags(tests.lanes++, flags_in);
+
+		expected_flags.push_back(flags_out);
+		output_masks.push_back(output_mask);
+		flag_masks.push_back(flag_mask);
+	}
+};
+
+/*
+ * Reads a table of input -> output mappings, one per line: e.g. "A=5 B=3 -> A=15 ZF=1".
+ * Registers on the left are the inputs, the rest can be anything. Registers & flags (CF, ZF, SF, OF, LF) on the right have to match.
+ * Returns false (and complains) on errors.
+ */
+static bool loadTable(const std::string &filename, Specification &spec, std::set<uint8_t> &constants)
+{
+	std::ifstream file(filename);
+	if (!file)
+	{
+		std::cout << "Error: Could not open table file \"" << filename << "\"\n";
+		return false;
+	}
+
+	spec.outputs = 0;
+	std::mt19937 random(1);
+	std::string line;
+	for (uint32_t line_number = 1; std::getline(file, line); ++line_number)
+	{
+		std::istringstream words(line.substr(0, line.find(';')));
+		uint8_t registers[NUM_REGISTERS], result[NUM_REGISTERS] = {}, flags_out = 0, output_mask = 0, flag_mask = 0;
+		uint8_t input_mask = 0;
+		bool outputs = false, any = false;
+
+		std::string word;
+		while (words >> word)
+		{
+			any = true;
+			if (word == "->")
+			{
+				outputs = true;
+				continue;
+			}
+
+			std::size_t equals = word.find('=');
+			std::string name = (equals == std::string::npos) ? word : word.substr(0, equals);
+			uint8_t reg, value;
+			if (equals == std::string::npos || !parseByte(word.substr(equals + 1), value))
+			{
+				std::cout << "Error: " << filename << " line " << line_number << ": Expected <register>=<value> or <flag>F=<0|1>, not \"" << word << "\".\n";
+				return false;
+			}
+
+			if (parseRegister(name, reg))
+			{
+				if (outputs)
+				{
+					result[reg] = value;
+					output_mask |= 1 << reg;
+				}
+				else
+				{
+					registers[reg] = value;
+					input_mask |= 1 << reg;
+					constants.insert(value);
+				}
+			}
+			else if (outputs && name.size() == 2 && toupper(name[1]) == 'F' && value <= 1 && strchr(FLAG_NAMES, toupper(name[0])) != nullptr)
+			{
+				uint8_t bit = 4 - (strchr(FLAG_NAMES, toupper(name[0])) - FLAG_NAMES);
+				flags_out |= value << bit;
+				flag_mask |= 1 << bit;
+			}
+			else
+			{
+				std::cout << "Error: " << filename << " line " << line_number << ": Unknown register or flag \"" << name << "\".\n";
+				return false;
+			}
+		}
+
+		if (!any)
+		{
+			continue;
+		}
+		if (!outputs)
+		{
+			std::cout << "Error: " << filename << " line " << line_number << ": Missing \"->\".\n";
+			return false;
+		}
+		if (spec.tests.lanes != 0 && input_mask != spec.inputs)
+		{
+			std::cout << "Error: " << filename << " line " << line_number << ": Every row has to give the same input registers.\n";
+			return false;
+		}
+		spec.inputs = input_mask;
+		spec.outputs |= output_mask;
+		spec.flags |= flag_mask;
+
+		//Whatever isn't an input gets random values. Each row is tried with flags clear & set, flags in don't matter either.
+		for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+		{
+			if (!(input_mask & (1 << r)))
+			{
+				registers[r] = random();
+			}
+		}
+		spec.addTest(registers, 0, result, flags_out, output_mask, flag_mask);
+		spec.addTest(registers, ALL_FLAGS, result, flags_out, output_mask, flag_mask);
+	}
+
+	if (spec.tests.lanes == 0)
+	{
+		std::cout << "Error: " << filename << " has no rows.\n";
+		return false;
+	}
+
+	return true;
+}
+
+//Registers the reference reads before writing them.
+static uint8_t inputRegisters(const std::vector<MicroOp> &ops)
+{
+	uint8_t inputs = 0, written = 0;
+	for (const MicroOp &op : ops)
+	{
+		inputs |= readsRegisters(op) & ~written;
+		written |= writesRegisters(op);
+	}
+
+	return inputs;
+}
+
+//Fills lane with the inputs of number index: the input registers' bytes (& flags, if they're checked), low bits first.
+static void setLaneInputs(BatchCPU &cpu, std::size_t lane, uint8_t inputs, bool with_flags, uint64_t index)
+{
+	for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+	{
+		if (inputs & (1 << r))
+		{
+			cpu.registers[r][lane] = index & 0xFF;
+			index >>= 8;
+		}
+		else
+		{
+			cpu.registers[r][lane] = 0x5A + 0x33 * r; //Never read, only compared if it has to be preserved.
+		}
+	}
+	cpu.setFlags(lane, with_flags ? (index & ALL_FLAGS) : 0);
+}
+
+//Builds the tests for a reference sequence: edge cases & random values for its inputs, expected results from running it.
+static void buildTests(const std::vector<MicroOp> &reference, Specification &spec)
+{
+	static const uint8_t EDGES[] = { 0, 1, 2, 127, 128, 255 };
+	std::mt19937 random(1);
+	uint8_t no_result[NUM_REGISTERS] = {};
+
+	std::vector<uint8_t> input_registers;
+	for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+	{
+		if (spec.inputs & (1 << r))
+		{
+			input_registers.push_back(r);
+		}
+	}
+
+	for (uint32_t test = 0; test < 128; ++test)
+	{
+		uint8_t registers[NUM_REGISTERS];
+		for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+		{
+			registers[r] = random();
+		}
+
+		//Every pair of edge values for the first two inputs, then random inputs.
+		if (test < 36 && !input_registers.empty())
+		{
+			registers[input_registers[0]] = EDGES[test % 6];
+			if (input_registers.size() > 1)
+			{
+				registers[input_registers[1]] = EDGES[test / 6];
+			}
+		}
+		spec.addTest(registers, random() & ALL_FLAGS, no_result, 0, spec.outputs, spec.flags);
+	}
+
+	//Expected results.
+	BatchCPU run = spec.tests;
+	run.execute(reference, 0, run.lanes);
+	for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+	{
+		spec.expected[r] = run.registers[r];
+	}
+	for (std::size_t lane = 0; lane < run.lanes; ++lane)
+	{
+		spec.expected_flags[lane] = run.flags(lane);
+	}
+}
+
+class Superoptimizer
+{
+	const Specification &spec;
+	std::vector<MicroOp> pool; //Every instruction a candidate can be built from.
+
+	std::vector<BatchCPU> states; //states[i]: every test after the first i instructions of the candidate.
+	BatchCPU scratch;
+	std::vector<MicroOp> candidate;
+
+public:
+	std::vector<std::vector<MicroOp> > found; //Every sequence of the current length that passed the tests.
+	uint64_t tried;
+
+	Superoptimizer(const Specification &specification, const std::set<uint8_t> &constants) :
+		spec(specification)
+	{
+		for (const InstructionInfo &info : INSTRUCTION_SET)
+		{
+			//Instructions that only set flags are useless unless flags are checked.
+			if (!BatchCPU::supports(info.operation) || info.operation == OP_NOP || ((info.operation == OP_CMP || info.operation == OP_CMPI) && !spec.flags))
+			{
+				continue;
+			}
+
+			for (uint8_t x = 0; x < (isRegisterOperand(info.layout, 0) ? NUM_REGISTERS : 1); ++x)
+			{
+				if (isRegisterOperand(info.layout, 1))
+				{
+					for (uint8_t y = 0; y < NUM_REGISTERS; ++y)
+					{
+						if (info.operation != OP_SET || x != y)
+						{
+							pool.push_back(MicroOp { info.operation, x, y });
+						}
+					}
+				}
+				else if (hasImmediate(info.layout))
+				{
+					for (uint8_t constant : constants)
+					{
+						pool.push_back(MicroOp { info.operation, x, constant });
+					}
+				}
+				else
+				{
+					pool.push_back(MicroOp { info.operation, x, 0 });
+				}
+			}
+		}
+
+		tried = 0;
+	}
+
+	std::size_t poolSize() const
+	{
+		return pool.size();
+	}
+
+	//Finds every sequence of exactly length instructions that passes the tests, into found.
+	void search(uint32_t length)
+	{
+		found.clear();
+		candidate.clear();
+		states.assign(length + 1, spec.tests);
+		scratch = spec.tests;
+		extend(0, length, spec.inputs);
+	}
+
+private:
+	//True if lanes [begin, end) of cpu match what's expected.
+	bool matches(const BatchCPU &cpu, std::size_t begin, std::size_t end) const
+	{
+		for (std::size_t lane = begin; lane < end; ++lane)
+		{
+			for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+			{
+				if ((spec.output_masks[lane] & (1 << r)) && cpu.registers[r][lane] != spec.expected[r][lane])
+				{
+					return false;
+				}
+			}
+			if ((cpu.flags(lane) ^ spec.expected_flags[lane]) & spec.flag_masks[lane])
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool sameState(const BatchCPU &a, const BatchCPU &b) const
+	{
+		for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+		{
+			if (a.registers[r] != b.registers[r])
+			{
+				return false;
+			}
+		}
+		for (std::size_t lane = 0; lane < a.lanes; ++lane)
+		{
+			if (a.flags(lane) != b.flags(lane))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	//The last instruction is only run on as many lanes as it takes to reject it, 8 at a time.
+	bool passes(const MicroOp &op, const BatchCPU &before)
+	{
+		for (std::size_t begin = 0; begin < before.lanes; begin += 8)
+		{
+			std::size_t end = std::min(before.lanes, begin + 8);
+			for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+			{
+				std::copy(before.registers[r].begin() + begin, before.registers[r].begin() + end, scratch.registers[r].begin() + begin);
+			}
+			std::copy(before.alus.begin() + begin, before.alus.begin() + end, scratch.alus.begin() + begin);
+
+			scratch.execute(op, begin, end);
+			if (!matches(scratch, begin, end))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void extend(uint32_t depth, uint32_t length, uint8_t defined)
+	{
+		if (length == 0)
+		{
+			++tried;
+			if (matches(states[0], 0, states[0].lanes))
+			{
+				found.push_back(candidate);
+			}
+			return;
+		}
+
+		for (const MicroOp &op : pool)
+		{
+			//Reading a register that isn't an input & hasn't been written would make the result depend on garbage.
+			if (readsRegisters(op) & ~defined)
+			{
+				continue;
+			}
+
+			candidate.push_back(op);
+			if (depth + 1 == length)
+			{
+				++tried;
+				if (passes(op, states[depth]))
+				{
+					found.push_back(candidate);
+				}
+			}
+			else
+			{
+				BatchCPU &next = states[depth + 1];
+				next = states[depth];
+				next.execute(op);
+
+				//Instructions that don't change anything can't be part of a shortest sequence.
+				if (!sameState(next, states[depth]))
+				{
+					extend(depth + 1, length, defined | writesRegisters(op));
+				}
+			}
+			candidate.pop_back();
+		}
+	}
+};
+
+/*
+ * Checks candidate against reference on every input (or a million random ones, if there are too many).
+ * Returns the number of inputs checked, 0 if they differ on one of them.
+ */
+static uint64_t verify(const std::vector<MicroOp> &reference, const std::vector<MicroOp> &candidate, const Specification &spec, bool &exhaustive)
+{
+	uint32_t bits = 0;
+	for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+	{
+		bits += (spec.inputs & (1 << r)) ? 8 : 0;
+	}
+	bits += spec.flags ? 5 : 0;
+
+	exhaustive = bits <= EXHAUSTIVE_BITS;
+	uint64_t total = exhaustive ? (1ULL << bits) : RANDOM_CHECKS;
+	std::mt19937_64 random(1);
+
+	BatchCPU expected, actual;
+	for (uint64_t first = 0; first < total; first += CHUNK)
+	{
+		std::size_t lanes = std::min<uint64_t>(CHUNK, total - first);
+		expected.resize(lanes);
+		for (std::size_t lane = 0; lane < lanes; ++lane)
+		{
+			setLaneInputs(expected, lane, spec.inputs, spec.flags != 0, exhaustive ? first + lane : random());
+		}
+		actual = expected;
+
+		expected.execute(reference, 0, lanes);
+		actual.execute(candidate, 0, lanes);
+
+		for (std::size_t lane = 0; lane < lanes; ++lane)
+		{
+			for (uint8_t r = 0; r < NUM_REGISTERS; ++r)
+			{
+				if ((spec.outputs & (1 << r)) && expected.registers[r][lane] != actual.registers[r][lane])
+				{
+					return 0;
+				}
+			}
+			if ((expected.flags(lane) ^ actual.flags(lane)) & spec.flags)
+			{
+				return 0;
+			}
+		}
+	}
+
+	return total;
+}
+
+static void printSequence(const std::vector<MicroOp> &ops)
+{
+	for (const MicroOp &op : ops)
+	{
+		std::cout << "\t" << formatOp(op) << "\n";
+	}
+}
+
+void displayUsageInstructions()
+{
+	std::cout << "Program usage: \n" \
+			<< "\n$> tsopt [options] <sequence file>\n" \
+			<< "$> tsopt [options] --table <mapping file>\n\n" \
+			<< "Finds the shortest sequence of register/flag instructions that does the same as the sequence\n" \
+			<< "(straight line tas code, no memory accesses or branches), or that maps inputs to outputs as the table says\n" \
+			<< "(one mapping per line, e.g. \"A=5 B=3 -> A=15 ZF=1\").\n\n" \
+			<< "Options:\n" \
+			<< "  --out <registers>    Registers that are live after the sequence, e.g. AC. The others are scratch. Default: all.\n" \
+			<< "  --flags <flags>      Flags that are live after the sequence, e.g. CZ. Default: none.\n" \
+			<< "  --max-length <n>     Longest sequence to try. Default: 3.\n" \
+			<< "  --constants <list>   Immediates to try, comma separated, on top of 0, 1, 2, 4, 8, 127, 128, 255 and the ones in the input.\n";
+}
+
+int main(int argc, char **argv)
+{
+	std::string input_filename;
+	bool table = false;
+	uint32_t max_length = 3;
+	std::set<uint8_t> constants = { 0, 1, 2, 4, 8, 127, 128, 255 };
+	Specification spec;
+	bool outputs_given = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-h"))
+		{
+			displayUsageInstructions();
+			return 0;
+		}
+		else if (!strcmp(argv[i], "--table"))
+		{
+			table = true;
+		}
+		else if (!strcmp(argv[i], "--out") && i + 1 < argc)
+		{
+			if (!parseMask(argv[++i], "ABCD", NUM_REGISTERS, spec.outputs))
+			{
+				return 1;
+			}
+			outputs_given = true;
+		}
+		else if (!strcmp(argv[i], "--flags") && i + 1 < argc)
+		{
+			if (!parseMask(argv[++i], FLAG_NAMES, 5, spec.flags))
+			{
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i], "--max-length") && i + 1 < argc)
+		{
+			max_length = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--constants") && i + 1 < argc)
+		{
+			std::istringstream list(argv[++i]);
+			std::string constant;
+			while (std::getline(list, constant, ','))
+			{
+				uint8_t value;
+				if (!parseByte(constant, value))
+				{
+					std::cout << "Error: Invalid constant \"" << constant << "\".\n";
+					return 1;
+				}
+				constants.insert(value);
+			}
+		}
+		else if (argv[i][0] == '-' || !input_filename.empty())
+		{
+			displayUsageInstructions();
+			return 1;
+		}
+		else
+		{
+			input_filename = argv[i];
+		}
+	}
+
+	if (input_filename.empty())
+	{
+		displayUsageInstructions();
+		return 1;
+	}
+
+	std::vector<MicroOp> reference;
+	if (table)
+	{
+		if (outputs_given || spec.flags)
+		{
+			std::cout << "Error: --out & --flags don't apply to tables, the right hand sides say what has to match.\n";
+			return 1;
+		}
+		if (!loadTable(input_filename, spec, constants))
+		{
+			return 1;
+		}
+		std::cout << "Table: " << spec.tests.lanes / 2 << " mappings.\n";
+	}
+	else
+	{
+		if (!loadSequence(input_filename, reference, constants))
+		{
+			return 1;
+		}
+		spec.inputs = inputRegisters(reference);
+		buildTests(reference, spec);
+
+		std::cout << "Reference: " << reference.size() << " instructions, " << sequenceBytes(reference) << " bytes.\n";
+		printSequence(reference);
+		max_length = std::min<uint32_t>(max_length, reference.size());
+	}
+
+	Superoptimizer superoptimizer(spec, constants);
+	std::cout << "Searching up to " << max_length << " instructions, " << superoptimizer.poolSize() << " to choose from at each step, "
+			<< spec.tests.lanes << " test inputs.\n";
+
+	for (uint32_t length = 0; length <= max_length; ++length)
+	{
+		superoptimizer.search(length);
+		std::cout << "Length " << length << ": " << superoptimizer.found.size() << " candidates pass the tests.\n";
+
+		//Fewest bytes first.
+		std::stable_sort(superoptimizer.found.begin(), superoptimizer.found.end(), [](const std::vector<MicroOp> &a, const std::vector<MicroOp> &b)
+		{
+			return sequenceBytes(a) < sequenceBytes(b);
+		});
+
+		for (const std::vector<MicroOp> &candidate : superoptimizer.found)
+		{
+			if (!table && (candidate.size() > reference.size() || (candidate.size() == reference.size() && sequenceBytes(candidate) >= sequenceBytes(reference))))
+			{
+				continue; //Not an improvement.
+			}
+
+			std::string checked = "matches every mapping";
+			if (!table)
+			{
+				bool exhaustive;
+				uint64_t count = verify(reference, candidate, spec, exhaustive);
+				if (count == 0)
+				{
+					continue;
+				}
+				checked = (exhaustive ? "verified on all " : "tested on ") + std::to_string(count) + (exhaustive ? " inputs" : " random inputs");
+			}
+
+			std::cout << "\nFound: " << candidate.size() << " instructions, " << sequenceBytes(candidate) << " bytes (" << checked << ", "
+					<< superoptimizer.tried << " sequences tried):\n";
+			printSequence(candidate);
+			return 0;
+		}
+	}
+
+	std::cout << "\nNo " << (table ? "" : "shorter ") << "sequence found up to " << max_length << " instructions.\n";
+	return table ? 1 : 0;
+}
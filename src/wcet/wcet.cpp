@@ -0,0 +1,744 @@
+/* Copyright Ciprian Ilies 2016 */
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <map>
+#include <set>
+#include <bitset>
+#include <algorithm>
+
+#include "isa.hpp"
+#include "cfg.hpp"
+#include "timing.hpp"
+
+/*
+ * twcet -- static worst/best case execution time analysis of a program image.
+ *
+ * Builds the control flow graph (see cfg.hpp), then for each routine computes the longest & shortest path
+ * in cycles (see timing.hpp) from its entry to wherever it ends (HALT, RET, or a jump through a register,
+ * which is how the software stack convention returns).
+ * Loops are found as natural loops (back edges to a block that dominates them) and need a bound from the user:
+ * the maximum (and optionally minimum) number of times the loop header runs each time the loop is entered.
+ * A loop is then costed as (bound - 1) iterations plus the path out of it. Irreducible loops aren't supported.
+ */
+
+static const int16_t END = -1; //Exit target for paths that end the routine.
+
+struct CycleRange
+{
+	uint64_t best;
+	uint64_t worst;
+
+	CycleRange operator+(const CycleRange &other) const
+	{
+		return CycleRange { best + other.best, worst + other.worst };
+	}
+
+	//Widens this range to also cover other.
+	void merge(const CycleRange &other)
+	{
+		best = std::min(best, other.best);
+		worst = std::max(worst, other.worst);
+	}
+};
+
+struct LoopBound
+{
+	uint32_t min;
+	uint32_t max;
+};
+
+struct LoopInfo
+{
+	uint8_t header;
+	std::bitset<RAM_SIZE> body;
+	LoopBound bound;
+	CycleRange iteration; //From the header back around to the header.
+	CycleRange total; //From entering the loop to leaving it, over all exits.
+};
+
+class TimingAnalyzer
+{
+	const ControlFlowGraph &cfg;
+	const CycleTable &cycles;
+	std::map<uint8_t, LoopBound> bounds;
+
+	std::set<uint8_t> in_progress; //Routines being analyzed, to catch recursion.
+
+	typedef std::map<int16_t, CycleRange> ExitMap; //Exit target (or END) -> cycles from the region's entry.
+
+public:
+	std::map<uint8_t, CycleRange> routines;
+	std::map<uint8_t, CycleRange> block_costs; //Not counting callees.
+	std::map<uint8_t, LoopInfo> loops;
+	std::set<uint8_t> used_bounds;
+	std::set<uint8_t> open_ends; //Blocks after which timing isn't followed (unresolved register branches).
+
+	TimingAnalyzer(const ControlFlowGraph &cfg_, const CycleTable &cycles_, const std::map<uint8_t, LoopBound> &bounds_) : cfg(cfg_), cycles(cycles_), bounds(bounds_)
+	{
+	}
+
+	//Computes the BCET/WCET of the routine starting at entry. Complains and returns false if it can't be bounded.
+	bool analyzeRoutine(uint8_t entry, CycleRange &result)
+	{
+		if (routines.count(entry))
+		{
+			result = routines[entry];
+			return true;
+		}
+
+		if (in_progress.count(entry))
+		{
+			std::cout << "Error: " << label(entry) << " calls itself (recursion can't be bounded).\n";
+			return false;
+		}
+
+		if (!cfg.blocks.count(entry))
+		{
+			std::cout << "Error: " << label(entry) << " isn't the start of a basic block.\n";
+			return false;
+		}
+
+		in_progress.insert(entry);
+		bool ok = analyze(entry, result);
+		in_progress.erase(entry);
+
+		if (ok)
+		{
+			routines[entry] = result;
+		}
+		return ok;
+	}
+
+	static std::string label(uint8_t address)
+	{
+		std::stringstream ss;
+		ss << "L_" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << static_cast<uint16_t>(address);
+		return ss.str();
+	}
+
+private:
+	const BasicBlock &block(uint8_t start) const
+	{
+		return cfg.blocks.find(start)->second;
+	}
+
+	CycleRange blockCost(const BasicBlock &b) const
+	{
+		CycleRange cost = { 0, 0 };
+
+		for (uint8_t address : b.instructions)
+		{
+			Operation operation = cfg.decode(address).operation;
+			const CycleCost &c = cycles[operation];
+			cost.best += c.base;
+			cost.worst += c.base;
+
+			if (c.per_byte == 0)
+			{
+				continue;
+			}
+
+			//Block instructions: C bytes, if it's known. Scans & compares can stop at the first byte.
+			uint8_t count;
+			uint64_t least = 0;
+			uint64_t most = 255;
+			if (cfg.registerValue(address, BLOCK_COUNT, count))
+			{
+				most = count;
+				least = (operation == OP_MSCAN || operation == OP_MCMP) ? std::min<uint64_t>(count, 1) : count;
+			}
+			cost.best += least * c.per_byte;
+			cost.worst += most * c.per_byte;
+		}
+
+		return cost;
+	}
+
+	bool analyze(uint8_t entry, CycleRange &result)
+	{
+		//Blocks of the routine: everything reachable from entry, stepping over CALLs.
+		std::bitset<RAM_SIZE> region;
+		std::vector<uint8_t> order;
+		std::vector<uint8_t> stack(1, entry);
+		region[entry] = true;
+		while (!stack.empty())
+		{
+			uint8_t b = stack.back();
+			stack.pop_back();
+			order.push_back(b);
+
+			for (uint8_t successor : block(b).successors)
+			{
+				if (!region[successor])
+				{
+					region[successor] = true;
+					stack.push_back(successor);
+				}
+			}
+		}
+		std::sort(order.begin(), order.end());
+
+		//Cost of each block, including the routines it calls.
+		std::map<uint8_t, CycleRange> node_costs;
+		for (uint8_t b : order)
+		{
+			const BasicBlock &bb = block(b);
+			CycleRange cost = blockCost(bb);
+			block_costs[b] = cost;
+
+			if (bb.exit == BLOCK_CALL)
+			{
+				CycleRange callee;
+				if (bb.callee == -1)
+				{
+					std::cout << "Error: CALL through a register with an unknown value at the end of " << label(b) << ".\n";
+					return false;
+				}
+				if (!analyzeRoutine(bb.callee, callee))
+				{
+					return false;
+				}
+				cost = cost + callee;
+			}
+
+			if (bb.unresolved)
+			{
+				open_ends.insert(b);
+			}
+
+			node_costs[b] = cost;
+		}
+
+		//Dominators (iteratively, the graphs are tiny).
+		std::map<uint8_t, std::bitset<RAM_SIZE> > dominators;
+		for (uint8_t b : order)
+		{
+			dominators[b] = region;
+		}
+		dominators[entry].reset();
+		dominators[entry][entry] = true;
+
+		std::map<uint8_t, std::vector<uint8_t> > predecessors;
+		for (uint8_t b : order)
+		{
+			for (uint8_t successor : block(b).successors)
+			{
+				predecessors[successor].push_back(b);
+			}
+		}
+
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			for (uint8_t b : order)
+			{
+				if (b == entry)
+				{
+					continue;
+				}
+
+				std::bitset<RAM_SIZE> d = region;
+				for (uint8_t p : predecessors[b])
+				{
+					d &= dominators[p];
+				}
+				d[b] = true;
+
+				if (d != dominators[b])
+				{
+					dominators[b] = d;
+					changed = true;
+				}
+			}
+		}
+
+		//Natural loops, one per header.
+		std::vector<LoopInfo> routine_loops;
+		for (uint8_t b : order)
+		{
+			for (uint8_t successor : block(b).successors)
+			{
+				if (!dominators[b][successor])
+				{
+					continue; //Not a back edge.
+				}
+
+				std::vector<LoopInfo>::iterator loop = routine_loops.begin();
+				while (loop != routine_loops.end() && loop->header != successor)
+				{
+					++loop;
+				}
+				if (loop == routine_loops.end())
+				{
+					LoopInfo info;
+					info.header = successor;
+					info.body[successor] = true;
+					routine_loops.push_back(info);
+					loop = routine_loops.end() - 1;
+				}
+
+				//Everything that reaches the back edge without going through the header.
+				std::vector<uint8_t> work;
+				if (!loop->body[b])
+				{
+					loop->body[b] = true;
+					work.push_back(b);
+				}
+				while (!work.empty())
+				{
+					uint8_t n = work.back();
+					work.pop_back();
+					for (uint8_t p : predecessors[n])
+					{
+						if (!loop->body[p])
+						{
+							loop->body[p] = true;
+							work.push_back(p);
+						}
+					}
+				}
+			}
+		}
+
+		//Innermost loops first, so they can be collapsed into a single node of the loops around them.
+		std::sort(routine_loops.begin(), routine_loops.end(), [](const LoopInfo &a, const LoopInfo &b)
+		{
+			return a.body.count() < b.body.count();
+		});
+
+		std::map<uint8_t, ExitMap> collapsed; //Loop header -> exits of the whole loop.
+		for (LoopInfo &loop : routine_loops)
+		{
+			if (!bounds.count(loop.header))
+			{
+				std::cout << "Error: no bound for the loop at " << label(loop.header) << " (use --loop " << label(loop.header) << " <max iterations>).\n";
+				return false;
+			}
+			loop.bound = bounds[loop.header];
+			used_bounds.insert(loop.header);
+
+			ExitMap exits;
+			CycleRange iteration = { 0, 0 };
+			bool iterates = false;
+			if (!evaluateRegion(loop.header, loop.body, true, routine_loops, collapsed, node_costs, exits, iteration, iterates))
+			{
+				return false;
+			}
+
+			//bound - 1 full iterations, then the way out.
+			loop.iteration = iteration;
+			ExitMap &loop_exits = collapsed[loop.header];
+			bool first = true;
+			for (ExitMap::iterator i = exits.begin(); i != exits.end(); ++i)
+			{
+				CycleRange cost = { (loop.bound.min - 1) * iteration.best + i->second.best, (loop.bound.max - 1) * iteration.worst + i->second.worst };
+				loop_exits[i->first] = cost;
+
+				if (first)
+				{
+					loop.total = cost;
+					first = false;
+				}
+				else
+				{
+					loop.total.merge(cost);
+				}
+			}
+
+			loops[loop.header] = loop;
+		}
+
+		ExitMap exits;
+		CycleRange unused = { 0, 0 };
+		bool iterates = false;
+		if (!evaluateRegion(entry, region, false, routine_loops, collapsed, node_costs, exits, unused, iterates))
+		{
+			return false;
+		}
+
+		if (!exits.count(END))
+		{
+			std::cout << "Error: the routine at " << label(entry) << " never ends.\n";
+			return false;
+		}
+
+		result = exits[END];
+		return true;
+	}
+
+	/*
+	 * Longest & shortest paths through a loop body (or a whole routine), with the loops nested in it collapsed.
+	 * exits gets the cycles from the start of header to each way out of the region,
+	 * iteration the cycles to get back around to header (for loops).
+	 */
+	bool evaluateRegion(uint8_t header, const std::bitset<RAM_SIZE> &body, bool is_loop, const std::vector<LoopInfo> &routine_loops,
+			const std::map<uint8_t, ExitMap> &collapsed, const std::map<uint8_t, CycleRange> &node_costs,
+			ExitMap &exits, CycleRange &iteration, bool &iterates)
+	{
+		//Which node of this region each block belongs to: itself, or the outermost loop nested in the region it's part of.
+		std::map<uint8_t, uint8_t> representative;
+		for (uint16_t b = 0; b < RAM_SIZE; ++b)
+		{
+			if (!body[b])
+			{
+				continue;
+			}
+
+			representative[b] = b;
+			std::size_t largest = 0;
+			for (const LoopInfo &loop : routine_loops)
+			{
+				if (loop.header == header || !loop.body[b] || (loop.body & ~body).any())
+				{
+					continue;
+				}
+				if (loop.body.count() > largest)
+				{
+					largest = loop.body.count();
+					representative[b] = loop.header;
+				}
+			}
+		}
+
+		//Edges out of each node, with the cycles from the start of the node to taking them.
+		std::map<uint8_t, ExitMap> edges;
+		for (std::map<uint8_t, uint8_t>::iterator i = representative.begin(); i != representative.end(); ++i)
+		{
+			uint8_t node = i->second;
+			if (node != i->first)
+			{
+				continue; //Part of a nested loop.
+			}
+
+			if ((node != header || !is_loop) && collapsed.count(node))
+			{
+				edges[node] = collapsed.find(node)->second;
+				continue;
+			}
+
+			const BasicBlock &bb = block(node);
+			const CycleRange &cost = node_costs.find(node)->second;
+			ExitMap &out = edges[node];
+			for (uint8_t successor : bb.successors)
+			{
+				out[successor] = cost;
+			}
+			if (bb.exit == BLOCK_HALT || bb.exit == BLOCK_RETURN || bb.exit == BLOCK_INDIRECT)
+			{
+				out[END] = cost;
+			}
+		}
+
+		//Topological order of the nodes, with the edges back to the header left out.
+		std::map<uint8_t, uint32_t> in_degree;
+		for (std::map<uint8_t, ExitMap>::iterator i = edges.begin(); i != edges.end(); ++i)
+		{
+			in_degree[i->first];
+			for (ExitMap::iterator e = i->second.begin(); e != i->second.end(); ++e)
+			{
+				if (e->first != END && body[e->first] && !(is_loop && e->first == header))
+				{
+					++in_degree[representative[e->first]];
+				}
+			}
+		}
+
+		std::map<uint8_t, CycleRange> arrival;
+		std::vector<uint8_t> ready;
+		for (std::map<uint8_t, uint32_t>::iterator i = in_degree.begin(); i != in_degree.end(); ++i)
+		{
+			if (i->second == 0)
+			{
+				ready.push_back(i->first);
+			}
+		}
+		arrival[representative[header]] = CycleRange { 0, 0 };
+
+		uint32_t visited = 0;
+		while (!ready.empty())
+		{
+			uint8_t node = ready.back();
+			ready.pop_back();
+			++visited;
+
+			std::map<uint8_t, CycleRange>::iterator at = arrival.find(node);
+			for (ExitMap::iterator e = edges[node].begin(); e != edges[node].end(); ++e)
+			{
+				bool back_edge = is_loop && e->first == header;
+				bool inside = e->first != END && body[e->first] && !back_edge;
+
+				if (inside)
+				{
+					uint8_t target = representative[e->first];
+					if (at != arrival.end())
+					{
+						CycleRange cost = at->second + e->second;
+						if (arrival.count(target))
+						{
+							arrival[target].merge(cost);
+						}
+						else
+						{
+							arrival[target] = cost;
+						}
+					}
+					if (--in_degree[target] == 0)
+					{
+						ready.push_back(target);
+					}
+					continue;
+				}
+
+				if (at == arrival.end())
+				{
+					continue; //Not reachable from the header (through this region).
+				}
+
+				CycleRange cost = at->second + e->second;
+				if (back_edge)
+				{
+					if (iterates)
+					{
+						iteration.merge(cost);
+					}
+					else
+					{
+						iteration = cost;
+						iterates = true;
+					}
+				}
+				else if (exits.count(e->first))
+				{
+					exits[e->first].merge(cost);
+				}
+				else
+				{
+					exits[e->first] = cost;
+				}
+			}
+		}
+
+		if (visited != edges.size())
+		{
+			std::cout << "Error: irreducible control flow around " << label(header) << " (a loop with more than one entry).\n";
+			return false;
+		}
+
+		return true;
+	}
+};
+
+void displayUsageInstructions(std::string default_input)
+{
+	std::cout << "Program usage: \n" \
+			<< "\n$> twcet [options] <input program file>\n\n" \
+			<< "Options:\n" \
+			<< "  --loop <label> <max>      The loop with its header at <label> runs its header at most <max> times per entry.\n" \
+			<< "  --loop <label> <min>-<max>  ...and at least <min> times.\n" \
+			<< "  --entry <label>           Also analyze the routine starting at <label> (e.g. one entered with JMP).\n" \
+			<< "  --cycles <file>           Override the cycle table: lines of \"<mnemonic> <base cycles> [<cycles per byte>]\".\n" \
+			<< "Labels are block labels as printed by tdis (L_1B), or addresses (0x1b, 27).\n" \
+			<< "\nDefault input: " << default_input << "\n";
+}
+
+//Parses "L_1B", "0x1b" or "27".
+bool parseAddress(const std::string &text, uint8_t &address)
+{
+	std::string digits = text;
+	int base = 10;
+	if (digits.size() > 2 && (digits[0] == 'L' || digits[0] == 'l') && digits[1] == '_')
+	{
+		digits = digits.substr(2);
+		base = 16;
+	}
+	else if (digits.size() > 2 && digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X'))
+	{
+		digits = digits.substr(2);
+		base = 16;
+	}
+
+	char *end = nullptr;
+	unsigned long value = strtoul(digits.c_str(), &end, base);
+	if (digits.empty() || *end != '\0' || value >= RAM_SIZE)
+	{
+		std::cout << "Error: invalid label or address \"" << text << "\".\n";
+		return false;
+	}
+
+	address = static_cast<uint8_t>(value);
+	return true;
+}
+
+bool parseBound(const std::string &text, LoopBound &bound)
+{
+	char *end = nullptr;
+	unsigned long min = strtoul(text.c_str(), &end, 10);
+	unsigned long max = min;
+	if (*end == '-')
+	{
+		max = strtoul(end + 1, &end, 10);
+	}
+	else
+	{
+		min = 1;
+	}
+
+	if (text.empty() || *end != '\0' || min < 1 || max < min)
+	{
+		std::cout << "Error: invalid loop bound \"" << text << "\" (expected <max> or <min>-<max>, at least 1).\n";
+		return false;
+	}
+
+	bound = LoopBound { static_cast<uint32_t>(min), static_cast<uint32_t>(max) };
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	std::string input_filename = "program.bin";
+	std::string cycles_filename;
+	std::map<uint8_t, LoopBound> bounds;
+	std::vector<uint8_t> entries(1, 0);
+
+	std::vector<std::string> positional;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-h"))
+		{
+			displayUsageInstructions(input_filename);
+			return 0;
+		}
+		else if (!strcmp(argv[i], "--loop") && i + 2 < argc)
+		{
+			uint8_t header;
+			LoopBound bound;
+			if (!parseAddress(argv[i + 1], header) || !parseBound(argv[i + 2], bound))
+			{
+				return 1;
+			}
+			bounds[header] = bound;
+			i += 2;
+		}
+		else if (!strcmp(argv[i], "--entry") && i + 1 < argc)
+		{
+			uint8_t entry;
+			if (!parseAddress(argv[++i], entry))
+			{
+				return 1;
+			}
+			entries.push_back(entry);
+		}
+		else if (!strcmp(argv[i], "--cycles") && i + 1 < argc)
+		{
+			cycles_filename = argv[++i];
+		}
+		else if (argv[i][0] == '-')
+		{
+			displayUsageInstructions(input_filename);
+			return 1;
+		}
+		else
+		{
+			positional.push_back(argv[i]);
+		}
+	}
+
+	if (positional.size() > 1)
+	{
+		displayUsageInstructions(input_filename);
+		return 1;
+	}
+	if (positional.size() == 1)
+	{
+		input_filename = positional[0];
+	}
+
+	CycleTable cycles;
+	if (!cycles_filename.empty() && !cycles.load(cycles_filename))
+	{
+		return 1;
+	}
+
+	std::ifstream input_file(input_filename, std::ios::binary);
+
+	if (!input_file)
+	{
+		std::cout << "Error: failed to open file for input program: \"" << input_filename << "\"\n";
+		return 1;
+	}
+
+	uint8_t program_memory[RAM_SIZE] = {};
+	input_file.read(reinterpret_cast<char* >(program_memory), RAM_SIZE);
+	if (input_file.gcount() != RAM_SIZE)
+	{
+		std::cout << "Error: Input program file is too short!\n";
+		input_file.close();
+		return 1;
+	}
+	input_file.close();
+
+	ControlFlowGraph cfg;
+	cfg.build(program_memory);
+
+	TimingAnalyzer analyzer(cfg, cycles, bounds);
+
+	bool ok = true;
+	for (uint8_t entry : entries)
+	{
+		CycleRange result;
+		ok = analyzer.analyzeRoutine(entry, result) && ok;
+	}
+
+	for (std::map<uint8_t, LoopBound>::iterator i = bounds.begin(); i != bounds.end(); ++i)
+	{
+		if (!analyzer.used_bounds.count(i->first))
+		{
+			std::cout << "Warning: " << TimingAnalyzer::label(i->first) << " isn't the header of an analyzed loop, its bound wasn't used.\n";
+		}
+	}
+
+	for (uint8_t b : analyzer.open_ends)
+	{
+		std::cout << "Warning: " << TimingAnalyzer::label(b) << " ends in a branch through a register with an unknown value. " \
+				<< "Timing only covers the path up to it (and the branch not taken).\n";
+	}
+
+	if (!ok)
+	{
+		return 1;
+	}
+
+	std::cout << "\nRoutine\tBCET\tWCET (cycles)\n";
+	for (std::map<uint8_t, CycleRange>::iterator i = analyzer.routines.begin(); i != analyzer.routines.end(); ++i)
+	{
+		std::cout << TimingAnalyzer::label(i->first) << "\t" << i->second.best << "\t" << i->second.worst << "\n";
+	}
+
+	if (!analyzer.loops.empty())
+	{
+		std::cout << "\nLoop\tBound\tIteration BCET\tIteration WCET\tLoop BCET\tLoop WCET\n";
+		for (std::map<uint8_t, LoopInfo>::iterator i = analyzer.loops.begin(); i != analyzer.loops.end(); ++i)
+		{
+			const LoopInfo &loop = i->second;
+			std::cout << TimingAnalyzer::label(i->first) << "\t" << loop.bound.min << "-" << loop.bound.max << "\t" \
+					<< loop.iteration.best << "\t" << loop.iteration.worst << "\t" << loop.total.best << "\t" << loop.total.worst << "\n";
+		}
+	}
+
+	std::cout << "\nBlock\tBCET\tWCET (cycles, not counting calls)\n";
+	for (std::map<uint8_t, CycleRange>::iterator i = analyzer.block_costs.begin(); i != analyzer.block_costs.end(); ++i)
+	{
+		std::cout << TimingAnalyzer::label(i->first) << "\t" << i->second.best << "\t" << i->second.worst << "\n";
+	}
+
+	return 0;
+}